@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Test program for bmp library.
+ * It saves the Sobel gradient, the Canny edges and the eroded and
+ * dilated images of sample.bmp.
+ */
+
+#include <stdio.h>
+#include "bmp.h"
+#include "bmp_filter.h"
+
+int main(void)
+{
+    bmp_handle h0, h1;
+    int rc;
+
+    /* Create bmp and load bmp file */
+    rc = bmp_open(&h0, "..\\examples\\sample.bmp");
+    if (rc != 0)
+        return 1;
+    rc = bmp_open(&h1, 0);
+    if (rc != 0)
+    {
+        bmp_close(h0);
+        return 1;
+    }
+
+    rc = bmp_gradient(h1, h0, BMP_FILTER_SOBEL);
+    if (rc == 0)
+        rc = bmp_save(h1, "sample_sobel.bmp");
+    if (rc == 0)
+        rc = bmp_canny(h1, h0, 100, 250);
+    if (rc == 0)
+        rc = bmp_save(h1, "sample_canny.bmp");
+    if (rc == 0)
+        rc = bmp_erode(h1, h0, 2);
+    if (rc == 0)
+        rc = bmp_save(h1, "sample_erode.bmp");
+    if (rc == 0)
+        rc = bmp_dilate(h1, h0, 2);
+    if (rc == 0)
+        rc = bmp_save(h1, "sample_dilate.bmp");
+
+    bmp_close(h1);
+    bmp_close(h0);
+
+    return (rc == 0) ? 0 : 1;
+}
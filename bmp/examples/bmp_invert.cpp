@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Test program for the C++ bmp layer.
+ * It open a bmp file and save its negative image.
+ */
+
+#include <iostream>
+#include "bmp.hpp"
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    const char *filename = (argc == 2) ? argv[1] : "..\\examples\\sample.bmp";
+
+    try {
+        bmp::Image<bmp::bgr24> src(filename);
+        bmp::Image<bmp::bgr24> dst(src.width(), src.height());
+
+        bmp::transform(src, dst, [](bmp::bgr24 p) {
+            return bmp::bgr24{ uint8_t(255 - p.b), uint8_t(255 - p.g), uint8_t(255 - p.r) };
+        });
+        dst.save("bmp_invert.bmp");
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Test program for bmp library.
+ * It writes pixels of tiled and Z-order images while a view is locked for
+ * read and checks that they are still there after bmp_unlock.
+ */
+
+#include <stdio.h>
+#include "bmp.h"
+
+static int check_layout(uint32_t layout)
+{
+    bmp_handle h;
+    bmp_config config;
+    bmp_view view;
+    uint32_t color;
+    int fails = 0;
+
+    config.width = 100;
+    config.height = 70;
+    config.bits_per_pixel = 24;
+    bmp_open(&h, 0);
+    bmp_set_layout(h, layout);
+    bmp_set_config(h, &config);
+
+    if (bmp_lock(h, &view, BMP_LOCK_READ) != 0)
+        return 1;
+    if (bmp_set_color(h, 65, 3, 0x123456) != 0)
+        fails++;
+    if ((bmp_get_color(h, 65, 3, &color) != 0) || (color != 0x123456))
+        fails++;
+    bmp_unlock(h, &view);
+
+    if ((bmp_get_color(h, 65, 3, &color) != 0) || (color != 0x123456))
+    {
+        printf("layout %d: pixel written under a read lock was lost (0x%06x)\n", layout, color);
+        fails++;
+    }
+
+    bmp_close(h);
+
+    return fails;
+}
+
+int main(void)
+{
+    int fails;
+
+    fails = check_layout(BMP_LAYOUT_LINEAR);
+    fails += check_layout(BMP_LAYOUT_TILED);
+    fails += check_layout(BMP_LAYOUT_ZORDER);
+    printf("%s\n", fails ? "FAILED" : "OK");
+
+    return fails ? 1 : 0;
+}
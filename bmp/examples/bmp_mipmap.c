@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Test program for bmp library.
+ * It makes all reduced levels of sample.bmp as separate files
+ * (sample_0.bmp, sample_1.bmp, ...) and as one packed file.
+ */
+
+#include <stdio.h>
+#include "bmp.h"
+#include "bmp_pyramid.h"
+
+int main(void)
+{
+    bmp_handle h0;
+    int rc;
+
+    /* Create bmp and load bmp file */
+    rc = bmp_open(&h0, "..\\examples\\sample.bmp");
+    if (rc != 0)
+        return 1;
+
+    rc = bmp_pyramid_save(h0, "sample_%u.bmp", 0);
+    if (rc == 0)
+        rc = bmp_pyramid_save_packed(h0, "sample_mipmap.bmp", 0);
+
+    bmp_close(h0);
+
+    return (rc == 0) ? 0 : 1;
+}
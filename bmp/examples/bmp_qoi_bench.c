@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Benchmark program for bmp library.
+ * It saves and loads a bmp file as BMP and as QOI and prints the file
+ * size and throughput of each format.  Timing comes from the span handler.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "bmp.h"
+#include "bmp_qoi.h"
+
+#define LOOPS 10
+
+static uint64_t nsec;
+
+static void span(bmp_handle h, const char *func, uint64_t elapsed, void *ctx)
+{
+    (void)h;
+    (void)ctx;
+
+    /* bmp_load/bmp_qoi_load also report the nested bmp_set_config */
+    if (strcmp(func, "bmp_set_config") != 0)
+        nsec += elapsed;
+}
+
+static void report(const char *name, uint64_t bytes, uint32_t image_size)
+{
+    double sec = nsec / 1e9;
+    printf("%-9s %10u bytes  %8.1f MB/s (of raw image)\n",
+           name, (uint32_t)(bytes / LOOPS), (double)image_size * LOOPS / sec / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+    bmp_handle h;
+    bmp_config config;
+    bmp_stats stats;
+    uint32_t image_size;
+    int i, rc;
+
+    rc = bmp_open(&h, (argc == 2) ? argv[1] : "..\\examples\\sample.bmp");
+    if (rc != 0)
+        return -1;
+    rc = bmp_get_config(h, &config);
+    image_size = config.width * config.height * 3;
+    printf("width = %d, height = %d, bit_count = %d\n", config.width, config.height, config.bits_per_pixel);
+
+    bmp_set_span_handler(span, 0);
+
+    /* BMP */
+    bmp_reset_stats(h);
+    nsec = 0;
+    for (i = 0; i < LOOPS; i++)
+        bmp_save(h, "bmp_qoi_bench.bmp");
+    bmp_get_stats(h, &stats);
+    report("bmp save", stats.bytes_written, image_size);
+
+    bmp_reset_stats(h);
+    nsec = 0;
+    for (i = 0; i < LOOPS; i++)
+        bmp_load(h, "bmp_qoi_bench.bmp");
+    bmp_get_stats(h, &stats);
+    report("bmp load", stats.bytes_read, image_size);
+
+    /* QOI */
+    bmp_reset_stats(h);
+    nsec = 0;
+    for (i = 0; i < LOOPS; i++)
+        bmp_qoi_save(h, "bmp_qoi_bench.qoi");
+    bmp_get_stats(h, &stats);
+    report("qoi save", stats.bytes_written, image_size);
+
+    bmp_reset_stats(h);
+    nsec = 0;
+    for (i = 0; i < LOOPS; i++)
+        bmp_qoi_load(h, "bmp_qoi_bench.qoi");
+    bmp_get_stats(h, &stats);
+    report("qoi load", stats.bytes_read, image_size);
+
+    bmp_close(h);
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Test program for bmp library.
+ * It reduces sample.bmp to 1, 4, 8 and 16 bits per pixel with error
+ * diffusion (sample_fs_*.bmp) and ordered dither (sample_od_*.bmp).
+ */
+
+#include <stdio.h>
+#include "bmp.h"
+#include "bmp_dither.h"
+
+int main(void)
+{
+    static const uint32_t format[] = {
+        BMP_DITHER_MONO, BMP_DITHER_GRAY4, BMP_DITHER_RGB332, BMP_DITHER_RGB565
+    };
+    bmp_handle h0;
+    char filename[64];
+    int i, rc;
+
+    /* Create bmp and load bmp file */
+    rc = bmp_open(&h0, "..\\examples\\sample.bmp");
+    if (rc != 0)
+        return 1;
+
+    for (i = 0; (i < 4) && (rc == 0); i++)
+    {
+        sprintf(filename, "sample_fs_%u.bmp", format[i]);
+        rc = bmp_dither_save(h0, filename, format[i], BMP_DITHER_FLOYD_STEINBERG);
+        if (rc != 0)
+            break;
+        sprintf(filename, "sample_od_%u.bmp", format[i]);
+        rc = bmp_dither_save(h0, filename, format[i], BMP_DITHER_ORDERED);
+    }
+
+    bmp_close(h0);
+
+    return (rc == 0) ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Test program for bmp library.
+ * It converts numbered bmp files (frame_0000.bmp, frame_0001.bmp, ...)
+ * into one Y4M video.
+ *
+ * usage: bmp_to_y4m [format [output.y4m [fps]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bmp.h"
+#include "bmp_yuv.h"
+
+int main(int argc, char *argv[])
+{
+    const char *format = (argc > 1) ? argv[1] : "frame_%04u.bmp";
+    const char *output = (argc > 2) ? argv[2] : "frames.y4m";
+    uint32_t fps = (argc > 3) ? atoi(argv[3]) : 30;
+    bmp_y4m_handle y;
+    int rc;
+
+    rc = bmp_y4m_open(&y, output, fps, 1, BMP_YUV_BT709);
+    if (rc != 0)
+        return 1;
+
+    rc = bmp_y4m_write_sequence(y, format, 0, 0);
+    if (bmp_y4m_close(y) != 0)
+        rc = -1;
+
+    return (rc == 0) ? 0 : 1;
+}
@@ -2,42 +2,35 @@
  * Copyright (C) 2002-2012 Hiroaki Inaba
  *
  * BMP file viewer program for Windows.
- * It automatically refresh BMP when its window is clicked.
+ * It automatically refresh BMP when the file is rewritten.
  */
 
 #include <windows.h>
 #include <iostream>
 extern "C" {
 #include "bmp.h"
+#include "bmp_watch.h"
 }
 #if CNET_DEBUG
 #include "cnetbuf.h"
 #endif
-#include <io.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <fcntl.h>
 using namespace std;
 
 // Globals
-bmp_handle bmp_h;
+bmp_watch_handle bmp_w;
 char *filename;
-time_t gmtime;
+HWND main_hwnd;
 
 #if CNET_DEBUG
 cnetbuf cbuf("localhost");
 ostream cnet(&cbuf);
 #endif
 
-time_t get_mtime(void)
+// called from the watcher thread after the new image was swapped in
+void on_reload(bmp_watch_handle w, void *ctx)
 {
-  // get the last update time of the BMP file
-  struct _stat buf;
-  int fh = _open(filename, _O_RDONLY);
-  int result = _fstat( fh, &buf );
-  _close( fh );
-
-  return buf.st_mtime;
+  if (main_hwnd)
+	InvalidateRect(main_hwnd, NULL, FALSE);
 }
 
 LRESULT CALLBACK WndProc(HWND hwnd, UINT iMsg, WPARAM wParam, LPARAM lParam);
@@ -51,12 +44,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
   else
 	filename = "a.bmp";
 
-  bmp_open(&bmp_h, filename);
-  gmtime = get_mtime();
-
-#if CNET_DEBUG
-  cnet << "mtime = " << gmtime << endl;
-#endif
+  if (bmp_watch_open(&bmp_w, filename, on_reload, 0) != 0)
+	return -1;
   //------------------------------------------------------------
 
   static char szAppName[] = "bmpview";
@@ -79,8 +68,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
   RegisterClassEx(&wndclass);
 
+  bmp_handle bmp_h;
   bmp_config config;
+  bmp_watch_acquire(bmp_w, &bmp_h, NULL);
   bmp_get_config(bmp_h, &config);
+  bmp_watch_release(bmp_w, bmp_h);
 
   hwnd = CreateWindow(szAppName,			// window class name
 					  filename,
@@ -97,6 +89,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 					  NULL					// create parameters
 					  );
 
+  main_hwnd = hwnd;
   ShowWindow(hwnd, iCmdShow);
   UpdateWindow(hwnd);
 
@@ -105,6 +98,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 	DispatchMessage(&msg);
   }
 
+  main_hwnd = NULL;
+  bmp_watch_close(bmp_w);
+
   return msg.wParam;
 }
 
@@ -115,26 +111,19 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT iMsg, WPARAM wParam, LPARAM lParam)
   RECT			rect;
 
   switch (iMsg) {
-  case WM_ACTIVATE: {
-	time_t mtime = get_mtime();
-#if CNET_DEBUG
-	cnet << "new mtime = " << mtime << endl;
-#endif
-	if (mtime != gmtime) {
-//	  bmpfile.read(filename);
-        bmp_load(bmp_h, filename);
-	  InvalidateRgn(hwnd, NULL, TRUE);
-	  gmtime = mtime;
-	}
-	return 0;
-  }
   case WM_PAINT: {
 	hdc = BeginPaint(hwnd, &ps);
 	GetClientRect(hwnd, &rect);
 	//	DrawText(hdc, "Hello, Windows95!", -1, &rect, DT_SINGLELINE | DT_CENTER | DT_VCENTER);
 
+    bmp_handle bmp_h;
     bmp_config config;
+    uint32_t generation;
+    bmp_watch_acquire(bmp_w, &bmp_h, &generation);
     bmp_get_config(bmp_h, &config);
+#if CNET_DEBUG
+	cnet << "generation = " << generation << endl;
+#endif
 
 	for (int y = 0; y < config.height; y++) {
         for (int x = 0; x < config.width; x++) {
@@ -143,6 +132,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT iMsg, WPARAM wParam, LPARAM lParam)
             SetPixel(hdc, x, y, RGB(RGB_R(color), RGB_G(color), RGB_B(color)));
         }
     }
+    bmp_watch_release(bmp_w, bmp_h);
 
 	EndPaint(hwnd, &ps);
 
@@ -6,8 +6,17 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include "bmp.h"
+#include "bmp_p.h"
+#include "bmp_thread.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 /*
  * BITMAP structures
@@ -45,18 +54,161 @@ typedef struct {
 #define BI_RGB 0x00000000
 
 /*
- * bmp internal data
+ * diagnostics
+ * The counters and the handlers are shared by all threads (pool, stream,
+ * cache and watcher threads), so they are only used under diag_mutex.
  */
-typedef struct {
-    uint8_t *image;
-    uint32_t image_size;
-    bmp_config config;
-} bmp_data;
+static bmp_p_mutex diag_mutex;
+static bmp_p_once diag_once = BMP_P_ONCE_INIT;
+static bmp_error_handler error_handler = bmp_stderr_handler;
+static void *error_ctx = 0;
+static bmp_span_handler span_handler = 0;
+static void *span_ctx = 0;
+static bmp_stats global_stats;
 
 /*
  * private functions
  */
 
+static void bmp_p_diag_init(void)
+{
+    bmp_p_mutex_init(&diag_mutex);
+}
+
+static void bmp_p_diag_lock(void)
+{
+    bmp_p_call_once(&diag_once, bmp_p_diag_init);
+    bmp_p_mutex_lock(&diag_mutex);
+}
+
+static void bmp_p_diag_unlock(void)
+{
+    bmp_p_mutex_unlock(&diag_mutex);
+}
+
+/* report an error to the registered handler */
+void bmp_p_error(bmp_data *bmp, const char *func, const char *format, ...)
+{
+    bmp_error_handler handler;
+    void *ctx;
+    char msg[256];
+    va_list ap;
+
+    bmp_p_diag_lock();
+    global_stats.errors++;
+    if (bmp)
+        bmp->stats.errors++;
+    handler = error_handler;
+    ctx = error_ctx;
+    bmp_p_diag_unlock();
+
+    if (handler == 0)
+        return;
+
+    va_start(ap, format);
+    vsnprintf(msg, sizeof(msg), format, ap);
+    va_end(ap);
+
+    handler((bmp_handle)bmp, func, msg, ctx);
+}
+
+/* report an out of range pixel access */
+static void bmp_p_reject(bmp_data *bmp, const char *func, const char *name, int value, uint32_t limit)
+{
+    bmp_p_diag_lock();
+    global_stats.rejected++;
+    bmp->stats.rejected++;
+    bmp_p_diag_unlock();
+    bmp_p_error(bmp, func, "Error %s=%d is out of range. It must be within [0, %d]", name, value, limit-1);
+}
+
+/* return monotonic time in nsec */
+static uint64_t bmp_p_clock(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/* start a timing span.  The clock is only read when a handler is set. */
+uint64_t bmp_p_span_begin(void)
+{
+    bmp_span_handler handler;
+
+    bmp_p_diag_lock();
+    handler = span_handler;
+    bmp_p_diag_unlock();
+
+    return handler ? bmp_p_clock() : 0;
+}
+
+void bmp_p_span_end(bmp_data *bmp, const char *func, uint64_t start)
+{
+    bmp_span_handler handler;
+    void *ctx;
+
+    bmp_p_diag_lock();
+    handler = span_handler;
+    ctx = span_ctx;
+    bmp_p_diag_unlock();
+
+    if (handler)
+        handler((bmp_handle)bmp, func, bmp_p_clock() - start, ctx);
+}
+
+/* update the I/O counters.  bmp may be 0 for I/O without a handle. */
+void bmp_p_count_read(bmp_data *bmp, uint32_t bytes)
+{
+    bmp_p_diag_lock();
+    global_stats.bytes_read += bytes;
+    if (bmp)
+        bmp->stats.bytes_read += bytes;
+    bmp_p_diag_unlock();
+}
+
+void bmp_p_count_write(bmp_data *bmp, uint32_t bytes)
+{
+    bmp_p_diag_lock();
+    global_stats.bytes_written += bytes;
+    if (bmp)
+        bmp->stats.bytes_written += bytes;
+    bmp_p_diag_unlock();
+}
+
+void bmp_p_count_load(bmp_data *bmp)
+{
+    bmp_p_diag_lock();
+    global_stats.loads++;
+    if (bmp)
+        bmp->stats.loads++;
+    bmp_p_diag_unlock();
+}
+
+void bmp_p_count_save(bmp_data *bmp)
+{
+    bmp_p_diag_lock();
+    global_stats.saves++;
+    if (bmp)
+        bmp->stats.saves++;
+    bmp_p_diag_unlock();
+}
+
+void bmp_p_count_allocation(bmp_data *bmp)
+{
+    bmp_p_diag_lock();
+    global_stats.allocations++;
+    if (bmp)
+        bmp->stats.allocations++;
+    bmp_p_diag_unlock();
+}
+
 /* return number of bytes for one line */
 static uint32_t bytes_per_line(bmp_config *config)
 {
@@ -81,11 +233,314 @@ static unsigned int bmp_p_offset(bmp_config *config, int x, int y)
     return offset;
 }
 
+/* spread the 6 bit x and y and interleave them (Z-order in a 64x64 tile) */
+static uint32_t bmp_p_morton(uint32_t x, uint32_t y)
+{
+    x = (x | (x << 4)) & 0x0f0f;
+    x = (x | (x << 2)) & 0x3333;
+    x = (x | (x << 1)) & 0x5555;
+    y = (y | (y << 4)) & 0x0f0f;
+    y = (y | (y << 2)) & 0x3333;
+    y = (y | (y << 1)) & 0x5555;
+
+    return x | (y << 1);
+}
+
+/* return the size of bmp->image in the current layout */
+static uint32_t bmp_p_storage_size(bmp_data *bmp)
+{
+    uint32_t cols, rows;
+
+    if (bmp->layout == BMP_LAYOUT_LINEAR)
+        return bmp_p_image_size(&bmp->config);
+
+    cols = (bmp->config.width + BMP_P_TILE - 1) >> BMP_P_TILE_SHIFT;
+    rows = (bmp->config.height + BMP_P_TILE - 1) >> BMP_P_TILE_SHIFT;
+
+    return cols * rows * BMP_P_TILE * BMP_P_TILE * 3;
+}
+
+/*
+ * check that the image of config fits in memory addressed by uint32_t in
+ * layout; the sizes above are computed in 32 bits and would wrap
+ */
+static int bmp_p_check_size(bmp_data *bmp, const char *func, const bmp_config *config, uint32_t layout)
+{
+    uint64_t size;
+
+    size = (((uint64_t)config->width * (config->bits_per_pixel / 8) + 3) & ~(uint64_t)3) * config->height;
+    if (layout != BMP_LAYOUT_LINEAR)
+        size = (((uint64_t)config->width + BMP_P_TILE - 1) >> BMP_P_TILE_SHIFT) *
+               (((uint64_t)config->height + BMP_P_TILE - 1) >> BMP_P_TILE_SHIFT) * BMP_P_TILE * BMP_P_TILE * 3;
+    if (size > 0xffffffff)
+    {
+        bmp_p_error(bmp, func, "Error image is too large (%d x %d)", config->width, config->height);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* return offset of pixel (x, y) in storage of the current layout */
+static uint32_t bmp_p_storage_offset(bmp_data *bmp, uint32_t x, uint32_t y)
+{
+    uint32_t cols, tile, pixel;
+
+    if (bmp->layout == BMP_LAYOUT_LINEAR)
+        return bmp_p_offset(&bmp->config, x, y);
+
+    /* tiles are top-down, left to right */
+    cols = (bmp->config.width + BMP_P_TILE - 1) >> BMP_P_TILE_SHIFT;
+    tile = (y >> BMP_P_TILE_SHIFT) * cols + (x >> BMP_P_TILE_SHIFT);
+    x &= BMP_P_TILE - 1;
+    y &= BMP_P_TILE - 1;
+    if (bmp->layout == BMP_LAYOUT_TILED)
+        pixel = y * BMP_P_TILE + x;
+    else
+        pixel = bmp_p_morton(x, y);
+
+    return (tile * BMP_P_TILE * BMP_P_TILE + pixel) * 3;
+}
+
+/* return the address of pixel (x, y).  A locked tiled image is accessed in its linear copy. */
+static uint8_t *bmp_p_pixel(bmp_data *bmp, int x, int y)
+{
+    if (bmp->linear)
+        return bmp->linear + bmp_p_offset(&bmp->config, x, y);
+
+    return bmp->image + bmp_p_storage_offset(bmp, x, y);
+}
+
+/* copy between storage of the current layout and the linear (file) layout */
+static void bmp_p_convert(bmp_data *bmp, uint8_t *storage, uint8_t *linear, int to_linear)
+{
+    uint32_t x, y, n;
+    uint8_t *p, *q;
+
+    if (bmp->layout == BMP_LAYOUT_LINEAR)
+    {
+        if (to_linear)
+            memcpy(linear, storage, bmp->image_size);
+        else
+            memcpy(storage, linear, bmp->image_size);
+        return;
+    }
+
+    for (y = 0; y < bmp->config.height; y++)
+    {
+        p = linear + bmp_p_offset(&bmp->config, 0, y);
+        for (x = 0; x < bmp->config.width; x += n)
+        {
+            /* a tile row is contiguous in the tiled layout */
+            n = (bmp->layout == BMP_LAYOUT_TILED) ? BMP_P_TILE - (x & (BMP_P_TILE - 1)) : 1;
+            if (n > bmp->config.width - x)
+                n = bmp->config.width - x;
+            q = storage + bmp_p_storage_offset(bmp, x, y);
+            if (to_linear)
+                memcpy(p + 3 * x, q, 3 * n);
+            else
+                memcpy(q, p + 3 * x, 3 * n);
+        }
+    }
+}
+
+/*
+ * Return the image in the linear (file) layout for reading.
+ * It is the image itself, the copy made by bmp_lock, or a temporary copy
+ * that bmp_p_linear_end releases.
+ */
+static uint8_t *bmp_p_linear_begin(bmp_data *bmp, const char *func)
+{
+    uint8_t *linear;
+
+    if (bmp->layout == BMP_LAYOUT_LINEAR)
+        return bmp->image;
+    if (bmp->linear)
+        return bmp->linear;
+
+    linear = (uint8_t*)malloc(bmp->image_size);
+    if (linear == 0)
+    {
+        bmp_p_error(bmp, func, "Can't allocate linear copy");
+        return 0;
+    }
+    bmp_p_convert(bmp, bmp->image, linear, 1);
+
+    return linear;
+}
+
+static void bmp_p_linear_end(bmp_data *bmp, uint8_t *linear)
+{
+    if ((linear != bmp->image) && (linear != bmp->linear))
+        free(linear);
+}
+
+/* allocate the dirty map for the current config with every tile marked */
+static int bmp_p_alloc_dirty(bmp_data *bmp)
+{
+    uint32_t tile = bmp->dirty_tile;
+
+    if (bmp->dirty)
+        free(bmp->dirty);
+    bmp->dirty = 0;
+    bmp->dirty_cols = 0;
+    bmp->dirty_rows = 0;
+
+    if ((tile == 0) || (bmp->image == 0))
+        return 0;
+
+    bmp->dirty_cols = (bmp->config.width + tile - 1) >> bmp->dirty_shift;
+    bmp->dirty_rows = (bmp->config.height + tile - 1) >> bmp->dirty_shift;
+    bmp->dirty = (uint8_t*)malloc(bmp->dirty_cols * bmp->dirty_rows);
+    if (bmp->dirty == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate dirty map");
+        bmp->dirty_cols = 0;
+        bmp->dirty_rows = 0;
+        return -1;
+    }
+    memset(bmp->dirty, 1, bmp->dirty_cols * bmp->dirty_rows);
+
+    return 0;
+}
+
+/* mark tiles overlapping the rectangle, clipped to the image */
+static void bmp_p_mark_rect(bmp_data *bmp, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    uint32_t tx0, ty0, tx1, ty1, ty;
+
+    if ((bmp->dirty == 0) || (x >= bmp->config.width) || (y >= bmp->config.height))
+        return;
+    if (width > bmp->config.width - x)
+        width = bmp->config.width - x;
+    if (height > bmp->config.height - y)
+        height = bmp->config.height - y;
+    if ((width == 0) || (height == 0))
+        return;
+
+    tx0 = x >> bmp->dirty_shift;
+    ty0 = y >> bmp->dirty_shift;
+    tx1 = (x + width - 1) >> bmp->dirty_shift;
+    ty1 = (y + height - 1) >> bmp->dirty_shift;
+    for (ty = ty0; ty <= ty1; ty++)
+        memset(bmp->dirty + ty * bmp->dirty_cols + tx0, 1, tx1 - tx0 + 1);
+}
+
+/* check bmp headers and return the config they describe */
+static int bmp_p_parse_header(bmp_data *bmp, const char *func, BITMAPFILEHEADER *fh, BITMAPINFO *bi, bmp_config *config)
+{
+    /* Check 'B', 'M' */
+    if (fh->bfType != 0x4d42)
+    {
+        bmp_p_error(bmp, func, "Can't find \"BM\"");
+        return -1;
+    }
+    if (bi->bmiHeader.biBitCount != 24)
+    {
+        bmp_p_error(bmp, func, "Only support 24 bits per pixel (%d)", bi->bmiHeader.biBitCount);
+        return -1;
+    }
+    if (bi->bmiHeader.biCompression != BI_RGB)
+    {
+        bmp_p_error(bmp, func, "biCompression != BI_RGB");
+        return -1;
+    }
+    /* the fields are signed in the file; a negative height is a top-down bitmap */
+    if ((int32_t)bi->bmiHeader.biHeight < 0)
+    {
+        bmp_p_error(bmp, func, "Top-down bitmaps are not supported");
+        return -1;
+    }
+    if ((bi->bmiHeader.biWidth == 0) || (bi->bmiHeader.biHeight == 0) || ((int32_t)bi->bmiHeader.biWidth < 0) ||
+        ((uint64_t)bi->bmiHeader.biWidth * bi->bmiHeader.biHeight > BMP_P_MAX_PIXELS))
+    {
+        bmp_p_error(bmp, func, "Invalid size (%d x %d)", bi->bmiHeader.biWidth, bi->bmiHeader.biHeight);
+        return -1;
+    }
+
+    config->height = bi->bmiHeader.biHeight;
+    config->width  = bi->bmiHeader.biWidth;
+    config->bits_per_pixel = bi->bmiHeader.biBitCount;
+
+    return 0;
+}
+
+/* fill bmp headers for the current image */
+static void bmp_p_make_header(bmp_data *bmp, BITMAPFILEHEADER *fh, BITMAPINFO *bi)
+{
+    fh->bfType = 0x4d42;		// 'BM'
+    fh->bfSize = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFO) + bmp->image_size;
+    fh->bfReserved1 = 0;
+    fh->bfReserved2 = 0;
+    fh->bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFO);
+
+    memset(bi, 0x00, sizeof(BITMAPINFO));
+    bi->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bi->bmiHeader.biWidth = bmp->config.width;
+    bi->bmiHeader.biHeight = bmp->config.height;
+    bi->bmiHeader.biPlanes = 1;
+    bi->bmiHeader.biBitCount = bmp->config.bits_per_pixel;
+    bi->bmiHeader.biCompression = BI_RGB;
+    bi->bmiHeader.biSizeImage = bmp->image_size;
+    bi->bmiHeader.biXPelsPerMeter = 0;
+    bi->bmiHeader.biYPelsPerMeter = 0;
+    bi->bmiHeader.biClrUsed = 0;
+    bi->bmiHeader.biClrImportant = 0;
+}
+
+/* free the image buffer, or drop the reference if it is not owned */
+static void bmp_p_free_image(bmp_data *bmp)
+{
+    if (bmp->shared)
+        bmp->shared_release(bmp->shared);
+    else if (bmp->image && !bmp->image_external)
+        free(bmp->image);
+    bmp->shared = 0;
+    bmp->image_external = 0;
+}
+
+/*
+ * Copy a shared image before it is modified.  Views of a read lock
+ * still point at the shared buffer, so it can't be dropped while locked.
+ */
+static int bmp_p_unshare(bmp_data *bmp, const char *func)
+{
+    uint32_t size = bmp_p_storage_size(bmp);
+    uint8_t *image;
+
+    if (bmp->locks)
+    {
+        bmp_p_error(bmp, func, "Error shared bmp is locked for read");
+        return -1;
+    }
+
+    image = (uint8_t*)malloc(size);
+    if (image == 0)
+    {
+        bmp_p_error(bmp, func, "Can't allocate bmp buffer");
+        return -1;
+    }
+    memcpy(image, bmp->image, size);
+    bmp_p_count_allocation(bmp);
+
+    bmp_p_free_image(bmp);
+    bmp->image = image;
+
+    return 0;
+}
+
 /* return image buffer size that needs in bmp_data->image */
 static void bmp_p_release_image(bmp_data *bmp)
 {
-    if (bmp->image)
-        free(bmp->image);
+    bmp_p_free_image(bmp);
+    if (bmp->linear)
+        free(bmp->linear);
+    bmp->linear = 0;
+    if (bmp->dirty)
+        free(bmp->dirty);
+    bmp->dirty = 0;
+    bmp->dirty_cols = 0;
+    bmp->dirty_rows = 0;
 
     bmp->image = 0;
     bmp->image_size = 0;
@@ -96,6 +551,38 @@ static void bmp_p_release_image(bmp_data *bmp)
     return;
 }
 
+/*
+ * Use a linear image owned by someone else (bmp_cache.c) as a read-only
+ * shared buffer.  release(shared) is called when the handle drops it;
+ * the first write makes a private copy.
+ */
+int bmp_p_share(bmp_data *bmp, const bmp_config *config, uint8_t *image, void (*release)(void *), void *shared)
+{
+    uint32_t layout = bmp->layout;
+
+    if (bmp->locks)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error bmp is locked");
+        return -1;
+    }
+
+    /* the shared pixels are linear, other layouts get a private copy */
+    bmp_p_release_image(bmp);
+    bmp->layout = BMP_LAYOUT_LINEAR;
+    bmp->config = *config;
+    bmp->image_size = bmp_p_image_size(&bmp->config);
+    bmp->image = image;
+    bmp->shared = shared;
+    bmp->shared_release = release;
+
+    if (bmp_p_alloc_dirty(bmp) != 0)
+        return -1;
+    if (layout != BMP_LAYOUT_LINEAR)
+        return bmp_set_layout((bmp_handle)bmp, layout);
+
+    return 0;
+}
+
 /*
  * Public functions
  */
@@ -112,7 +599,7 @@ int bmp_open(bmp_handle *h, const char *filename)
     /* check argument */
     if (h == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(0, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
 
@@ -127,6 +614,7 @@ int bmp_open(bmp_handle *h, const char *filename)
     }
     else
     {
+        bmp_p_error(0, __FUNCTION__, "Can't allocate bmp_data");
         rc = -1;
     }
 
@@ -140,7 +628,7 @@ int bmp_close(bmp_handle h)
     /* check argument */
     if (bmp == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
 
@@ -156,23 +644,33 @@ int bmp_set_config(bmp_handle h, bmp_config *config)
 {
     bmp_data *bmp = (bmp_data *)h;
     int rc = 0;
+    uint64_t start;
 
     /* check argument */
     if (bmp == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
     if (config == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid argument\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
         return -1;
     }
     if (config->bits_per_pixel != 24)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Only 24 bits/pixel is supported\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Only 24 bits/pixel is supported");
+        return -1;
+    }
+    if (bmp->locks)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error bmp is locked");
         return -1;
     }
+    if (bmp_p_check_size(bmp, __FUNCTION__, config, bmp->layout) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
 
     /* free old bmp buffer */
     bmp_p_release_image(bmp);
@@ -180,14 +678,21 @@ int bmp_set_config(bmp_handle h, bmp_config *config)
     /* copy config and allocate new buffer */
     bmp->config = *config;
     bmp->image_size = bmp_p_image_size(config);
-    bmp->image = (uint8_t*)malloc(bmp->image_size);
+    bmp->image = (uint8_t*)malloc(bmp_p_storage_size(bmp));
     if (bmp->image == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Can't allocate bmp buffer\n");
-        memset(bmp, 0x00, sizeof(bmp_data));
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate bmp buffer");
+        bmp_p_release_image(bmp);
         rc = -1;
     }
-    memset(bmp->image, 0xff, bmp->image_size);
+    else
+    {
+        bmp_p_count_allocation(bmp);
+        memset(bmp->image, 0xff, bmp_p_storage_size(bmp));
+        rc = bmp_p_alloc_dirty(bmp);
+    }
+
+    bmp_p_span_end(bmp, __FUNCTION__, start);
 
     return rc;
 }
@@ -199,12 +704,12 @@ int bmp_get_config(bmp_handle h, bmp_config *config)
     /* check argument */
     if (bmp == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
     if (config == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid argument\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
         return -1;
     }
 
@@ -214,39 +719,138 @@ int bmp_get_config(bmp_handle h, bmp_config *config)
     return 0;
 }
 
+/*
+ * Change the storage layout.  The current image is converted and the
+ * layout is kept for later bmp_set_config/bmp_load.
+ */
+int bmp_set_layout(bmp_handle h, uint32_t layout)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    uint8_t *linear, *image;
+    uint32_t old_layout;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (layout > BMP_LAYOUT_ZORDER)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid layout (%d)", layout);
+        return -1;
+    }
+    if (bmp->locks)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error bmp is locked");
+        return -1;
+    }
+    if ((layout == bmp->layout) || (bmp->image == 0))
+    {
+        bmp->layout = layout;
+        return 0;
+    }
+    if (bmp_p_check_size(bmp, __FUNCTION__, &bmp->config, layout) != 0)
+        return -1;
+
+    linear = bmp_p_linear_begin(bmp, __FUNCTION__);
+    if (linear == 0)
+        return -1;
+
+    old_layout = bmp->layout;
+    bmp->layout = layout;
+    if ((layout == BMP_LAYOUT_LINEAR) && (linear != bmp->image))
+    {
+        /* the temporary linear copy becomes the image */
+        image = linear;
+    }
+    else
+    {
+        image = (uint8_t*)malloc(bmp_p_storage_size(bmp));
+        if (image == 0)
+        {
+            bmp_p_error(bmp, __FUNCTION__, "Can't allocate bmp buffer");
+            bmp->layout = old_layout;
+            bmp_p_linear_end(bmp, linear);
+            return -1;
+        }
+        memset(image, 0xff, bmp_p_storage_size(bmp));
+        bmp_p_convert(bmp, image, linear, 0);
+        if (linear != bmp->image)
+            free(linear);
+    }
+
+    bmp_p_free_image(bmp);
+    bmp->image = image;
+    bmp_p_count_allocation(bmp);
+
+    return 0;
+}
+
+int bmp_get_layout(bmp_handle h, uint32_t *layout)
+{
+    bmp_data *bmp = (bmp_data *)h;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (layout == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    *layout = bmp->layout;
+
+    return 0;
+}
+
 int bmp_set_color(bmp_handle h, int x, int y, uint32_t color)
 {
     bmp_data *bmp = (bmp_data *)h;
     int rc = 0;
-    uint32_t offset;
+    uint8_t *p;
     uint8_t B,G,R;
 
     /* check argument */
     if (bmp == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
     if ((x < 0) || (bmp->config.width -1 < x))
     {
-        fprintf(stderr, __FUNCTION__ ": Error x=%d is out of range. It must be within [0, %d]\n", x, bmp->config.width-1);
+        bmp_p_reject(bmp, __FUNCTION__, "x", x, bmp->config.width);
         return -1;
     }
     if ((y < 0) || (bmp->config.height -1 < y))
     {
-        fprintf(stderr, __FUNCTION__ ": Error y=%d is out of range. It must be within [0, %d]\n", y, bmp->config.height-1);
+        bmp_p_reject(bmp, __FUNCTION__, "y", y, bmp->config.height);
         return -1;
     }
 
+    if (bmp->shared && (bmp_p_unshare(bmp, __FUNCTION__) != 0))
+        return -1;
+
+    /* a locked tiled image is written in its linear copy, which goes back on unlock */
+    if (bmp->linear)
+        bmp->linear_modified = 1;
+
     // This code only support 24 bits per pixel
-    offset = bmp_p_offset(&(bmp->config), x, y);
+    p = bmp_p_pixel(bmp, x, y);
     B = color & 0xff;
     G = (color >> 8) & 0xff;
     R = (color >> 16) & 0xff;
 
-    bmp->image[offset+0] = B;
-    bmp->image[offset+1] = G;
-    bmp->image[offset+2] = R;
+    p[0] = B;
+    p[1] = G;
+    p[2] = R;
+
+    if (bmp->dirty)
+        BMP_P_MARK_DIRTY(bmp, x, y);
 
     return rc;
 }
@@ -255,58 +859,166 @@ int bmp_get_color(bmp_handle h, int x, int y, uint32_t *color)
 {
     bmp_data *bmp = (bmp_data *)h;
     int rc = 0;
-    uint32_t offset;
+    uint8_t *p;
 
     /* check argument */
     if (bmp == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
     if (color == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid parameter\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid parameter");
         return -1;
     }
     if ((x < 0) || (bmp->config.width -1 < x))
     {
-        fprintf(stderr, __FUNCTION__ ": Error x=%d is out of range. It must be within [0, %d]\n", x, bmp->config.width-1);
+        bmp_p_reject(bmp, __FUNCTION__, "x", x, bmp->config.width);
         return -1;
     }
     if ((y < 0) || (bmp->config.height -1 < y))
     {
-        fprintf(stderr, __FUNCTION__ ": Error y=%d is out of range. It must be within [0, %d]\n", y, bmp->config.height-1);
+        bmp_p_reject(bmp, __FUNCTION__, "y", y, bmp->config.height);
         return -1;
     }
 
     // This code only support 24 bits per pixel
-    offset = bmp_p_offset(&(bmp->config), x, y);
-    *color = *((uint32_t*)(bmp->image + offset)) & 0x00ffffff;
+    p = bmp_p_pixel(bmp, x, y);
+    *color = ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | (uint32_t)p[0];
 
     return rc;
 }
 
-int bmp_copy(bmp_handle dst, bmp_handle src)
+/*
+ * Lock the image buffer and return a view of it.
+ * Locks nest; each bmp_lock must be paired with bmp_unlock.
+ */
+int bmp_lock(bmp_handle h, bmp_view *view, uint32_t flags)
 {
-    bmp_data *bmp_dst = (bmp_data *)dst;
-    bmp_data *bmp_src = (bmp_data *)src;
-    int rc = 0;
+    bmp_data *bmp = (bmp_data *)h;
+    uint32_t stride;
+    uint8_t *image;
 
     /* check argument */
-    if (bmp_dst == 0)
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((view == 0) || ((flags & (BMP_LOCK_READ | BMP_LOCK_WRITE)) == 0))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if (bmp->image == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error No image");
+        return -1;
+    }
+
+    /* a shared image is copied before the first write */
+    if (bmp->shared && (flags & BMP_LOCK_WRITE) && (bmp_p_unshare(bmp, __FUNCTION__) != 0))
+        return -1;
+
+    /* a tiled image is converted to a linear copy while it is locked */
+    image = bmp->image;
+    if (bmp->layout != BMP_LAYOUT_LINEAR)
+    {
+        if (bmp->linear == 0)
+        {
+            bmp->linear = bmp_p_linear_begin(bmp, __FUNCTION__);
+            if (bmp->linear == 0)
+                return -1;
+            bmp->linear_modified = 0;
+        }
+        if (flags & BMP_LOCK_WRITE)
+            bmp->linear_modified = 1;
+        image = bmp->linear;
+    }
+
+    /* bmp is stored bottom-up, so the view starts at the last line */
+    stride = bytes_per_line(&bmp->config);
+    view->base = image + stride * (bmp->config.height - 1);
+    view->stride = -(int32_t)stride;
+    view->width = bmp->config.width;
+    view->height = bmp->config.height;
+    view->bits_per_pixel = bmp->config.bits_per_pixel;
+    view->flags = flags;
+    bmp->locks++;
+
+    return 0;
+}
+
+int bmp_unlock(bmp_handle h, bmp_view *view)
+{
+    bmp_data *bmp = (bmp_data *)h;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((view == 0) || (bmp->locks == 0))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    if ((view->flags & (BMP_LOCK_WRITE | BMP_LOCK_NO_DIRTY)) == BMP_LOCK_WRITE)
+        bmp_p_mark_rect(bmp, 0, 0, bmp->config.width, bmp->config.height);
+
+    view->base = 0;
+    bmp->locks--;
+
+    /* write back the linear copy of a tiled image */
+    if ((bmp->locks == 0) && bmp->linear)
+    {
+        if (bmp->linear_modified)
+            bmp_p_convert(bmp, bmp->image, bmp->linear, 0);
+        free(bmp->linear);
+        bmp->linear = 0;
+    }
+
+    return 0;
+}
+
+int bmp_copy(bmp_handle dst, bmp_handle src)
+{
+    bmp_data *bmp_dst = (bmp_data *)dst;
+    bmp_data *bmp_src = (bmp_data *)src;
+    uint8_t *linear;
+    int rc = 0;
+
+    /* check argument */
+    if (bmp_dst == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp_dst, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
     if (bmp_src == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp_dst, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
 
     rc = bmp_set_config(dst, &bmp_src->config);
     if (rc == 0)
-        memcpy(bmp_dst->image, bmp_src->image, bmp_dst->image_size);
+    {
+        if (bmp_dst->layout == bmp_src->layout && bmp_src->linear == 0)
+        {
+            memcpy(bmp_dst->image, bmp_src->image, bmp_p_storage_size(bmp_dst));
+        }
+        else
+        {
+            linear = bmp_p_linear_begin(bmp_src, __FUNCTION__);
+            if (linear == 0)
+                return -1;
+            bmp_p_convert(bmp_dst, bmp_dst->image, linear, 0);
+            bmp_p_linear_end(bmp_src, linear);
+        }
+    }
 
     return rc;
 }
@@ -319,63 +1031,69 @@ int bmp_load(bmp_handle h, const char *filename)
     BITMAPINFO BitMapInfo;
     int len;
     bmp_config new_config;
+    uint8_t *linear;
     FILE *fp;
+    uint64_t start;
 
     /* check argument */
     if (bmp == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
     if (filename == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
 
     fp = fopen(filename, "rb");
-
-    /* Read BITMAPFILEHEADER */
-    len = fread(&BitMapFileHeader, sizeof(BITMAPFILEHEADER), 1, fp);
-
-    /* Check 'B', 'M' */
-    if (BitMapFileHeader.bfType != 0x4d42)
+    if (fp == NULL)
     {
-        fprintf(stderr, __FUNCTION__ ": Can't find \"BM\"\n");
-        rc = -1;
-        goto exit;
+        bmp_p_error(bmp, __FUNCTION__, "Cannot open %s", filename);
+        return -1;
     }
+    start = bmp_p_span_begin();
 
-    /* Read BITMAPINFO */
+    /* Read BITMAPFILEHEADER and BITMAPINFO */
+    len = fread(&BitMapFileHeader, sizeof(BITMAPFILEHEADER), 1, fp);
     len = fread(&BitMapInfo, sizeof(BITMAPINFO), 1, fp);
 
-    if (BitMapInfo.bmiHeader.biBitCount != 24)
-    {
-        fprintf(stderr, __FUNCTION__ ": Only support 24 bits per pixel (%d)\n", BitMapInfo.bmiHeader.biBitCount);
-        rc = -1;
-        goto exit;
-    }
-
-    if (BitMapInfo.bmiHeader.biCompression != BI_RGB)
-    {
-        fprintf(stderr, __FUNCTION__ ": biCompression != BI_RGB\n");
-        rc = -1;
+    rc = bmp_p_parse_header(bmp, __FUNCTION__, &BitMapFileHeader, &BitMapInfo, &new_config);
+    if (rc != 0)
         goto exit;
-    }
 
     /* bmp_set_config release old image buffer and allocate new one. */
-    new_config.height = BitMapInfo.bmiHeader.biHeight;
-    new_config.width  = BitMapInfo.bmiHeader.biWidth;
-    new_config.bits_per_pixel = BitMapInfo.bmiHeader.biBitCount;
-    bmp_set_config(h, &new_config);
+    rc = bmp_set_config(h, &new_config);
+    if (rc != 0)
+        goto exit;
     //printf("width = %d, height = %d, bits/pixel = %d\n", bmp->config.width, bmp->config.height, bmp->config.bits_per_pixel);
 
     /* Then load new bmp image */
     fseek(fp, BitMapFileHeader.bfOffBits, SEEK_SET);
-    len = fread(bmp->image, 1, bmp->image_size, fp);
+    if (bmp->layout == BMP_LAYOUT_LINEAR)
+    {
+        len = fread(bmp->image, 1, bmp->image_size, fp);
+    }
+    else
+    {
+        linear = (uint8_t*)malloc(bmp->image_size);
+        if (linear == 0)
+        {
+            bmp_p_error(bmp, __FUNCTION__, "Can't allocate linear copy");
+            rc = -1;
+            goto exit;
+        }
+        len = fread(linear, 1, bmp->image_size, fp);
+        bmp_p_convert(bmp, bmp->image, linear, 0);
+        free(linear);
+    }
+    bmp_p_count_read(bmp, sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFO) + len);
+    bmp_p_count_load(bmp);
 
  exit:
     fclose(fp);
+    bmp_p_span_end(bmp, __FUNCTION__, start);
     return rc;
 }
 
@@ -386,45 +1104,576 @@ int bmp_save(bmp_handle h, const char *filename)
     BITMAPFILEHEADER BitMapFileHeader;
     BITMAPINFO BitMapInfo;
     int len;
+    uint8_t *linear;
     FILE *fp;
+    uint64_t start;
 
     /* check argument */
     if (bmp == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
     if (filename == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
 
+    linear = bmp_p_linear_begin(bmp, __FUNCTION__);
+    if (linear == 0)
+        return -1;
+
     fp = fopen(filename, "wb+");
+    if (fp == NULL)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Cannot open %s", filename);
+        bmp_p_linear_end(bmp, linear);
+        return -1;
+    }
+    start = bmp_p_span_begin();
 
-    BitMapFileHeader.bfType = 0x4d42;		// 'BM'
-    BitMapFileHeader.bfSize = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFO) + bmp->image_size;
-    BitMapFileHeader.bfReserved1 = 0;
-    BitMapFileHeader.bfReserved2 = 0;
-    BitMapFileHeader.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFO);
-
-    BitMapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-    BitMapInfo.bmiHeader.biWidth = bmp->config.width;
-    BitMapInfo.bmiHeader.biHeight = bmp->config.height;
-    BitMapInfo.bmiHeader.biPlanes = 1;
-    BitMapInfo.bmiHeader.biBitCount = bmp->config.bits_per_pixel;
-    BitMapInfo.bmiHeader.biCompression = BI_RGB;
-    BitMapInfo.bmiHeader.biSizeImage = bmp->image_size;
-    BitMapInfo.bmiHeader.biXPelsPerMeter = 0;
-    BitMapInfo.bmiHeader.biYPelsPerMeter = 0;
-    BitMapInfo.bmiHeader.biClrUsed = 0;
-    BitMapInfo.bmiHeader.biClrImportant = 0;
+    bmp_p_make_header(bmp, &BitMapFileHeader, &BitMapInfo);
 
     len = fwrite((char*)&BitMapFileHeader, sizeof(BITMAPFILEHEADER), 1, fp);
     len = fwrite((char*)&BitMapInfo, sizeof(BITMAPINFO), 1, fp);
-    len = fwrite(bmp->image, 1, bmp->image_size, fp);
+    len = fwrite(linear, 1, bmp->image_size, fp);
+    bmp_p_linear_end(bmp, linear);
+    bmp_p_count_write(bmp, sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFO) + len);
+    bmp_p_count_save(bmp);
+
+    fclose(fp);
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    return rc;
+}
+
+/*
+ * Parse bmp headers from buf.  The returned config and payload pointer are
+ * shared by bmp_load_mem and bmp_attach_mem.
+ */
+static int bmp_p_parse_mem(bmp_data *bmp, const char *func, const uint8_t *buf, size_t size, bmp_config *config, const uint8_t **payload)
+{
+    BITMAPFILEHEADER BitMapFileHeader;
+    BITMAPINFO BitMapInfo;
+    size_t len;
+
+    /* bmiColors is optional for 24 bits/pixel */
+    if ((buf == 0) || (size < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER)))
+    {
+        bmp_p_error(bmp, func, "Error buffer is too short");
+        return -1;
+    }
+    memcpy(&BitMapFileHeader, buf, sizeof(BITMAPFILEHEADER));
+    memset(&BitMapInfo, 0x00, sizeof(BITMAPINFO));
+    len = size - sizeof(BITMAPFILEHEADER);
+    if (len > sizeof(BITMAPINFO))
+        len = sizeof(BITMAPINFO);
+    memcpy(&BitMapInfo, buf + sizeof(BITMAPFILEHEADER), len);
+
+    if (bmp_p_parse_header(bmp, func, &BitMapFileHeader, &BitMapInfo, config) != 0)
+        return -1;
+
+    /* the size is limited by bmp_p_parse_header, the sum is checked in 64 bits */
+    if ((uint64_t)BitMapFileHeader.bfOffBits + bmp_p_image_size(config) > size)
+    {
+        bmp_p_error(bmp, func, "Error image data is truncated");
+        return -1;
+    }
+    *payload = buf + BitMapFileHeader.bfOffBits;
+
+    return 0;
+}
+
+/* Load a bmp file image from memory.  The pixels are copied. */
+int bmp_load_mem(bmp_handle h, const void *buf, size_t size)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    bmp_config new_config;
+    const uint8_t *payload;
+    int rc;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    rc = bmp_p_parse_mem(bmp, __FUNCTION__, (const uint8_t*)buf, size, &new_config, &payload);
+    if (rc == 0)
+        rc = bmp_set_config(h, &new_config);
+    if (rc == 0)
+    {
+        bmp_p_convert(bmp, bmp->image, (uint8_t*)payload, 0);
+        bmp_p_count_read(bmp, (uint32_t)(payload - (const uint8_t*)buf) + bmp->image_size);
+        bmp_p_count_load(bmp);
+    }
+
+    return rc;
+}
+
+/*
+ * Use the pixels of a bmp file image in memory without copying.
+ * The handle reads and writes buf directly until it is reconfigured,
+ * reloaded or closed, so buf must stay valid until then.
+ */
+int bmp_attach_mem(bmp_handle h, void *buf, size_t size)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    bmp_config new_config;
+    const uint8_t *payload;
+    int rc;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (bmp->locks)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error bmp is locked");
+        return -1;
+    }
+
+    /* only a linear image can use the pixels in place */
+    if (bmp->layout != BMP_LAYOUT_LINEAR)
+        return bmp_load_mem(h, buf, size);
+
+    rc = bmp_p_parse_mem(bmp, __FUNCTION__, (const uint8_t*)buf, size, &new_config, &payload);
+    if (rc != 0)
+        return rc;
+
+    bmp_p_release_image(bmp);
+    bmp->config = new_config;
+    bmp->image_size = bmp_p_image_size(&new_config);
+    bmp->image = (uint8_t*)buf + (payload - (const uint8_t*)buf);
+    bmp->image_external = 1;
+    bmp_p_count_read(bmp, (uint32_t)(payload - (const uint8_t*)buf));
+    bmp_p_count_load(bmp);
+
+    return bmp_p_alloc_dirty(bmp);
+}
+
+/*
+ * Write a bmp file image to buf.  size returns the number of bytes needed.
+ * Pass buf = 0 to get the size only.
+ */
+int bmp_save_mem(bmp_handle h, void *buf, size_t capacity, size_t *size)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    BITMAPFILEHEADER BitMapFileHeader;
+    BITMAPINFO BitMapInfo;
+    uint8_t *p = (uint8_t*)buf;
+    uint8_t *linear;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (size == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    bmp_p_make_header(bmp, &BitMapFileHeader, &BitMapInfo);
+    *size = BitMapFileHeader.bfSize;
+    if (buf == 0)
+        return 0;
+    if (capacity < *size)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error buffer is too short (%d < %d)", (uint32_t)capacity, (uint32_t)*size);
+        return -1;
+    }
+
+    memcpy(p, &BitMapFileHeader, sizeof(BITMAPFILEHEADER));
+    memcpy(p + sizeof(BITMAPFILEHEADER), &BitMapInfo, sizeof(BITMAPINFO));
+    linear = bmp_p_linear_begin(bmp, __FUNCTION__);
+    if (linear == 0)
+        return -1;
+    memcpy(p + BitMapFileHeader.bfOffBits, linear, bmp->image_size);
+    bmp_p_linear_end(bmp, linear);
+    bmp_p_count_write(bmp, BitMapFileHeader.bfSize);
+    bmp_p_count_save(bmp);
+
+    return 0;
+}
+
+/*
+ * Diagnostics
+ */
+
+/* Default error handler */
+void bmp_stderr_handler(bmp_handle h, const char *func, const char *msg, void *ctx)
+{
+    (void)h;
+    (void)ctx;
+    fprintf(stderr, "%s: %s\n", func, msg);
+}
+
+void bmp_set_error_handler(bmp_error_handler handler, void *ctx)
+{
+    bmp_p_diag_lock();
+    error_handler = handler;
+    error_ctx = ctx;
+    bmp_p_diag_unlock();
+}
+
+void bmp_set_span_handler(bmp_span_handler handler, void *ctx)
+{
+    bmp_p_diag_lock();
+    span_handler = handler;
+    span_ctx = ctx;
+    bmp_p_diag_unlock();
+}
+
+int bmp_get_stats(bmp_handle h, bmp_stats *stats)
+{
+    bmp_data *bmp = (bmp_data *)h;
+
+    /* check argument */
+    if (stats == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    /* h == 0 returns the process wide counters */
+    bmp_p_diag_lock();
+    *stats = bmp ? bmp->stats : global_stats;
+    bmp_p_diag_unlock();
+
+    return 0;
+}
+
+int bmp_reset_stats(bmp_handle h)
+{
+    bmp_data *bmp = (bmp_data *)h;
+
+    bmp_p_diag_lock();
+    if (bmp)
+        memset(&bmp->stats, 0x00, sizeof(bmp_stats));
+    else
+        memset(&global_stats, 0x00, sizeof(bmp_stats));
+    bmp_p_diag_unlock();
+
+    return 0;
+}
+
+/*
+ * Dirty region tracking
+ */
+
+int bmp_set_dirty_tracking(bmp_handle h, uint32_t tile_size)
+{
+    bmp_data *bmp = (bmp_data *)h;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (tile_size & (tile_size - 1))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error tile_size=%d is not a power of 2", tile_size);
+        return -1;
+    }
+
+    bmp->dirty_tile = tile_size;
+    bmp->dirty_shift = 0;
+    while ((1u << bmp->dirty_shift) < tile_size)
+        bmp->dirty_shift++;
+
+    return bmp_p_alloc_dirty(bmp);
+}
+
+int bmp_mark_dirty(bmp_handle h, const bmp_rect *rect)
+{
+    bmp_data *bmp = (bmp_data *)h;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (rect == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    bmp_p_mark_rect(bmp, rect->x, rect->y, rect->width, rect->height);
+
+    return 0;
+}
+
+/*
+ * Runs of dirty tiles in a tile row become rectangles, and a rectangle
+ * grows downward while the next tile row has a run with the same span.
+ */
+int bmp_get_dirty_rects(bmp_handle h, bmp_rect *rects, uint32_t max, uint32_t *count)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    bmp_rect *list, *r;
+    uint32_t n, prev_first, prev_last, i, tx, ty, x0, tile;
+    const uint8_t *row;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((count == 0) || ((rects == 0) && (max > 0)))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    *count = 0;
+    if (bmp->dirty == 0)
+        return 0;
+
+    /* at most one rectangle per two tiles, plus one */
+    list = (bmp_rect*)malloc(sizeof(bmp_rect) * (bmp->dirty_cols / 2 + 1) * bmp->dirty_rows);
+    if (list == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate rect list");
+        return -1;
+    }
+
+    tile = bmp->dirty_tile;
+    n = 0;
+    prev_first = prev_last = 0;
+    for (ty = 0; ty < bmp->dirty_rows; ty++)
+    {
+        uint32_t first = n;
+
+        row = bmp->dirty + ty * bmp->dirty_cols;
+        for (tx = 0; tx < bmp->dirty_cols; )
+        {
+            if (row[tx] == 0)
+            {
+                tx++;
+                continue;
+            }
+            x0 = tx;
+            while ((tx < bmp->dirty_cols) && row[tx])
+                tx++;
+
+            /* extend a rectangle of the previous tile row with the same span */
+            r = 0;
+            for (i = prev_first; i < prev_last; i++)
+            {
+                if ((list[i].x == x0 * tile) && (list[i].width == (tx - x0) * tile))
+                {
+                    r = &list[i];
+                    break;
+                }
+            }
+            if (r)
+            {
+                r->height += tile;
+                /* keep it visible to the next tile row */
+                list[n] = *r;
+                r->width = 0;
+            }
+            else
+            {
+                list[n].x = x0 * tile;
+                list[n].y = ty * tile;
+                list[n].width = (tx - x0) * tile;
+                list[n].height = tile;
+            }
+            n++;
+        }
+        prev_first = first;
+        prev_last = n;
+    }
+
+    /* drop moved entries and clip to the image */
+    for (i = 0; i < n; i++)
+    {
+        r = &list[i];
+        if (r->width == 0)
+            continue;
+        if (r->x + r->width > bmp->config.width)
+            r->width = bmp->config.width - r->x;
+        if (r->y + r->height > bmp->config.height)
+            r->height = bmp->config.height - r->y;
+        if (*count < max)
+            rects[*count] = *r;
+        (*count)++;
+    }
+
+    free(list);
+
+    return 0;
+}
+
+int bmp_clear_dirty(bmp_handle h)
+{
+    bmp_data *bmp = (bmp_data *)h;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    if (bmp->dirty)
+        memset(bmp->dirty, 0, bmp->dirty_cols * bmp->dirty_rows);
+
+    return 0;
+}
+
+/* save the whole image and clear the dirty state */
+static int bmp_p_save_all(bmp_handle h, const char *filename)
+{
+    int rc;
+
+    rc = bmp_save(h, filename);
+    if (rc == 0)
+        bmp_clear_dirty(h);
+
+    return rc;
+}
+
+/*
+ * The file keeps the bottom-up layout of a linear image, so each dirty line
+ * is written at bfOffBits + its offset in the linear image buffer.
+ */
+int bmp_save_dirty(bmp_handle h, const char *filename)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    int rc = 0;
+    BITMAPFILEHEADER BitMapFileHeader;
+    BITMAPINFO BitMapInfo;
+    bmp_rect *rects;
+    uint8_t *image, *line;
+    uint32_t count, i, x, y, offset, stride, len;
+    uint64_t start;
+    FILE *fp;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (filename == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (bmp->dirty == 0)
+        return bmp_p_save_all(h, filename);
+
+    /* the file must have been written from an image of the same config */
+    fp = fopen(filename, "rb+");
+    if (fp == NULL)
+        return bmp_p_save_all(h, filename);
+
+    len = fread(&BitMapFileHeader, sizeof(BITMAPFILEHEADER), 1, fp);
+    len += fread(&BitMapInfo, sizeof(BITMAPINFO), 1, fp);
+    if ((len != 2) ||
+        (BitMapFileHeader.bfType != 0x4d42) ||
+        (BitMapFileHeader.bfSize != BitMapFileHeader.bfOffBits + bmp->image_size) ||
+        (BitMapInfo.bmiHeader.biWidth != bmp->config.width) ||
+        (BitMapInfo.bmiHeader.biHeight != bmp->config.height) ||
+        (BitMapInfo.bmiHeader.biBitCount != bmp->config.bits_per_pixel) ||
+        (BitMapInfo.bmiHeader.biCompression != BI_RGB))
+    {
+        fclose(fp);
+        return bmp_p_save_all(h, filename);
+    }
+
+    rc = bmp_get_dirty_rects(h, 0, 0, &count);
+    rects = (bmp_rect*)malloc(sizeof(bmp_rect) * (count + 1));
+    if ((rc != 0) || (rects == 0))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate rect list");
+        fclose(fp);
+        return -1;
+    }
+    bmp_get_dirty_rects(h, rects, count, &count);
+
+    /* a tiled image is gathered line by line */
+    image = (bmp->layout == BMP_LAYOUT_LINEAR) ? bmp->image : bmp->linear;
+    stride = bytes_per_line(&bmp->config);
+    line = 0;
+    if (image == 0)
+    {
+        line = (uint8_t*)malloc(stride);
+        if (line == 0)
+        {
+            bmp_p_error(bmp, __FUNCTION__, "Can't allocate line buffer");
+            free(rects);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    start = bmp_p_span_begin();
+    for (i = 0; (i < count) && (rc == 0); i++)
+    {
+        bmp_rect *r = &rects[i];
+
+        if ((r->width == bmp->config.width) && image)
+        {
+            /* full lines are contiguous in the file */
+            offset = bmp_p_offset(&bmp->config, 0, r->y + r->height - 1);
+            fseek(fp, BitMapFileHeader.bfOffBits + offset, SEEK_SET);
+            len = fwrite(image + offset, 1, stride * r->height, fp);
+            bmp_p_count_write(bmp, len);
+            if (len != stride * r->height)
+                rc = -1;
+            continue;
+        }
+
+        for (y = r->y; y < r->y + r->height; y++)
+        {
+            offset = bmp_p_offset(&bmp->config, r->x, y);
+            fseek(fp, BitMapFileHeader.bfOffBits + offset, SEEK_SET);
+            if (image)
+            {
+                len = fwrite(image + offset, 1, 3 * r->width, fp);
+            }
+            else
+            {
+                for (x = 0; x < r->width; x++)
+                    memcpy(line + 3 * x, bmp_p_pixel(bmp, r->x + x, y), 3);
+                len = fwrite(line, 1, 3 * r->width, fp);
+            }
+            bmp_p_count_write(bmp, len);
+            if (len != 3 * r->width)
+            {
+                rc = -1;
+                break;
+            }
+        }
+    }
+
+    if (rc != 0)
+        bmp_p_error(bmp, __FUNCTION__, "Write error");
+    else
+    {
+        bmp_p_count_save(bmp);
+        bmp_clear_dirty(h);
+    }
 
+    if (line)
+        free(line);
+    free(rects);
     fclose(fp);
+    bmp_p_span_end(bmp, __FUNCTION__, start);
 
     return rc;
 }
@@ -8,6 +8,7 @@
 #ifndef BMP_H
 #define BMP_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef uint32_t* bmp_handle;
@@ -40,6 +41,157 @@ int bmp_copy(bmp_handle dst, bmp_handle src);
 int bmp_load(bmp_handle h, const char *filename);
 int bmp_save(bmp_handle h, const char *filename);
 
+/*
+ * Storage layout of the image buffer.
+ * BMP_LAYOUT_TILED stores 64x64 pixel tiles, BMP_LAYOUT_ZORDER stores the
+ * pixels of each 64x64 tile in Z-order (Morton order), so that pixels close
+ * in 2D are close in memory.  The layout stays with the handle across
+ * bmp_set_config and bmp_load; files are always read and written in bmp
+ * order.  bmp_lock of a tiled image works on a linear copy that is written
+ * back at the last bmp_unlock, so use bmp_set_color/bmp_get_color for
+ * 2D-local access to a tiled image.
+ */
+#define BMP_LAYOUT_LINEAR   0
+#define BMP_LAYOUT_TILED    1
+#define BMP_LAYOUT_ZORDER   2
+
+int bmp_set_layout(bmp_handle h, uint32_t layout);
+int bmp_get_layout(bmp_handle h, uint32_t *layout);
+
+/*
+ * Functions to load/save a bmp file image in memory.
+ * bmp_attach_mem uses the pixels in buf without copying; buf must stay
+ * valid until the handle is reconfigured, reloaded or closed.
+ * bmp_save_mem returns the bytes needed in size; pass buf = 0 to query it.
+ */
+int bmp_load_mem(bmp_handle h, const void *buf, size_t size);
+int bmp_attach_mem(bmp_handle h, void *buf, size_t size);
+int bmp_save_mem(bmp_handle h, void *buf, size_t capacity, size_t *size);
+
+/*
+ * Locked view for fast pixel access.
+ * bmp_lock returns the address of the top row and the signed distance
+ * between rows, so row y starts at base + y * stride.  The inline
+ * accessors below are unchecked unless BMP_DEBUG is defined.
+ * The handle must not be reconfigured or reloaded while it is locked.
+ */
+#define BMP_LOCK_READ   0x01
+#define BMP_LOCK_WRITE  0x02
+
+typedef struct {
+    uint8_t *base;
+    int32_t stride;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bits_per_pixel;
+    uint32_t flags;
+} bmp_view;
+
+int bmp_lock(bmp_handle h, bmp_view *view, uint32_t flags);
+int bmp_unlock(bmp_handle h, bmp_view *view);
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define BMP_INLINE static __inline
+#else
+#define BMP_INLINE static inline
+#endif
+
+#ifdef BMP_DEBUG
+#include <assert.h>
+#define BMP_VIEW_CHECK(view, x, y) \
+    assert((view)->base && (uint32_t)(x) < (view)->width && (uint32_t)(y) < (view)->height)
+#else
+#define BMP_VIEW_CHECK(view, x, y) ((void)0)
+#endif
+
+BMP_INLINE uint8_t *bmp_view_row(const bmp_view *view, int y)
+{
+    BMP_VIEW_CHECK(view, 0, y);
+    return view->base + (intptr_t)y * view->stride;
+}
+
+BMP_INLINE uint32_t bmp_view_get(const bmp_view *view, int x, int y)
+{
+    const uint8_t *p = view->base + (intptr_t)y * view->stride + 3 * x;
+
+    BMP_VIEW_CHECK(view, x, y);
+    return ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | (uint32_t)p[0];
+}
+
+BMP_INLINE void bmp_view_set(const bmp_view *view, int x, int y, uint32_t color)
+{
+    uint8_t *p = view->base + (intptr_t)y * view->stride + 3 * x;
+
+    BMP_VIEW_CHECK(view, x, y);
+    p[0] = color & 0xff;
+    p[1] = (color >> 8) & 0xff;
+    p[2] = (color >> 16) & 0xff;
+}
+
+/*
+ * Dirty region tracking.
+ * When enabled, the image is divided into tiles of tile_size x tile_size
+ * pixels (a power of 2) and bmp_set_color marks the tile it writes.
+ * bmp_set_config/bmp_load mark the whole image.  bmp_unlock of a
+ * BMP_LOCK_WRITE view also marks the whole image unless BMP_LOCK_NO_DIRTY
+ * was given, in which case the writer reports what it changed with
+ * bmp_mark_dirty.
+ * bmp_get_dirty_rects returns the modified area as rectangles on tile
+ * boundaries (y = 0 is the top line).  count is set to the number of
+ * rectangles, which may be more than max.
+ * bmp_save_dirty rewrites only the modified part of an existing bmp file
+ * written from this image (falls back to bmp_save otherwise), then clears
+ * the dirty state.
+ */
+#define BMP_LOCK_NO_DIRTY   0x04
+
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} bmp_rect;
+
+int bmp_set_dirty_tracking(bmp_handle h, uint32_t tile_size);
+int bmp_mark_dirty(bmp_handle h, const bmp_rect *rect);
+int bmp_get_dirty_rects(bmp_handle h, bmp_rect *rects, uint32_t max, uint32_t *count);
+int bmp_clear_dirty(bmp_handle h);
+int bmp_save_dirty(bmp_handle h, const char *filename);
+
+/*
+ * Diagnostics.
+ * Errors are passed to the error handler instead of being printed inline.
+ * bmp_stderr_handler is the default.  Pass 0 to disable the output.
+ * The span handler, if set, receives the elapsed time in nsec of
+ * bmp_load, bmp_save and bmp_set_config.
+ * Handlers are called on the thread that hit the error, which may be a
+ * library thread; the counters can be read from any thread.
+ */
+typedef void (*bmp_error_handler)(bmp_handle h, const char *func, const char *msg, void *ctx);
+typedef void (*bmp_span_handler)(bmp_handle h, const char *func, uint64_t nsec, void *ctx);
+
+void bmp_stderr_handler(bmp_handle h, const char *func, const char *msg, void *ctx);
+void bmp_set_error_handler(bmp_error_handler handler, void *ctx);
+void bmp_set_span_handler(bmp_span_handler handler, void *ctx);
+
+/*
+ * Counters are kept per handle and for the whole process.
+ * Pass h = 0 to get/reset the process wide counters.
+ * The mem functions count the bytes they copy; attaching counts the header only.
+ */
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint32_t loads;
+    uint32_t saves;
+    uint32_t allocations;
+    uint32_t rejected;          /* out of range pixel accesses */
+    uint32_t errors;
+} bmp_stats;
+
+int bmp_get_stats(bmp_handle h, bmp_stats *stats);
+int bmp_reset_stats(bmp_handle h);
+
 /* Macros to pack/unpack R,G,B to/from uint32_t */
 #define RGB_R(rgb) (((rgb) >> 16) & 0xff)
 #define RGB_G(rgb) (((rgb) >> 8) & 0xff)
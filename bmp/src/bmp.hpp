@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * This is a C++17 header layer on top of the bmp library.
+ * Image<PixelFormat> owns a bmp_handle and keeps it locked, so pixels are
+ * accessed through plain pointers and the format is fixed at compile time.
+ */
+
+#ifndef BMP_HPP
+#define BMP_HPP
+
+extern "C" {
+#include "bmp.h"
+}
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace bmp {
+
+/*
+ * Pixel formats.  Each format is the in-memory layout of one pixel.
+ */
+struct bgr24 {
+    uint8_t b, g, r;
+};
+static_assert(sizeof(bgr24) == 3, "bgr24 must be packed");
+
+template <class P> struct pixel_traits;
+
+template <> struct pixel_traits<bgr24> {
+    static constexpr uint32_t bits_per_pixel = 24;
+
+    static constexpr uint32_t to_rgb(bgr24 p)
+    {
+        return RGB_A(p.r, p.g, p.b);
+    }
+    static constexpr bgr24 from_rgb(uint32_t rgb)
+    {
+        return bgr24{ uint8_t(RGB_B(rgb)), uint8_t(RGB_G(rgb)), uint8_t(RGB_R(rgb)) };
+    }
+    /* BT.601 luma in 8 bit fixed point */
+    static constexpr uint8_t luma(bgr24 p)
+    {
+        return uint8_t((77u * p.r + 150u * p.g + 29u * p.b + 128u) >> 8);
+    }
+};
+
+/*
+ * One row of pixels.
+ */
+template <class P> class Row {
+public:
+    using iterator = P*;
+
+    Row(P *first, uint32_t width) : first_(first), width_(width) { }
+
+    P *begin() const { return first_; }
+    P *end() const { return first_ + width_; }
+    uint32_t size() const { return width_; }
+    P &operator[](uint32_t x) const { return first_[x]; }
+
+private:
+    P *first_;
+    uint32_t width_;
+};
+
+/*
+ * Iterator over rows, top to bottom.
+ */
+template <class P> class RowIterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Row<P>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Row<P>;
+
+    RowIterator(uint8_t *row, int32_t stride, uint32_t width)
+        : row_(row), stride_(stride), width_(width) { }
+
+    Row<P> operator*() const { return Row<P>(reinterpret_cast<P*>(row_), width_); }
+    Row<P> operator[](difference_type n) const { return *(*this + n); }
+    RowIterator &operator++() { row_ += stride_; return *this; }
+    RowIterator operator++(int) { RowIterator t = *this; row_ += stride_; return t; }
+    RowIterator &operator--() { row_ -= stride_; return *this; }
+    RowIterator operator--(int) { RowIterator t = *this; row_ -= stride_; return t; }
+    RowIterator &operator+=(difference_type n) { row_ += n * stride_; return *this; }
+    RowIterator &operator-=(difference_type n) { row_ -= n * stride_; return *this; }
+    RowIterator operator+(difference_type n) const { RowIterator t = *this; return t += n; }
+    RowIterator operator-(difference_type n) const { RowIterator t = *this; return t -= n; }
+    difference_type operator-(const RowIterator &o) const { return (row_ - o.row_) / stride_; }
+    bool operator==(const RowIterator &o) const { return row_ == o.row_; }
+    bool operator!=(const RowIterator &o) const { return row_ != o.row_; }
+    bool operator<(const RowIterator &o) const { return (*this - o) < 0; }
+    bool operator>(const RowIterator &o) const { return o < *this; }
+    bool operator<=(const RowIterator &o) const { return !(o < *this); }
+    bool operator>=(const RowIterator &o) const { return !(*this < o); }
+    friend RowIterator operator+(difference_type n, const RowIterator &it) { return it + n; }
+
+private:
+    uint8_t *row_;
+    int32_t stride_;
+    uint32_t width_;
+};
+
+template <class P> class Rows {
+public:
+    Rows(RowIterator<P> first, RowIterator<P> last) : first_(first), last_(last) { }
+    RowIterator<P> begin() const { return first_; }
+    RowIterator<P> end() const { return last_; }
+
+private:
+    RowIterator<P> first_, last_;
+};
+
+/*
+ * Move-only owner of a locked bmp_handle.
+ * Errors of the underlying C functions are thrown as std::runtime_error.
+ */
+template <class P> class Image {
+public:
+    using pixel_type = P;
+    using traits = pixel_traits<P>;
+
+    Image(uint32_t width, uint32_t height) : h_(0), view_()
+    {
+        bmp_config config;
+        config.width = width;
+        config.height = height;
+        config.bits_per_pixel = traits::bits_per_pixel;
+        open(0);
+        try {
+            check(bmp_set_config(h_, &config), "bmp_set_config");
+            lock();
+        }
+        catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    explicit Image(const std::string &filename) : h_(0), view_()
+    {
+        open(filename.c_str());
+        try {
+            lock();
+        }
+        catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    Image(Image &&other) noexcept : h_(other.h_), view_(other.view_)
+    {
+        other.h_ = 0;
+    }
+
+    Image &operator=(Image &&other) noexcept
+    {
+        if (this != &other) {
+            release();
+            h_ = other.h_;
+            view_ = other.view_;
+            other.h_ = 0;
+        }
+        return *this;
+    }
+
+    Image(const Image &) = delete;
+    Image &operator=(const Image &) = delete;
+
+    ~Image() { release(); }
+
+    void load(const std::string &filename)
+    {
+        if (view_.base) {
+            bmp_unlock(h_, &view_);
+            view_ = bmp_view();
+        }
+        check(bmp_load(h_, filename.c_str()), "bmp_load");
+        lock();
+    }
+
+    void save(const std::string &filename) const
+    {
+        check(bmp_save(h_, filename.c_str()), "bmp_save");
+    }
+
+    uint32_t width() const { return view_.width; }
+    uint32_t height() const { return view_.height; }
+    bmp_handle handle() const { return h_; }
+
+    Row<P> row(uint32_t y) const
+    {
+        return Row<P>(reinterpret_cast<P*>(bmp_view_row(&view_, y)), view_.width);
+    }
+
+    P &operator()(uint32_t x, uint32_t y) const { return row(y)[x]; }
+
+    Rows<P> rows() const
+    {
+        RowIterator<P> first(view_.base, view_.stride, view_.width);
+        return Rows<P>(first, first + view_.height);
+    }
+
+private:
+    static void check(int rc, const char *func)
+    {
+        if (rc != 0)
+            throw std::runtime_error(std::string(func) + " failed");
+    }
+
+    void open(const char *filename)
+    {
+        bmp_handle h = 0;
+        int rc = bmp_open(&h, filename);
+        if (rc != 0 && h)
+            bmp_close(h);
+        check(rc, "bmp_open");
+        h_ = h;
+    }
+
+    void lock()
+    {
+        bmp_config config;
+        bmp_get_config(h_, &config);
+        if (config.bits_per_pixel != traits::bits_per_pixel)
+            throw std::runtime_error("bmp pixel format mismatch");
+        check(bmp_lock(h_, &view_, BMP_LOCK_READ | BMP_LOCK_WRITE), "bmp_lock");
+    }
+
+    void release()
+    {
+        if (h_) {
+            if (view_.base)
+                bmp_unlock(h_, &view_);
+            bmp_close(h_);
+            h_ = 0;
+        }
+    }
+
+    bmp_handle h_;
+    bmp_view view_;
+};
+
+/*
+ * Kernels.  The pixel format is a template parameter, so each row is a
+ * contiguous array of P and the per-pixel function is inlined into the
+ * loop.
+ */
+
+/* Apply f(P) -> P to every pixel of dst, reading from src of the same size */
+template <class P, class F>
+void transform(const Image<P> &src, Image<P> &dst, F f)
+{
+    if (src.width() != dst.width() || src.height() != dst.height())
+        throw std::invalid_argument("image size mismatch");
+
+    for (uint32_t y = 0; y < src.height(); y++) {
+        Row<P> s = src.row(y);
+        std::transform(s.begin(), s.end(), dst.row(y).begin(), f);
+    }
+}
+
+/* Apply f(P) -> P to every pixel in place */
+template <class P, class F>
+void transform(Image<P> &img, F f)
+{
+    for (Row<P> r : img.rows())
+        std::transform(r.begin(), r.end(), r.begin(), f);
+}
+
+/* Fill with a 0xRRGGBB color */
+template <class P>
+void fill(Image<P> &img, uint32_t rgb)
+{
+    const P p = pixel_traits<P>::from_rgb(rgb);
+    for (Row<P> r : img.rows())
+        std::fill(r.begin(), r.end(), p);
+}
+
+} /* namespace bmp */
+
+#endif /* BMP_HPP */
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Process-wide cache of loaded bmp files.
+ * Opening the same unchanged file again shares the pixels already in
+ * memory instead of reading and decoding the file.
+ */
+
+#ifndef BMP_CACHE_H
+#define BMP_CACHE_H
+
+#include "bmp.h"
+
+#define BMP_CACHE_DEFAULT_BUDGET    (256 * 1024 * 1024)
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bytes;             /* image bytes held by the cache */
+    uint64_t entries;
+    uint64_t budget;
+} bmp_cache_stats;
+
+/*
+ * bmp_cache_open creates a new handle like bmp_open(h, filename).
+ * A file is identified by device, inode, modification time and size, so
+ * a rewritten file is loaded again.  The handle shares the cached image
+ * read-only; the first bmp_set_color or write lock makes a private copy.
+ */
+int bmp_cache_open(bmp_handle *h, const char *filename);
+
+/*
+ * Least recently used images are dropped while the cache holds more than
+ * budget bytes.  Handles keep their image until they are closed.
+ * Images larger than the budget are not cached.
+ */
+int bmp_cache_set_budget(uint64_t budget);
+int bmp_cache_get_stats(bmp_cache_stats *stats);
+int bmp_cache_clear(void);
+
+#endif /* BMP_CACHE_H */
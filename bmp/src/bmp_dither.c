@@ -0,0 +1,596 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Color reduction with dithering for the bmp library.
+ *
+ * Floyd-Steinberg error diffusion runs as a wavefront: line y is given to
+ * thread y % n and a pixel is processed once the line above has finished
+ * the pixel to its right, so the threads follow each other down the image
+ * a few pixels apart.  Progress is published every DITHER_BLOCK pixels.
+ * The error lines are kept in a small ring instead of one per line.
+ *
+ * The ordered dither has no dependency between pixels.  Bands of lines are
+ * quantized on the pool of bmp_parallel.c, 16 bytes at a time with SSE2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+#include "bmp_p.h"
+#include "bmp_thread.h"
+#include "bmp_parallel.h"
+#include "bmp_dither.h"
+#ifdef BMP_P_SSE2
+#include <emmintrin.h>
+#endif
+
+#define DITHER_MAX_THREADS  64
+#define DITHER_MIN_PIXELS   (256 * 256)    /* smaller images use one thread */
+#define DITHER_BLOCK        64              /* pixels between progress updates */
+
+/* 8x8 Bayer matrix */
+static const uint8_t dither_bayer[64] = {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+};
+
+/*
+ * dither internal data
+ */
+typedef struct dither_work dither_work;
+
+typedef struct {
+    const bmp_view *view;
+    uint32_t format;
+    uint32_t comps;             /* 3 (B, G, R) or 1 (gray) */
+    uint32_t levels[3];
+    uint8_t *out;
+    uint32_t stride;
+    uint32_t threads;
+    int go;
+    dither_work *work;          /* line buffers of each thread or band */
+    uint8_t *mult;              /* ordered: levels - 1 for each byte of a line */
+    uint8_t *thr;               /* ordered: thresholds of 8 lines */
+    int32_t *err;               /* error diffusion: ring of error lines (x 16) */
+    uint32_t ring;
+    uint32_t *progress;         /* error diffusion: pixels done in each line */
+    bmp_p_mutex mutex;
+    bmp_p_cond cond;
+} dither_job;
+
+struct dither_work {
+    dither_job *job;
+    uint32_t index;
+    uint8_t *gray;
+    uint8_t *level;
+    bmp_p_thread thread;
+};
+
+/*
+ * private functions
+ */
+
+/* number of levels of each component, 0 if format is unknown */
+static uint32_t dither_p_levels(uint32_t format, uint32_t *levels)
+{
+    switch (format)
+    {
+    case BMP_DITHER_MONO:
+        levels[0] = 2;
+        return 1;
+    case BMP_DITHER_GRAY4:
+        levels[0] = 16;
+        return 1;
+    case BMP_DITHER_RGB332:
+        levels[0] = 4;
+        levels[1] = 8;
+        levels[2] = 8;
+        return 3;
+    case BMP_DITHER_RGB565:
+        levels[0] = 32;
+        levels[1] = 64;
+        levels[2] = 32;
+        return 3;
+    }
+
+    return 0;
+}
+
+/* return line y as B, G, R bytes or as gray bytes */
+static const uint8_t *dither_p_source(dither_job *job, uint32_t y, uint8_t *gray)
+{
+    const uint8_t *p = bmp_view_row(job->view, y);
+    uint32_t x;
+
+    if (job->comps == 3)
+        return p;
+
+    for (x = 0; x < job->view->width; x++, p += 3)
+        gray[x] = (uint8_t)((29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8);
+
+    return gray;
+}
+
+/* pack the levels of one line into output pixels */
+static void dither_p_pack(dither_job *job, const uint8_t *level, uint8_t *out)
+{
+    uint32_t width = job->view->width;
+    uint32_t x, v;
+
+    switch (job->format)
+    {
+    case BMP_DITHER_RGB565:
+        for (x = 0; x < width; x++, level += 3, out += 2)
+        {
+            v = ((uint32_t)level[2] << 11) | ((uint32_t)level[1] << 5) | level[0];
+            out[0] = (uint8_t)v;
+            out[1] = (uint8_t)(v >> 8);
+        }
+        break;
+    case BMP_DITHER_RGB332:
+        for (x = 0; x < width; x++, level += 3)
+            out[x] = (uint8_t)((level[2] << 5) | (level[1] << 2) | level[0]);
+        break;
+    case BMP_DITHER_GRAY4:
+        for (x = 0; x < width; x++)
+        {
+            if (x & 1)
+                out[x >> 1] |= level[x];
+            else
+                out[x >> 1] = (uint8_t)(level[x] << 4);
+        }
+        break;
+    case BMP_DITHER_MONO:
+        for (x = 0; x < width; x++)
+        {
+            if ((x & 7) == 0)
+                out[x >> 3] = 0;
+            out[x >> 3] |= (uint8_t)(level[x] << (7 - (x & 7)));
+        }
+        break;
+    }
+}
+
+/* level = floor((src * mult + thr) / 255) for n bytes */
+static void dither_p_quantize(const uint8_t *src, const uint8_t *mult, const uint8_t *thr, uint8_t *level, uint32_t n)
+{
+    uint32_t i = 0, v;
+
+#ifdef BMP_P_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi16(1);
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i m = _mm_loadu_si128((const __m128i *)(mult + i));
+        __m128i t = _mm_loadu_si128((const __m128i *)(thr + i));
+        __m128i lo, hi;
+
+        lo = _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(m, zero));
+        hi = _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(m, zero));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(t, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(t, zero));
+
+        /* x / 255 = (x + (x >> 8) + 1) >> 8 for x < 65535 */
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), one), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), one), 8);
+        _mm_storeu_si128((__m128i *)(level + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        v = src[i] * mult[i] + thr[i];
+        level[i] = (uint8_t)((v + (v >> 8) + 1) >> 8);
+    }
+}
+
+/* wait until count pixels of line are done */
+static void dither_p_wait(dither_job *job, uint32_t line, uint32_t count)
+{
+    bmp_p_mutex_lock(&job->mutex);
+    while (job->progress[line] < count)
+        bmp_p_cond_wait(&job->cond, &job->mutex);
+    bmp_p_mutex_unlock(&job->mutex);
+}
+
+static void dither_p_publish(dither_job *job, uint32_t line, uint32_t count)
+{
+    bmp_p_mutex_lock(&job->mutex);
+    job->progress[line] = count;
+    bmp_p_cond_broadcast(&job->cond);
+    bmp_p_mutex_unlock(&job->mutex);
+}
+
+/* Floyd-Steinberg error diffusion of line y */
+static void dither_p_diffuse(dither_job *job, uint32_t y, const uint8_t *src, uint8_t *level)
+{
+    uint32_t width = job->view->width;
+    uint32_t comps = job->comps;
+    size_t pitch = (size_t)(width + 2) * comps;
+    int32_t *cur = job->err + (y % job->ring) * pitch;
+    int32_t *next = job->err + ((y + 1) % job->ring) * pitch;
+    int32_t carry[3] = { 0, 0, 0 };
+    int32_t v, e, q, top;
+    uint32_t x, x1, c, i;
+
+    /* the error line below was last used by line y + 1 - ring */
+    if (y + 1 >= job->ring)
+        dither_p_wait(job, y + 1 - job->ring, width);
+    memset(next, 0x00, pitch * sizeof(int32_t));
+
+    for (x = 0; x < width; x = x1)
+    {
+        x1 = (x + DITHER_BLOCK < width) ? x + DITHER_BLOCK : width;
+        if (y > 0)
+            dither_p_wait(job, y - 1, (x1 < width) ? x1 + 1 : width);
+
+        for (; x < x1; x++)
+        {
+            for (c = 0; c < comps; c++)
+            {
+                /* cur and next are offset by one pixel */
+                i = x * comps + c;
+                top = (int32_t)job->levels[c] - 1;
+                v = src[i] + ((cur[i + comps] + carry[c] + 8) >> 4);
+                if (v < 0)
+                    v = 0;
+                else if (v > 255)
+                    v = 255;
+                /* the error is taken from the palette value of bmp_dither_palette */
+                q = (v * top + 127) / 255;
+                e = v - q * 255 / top;
+                level[i] = (uint8_t)q;
+
+                carry[c] = e * 7;
+                next[i] += e * 3;
+                next[i + comps] += e * 5;
+                next[i + 2 * comps] += e;
+            }
+        }
+        dither_p_publish(job, y, x1);
+    }
+}
+
+/* error diffusion: every threads-th line */
+static BMP_P_THREAD_PROC(dither_p_thread, arg)
+{
+    dither_work *work = (dither_work *)arg;
+    dither_job *job = work->job;
+    const uint8_t *src;
+    uint32_t y;
+
+    /* job->threads is final once go is set */
+    bmp_p_mutex_lock(&job->mutex);
+    while (!job->go)
+        bmp_p_cond_wait(&job->cond, &job->mutex);
+    bmp_p_mutex_unlock(&job->mutex);
+    if (work->index >= job->threads)
+        return 0;
+
+    for (y = work->index; y < job->view->height; y += job->threads)
+    {
+        src = dither_p_source(job, y, work->gray);
+        dither_p_diffuse(job, y, src, work->level);
+        dither_p_pack(job, work->level, job->out + (size_t)y * job->stride);
+    }
+
+    return 0;
+}
+
+/* ordered: band index of the lines, a task of bmp_parallel_tasks */
+static void dither_p_band(uint32_t index, void *ctx)
+{
+    dither_job *job = (dither_job *)ctx;
+    dither_work *work = job->work + index;
+    uint32_t height = job->view->height;
+    uint32_t n = job->view->width * job->comps;
+    const uint8_t *src;
+    uint32_t y, end;
+
+    end = (uint32_t)((uint64_t)height * (index + 1) / job->threads);
+    for (y = (uint32_t)((uint64_t)height * index / job->threads); y < end; y++)
+    {
+        src = dither_p_source(job, y, work->gray);
+        dither_p_quantize(src, job->mult, job->thr + (y & 7) * n, work->level, n);
+        dither_p_pack(job, work->level, job->out + (size_t)y * job->stride);
+    }
+}
+
+/* allocate the tables of method, return 0 on success */
+static int dither_p_setup(dither_job *job, uint32_t method)
+{
+    uint32_t width = job->view->width;
+    uint32_t n = width * job->comps;
+    uint32_t x, c, r;
+
+    if (method == BMP_DITHER_FLOYD_STEINBERG)
+    {
+        job->ring = job->threads + 2;
+        job->err = (int32_t*)calloc((size_t)job->ring * (width + 2) * job->comps, sizeof(int32_t));
+        job->progress = (uint32_t*)calloc(job->view->height, sizeof(uint32_t));
+        return ((job->err == 0) || (job->progress == 0)) ? -1 : 0;
+    }
+
+    job->mult = (uint8_t*)malloc(n);
+    job->thr = (uint8_t*)malloc((size_t)n * 8);
+    if ((job->mult == 0) || (job->thr == 0))
+        return -1;
+
+    for (x = 0; x < width; x++)
+        for (c = 0; c < job->comps; c++)
+            job->mult[x * job->comps + c] = (uint8_t)(job->levels[c] - 1);
+
+    /* threshold (b + 0.5) / 64 of one level, in 1/255 */
+    for (r = 0; r < 8; r++)
+        for (x = 0; x < width; x++)
+            for (c = 0; c < job->comps; c++)
+                job->thr[r * n + x * job->comps + c] = (uint8_t)(((2 * dither_bayer[r * 8 + (x & 7)] + 1) * 255) >> 7);
+
+    return 0;
+}
+
+static void dither_p_release(dither_job *job)
+{
+    if (job->mult)
+        free(job->mult);
+    if (job->thr)
+        free(job->thr);
+    if (job->err)
+        free(job->err);
+    if (job->progress)
+        free(job->progress);
+}
+
+static void dither_p_put16(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void dither_p_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/*
+ * Public functions
+ */
+
+uint32_t bmp_dither_stride(uint32_t width, uint32_t format)
+{
+    return (uint32_t)((((uint64_t)width * format + 31) >> 5) << 2);
+}
+
+int bmp_dither_palette(uint32_t format, uint32_t *palette, uint32_t *count)
+{
+    uint32_t levels[3];
+    uint32_t i, n, r, g, b;
+
+    /* check argument */
+    if ((count == 0) || (dither_p_levels(format, levels) == 0))
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    n = (format == BMP_DITHER_RGB565) ? 0 : (1 << format);
+    for (i = 0; palette && (i < n); i++)
+    {
+        if (format == BMP_DITHER_RGB332)
+        {
+            r = (i >> 5) * 255 / 7;
+            g = ((i >> 2) & 7) * 255 / 7;
+            b = (i & 3) * 255 / 3;
+        }
+        else
+            r = g = b = i * 255 / (n - 1);
+        palette[i] = RGB_A(r, g, b);
+    }
+    *count = n;
+
+    return 0;
+}
+
+int bmp_dither(bmp_handle h, uint32_t format, uint32_t method, uint8_t *out, uint32_t stride)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    dither_work work[DITHER_MAX_THREADS];
+    dither_job job;
+    bmp_view view;
+    uint32_t i, n, started;
+    uint64_t start;
+    int rc = 0;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    memset(&job, 0x00, sizeof(dither_job));
+    job.comps = dither_p_levels(format, job.levels);
+    if ((out == 0) || (job.comps == 0) ||
+        ((method != BMP_DITHER_FLOYD_STEINBERG) && (method != BMP_DITHER_ORDERED)))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if ((uint64_t)stride * 8 < (uint64_t)bmp->config.width * format)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error stride %d is less than %d", stride, bmp_dither_stride(bmp->config.width, format));
+        return -1;
+    }
+
+    if (bmp_lock(h, &view, BMP_LOCK_READ) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
+
+    n = bmp_p_cpu_count();
+    if (n > DITHER_MAX_THREADS)
+        n = DITHER_MAX_THREADS;
+    if ((uint64_t)view.width * view.height < DITHER_MIN_PIXELS)
+        n = 1;
+    if (n > view.height)
+        n = view.height;
+    if (n == 0)
+        n = 1;
+
+    job.view = &view;
+    job.format = format;
+    job.out = out;
+    job.stride = stride;
+    job.threads = n;
+    job.work = work;
+    bmp_p_mutex_init(&job.mutex);
+    bmp_p_cond_init(&job.cond);
+
+    memset(work, 0x00, sizeof(work));
+    rc = dither_p_setup(&job, method);
+    for (i = 0; (i < n) && (rc == 0); i++)
+    {
+        work[i].job = &job;
+        work[i].index = i;
+        work[i].gray = (uint8_t*)malloc(view.width + 1);
+        work[i].level = (uint8_t*)malloc((size_t)view.width * job.comps + 1);
+        if ((work[i].gray == 0) || (work[i].level == 0))
+            rc = -1;
+    }
+
+    if (rc != 0)
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate dither buffers (%d x %d)", view.width, view.height);
+    else if (method == BMP_DITHER_ORDERED)
+        bmp_parallel_tasks(n, dither_p_band, &job);
+    else
+    {
+        /* the calling thread takes the first lines */
+        for (started = 1; started < n; started++)
+        {
+            if (bmp_p_thread_create(&work[started].thread, dither_p_thread, &work[started]) != 0)
+                break;
+        }
+
+        bmp_p_mutex_lock(&job.mutex);
+        job.threads = started;
+        job.go = 1;
+        bmp_p_cond_broadcast(&job.cond);
+        bmp_p_mutex_unlock(&job.mutex);
+
+        dither_p_thread(&work[0]);
+        for (i = 1; i < started; i++)
+            bmp_p_thread_join(work[i].thread);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (work[i].gray)
+            free(work[i].gray);
+        if (work[i].level)
+            free(work[i].level);
+    }
+    dither_p_release(&job);
+    bmp_p_cond_destroy(&job.cond);
+    bmp_p_mutex_destroy(&job.mutex);
+
+    bmp_unlock(h, &view);
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    return rc;
+}
+
+int bmp_dither_save(bmp_handle h, const char *filename, uint32_t format, uint32_t method)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    uint8_t header[14 + 40 + 256 * 4];
+    uint32_t palette[256];
+    uint32_t count, stride, header_size, i;
+    uint8_t *image;
+    FILE *fp;
+    size_t len;
+    int y;
+    int rc = 0;
+
+    /* check argument */
+    if ((bmp == 0) || (filename == 0))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (bmp_dither_palette(format, palette, &count) != 0)
+        return -1;
+
+    stride = bmp_dither_stride(bmp->config.width, format);
+    image = (uint8_t*)calloc((size_t)stride * bmp->config.height + 1, 1);
+    if (image == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate dither image");
+        return -1;
+    }
+    if (bmp_dither(h, format, method, image, stride) != 0)
+    {
+        free(image);
+        return -1;
+    }
+
+    /* palette, or bit fields for 5-6-5 */
+    header_size = 14 + 40 + ((count > 0) ? count * 4 : 12);
+    memset(header, 0x00, sizeof(header));
+    header[0] = 'B';
+    header[1] = 'M';
+    dither_p_put32(header + 2, header_size + stride * bmp->config.height);
+    dither_p_put32(header + 10, header_size);
+    dither_p_put32(header + 14, 40);
+    dither_p_put32(header + 18, bmp->config.width);
+    dither_p_put32(header + 22, bmp->config.height);
+    dither_p_put16(header + 26, 1);
+    dither_p_put16(header + 28, format);
+    dither_p_put32(header + 30, (count > 0) ? 0 : 3);
+    dither_p_put32(header + 34, stride * bmp->config.height);
+    dither_p_put32(header + 46, count);
+    for (i = 0; i < count; i++)
+        dither_p_put32(header + 54 + i * 4, palette[i]);
+    if (count == 0)
+    {
+        dither_p_put32(header + 54, 0xf800);
+        dither_p_put32(header + 58, 0x07e0);
+        dither_p_put32(header + 62, 0x001f);
+    }
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Cannot open %s", filename);
+        free(image);
+        return -1;
+    }
+
+    /* bmp lines are stored bottom up */
+    len = fwrite(header, 1, header_size, fp);
+    for (y = (int)bmp->config.height - 1; y >= 0; y--)
+        len += fwrite(image + (size_t)y * stride, 1, stride, fp);
+    if (len != header_size + (size_t)stride * bmp->config.height)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Write error %s", filename);
+        rc = -1;
+    }
+    bmp_p_count_write(bmp, (uint32_t)len);
+    if (rc == 0)
+        bmp_p_count_save(bmp);
+
+    fclose(fp);
+    free(image);
+
+    return rc;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Color reduction with dithering for the bmp library.
+ * A 24 bit image is reduced to 1/4/8 bit paletted or 16 bit (5-6-5)
+ * pixels with Floyd-Steinberg error diffusion or an 8x8 ordered dither.
+ */
+
+#ifndef BMP_DITHER_H
+#define BMP_DITHER_H
+
+#include "bmp.h"
+
+/* output formats.  The value is the number of bits per pixel. */
+#define BMP_DITHER_MONO         1       /* black and white */
+#define BMP_DITHER_GRAY4        4       /* 16 grays */
+#define BMP_DITHER_RGB332       8       /* 3-3-2 bit color palette */
+#define BMP_DITHER_RGB565       16      /* no palette */
+
+/* methods */
+#define BMP_DITHER_FLOYD_STEINBERG  0
+#define BMP_DITHER_ORDERED          1
+
+/*
+ * Return the bytes of one output line, rounded up to 4 bytes as in a
+ * bmp file.
+ */
+uint32_t bmp_dither_stride(uint32_t width, uint32_t format);
+
+/*
+ * Return the palette of format as RGB_A colors.  count is set to the
+ * number of entries (0 for BMP_DITHER_RGB565).  palette may be 0.
+ */
+int bmp_dither_palette(uint32_t format, uint32_t *palette, uint32_t *count);
+
+/*
+ * Reduce the image of h into out.  Lines are stored top to bottom,
+ * stride bytes apart.  Pixels are packed most significant bits first as
+ * in a bmp file; RGB565 pixels are little endian.
+ */
+int bmp_dither(bmp_handle h, uint32_t format, uint32_t method, uint8_t *out, uint32_t stride);
+
+/* reduce the image of h and save it as a 1/4/8/16 bit bmp file */
+int bmp_dither_save(bmp_handle h, const char *filename, uint32_t format, uint32_t method);
+
+#endif /* BMP_DITHER_H */
@@ -0,0 +1,647 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Neighborhood filters for the bmp library.
+ *
+ * Every filter splits the image into bands of lines, one per CPU, and runs
+ * them on the pool of bmp_parallel.c.  A band reads the lines around it
+ * (the halo) from src itself, so the bands do not depend on each other.
+ * Only the hysteresis of Canny, which follows edges across the whole
+ * image, runs on one thread.
+ *
+ * Erode and dilate use the van Herk/Gil-Werman algorithm: the line is cut
+ * into blocks of the window size, and the running min/max from the start
+ * and from the end of each block give the min/max of any window with 3
+ * operations per pixel.  It is done along the lines and then down the
+ * columns, where whole lines are combined 16 bytes at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+#include "bmp_p.h"
+#include "bmp_thread.h"
+#include "bmp_parallel.h"
+#include "bmp_filter.h"
+#ifdef BMP_P_SSE2
+#include <emmintrin.h>
+#endif
+
+#define FILTER_MAX_BANDS    64
+#define FILTER_MIN_PIXELS   (256 * 256)    /* smaller images use one band */
+
+#define FILTER_WEAK         1
+#define FILTER_STRONG       2
+#define FILTER_EDGE         3
+
+/*
+ * filter internal data
+ */
+typedef struct filter_job {
+    bmp_view src;
+    bmp_view dst;
+    uint32_t kernel;
+    uint32_t radius_x;          /* erode/dilate: along the lines */
+    uint32_t radius_y;          /* erode/dilate: down the columns */
+    int dilate;
+    uint32_t low;
+    uint32_t high;
+    uint8_t *edge;              /* Canny: FILTER_WEAK/STRONG of each pixel */
+    int (*band)(struct filter_job *job, uint32_t begin, uint32_t end);
+    uint32_t bands;
+    int rc[FILTER_MAX_BANDS];   /* result of each band */
+} filter_job;
+
+/*
+ * private functions
+ */
+
+static int filter_p_clamp(int y, uint32_t height)
+{
+    if (y < 0)
+        return 0;
+    if (y >= (int)height)
+        return (int)height - 1;
+    return y;
+}
+
+/* luminance of line y with the first and last pixel repeated on each side */
+static void filter_p_luma(const bmp_view *view, int y, int16_t *luma)
+{
+    const uint8_t *p = bmp_view_row(view, y);
+    uint32_t x;
+
+    for (x = 0; x < view->width; x++, p += 3)
+        luma[x + 1] = (int16_t)((29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8);
+    luma[0] = luma[1];
+    luma[view->width + 1] = luma[view->width];
+}
+
+/* gradient of the middle line b from the padded luminance lines a, b, c */
+static void filter_p_sobel(const int16_t *a, const int16_t *b, const int16_t *c, int16_t *gx, int16_t *gy, uint32_t width, uint32_t kernel)
+{
+    int16_t k1 = (kernel == BMP_FILTER_SCHARR) ? 3 : 1;
+    int16_t k2 = (kernel == BMP_FILTER_SCHARR) ? 10 : 2;
+    uint32_t x = 0;
+
+#ifdef BMP_P_SSE2
+    __m128i w1 = _mm_set1_epi16(k1);
+    __m128i w2 = _mm_set1_epi16(k2);
+
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(a + x));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(a + x + 1));
+        __m128i a2 = _mm_loadu_si128((const __m128i *)(a + x + 2));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(b + x));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(b + x + 2));
+        __m128i c0 = _mm_loadu_si128((const __m128i *)(c + x));
+        __m128i c1 = _mm_loadu_si128((const __m128i *)(c + x + 1));
+        __m128i c2 = _mm_loadu_si128((const __m128i *)(c + x + 2));
+        __m128i dx, dy;
+
+        dx = _mm_mullo_epi16(_mm_add_epi16(_mm_sub_epi16(a2, a0), _mm_sub_epi16(c2, c0)), w1);
+        dx = _mm_add_epi16(dx, _mm_mullo_epi16(_mm_sub_epi16(b2, b0), w2));
+        dy = _mm_mullo_epi16(_mm_add_epi16(_mm_sub_epi16(c0, a0), _mm_sub_epi16(c2, a2)), w1);
+        dy = _mm_add_epi16(dy, _mm_mullo_epi16(_mm_sub_epi16(c1, a1), w2));
+        _mm_storeu_si128((__m128i *)(gx + x), dx);
+        _mm_storeu_si128((__m128i *)(gy + x), dy);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        gx[x] = (int16_t)(k1 * (a[x + 2] - a[x] + c[x + 2] - c[x]) + k2 * (b[x + 2] - b[x]));
+        gy[x] = (int16_t)(k1 * (c[x] - a[x] + c[x + 2] - a[x + 2]) + k2 * (c[x + 1] - a[x + 1]));
+    }
+}
+
+/* mag = (|gx| + |gy|) >> shift, clipped to 255 */
+static void filter_p_magnitude(const int16_t *gx, const int16_t *gy, uint8_t *mag, uint32_t width, int shift)
+{
+    uint32_t x = 0;
+    int v;
+
+#ifdef BMP_P_SSE2
+    __m128i zero = _mm_setzero_si128();
+
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i dx = _mm_loadu_si128((const __m128i *)(gx + x));
+        __m128i dy = _mm_loadu_si128((const __m128i *)(gy + x));
+        __m128i m;
+
+        dx = _mm_max_epi16(dx, _mm_sub_epi16(zero, dx));
+        dy = _mm_max_epi16(dy, _mm_sub_epi16(zero, dy));
+        m = _mm_sra_epi16(_mm_add_epi16(dx, dy), _mm_cvtsi32_si128(shift));
+        _mm_storel_epi64((__m128i *)(mag + x), _mm_packus_epi16(m, m));
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        v = (abs(gx[x]) + abs(gy[x])) >> shift;
+        mag[x] = (uint8_t)((v > 255) ? 255 : v);
+    }
+}
+
+/* out = min or max of a and b for n bytes */
+static void filter_p_minmax(uint8_t *out, const uint8_t *a, const uint8_t *b, uint32_t n, int dilate)
+{
+    uint32_t i = 0;
+
+#ifdef BMP_P_SSE2
+    if (dilate)
+    {
+        for (; i + 16 <= n; i += 16)
+            _mm_storeu_si128((__m128i *)(out + i), _mm_max_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                                _mm_loadu_si128((const __m128i *)(b + i))));
+    }
+    else
+    {
+        for (; i + 16 <= n; i += 16)
+            _mm_storeu_si128((__m128i *)(out + i), _mm_min_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                                _mm_loadu_si128((const __m128i *)(b + i))));
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        if (dilate)
+            out[i] = (a[i] > b[i]) ? a[i] : b[i];
+        else
+            out[i] = (a[i] < b[i]) ? a[i] : b[i];
+    }
+}
+
+/*
+ * van Herk/Gil-Werman along one line.  count elements step bytes apart
+ * are read from src and written to out.  p, g and h have room for the
+ * line with radius elements on each side, rounded up to the window size.
+ */
+static void filter_p_herk(const uint8_t *src, uint8_t *out, uint32_t count, uint32_t step, uint32_t radius, int dilate,
+                          uint8_t *p, uint8_t *g, uint8_t *h)
+{
+    uint32_t w = 2 * radius + 1;
+    uint32_t n = (count + 2 * radius + w - 1) / w * w;
+    uint32_t i, b;
+    uint8_t a, c;
+
+    memset(p, dilate ? 0x00 : 0xff, n);
+    for (i = 0; i < count; i++)
+        p[radius + i] = src[i * step];
+
+    for (b = 0; b < n; b += w)
+    {
+        g[b] = p[b];
+        for (i = b + 1; i < b + w; i++)
+        {
+            a = g[i - 1];
+            c = p[i];
+            g[i] = dilate ? ((a > c) ? a : c) : ((a < c) ? a : c);
+        }
+        h[b + w - 1] = p[b + w - 1];
+        for (i = b + w - 1; i > b; i--)
+        {
+            a = h[i];
+            c = p[i - 1];
+            h[i - 1] = dilate ? ((a > c) ? a : c) : ((a < c) ? a : c);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        a = h[i];
+        c = g[i + w - 1];
+        out[i * step] = dilate ? ((a > c) ? a : c) : ((a < c) ? a : c);
+    }
+}
+
+/* gradient magnitude of lines [begin, end) */
+static int filter_p_gradient_band(filter_job *job, uint32_t begin, uint32_t end)
+{
+    uint32_t width = job->src.width;
+    uint32_t rows = end - begin;
+    int16_t *luma, *gx, *gy;
+    uint8_t *mag, *d;
+    uint32_t x, y;
+
+    luma = (int16_t*)malloc((size_t)(rows + 2) * (width + 2) * sizeof(int16_t));
+    gx = (int16_t*)malloc((size_t)width * 2 * sizeof(int16_t));
+    mag = (uint8_t*)malloc(width);
+    if ((luma == 0) || (gx == 0) || (mag == 0))
+    {
+        free(luma);
+        free(gx);
+        free(mag);
+        return -1;
+    }
+    gy = gx + width;
+
+    /* lines begin - 1 ... end */
+    for (y = 0; y < rows + 2; y++)
+        filter_p_luma(&job->src, filter_p_clamp((int)(begin + y) - 1, job->src.height), luma + y * (width + 2));
+
+    for (y = 0; y < rows; y++)
+    {
+        filter_p_sobel(luma + y * (width + 2), luma + (y + 1) * (width + 2), luma + (y + 2) * (width + 2),
+                       gx, gy, width, job->kernel);
+        filter_p_magnitude(gx, gy, mag, width, (job->kernel == BMP_FILTER_SCHARR) ? 4 : 2);
+
+        d = bmp_view_row(&job->dst, begin + y);
+        for (x = 0; x < width; x++, d += 3)
+            d[0] = d[1] = d[2] = mag[x];
+    }
+
+    free(luma);
+    free(gx);
+    free(mag);
+
+    return 0;
+}
+
+/* Canny: gradient and non-maximum suppression of lines [begin, end) */
+static int filter_p_canny_band(filter_job *job, uint32_t begin, uint32_t end)
+{
+    uint32_t width = job->src.width;
+    uint32_t height = job->src.height;
+    uint32_t rows = end - begin;
+    size_t pitch = width + 2;
+    int stride = (int)pitch;
+    int16_t *luma, *gx, *gy, *mag, *m, *c;
+    uint8_t *edge;
+    int32_t ax, ay, v, n1, n2;
+    uint32_t x, y;
+    int line;
+
+    luma = (int16_t*)malloc(3 * pitch * sizeof(int16_t));
+    gx = (int16_t*)malloc((size_t)(rows + 2) * width * 2 * sizeof(int16_t));
+    mag = (int16_t*)calloc((rows + 2) * pitch, sizeof(int16_t));
+    if ((luma == 0) || (gx == 0) || (mag == 0))
+    {
+        free(luma);
+        free(gx);
+        free(mag);
+        return -1;
+    }
+    gy = gx + (size_t)(rows + 2) * width;
+
+    /* gradient of lines begin - 1 ... end, magnitude 0 outside the image */
+    for (y = 0; y < rows + 2; y++)
+    {
+        line = (int)(begin + y) - 1;
+        if ((line < 0) || (line >= (int)height))
+            continue;
+        filter_p_luma(&job->src, filter_p_clamp(line - 1, height), luma);
+        filter_p_luma(&job->src, line, luma + pitch);
+        filter_p_luma(&job->src, filter_p_clamp(line + 1, height), luma + 2 * pitch);
+        filter_p_sobel(luma, luma + pitch, luma + 2 * pitch, gx + y * width, gy + y * width, width, BMP_FILTER_SOBEL);
+
+        m = mag + y * pitch + 1;
+        for (x = 0; x < width; x++)
+            m[x] = (int16_t)(abs(gx[y * width + x]) + abs(gy[y * width + x]));
+    }
+
+    /* keep the pixels that are a maximum across the edge direction */
+    for (y = 1; y <= rows; y++)
+    {
+        m = mag + y * pitch + 1;
+        edge = job->edge + (size_t)(begin + y - 1) * width;
+        for (x = 0; x < width; x++)
+        {
+            c = m + x;
+            v = c[0];
+            edge[x] = 0;
+            if ((uint32_t)v < job->low)
+                continue;
+
+            ax = abs(gx[y * width + x]);
+            ay = abs(gy[y * width + x]);
+            if (ay * 128 <= ax * 53)
+            {
+                /* within 22.5 degrees of horizontal */
+                n1 = c[-1];
+                n2 = c[1];
+            }
+            else if (ay * 128 >= ax * 309)
+            {
+                n1 = c[-stride];
+                n2 = c[stride];
+            }
+            else if ((gx[y * width + x] > 0) == (gy[y * width + x] > 0))
+            {
+                n1 = c[-stride - 1];
+                n2 = c[stride + 1];
+            }
+            else
+            {
+                n1 = c[-stride + 1];
+                n2 = c[stride - 1];
+            }
+
+            if ((v > n1) && (v >= n2))
+                edge[x] = ((uint32_t)v >= job->high) ? FILTER_STRONG : FILTER_WEAK;
+        }
+    }
+
+    free(luma);
+    free(gx);
+    free(mag);
+
+    return 0;
+}
+
+/* Canny: weak pixels connected to strong ones become edges */
+static int filter_p_hysteresis(filter_job *job)
+{
+    uint32_t width = job->src.width;
+    uint32_t height = job->src.height;
+    uint8_t *edge = job->edge;
+    uint32_t *stack;
+    uint32_t top, i, p, x, y, k;
+    uint8_t *d;
+    int dx, dy;
+
+    stack = (uint32_t*)malloc((size_t)width * height * sizeof(uint32_t));
+    if (stack == 0)
+        return -1;
+
+    for (i = 0; i < width * height; i++)
+    {
+        if (edge[i] != FILTER_STRONG)
+            continue;
+
+        edge[i] = FILTER_EDGE;
+        stack[0] = i;
+        top = 1;
+        while (top > 0)
+        {
+            p = stack[--top];
+            x = p % width;
+            y = p / width;
+            for (k = 0; k < 9; k++)
+            {
+                dx = (int)(k % 3) - 1;
+                dy = (int)(k / 3) - 1;
+                if (((dx < 0) && (x == 0)) || ((dx > 0) && (x + 1 == width)) ||
+                    ((dy < 0) && (y == 0)) || ((dy > 0) && (y + 1 == height)))
+                    continue;
+                p = (y + dy) * width + x + dx;
+                if ((edge[p] == FILTER_WEAK) || (edge[p] == FILTER_STRONG))
+                {
+                    edge[p] = FILTER_EDGE;
+                    stack[top++] = p;
+                }
+            }
+        }
+    }
+    free(stack);
+
+    for (y = 0; y < height; y++)
+    {
+        d = bmp_view_row(&job->dst, y);
+        for (x = 0; x < width; x++, d += 3)
+            d[0] = d[1] = d[2] = (edge[y * width + x] == FILTER_EDGE) ? 0xff : 0x00;
+    }
+
+    return 0;
+}
+
+/* erode/dilate lines [begin, end) */
+static int filter_p_morph_band(filter_job *job, uint32_t begin, uint32_t end)
+{
+    uint32_t width = job->src.width;
+    uint32_t radius = job->radius_y;
+    uint32_t w = 2 * radius + 1;
+    uint32_t size = width * 3;
+    uint32_t rows = (end - begin + 2 * radius + w - 1) / w * w;
+    uint32_t line = width + 4 * job->radius_x + 1;
+    uint8_t *horz, *g, *h, *p;
+    uint32_t y, b, c;
+    int src_y;
+
+    /* lines begin - radius ... in horz, then the block min/max in g and h */
+    horz = (uint8_t*)malloc((size_t)rows * size * 3);
+    p = (uint8_t*)malloc((size_t)line * 3);
+    if ((horz == 0) || (p == 0))
+    {
+        free(horz);
+        free(p);
+        return -1;
+    }
+    g = horz + (size_t)rows * size;
+    h = g + (size_t)rows * size;
+
+    for (y = 0; y < rows; y++)
+    {
+        src_y = (int)(begin + y) - (int)radius;
+        if ((src_y < 0) || (src_y >= (int)job->src.height))
+        {
+            memset(horz + (size_t)y * size, job->dilate ? 0x00 : 0xff, size);
+            continue;
+        }
+        for (c = 0; c < 3; c++)
+            filter_p_herk(bmp_view_row(&job->src, src_y) + c, horz + (size_t)y * size + c, width, 3, job->radius_x,
+                          job->dilate, p, p + line, p + 2 * line);
+    }
+
+    for (b = 0; b < rows; b += w)
+    {
+        memcpy(g + (size_t)b * size, horz + (size_t)b * size, size);
+        for (y = b + 1; y < b + w; y++)
+            filter_p_minmax(g + (size_t)y * size, g + (size_t)(y - 1) * size, horz + (size_t)y * size, size, job->dilate);
+        memcpy(h + (size_t)(b + w - 1) * size, horz + (size_t)(b + w - 1) * size, size);
+        for (y = b + w - 1; y > b; y--)
+            filter_p_minmax(h + (size_t)(y - 1) * size, h + (size_t)y * size, horz + (size_t)(y - 1) * size, size, job->dilate);
+    }
+
+    for (y = begin; y < end; y++)
+        filter_p_minmax(bmp_view_row(&job->dst, y), h + (size_t)(y - begin) * size,
+                        g + (size_t)(y - begin + w - 1) * size, size, job->dilate);
+
+    free(horz);
+    free(p);
+
+    return 0;
+}
+
+static void filter_p_task(uint32_t index, void *ctx)
+{
+    filter_job *job = (filter_job *)ctx;
+    uint32_t height = job->src.height;
+
+    job->rc[index] = job->band(job, (uint32_t)((uint64_t)height * index / job->bands),
+                               (uint32_t)((uint64_t)height * (index + 1) / job->bands));
+}
+
+/* run job->band on bands of lines split over the CPUs */
+static int filter_p_run(filter_job *job)
+{
+    uint32_t height = job->src.height;
+    uint32_t i;
+
+    /* nothing to do for an empty image */
+    if (height == 0)
+        return 0;
+
+    job->bands = bmp_p_cpu_count();
+    if (job->bands > FILTER_MAX_BANDS)
+        job->bands = FILTER_MAX_BANDS;
+    if ((uint64_t)job->src.width * height < FILTER_MIN_PIXELS)
+        job->bands = 1;
+    if (job->bands > height)
+        job->bands = height;
+
+    if (bmp_parallel_tasks(job->bands, filter_p_task, job) != 0)
+        return -1;
+    for (i = 0; i < job->bands; i++)
+        if (job->rc[i] != 0)
+            return -1;
+
+    return 0;
+}
+
+/* check the handles, size dst like src and lock both */
+static int filter_p_begin(filter_job *job, bmp_handle dst, bmp_handle src, const char *func)
+{
+    bmp_data *bmp_dst = (bmp_data *)dst;
+    bmp_data *bmp_src = (bmp_data *)src;
+
+    memset(job, 0x00, sizeof(filter_job));
+
+    /* check argument */
+    if ((bmp_dst == 0) || (bmp_src == 0))
+    {
+        bmp_p_error(bmp_dst, func, "Error Invalid handle");
+        return -1;
+    }
+    if (bmp_dst == bmp_src)
+    {
+        bmp_p_error(bmp_dst, func, "Error dst and src are the same handle");
+        return -1;
+    }
+
+    if (bmp_set_config(dst, &bmp_src->config) != 0)
+        return -1;
+    if (bmp_lock(src, &job->src, BMP_LOCK_READ) != 0)
+        return -1;
+    if (bmp_lock(dst, &job->dst, BMP_LOCK_WRITE) != 0)
+    {
+        bmp_unlock(src, &job->src);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void filter_p_end(filter_job *job, bmp_handle dst, bmp_handle src)
+{
+    bmp_unlock(dst, &job->dst);
+    bmp_unlock(src, &job->src);
+}
+
+static int filter_p_morph(bmp_handle dst, bmp_handle src, uint32_t radius, int dilate, const char *func)
+{
+    bmp_data *bmp = (bmp_data *)dst;
+    filter_job job;
+    uint64_t start;
+    int rc;
+
+    if (filter_p_begin(&job, dst, src, func) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
+
+    /* a larger window covers the whole line or column anyway */
+    job.radius_x = (radius > job.src.width) ? job.src.width : radius;
+    job.radius_y = (radius > job.src.height) ? job.src.height : radius;
+    job.dilate = dilate;
+    job.band = filter_p_morph_band;
+
+    rc = filter_p_run(&job);
+    if (rc != 0)
+        bmp_p_error(bmp, func, "Can't allocate filter buffers (%d x %d)", job.src.width, job.src.height);
+
+    filter_p_end(&job, dst, src);
+    bmp_p_span_end(bmp, func, start);
+
+    return rc;
+}
+
+/*
+ * Public functions
+ */
+
+int bmp_gradient(bmp_handle dst, bmp_handle src, uint32_t kernel)
+{
+    bmp_data *bmp = (bmp_data *)dst;
+    filter_job job;
+    uint64_t start;
+    int rc;
+
+    if ((kernel != BMP_FILTER_SOBEL) && (kernel != BMP_FILTER_SCHARR))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if (filter_p_begin(&job, dst, src, __FUNCTION__) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
+
+    job.kernel = kernel;
+    job.band = filter_p_gradient_band;
+    rc = filter_p_run(&job);
+    if (rc != 0)
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate filter buffers (%d x %d)", job.src.width, job.src.height);
+
+    filter_p_end(&job, dst, src);
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    return rc;
+}
+
+int bmp_canny(bmp_handle dst, bmp_handle src, uint32_t low, uint32_t high)
+{
+    bmp_data *bmp = (bmp_data *)dst;
+    filter_job job;
+    uint64_t start;
+    int rc;
+
+    if (low > high)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error low %d is greater than high %d", low, high);
+        return -1;
+    }
+    if (filter_p_begin(&job, dst, src, __FUNCTION__) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
+
+    job.low = low;
+    job.high = high;
+    job.band = filter_p_canny_band;
+    job.edge = (uint8_t*)malloc((size_t)job.src.width * job.src.height + 1);
+    rc = (job.edge == 0) ? -1 : filter_p_run(&job);
+    if (rc == 0)
+        rc = filter_p_hysteresis(&job);
+    if (rc != 0)
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate filter buffers (%d x %d)", job.src.width, job.src.height);
+    free(job.edge);
+
+    filter_p_end(&job, dst, src);
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    return rc;
+}
+
+int bmp_erode(bmp_handle dst, bmp_handle src, uint32_t radius)
+{
+    return filter_p_morph(dst, src, radius, 0, __FUNCTION__);
+}
+
+int bmp_dilate(bmp_handle dst, bmp_handle src, uint32_t radius)
+{
+    return filter_p_morph(dst, src, radius, 1, __FUNCTION__);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Neighborhood filters for the bmp library: Sobel/Scharr gradients,
+ * Canny edge detection and erode/dilate.
+ * The result is written to dst, which gets the size of src.  dst and src
+ * must be different handles.
+ */
+
+#ifndef BMP_FILTER_H
+#define BMP_FILTER_H
+
+#include "bmp.h"
+
+/* gradient kernels */
+#define BMP_FILTER_SOBEL    0
+#define BMP_FILTER_SCHARR   1
+
+/*
+ * Gradient magnitude |gx| + |gy| of the luminance as a gray image.
+ * It is divided by the kernel weight (4 for Sobel, 16 for Scharr) and
+ * clipped to 255.
+ */
+int bmp_gradient(bmp_handle dst, bmp_handle src, uint32_t kernel);
+
+/*
+ * Canny edges as a black and white image.  low and high are thresholds
+ * of |gx| + |gy| of the Sobel gradient of the luminance (0 - 2040).
+ */
+int bmp_canny(bmp_handle dst, bmp_handle src, uint32_t low, uint32_t high);
+
+/*
+ * Minimum (erode) or maximum (dilate) of each color over the
+ * (2 * radius + 1) square around each pixel.  Pixels outside the image
+ * are ignored.  The cost does not depend on radius.
+ */
+int bmp_erode(bmp_handle dst, bmp_handle src, uint32_t radius);
+int bmp_dilate(bmp_handle dst, bmp_handle src, uint32_t radius);
+
+#endif /* BMP_FILTER_H */
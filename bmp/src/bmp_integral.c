@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Summed-area tables (integral images) for the bmp library.
+ *
+ * table[(y * (width + 1) + x) * 3 + c] is the sum of channel c over the
+ * pixels above and to the left of (x, y).  The first line and column are 0.
+ * The tables are built in two passes: prefix sums along each line, split
+ * into bands of lines, then prefix sums down each column, split into bands
+ * of columns.  Each pass runs on all CPUs (bmp_parallel_tasks).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+#include "bmp_p.h"
+#include "bmp_thread.h"
+#include "bmp_parallel.h"
+#include "bmp_integral.h"
+
+#define INTEGRAL_MAX_BANDS      64
+#define INTEGRAL_MIN_PIXELS     (256 * 256)    /* smaller images use one band */
+
+/*
+ * integral internal data
+ */
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint64_t *sum;              /* (width + 1) * (height + 1) * 3 */
+    uint64_t *square;           /* same layout, 0 if not built */
+} integral_data;
+
+typedef struct {
+    integral_data *integral;
+    const bmp_view *view;
+    int pass;
+    uint32_t total;             /* lines or column entries */
+    uint32_t bands;
+} integral_job;
+
+/*
+ * private functions
+ */
+
+/* pass 0: prefix sums along lines [begin, end) */
+static void integral_p_rows(integral_data *s, const bmp_view *view, uint32_t begin, uint32_t end)
+{
+    size_t pitch = (size_t)(s->width + 1) * 3;
+    uint32_t x, y;
+
+    for (y = begin; y < end; y++)
+    {
+        const uint8_t *p = bmp_view_row(view, y);
+        uint64_t *sum = s->sum + (y + 1) * pitch + 3;
+        uint64_t b = 0, g = 0, r = 0;
+
+        for (x = 0; x < s->width; x++, p += 3, sum += 3)
+        {
+            b += p[0];
+            g += p[1];
+            r += p[2];
+            sum[0] = b;
+            sum[1] = g;
+            sum[2] = r;
+        }
+
+        if (s->square)
+        {
+            uint64_t *square = s->square + (y + 1) * pitch + 3;
+
+            p = bmp_view_row(view, y);
+            b = g = r = 0;
+            for (x = 0; x < s->width; x++, p += 3, square += 3)
+            {
+                b += p[0] * p[0];
+                g += p[1] * p[1];
+                r += p[2] * p[2];
+                square[0] = b;
+                square[1] = g;
+                square[2] = r;
+            }
+        }
+    }
+}
+
+/* pass 1: prefix sums down the table entries [begin, end) of every line */
+static void integral_p_columns(integral_data *s, uint32_t begin, uint32_t end)
+{
+    size_t pitch = (size_t)(s->width + 1) * 3;
+    uint32_t i, y;
+
+    for (y = 2; y <= s->height; y++)
+    {
+        uint64_t *sum = s->sum + y * pitch;
+
+        for (i = begin; i < end; i++)
+            sum[i] += sum[i - pitch];
+
+        if (s->square)
+        {
+            uint64_t *square = s->square + y * pitch;
+
+            for (i = begin; i < end; i++)
+                square[i] += square[i - pitch];
+        }
+    }
+}
+
+static void integral_p_task(uint32_t index, void *ctx)
+{
+    integral_job *job = (integral_job *)ctx;
+    uint32_t begin = (uint32_t)((uint64_t)job->total * index / job->bands);
+    uint32_t end = (uint32_t)((uint64_t)job->total * (index + 1) / job->bands);
+
+    if (job->pass == 0)
+        integral_p_rows(job->integral, job->view, begin, end);
+    else
+        integral_p_columns(job->integral, begin, end);
+}
+
+/* run one pass over [0, total) split into n bands */
+static void integral_p_pass(integral_data *s, const bmp_view *view, int pass, uint32_t total, uint32_t n)
+{
+    integral_job job;
+
+    job.integral = s;
+    job.view = view;
+    job.pass = pass;
+    job.total = total;
+    job.bands = n;
+    bmp_parallel_tasks(n, integral_p_task, &job);
+}
+
+static void integral_p_release(integral_data *s)
+{
+    if (s->sum)
+        free(s->sum);
+    if (s->square)
+        free(s->square);
+    free(s);
+}
+
+/*
+ * Public functions
+ */
+
+int bmp_integral_open(bmp_integral_handle *s, bmp_handle h, uint32_t flags)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    integral_data *integral;
+    bmp_view view;
+    size_t entries;
+    uint32_t n;
+    uint64_t start;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (s == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    if (bmp_lock(h, &view, BMP_LOCK_READ) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
+
+    integral = (integral_data*)malloc(sizeof(integral_data));
+    if (integral == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate integral_data");
+        bmp_unlock(h, &view);
+        return -1;
+    }
+    memset(integral, 0x00, sizeof(integral_data));
+    integral->width = view.width;
+    integral->height = view.height;
+
+    /* calloc gives the zero first line and column */
+    entries = (size_t)(view.width + 1) * (view.height + 1) * 3;
+    integral->sum = (uint64_t*)calloc(entries, sizeof(uint64_t));
+    if (flags & BMP_INTEGRAL_SQUARED)
+        integral->square = (uint64_t*)calloc(entries, sizeof(uint64_t));
+    if ((integral->sum == 0) || ((flags & BMP_INTEGRAL_SQUARED) && (integral->square == 0)))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Can't allocate tables (%d x %d)", view.width, view.height);
+        integral_p_release(integral);
+        bmp_unlock(h, &view);
+        return -1;
+    }
+
+    n = bmp_p_cpu_count();
+    if (n > INTEGRAL_MAX_BANDS)
+        n = INTEGRAL_MAX_BANDS;
+    if ((uint64_t)view.width * view.height < INTEGRAL_MIN_PIXELS)
+        n = 1;
+
+    integral_p_pass(integral, &view, 0, view.height, (view.height < n) ? 1 : n);
+    integral_p_pass(integral, &view, 1, (view.width + 1) * 3, n);
+
+    bmp_unlock(h, &view);
+    *s = (bmp_integral_handle)integral;
+
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    return 0;
+}
+
+int bmp_integral_close(bmp_integral_handle s)
+{
+    integral_data *integral = (integral_data *)s;
+
+    /* check argument */
+    if (integral == 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    integral_p_release(integral);
+
+    return 0;
+}
+
+int bmp_integral_query(bmp_integral_handle s, const bmp_rect *rect, bmp_region_stats *stats)
+{
+    integral_data *integral = (integral_data *)s;
+    size_t pitch, a, b, c, d;
+    uint32_t ch, i;
+
+    /* check argument */
+    if (integral == 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((rect == 0) || (stats == 0))
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if ((rect->x > integral->width) || (rect->width > integral->width - rect->x) ||
+        (rect->y > integral->height) || (rect->height > integral->height - rect->y))
+    {
+        bmp_p_error(0, __FUNCTION__, "Error rect (%d, %d, %d, %d) is out of the image",
+                    rect->x, rect->y, rect->width, rect->height);
+        return -1;
+    }
+
+    /* corners: a = top left, b = top right, c = bottom left, d = bottom right */
+    pitch = (size_t)(integral->width + 1) * 3;
+    a = rect->y * pitch + rect->x * 3;
+    b = a + rect->width * 3;
+    c = a + rect->height * pitch;
+    d = c + rect->width * 3;
+
+    memset(stats, 0x00, sizeof(bmp_region_stats));
+    stats->count = rect->width * rect->height;
+
+    for (ch = 0; ch < 3; ch++)
+    {
+        /* table is in B, G, R order */
+        i = 2 - ch;
+        stats->sum[ch] = integral->sum[d + i] - integral->sum[b + i] - integral->sum[c + i] + integral->sum[a + i];
+        if (stats->count == 0)
+            continue;
+
+        stats->mean[ch] = (double)stats->sum[ch] / stats->count;
+        if (integral->square)
+        {
+            uint64_t square = integral->square[d + i] - integral->square[b + i] - integral->square[c + i] + integral->square[a + i];
+
+            stats->variance[ch] = (double)square / stats->count - stats->mean[ch] * stats->mean[ch];
+            if (stats->variance[ch] < 0)
+                stats->variance[ch] = 0;
+        }
+    }
+
+    return 0;
+}
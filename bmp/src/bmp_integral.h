@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Summed-area tables (integral images) for the bmp library.
+ * Once built, the sum, mean and variance of each color channel over any
+ * rectangle are returned in constant time.
+ */
+
+#ifndef BMP_INTEGRAL_H
+#define BMP_INTEGRAL_H
+
+#include "bmp.h"
+
+typedef uint32_t* bmp_integral_handle;
+
+/* also build the table of squared values needed for the variance */
+#define BMP_INTEGRAL_SQUARED    0x01
+
+/* channels are in the order R, G, B */
+typedef struct {
+    uint32_t count;             /* number of pixels */
+    uint64_t sum[3];
+    double mean[3];
+    double variance[3];         /* 0 unless BMP_INTEGRAL_SQUARED */
+} bmp_region_stats;
+
+/*
+ * bmp_integral_open builds the tables from the current image of h.
+ * The tables are a snapshot; later changes to h are not reflected.
+ * Rectangles use the bmp_rect convention (y = 0 is the top line).
+ */
+int bmp_integral_open(bmp_integral_handle *s, bmp_handle h, uint32_t flags);
+int bmp_integral_close(bmp_integral_handle s);
+int bmp_integral_query(bmp_integral_handle s, const bmp_rect *rect, bmp_region_stats *stats);
+
+#endif /* BMP_INTEGRAL_H */
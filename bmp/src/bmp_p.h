@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Private definitions shared by the bmp library sources.
+ * This header is not part of the public API.
+ */
+
+#ifndef BMP_P_H
+#define BMP_P_H
+
+#include "bmp.h"
+
+/* SSE2 is always available on x64 */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BMP_P_SSE2
+#endif
+
+/*
+ * bmp internal data
+ */
+typedef struct {
+    uint8_t *image;
+    uint32_t image_size;
+    int image_external;         /* image is not owned (bmp_attach_mem) */
+    bmp_config config;
+    uint32_t locks;
+    bmp_stats stats;
+    uint32_t dirty_tile;        /* tile size, 0 if not tracking */
+    uint32_t dirty_shift;       /* log2 of dirty_tile */
+    uint8_t *dirty;             /* one byte per tile */
+    uint32_t dirty_cols;
+    uint32_t dirty_rows;
+    uint32_t layout;            /* BMP_LAYOUT_* */
+    uint8_t *linear;            /* linear copy of a tiled image while locked */
+    int linear_modified;        /* a write lock was taken on the copy */
+    void *shared;               /* owner of a shared read-only image (bmp_cache.c) */
+    void (*shared_release)(void *shared);
+} bmp_data;
+
+/* tile size of BMP_LAYOUT_TILED and BMP_LAYOUT_ZORDER */
+#define BMP_P_TILE_SHIFT    6
+#define BMP_P_TILE          (1 << BMP_P_TILE_SHIFT)
+
+/* largest image accepted from a file header (as the QOI reference decoder) */
+#define BMP_P_MAX_PIXELS    400000000
+
+/* mark the tile of pixel (x, y) as modified */
+#define BMP_P_MARK_DIRTY(bmp, x, y) \
+    ((bmp)->dirty[((uint32_t)(y) >> (bmp)->dirty_shift) * (bmp)->dirty_cols + ((uint32_t)(x) >> (bmp)->dirty_shift)] = 1)
+
+/*
+ * diagnostics (bmp.c)
+ */
+void bmp_p_error(bmp_data *bmp, const char *func, const char *format, ...);
+uint64_t bmp_p_span_begin(void);
+void bmp_p_span_end(bmp_data *bmp, const char *func, uint64_t start);
+void bmp_p_count_read(bmp_data *bmp, uint32_t bytes);
+void bmp_p_count_write(bmp_data *bmp, uint32_t bytes);
+void bmp_p_count_load(bmp_data *bmp);
+void bmp_p_count_save(bmp_data *bmp);
+void bmp_p_count_allocation(bmp_data *bmp);
+
+/*
+ * shared read-only image (bmp.c); the handle keeps its layout, a
+ * layout other than BMP_LAYOUT_LINEAR gets a private copy
+ */
+int bmp_p_share(bmp_data *bmp, const bmp_config *config, uint8_t *image, void (*release)(void *), void *shared);
+
+#endif /* BMP_P_H */
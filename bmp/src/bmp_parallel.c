@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Parallel processing of bmp rows on a thread pool owned by the library.
+ *
+ * A job is split into chunks and every worker (the calling thread is one
+ * of them) gets a contiguous range of chunks in its own queue.  A worker
+ * takes chunks from the front of its queue and, when it is empty, steals
+ * from the back of the other queues, so a slow band does not hold up the
+ * whole job.  The threads stay alive between jobs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+#include "bmp_p.h"
+#include "bmp_thread.h"
+#include "bmp_parallel.h"
+
+#define PARALLEL_MAX_THREADS    64
+#define PARALLEL_CHUNKS         4       /* chunks per thread */
+
+typedef void (*parallel_task)(void *arg, uint32_t chunk);
+
+typedef struct {
+    bmp_p_mutex mutex;
+    uint32_t begin;
+    uint32_t end;
+} parallel_queue;
+
+/*
+ * pool data
+ */
+typedef struct {
+    bmp_p_mutex mutex;          /* one job at a time, start/stop */
+    bmp_p_mutex state;          /* protects the fields below */
+    bmp_p_cond wake;
+    bmp_p_cond done;
+    int running;
+    int stop;
+    uint32_t threads;           /* workers including the calling thread */
+    uint32_t generation;        /* incremented for each job */
+    uint32_t active;            /* pool threads still working on the job */
+    parallel_task task;
+    void *arg;
+    bmp_p_thread thread[PARALLEL_MAX_THREADS];
+    parallel_queue queue[PARALLEL_MAX_THREADS];
+} parallel_pool;
+
+static parallel_pool pool;
+static bmp_p_once pool_once = BMP_P_ONCE_INIT;
+static BMP_P_TLS int in_pool;
+
+typedef struct {
+    bmp_view view;
+    uint32_t rows;              /* rows per chunk */
+    bmp_rows_fn fn;
+    void *ctx;
+} rows_job;
+
+typedef struct {
+    bmp_task_fn fn;
+    void *ctx;
+} tasks_job;
+
+/*
+ * private functions
+ */
+
+static void parallel_p_init(void)
+{
+    bmp_p_mutex_init(&pool.mutex);
+}
+
+/* run chunks from our queue, then steal from the others until all are empty */
+static void parallel_p_work(uint32_t index)
+{
+    parallel_queue *q;
+    uint32_t i, chunk;
+    int found;
+
+    for (;;)
+    {
+        q = &pool.queue[index];
+        bmp_p_mutex_lock(&q->mutex);
+        found = (q->begin < q->end);
+        if (found)
+            chunk = q->begin++;
+        bmp_p_mutex_unlock(&q->mutex);
+
+        for (i = 1; (i < pool.threads) && !found; i++)
+        {
+            q = &pool.queue[(index + i) % pool.threads];
+            bmp_p_mutex_lock(&q->mutex);
+            found = (q->begin < q->end);
+            if (found)
+                chunk = --q->end;
+            bmp_p_mutex_unlock(&q->mutex);
+        }
+
+        if (!found)
+            return;
+        pool.task(pool.arg, chunk);
+    }
+}
+
+static BMP_P_THREAD_PROC(parallel_p_worker, arg)
+{
+    uint32_t index = (uint32_t)(uintptr_t)arg;
+    uint32_t seen = 0;
+
+    in_pool = 1;
+
+    for (;;)
+    {
+        bmp_p_mutex_lock(&pool.state);
+        while ((pool.generation == seen) && !pool.stop)
+            bmp_p_cond_wait(&pool.wake, &pool.state);
+        seen = pool.generation;
+        bmp_p_mutex_unlock(&pool.state);
+        if (pool.stop)
+            break;
+
+        parallel_p_work(index);
+
+        bmp_p_mutex_lock(&pool.state);
+        if (--pool.active == 0)
+            bmp_p_cond_signal(&pool.done);
+        bmp_p_mutex_unlock(&pool.state);
+    }
+
+    return 0;
+}
+
+/* called with pool.mutex held */
+static void parallel_p_start(void)
+{
+    uint32_t i, n;
+
+    n = bmp_p_cpu_count();
+    if (n > PARALLEL_MAX_THREADS)
+        n = PARALLEL_MAX_THREADS;
+
+    bmp_p_mutex_init(&pool.state);
+    bmp_p_cond_init(&pool.wake);
+    bmp_p_cond_init(&pool.done);
+    pool.stop = 0;
+    pool.generation = 0;
+    pool.threads = n;
+
+    for (i = 1; i < n; i++)
+    {
+        if (bmp_p_thread_create(&pool.thread[i], parallel_p_worker, (void *)(uintptr_t)i) != 0)
+        {
+            bmp_p_error(0, __FUNCTION__, "Can't create worker thread (%d of %d)", i, n);
+            break;
+        }
+    }
+    pool.threads = i;
+    for (i = 0; i < pool.threads; i++)
+        bmp_p_mutex_init(&pool.queue[i].mutex);
+    pool.running = 1;
+}
+
+/* run task for chunks [0, chunks) on the pool and wait for them */
+static void parallel_p_run(uint32_t chunks, parallel_task task, void *arg)
+{
+    uint32_t i, n;
+
+    if (!in_pool && (chunks > 1))
+    {
+        bmp_p_call_once(&pool_once, parallel_p_init);
+        bmp_p_mutex_lock(&pool.mutex);
+        if (!pool.running)
+            parallel_p_start();
+        n = pool.threads;
+
+        if (n > 1)
+        {
+            for (i = 0; i < n; i++)
+            {
+                pool.queue[i].begin = (uint32_t)((uint64_t)chunks * i / n);
+                pool.queue[i].end = (uint32_t)((uint64_t)chunks * (i + 1) / n);
+            }
+
+            bmp_p_mutex_lock(&pool.state);
+            pool.task = task;
+            pool.arg = arg;
+            pool.active = n - 1;
+            pool.generation++;
+            bmp_p_cond_broadcast(&pool.wake);
+            bmp_p_mutex_unlock(&pool.state);
+
+            in_pool = 1;
+            parallel_p_work(0);
+            in_pool = 0;
+
+            bmp_p_mutex_lock(&pool.state);
+            while (pool.active > 0)
+                bmp_p_cond_wait(&pool.done, &pool.state);
+            bmp_p_mutex_unlock(&pool.state);
+
+            bmp_p_mutex_unlock(&pool.mutex);
+            return;
+        }
+        bmp_p_mutex_unlock(&pool.mutex);
+    }
+
+    /* nested call or nothing to share */
+    for (i = 0; i < chunks; i++)
+        task(arg, i);
+}
+
+static void parallel_p_rows(void *arg, uint32_t chunk)
+{
+    rows_job *job = (rows_job *)arg;
+    uint32_t y = chunk * job->rows;
+    uint32_t count = job->view.height - y;
+
+    if (count > job->rows)
+        count = job->rows;
+    job->fn(bmp_view_row(&job->view, y), job->view.stride, job->view.width, y, count, job->ctx);
+}
+
+static void parallel_p_tasks(void *arg, uint32_t chunk)
+{
+    tasks_job *job = (tasks_job *)arg;
+
+    job->fn(chunk, job->ctx);
+}
+
+/*
+ * Public functions
+ */
+
+int bmp_parallel_rows(bmp_handle h, bmp_rows_fn fn, void *ctx)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    rows_job job;
+    uint32_t chunks;
+    uint64_t start;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (fn == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    if (bmp_lock(h, &job.view, BMP_LOCK_READ | BMP_LOCK_WRITE) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
+
+    chunks = bmp_p_cpu_count() * PARALLEL_CHUNKS;
+    if (chunks > job.view.height)
+        chunks = job.view.height;
+    if (chunks == 0)
+        chunks = 1;
+    job.rows = (job.view.height + chunks - 1) / chunks;
+    if (job.rows == 0)
+        job.rows = 1;
+    job.fn = fn;
+    job.ctx = ctx;
+
+    parallel_p_run((job.view.height + job.rows - 1) / job.rows, parallel_p_rows, &job);
+
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+    bmp_unlock(h, &job.view);
+
+    return 0;
+}
+
+int bmp_parallel_tasks(uint32_t count, bmp_task_fn fn, void *ctx)
+{
+    tasks_job job;
+
+    /* check argument */
+    if (fn == 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    job.fn = fn;
+    job.ctx = ctx;
+    parallel_p_run(count, parallel_p_tasks, &job);
+
+    return 0;
+}
+
+void bmp_parallel_shutdown(void)
+{
+    uint32_t i;
+
+    bmp_p_call_once(&pool_once, parallel_p_init);
+    bmp_p_mutex_lock(&pool.mutex);
+
+    if (pool.running)
+    {
+        bmp_p_mutex_lock(&pool.state);
+        pool.stop = 1;
+        bmp_p_cond_broadcast(&pool.wake);
+        bmp_p_mutex_unlock(&pool.state);
+
+        for (i = 1; i < pool.threads; i++)
+            bmp_p_thread_join(pool.thread[i]);
+        for (i = 0; i < pool.threads; i++)
+            bmp_p_mutex_destroy(&pool.queue[i].mutex);
+        bmp_p_cond_destroy(&pool.done);
+        bmp_p_cond_destroy(&pool.wake);
+        bmp_p_mutex_destroy(&pool.state);
+        pool.running = 0;
+    }
+
+    bmp_p_mutex_unlock(&pool.mutex);
+}
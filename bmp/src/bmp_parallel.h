@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Parallel processing of bmp rows on a thread pool owned by the library.
+ */
+
+#ifndef BMP_PARALLEL_H
+#define BMP_PARALLEL_H
+
+#include "bmp.h"
+
+/*
+ * fn processes count rows starting at row y (y = 0 is the top line).
+ * row points to row y and row y + i starts at row + i * stride.  Each row
+ * is width pixels in the same B, G, R layout as bmp_view_row().
+ */
+typedef void (*bmp_rows_fn)(uint8_t *row, int32_t stride, uint32_t width, uint32_t y, uint32_t count, void *ctx);
+
+/*
+ * Call fn for bands of rows covering the whole image and return when all
+ * are done.  The bands run at the same time on the pool, so fn must only
+ * write the rows it is given.  The handle is locked for read/write during
+ * the call.  A call from inside fn runs on the calling thread.
+ */
+int bmp_parallel_rows(bmp_handle h, bmp_rows_fn fn, void *ctx);
+
+/*
+ * Call fn for index 0 to count - 1 on the pool and return when all are
+ * done, for jobs that are not split by the rows of one handle (e.g. bands
+ * of a buffer of the caller, or columns).
+ */
+typedef void (*bmp_task_fn)(uint32_t index, void *ctx);
+
+int bmp_parallel_tasks(uint32_t count, bmp_task_fn fn, void *ctx);
+
+/*
+ * The pool is started on first use with one thread per CPU.
+ * bmp_parallel_shutdown stops it, e.g. before unloading the library.
+ */
+void bmp_parallel_shutdown(void);
+
+#endif /* BMP_PARALLEL_H */
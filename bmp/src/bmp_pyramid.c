@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Image pyramid (mipmap) generation for the bmp library.
+ *
+ * All levels are made in one pass over the source.  As soon as a pair of
+ * lines of a level is complete, the next level's line is computed from it
+ * while both lines are still in cache, and so on down the pyramid.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+#include "bmp_p.h"
+#include "bmp_pyramid.h"
+#ifdef BMP_P_SSE2
+#include <emmintrin.h>
+#endif
+
+#define PYRAMID_MAX_LEVELS  32
+
+/*
+ * pyramid internal data
+ */
+typedef struct {
+    bmp_view level[PYRAMID_MAX_LEVELS + 1];    /* level[0] is the source */
+    uint32_t count;                             /* number of views incl. source */
+    uint8_t *line;                              /* work line for the SIMD path */
+} pyramid_data;
+
+/*
+ * private functions
+ */
+
+/* return the number of levels below width x height, limited by max_levels */
+static uint32_t pyramid_p_levels(uint32_t width, uint32_t height, uint32_t max_levels)
+{
+    uint32_t n = 0;
+
+    if ((max_levels == 0) || (max_levels > PYRAMID_MAX_LEVELS))
+        max_levels = PYRAMID_MAX_LEVELS;
+
+    while (((width > 1) || (height > 1)) && (n < max_levels))
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        n++;
+    }
+
+    return n;
+}
+
+/* reduce lines a and b (width pixels) into one line of dst */
+static void pyramid_p_down(pyramid_data *pyr, const uint8_t *a, const uint8_t *b, uint8_t *dst, uint32_t width)
+{
+    uint32_t pairs = width / 2;
+    uint32_t bytes = 3 * width;
+    uint32_t i = 0, k, c;
+
+#ifdef BMP_P_SSE2
+    /*
+     * line[i] = average of byte i and byte i+3 on both lines, i.e. for
+     * i = 6k+c it is channel c of output pixel k.  16 bytes at a time.
+     */
+    uint8_t *line = pyr->line;
+    __m128i zero = _mm_setzero_si128();
+    __m128i two = _mm_set1_epi16(2);
+
+    for (i = 0; i + 19 <= bytes; i += 16)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(a + i + 3));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(b + i + 3));
+        __m128i lo, hi;
+
+        lo = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(a1, zero));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(b0, zero));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(b1, zero));
+        hi = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(a1, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(b0, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(b1, zero));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        _mm_storeu_si128((__m128i *)(line + i), _mm_packus_epi16(lo, hi));
+    }
+    for (; i + 3 < bytes; i++)
+        line[i] = (a[i] + a[i + 3] + b[i] + b[i + 3] + 2) >> 2;
+
+    /* keep the first half of every 6 bytes */
+    for (k = 0; k < pairs; k++)
+    {
+        dst[3 * k + 0] = line[6 * k + 0];
+        dst[3 * k + 1] = line[6 * k + 1];
+        dst[3 * k + 2] = line[6 * k + 2];
+    }
+#else
+    (void)pyr;
+    (void)i;
+    for (k = 0; k < pairs; k++)
+    {
+        for (c = 0; c < 3; c++)
+            dst[3 * k + c] = (a[6 * k + c] + a[6 * k + 3 + c] + b[6 * k + c] + b[6 * k + 3 + c] + 2) >> 2;
+    }
+#endif
+
+    /* odd width: the last pixel has no right neighbour */
+    if (width & 1)
+    {
+        for (c = 0; c < 3; c++)
+            dst[3 * pairs + c] = (a[bytes - 3 + c] + b[bytes - 3 + c] + 1) >> 1;
+    }
+}
+
+/* line y of a level is ready.  Make the next level's line if it completes a pair. */
+static void pyramid_p_emit(pyramid_data *pyr, uint32_t level, uint32_t y)
+{
+    const bmp_view *src = &pyr->level[level];
+    uint32_t next = level + 1;
+
+    while (next < pyr->count)
+    {
+        /* wait for the second line of the pair.  An odd last line pairs with itself. */
+        if (((y & 1) == 0) && (y + 1 < src->height))
+            return;
+
+        pyramid_p_down(pyr, bmp_view_row(src, y & ~1u), bmp_view_row(src, y),
+                       bmp_view_row(&pyr->level[next], y / 2), src->width);
+
+        src = &pyr->level[next];
+        y /= 2;
+        next++;
+    }
+}
+
+/* build all levels from level[0].  copy, if not 0, receives each source line first. */
+static int pyramid_p_run(pyramid_data *pyr, const bmp_view *copy)
+{
+    uint32_t y;
+
+    pyr->line = (uint8_t*)malloc(3 * pyr->level[0].width + 16);
+    if (pyr->line == 0)
+    {
+        bmp_p_error(0, "bmp_pyramid", "Can't allocate work line");
+        return -1;
+    }
+
+    for (y = 0; y < pyr->level[0].height; y++)
+    {
+        if (copy)
+            memcpy(bmp_view_row(&pyr->level[0], y), bmp_view_row(copy, y), 3 * copy->width);
+        pyramid_p_emit(pyr, 0, y);
+    }
+
+    free(pyr->line);
+    pyr->line = 0;
+
+    return 0;
+}
+
+/* return a view of the width x height area at (x, y) of view */
+static void pyramid_p_subview(bmp_view *sub, const bmp_view *view, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    *sub = *view;
+    sub->base = bmp_view_row(view, y) + 3 * x;
+    sub->width = width;
+    sub->height = height;
+}
+
+/*
+ * Public functions
+ */
+
+int bmp_pyramid_build(bmp_handle src, bmp_handle *levels, uint32_t max_levels, uint32_t *count)
+{
+    bmp_data *bmp = (bmp_data *)src;
+    pyramid_data pyr;
+    bmp_config config;
+    uint32_t i, n;
+    int rc = 0;
+    uint64_t start;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((levels == 0) || (count == 0))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    *count = 0;
+    if (bmp_lock(src, &pyr.level[0], BMP_LOCK_READ) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
+
+    /* create and lock the level handles */
+    n = pyramid_p_levels(pyr.level[0].width, pyr.level[0].height, max_levels);
+    config = bmp->config;
+    for (i = 0; i < n; i++)
+    {
+        config.width = (config.width + 1) / 2;
+        config.height = (config.height + 1) / 2;
+        levels[i] = 0;
+        if ((bmp_open(&levels[i], 0) != 0) ||
+            (bmp_set_config(levels[i], &config) != 0) ||
+            (bmp_lock(levels[i], &pyr.level[i + 1], BMP_LOCK_WRITE) != 0))
+        {
+            if (levels[i])
+                bmp_close(levels[i]);
+            rc = -1;
+            break;
+        }
+    }
+    n = i;
+    pyr.count = n + 1;
+
+    if (rc == 0)
+        rc = pyramid_p_run(&pyr, 0);
+
+    for (i = 0; i < n; i++)
+        bmp_unlock(levels[i], &pyr.level[i + 1]);
+    bmp_unlock(src, &pyr.level[0]);
+
+    if (rc == 0)
+    {
+        *count = n;
+    }
+    else
+    {
+        for (i = 0; i < n; i++)
+            bmp_close(levels[i]);
+    }
+
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    return rc;
+}
+
+int bmp_pyramid_save(bmp_handle src, const char *format, uint32_t max_levels)
+{
+    bmp_handle levels[PYRAMID_MAX_LEVELS];
+    char filename[1024];
+    uint32_t i, count;
+    int rc;
+
+    /* check argument */
+    if (format == 0)
+    {
+        bmp_p_error((bmp_data *)src, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    rc = bmp_pyramid_build(src, levels, max_levels, &count);
+    if (rc != 0)
+        return rc;
+
+    snprintf(filename, sizeof(filename), format, 0u);
+    rc = bmp_save(src, filename);
+    for (i = 0; i < count; i++)
+    {
+        if (rc == 0)
+        {
+            snprintf(filename, sizeof(filename), format, i + 1);
+            rc = bmp_save(levels[i], filename);
+        }
+        bmp_close(levels[i]);
+    }
+
+    return rc;
+}
+
+int bmp_pyramid_save_packed(bmp_handle src, const char *filename, uint32_t max_levels)
+{
+    bmp_data *bmp = (bmp_data *)src;
+    pyramid_data pyr;
+    bmp_handle packed = 0;
+    bmp_view source, view;
+    bmp_config config;
+    uint32_t i, n, y, width, height;
+    int rc;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (filename == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    if (bmp_lock(src, &source, BMP_LOCK_READ) != 0)
+        return -1;
+
+    /* level 0 on the left, the other levels in a column on the right */
+    n = pyramid_p_levels(source.width, source.height, max_levels);
+    config = bmp->config;
+    config.width = source.width + (n ? (source.width + 1) / 2 : 0);
+    for (i = 0, y = 0, height = source.height; i < n; i++)
+    {
+        height = (height + 1) / 2;
+        y += height;
+    }
+    if (config.height < y)
+        config.height = y;
+
+    rc = bmp_open(&packed, 0);
+    if (rc == 0)
+        rc = bmp_set_config(packed, &config);
+    if (rc == 0)
+        rc = bmp_lock(packed, &view, BMP_LOCK_WRITE);
+
+    if (rc == 0)
+    {
+        width = source.width;
+        height = source.height;
+        pyramid_p_subview(&pyr.level[0], &view, 0, 0, width, height);
+        for (i = 1, y = 0; i <= n; i++)
+        {
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+            pyramid_p_subview(&pyr.level[i], &view, source.width, y, width, height);
+            y += height;
+        }
+        pyr.count = n + 1;
+
+        rc = pyramid_p_run(&pyr, &source);
+        bmp_unlock(packed, &view);
+    }
+    bmp_unlock(src, &source);
+
+    if (rc == 0)
+        rc = bmp_save(packed, filename);
+    if (packed)
+        bmp_close(packed);
+
+    return rc;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Image pyramid (mipmap) generation for the bmp library.
+ * Level n is the source reduced by 2^n with 2x2 box averaging.  Odd sizes
+ * are rounded up and the last column/line is averaged with itself, so every
+ * level covers the whole source down to 1x1.
+ */
+
+#ifndef BMP_PYRAMID_H
+#define BMP_PYRAMID_H
+
+#include "bmp.h"
+
+/*
+ * Create levels 1, 2, ... of src as new handles in levels[].
+ * max_levels limits the number of levels (0 = all levels down to 1x1).
+ * levels must have room for max_levels handles (32 when max_levels is 0).
+ * count returns the number of handles created.  Close them with bmp_close.
+ */
+int bmp_pyramid_build(bmp_handle src, bmp_handle *levels, uint32_t max_levels, uint32_t *count);
+
+/*
+ * Write level 0 (src itself) and all reduced levels as bmp files.
+ * format is a printf format that takes the level number, e.g. "tile_%u.bmp".
+ */
+int bmp_pyramid_save(bmp_handle src, const char *format, uint32_t max_levels);
+
+/*
+ * Write all levels into one bmp file.  Level 0 is on the left and the
+ * reduced levels are stacked top-down in a column on its right.
+ */
+int bmp_pyramid_save_packed(bmp_handle src, const char *filename, uint32_t max_levels);
+
+#endif /* BMP_PYRAMID_H */
@@ -0,0 +1,570 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * QOI (Quite OK Image) codec for the bmp library.
+ * It provides functions to load/save a bmp_handle as a QOI file and
+ * a streaming interface that encodes/decodes one row at a time.
+ *
+ * The format is described at https://qoiformat.org/qoi-specification.pdf
+ * Only RGB is written.  RGBA files are read and alpha is dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+#include "bmp_p.h"
+#include "bmp_qoi.h"
+
+/*
+ * QOI definitions
+ */
+#define QOI_MAGIC       0x716f6966      /* 'qoif' */
+#define QOI_HEADER_SIZE 14
+#define QOI_OP_INDEX    0x00            /* 00xxxxxx */
+#define QOI_OP_DIFF     0x40            /* 01xxxxxx */
+#define QOI_OP_LUMA     0x80            /* 10xxxxxx */
+#define QOI_OP_RUN      0xc0            /* 11xxxxxx */
+#define QOI_OP_RGB      0xfe
+#define QOI_OP_RGBA     0xff
+#define QOI_MASK_2      0xc0
+#define QOI_MAX_RUN     62
+
+/* pixels are kept as r | g << 8 | b << 16 | a << 24 */
+#define QOI_R(px)   ((px) & 0xff)
+#define QOI_G(px)   (((px) >> 8) & 0xff)
+#define QOI_B(px)   (((px) >> 16) & 0xff)
+#define QOI_A(px)   ((px) >> 24)
+#define QOI_PX(r, g, b, a) \
+    ((uint32_t)(r) | ((uint32_t)(g) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(a) << 24))
+#define QOI_HASH(px) \
+    ((QOI_R(px) * 3 + QOI_G(px) * 5 + QOI_B(px) * 7 + QOI_A(px) * 11) & 63)
+
+#define QOI_IO_SIZE     (64 * 1024)
+
+static const uint8_t qoi_padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+/*
+ * qoi internal data
+ */
+typedef struct {
+    FILE *fp;
+    bmp_data *bmp;          /* handle to count I/O on, or 0 */
+    int writing;
+    bmp_config config;
+    uint32_t rows;          /* rows done */
+    uint32_t px;            /* previous pixel */
+    uint32_t run;
+    uint32_t index[64];
+    uint8_t *buf;           /* I/O buffer */
+    uint32_t pos;
+    uint32_t len;
+    uint32_t cap;
+} qoi_data;
+
+/*
+ * private functions
+ */
+
+static void qoi_p_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static uint32_t qoi_p_get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* write out the buffered bytes */
+static int qoi_p_flush(qoi_data *qoi)
+{
+    uint32_t len;
+
+    len = fwrite(qoi->buf, 1, qoi->len, qoi->fp);
+    bmp_p_count_write(qoi->bmp, len);
+    if (len != qoi->len)
+    {
+        bmp_p_error(0, __FUNCTION__, "Write error %d bytes were written", len);
+        return -1;
+    }
+    qoi->len = 0;
+
+    return 0;
+}
+
+/* make sure at least one op (5 bytes) is buffered, or the rest of the file */
+static int qoi_p_fill(qoi_data *qoi)
+{
+    uint32_t rest = qoi->len - qoi->pos;
+    uint32_t len;
+
+    if (rest >= 5)
+        return 0;
+
+    memmove(qoi->buf, qoi->buf + qoi->pos, rest);
+    len = fread(qoi->buf + rest, 1, qoi->cap - rest, qoi->fp);
+    bmp_p_count_read(qoi->bmp, len);
+    qoi->pos = 0;
+    qoi->len = rest + len;
+
+    if (qoi->len == 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Unexpected end of file");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void qoi_p_release(qoi_data *qoi)
+{
+    if (qoi->fp)
+        fclose(qoi->fp);
+    if (qoi->buf)
+        free(qoi->buf);
+    free(qoi);
+}
+
+static qoi_data *qoi_p_alloc(const char *filename, const char *mode, uint32_t cap)
+{
+    qoi_data *qoi;
+
+    qoi = (qoi_data*)malloc(sizeof(qoi_data));
+    if (qoi == 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Can't allocate qoi_data");
+        return 0;
+    }
+    memset(qoi, 0x00, sizeof(qoi_data));
+
+    qoi->cap = cap;
+    qoi->buf = (uint8_t*)malloc(cap);
+    qoi->fp = fopen(filename, mode);
+    if ((qoi->buf == 0) || (qoi->fp == 0))
+    {
+        bmp_p_error(0, __FUNCTION__, "Cannot open %s", filename);
+        qoi_p_release(qoi);
+        return 0;
+    }
+    qoi->px = QOI_PX(0, 0, 0, 255);
+
+    return qoi;
+}
+
+/* open a reader that counts its reads on bmp (may be 0) */
+static int qoi_p_open_reader(bmp_qoi_handle *q, const char *filename, bmp_config *config, bmp_data *bmp)
+{
+    qoi_data *qoi;
+    uint8_t header[QOI_HEADER_SIZE];
+    uint32_t len;
+
+    qoi = qoi_p_alloc(filename, "rb", QOI_IO_SIZE);
+    if (qoi == 0)
+        return -1;
+    qoi->bmp = bmp;
+
+    len = fread(header, 1, QOI_HEADER_SIZE, qoi->fp);
+    bmp_p_count_read(bmp, len);
+    if ((len != QOI_HEADER_SIZE) || (qoi_p_get32(header) != QOI_MAGIC))
+    {
+        bmp_p_error(0, __FUNCTION__, "Can't find \"qoif\"");
+        qoi_p_release(qoi);
+        return -1;
+    }
+    if ((header[12] != 3) && (header[12] != 4))
+    {
+        bmp_p_error(0, __FUNCTION__, "Invalid channels (%d)", header[12]);
+        qoi_p_release(qoi);
+        return -1;
+    }
+
+    qoi->config.width = qoi_p_get32(header + 4);
+    qoi->config.height = qoi_p_get32(header + 8);
+    qoi->config.bits_per_pixel = 24;
+    if ((qoi->config.width == 0) || (qoi->config.height == 0) ||
+        ((uint64_t)qoi->config.width * qoi->config.height > BMP_P_MAX_PIXELS))
+    {
+        bmp_p_error(0, __FUNCTION__, "Invalid size (%d x %d)", qoi->config.width, qoi->config.height);
+        qoi_p_release(qoi);
+        return -1;
+    }
+    *config = qoi->config;
+    *q = (bmp_qoi_handle)qoi;
+
+    return 0;
+}
+
+/*
+ * Public functions
+ */
+
+int bmp_qoi_open_reader(bmp_qoi_handle *q, const char *filename, bmp_config *config)
+{
+    /* check argument */
+    if ((q == 0) || (filename == 0) || (config == 0))
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    return qoi_p_open_reader(q, filename, config, 0);
+}
+
+int bmp_qoi_open_writer(bmp_qoi_handle *q, const char *filename, bmp_config *config)
+{
+    qoi_data *qoi;
+    uint32_t cap;
+
+    /* check argument */
+    if ((q == 0) || (filename == 0) || (config == 0))
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if (config->bits_per_pixel != 24)
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Only 24 bits/pixel is supported");
+        return -1;
+    }
+
+    /* a row never takes more than 4 bytes/pixel plus a pending run */
+    cap = config->width * 4 + 16;
+    if (cap < QOI_IO_SIZE)
+        cap = QOI_IO_SIZE;
+
+    qoi = qoi_p_alloc(filename, "wb", cap);
+    if (qoi == 0)
+        return -1;
+
+    qoi->writing = 1;
+    qoi->config = *config;
+
+    qoi_p_put32(qoi->buf, QOI_MAGIC);
+    qoi_p_put32(qoi->buf + 4, config->width);
+    qoi_p_put32(qoi->buf + 8, config->height);
+    qoi->buf[12] = 3;       /* RGB */
+    qoi->buf[13] = 0;       /* sRGB with linear alpha */
+    qoi->len = QOI_HEADER_SIZE;
+
+    *q = (bmp_qoi_handle)qoi;
+
+    return 0;
+}
+
+int bmp_qoi_read_row(bmp_qoi_handle q, uint8_t *row)
+{
+    qoi_data *qoi = (qoi_data *)q;
+    uint32_t x, px, run, size;
+    uint32_t *index;
+    uint8_t b1, b2;
+    int vg;
+
+    /* check argument */
+    if ((qoi == 0) || qoi->writing || (row == 0))
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if (qoi->rows >= qoi->config.height)
+    {
+        bmp_p_error(0, __FUNCTION__, "Error No more rows");
+        return -1;
+    }
+
+    px = qoi->px;
+    run = qoi->run;
+    index = qoi->index;
+
+    for (x = 0; x < qoi->config.width; x++)
+    {
+        if (run > 0)
+        {
+            run--;
+        }
+        else
+        {
+            if (qoi_p_fill(qoi) != 0)
+                return -1;
+
+            /* the file must hold the whole op */
+            b1 = qoi->buf[qoi->pos];
+            if (b1 == QOI_OP_RGB)
+                size = 4;
+            else if (b1 == QOI_OP_RGBA)
+                size = 5;
+            else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+                size = 2;
+            else
+                size = 1;
+            if (qoi->len - qoi->pos < size)
+            {
+                bmp_p_error(0, __FUNCTION__, "Unexpected end of file at row %d", qoi->rows);
+                return -1;
+            }
+            qoi->pos++;
+            if (b1 == QOI_OP_RGB)
+            {
+                px = QOI_PX(qoi->buf[qoi->pos], qoi->buf[qoi->pos+1], qoi->buf[qoi->pos+2], QOI_A(px));
+                qoi->pos += 3;
+            }
+            else if (b1 == QOI_OP_RGBA)
+            {
+                px = QOI_PX(qoi->buf[qoi->pos], qoi->buf[qoi->pos+1], qoi->buf[qoi->pos+2], qoi->buf[qoi->pos+3]);
+                qoi->pos += 4;
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX)
+            {
+                px = index[b1];
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF)
+            {
+                px = QOI_PX((QOI_R(px) + ((b1 >> 4) & 0x03) - 2) & 0xff,
+                            (QOI_G(px) + ((b1 >> 2) & 0x03) - 2) & 0xff,
+                            (QOI_B(px) + (b1 & 0x03) - 2) & 0xff,
+                            QOI_A(px));
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+            {
+                b2 = qoi->buf[qoi->pos++];
+                vg = (b1 & 0x3f) - 32;
+                px = QOI_PX((QOI_R(px) + vg - 8 + ((b2 >> 4) & 0x0f)) & 0xff,
+                            (QOI_G(px) + vg) & 0xff,
+                            (QOI_B(px) + vg - 8 + (b2 & 0x0f)) & 0xff,
+                            QOI_A(px));
+            }
+            else
+            {
+                run = b1 & 0x3f;
+            }
+
+            index[QOI_HASH(px)] = px;
+        }
+
+        row[3*x+0] = QOI_B(px);
+        row[3*x+1] = QOI_G(px);
+        row[3*x+2] = QOI_R(px);
+    }
+
+    qoi->px = px;
+    qoi->run = run;
+    qoi->rows++;
+
+    return 0;
+}
+
+int bmp_qoi_write_row(bmp_qoi_handle q, const uint8_t *row)
+{
+    qoi_data *qoi = (qoi_data *)q;
+    uint32_t x, px, prev, run, hash;
+    uint32_t *index;
+    uint8_t *out;
+    int vr, vg, vb, vg_r, vg_b;
+
+    /* check argument */
+    if ((qoi == 0) || !qoi->writing || (row == 0))
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if (qoi->rows >= qoi->config.height)
+    {
+        bmp_p_error(0, __FUNCTION__, "Error No more rows");
+        return -1;
+    }
+
+    /* the buffer always has room for one row */
+    if (qoi->len + qoi->config.width * 4 + 16 > qoi->cap)
+    {
+        if (qoi_p_flush(qoi) != 0)
+            return -1;
+    }
+
+    prev = qoi->px;
+    run = qoi->run;
+    index = qoi->index;
+    out = qoi->buf + qoi->len;
+
+    for (x = 0; x < qoi->config.width; x++)
+    {
+        px = QOI_PX(row[3*x+2], row[3*x+1], row[3*x+0], 255);
+
+        if (px == prev)
+        {
+            run++;
+            if (run == QOI_MAX_RUN)
+            {
+                *out++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0)
+        {
+            *out++ = QOI_OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        hash = QOI_HASH(px);
+        if (index[hash] == px)
+        {
+            *out++ = QOI_OP_INDEX | hash;
+        }
+        else
+        {
+            index[hash] = px;
+
+            /* alpha is always 255, so only RGB ops are needed */
+            vr = (int8_t)(QOI_R(px) - QOI_R(prev));
+            vg = (int8_t)(QOI_G(px) - QOI_G(prev));
+            vb = (int8_t)(QOI_B(px) - QOI_B(prev));
+            vg_r = vr - vg;
+            vg_b = vb - vg;
+
+            if ((vr > -3) && (vr < 2) && (vg > -3) && (vg < 2) && (vb > -3) && (vb < 2))
+            {
+                *out++ = QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2);
+            }
+            else if ((vg_r > -9) && (vg_r < 8) && (vg > -33) && (vg < 32) && (vg_b > -9) && (vg_b < 8))
+            {
+                *out++ = QOI_OP_LUMA | (vg + 32);
+                *out++ = ((vg_r + 8) << 4) | (vg_b + 8);
+            }
+            else
+            {
+                *out++ = QOI_OP_RGB;
+                *out++ = QOI_R(px);
+                *out++ = QOI_G(px);
+                *out++ = QOI_B(px);
+            }
+        }
+        prev = px;
+    }
+
+    qoi->len = out - qoi->buf;
+    qoi->px = prev;
+    qoi->run = run;
+    qoi->rows++;
+
+    return 0;
+}
+
+int bmp_qoi_close(bmp_qoi_handle q)
+{
+    qoi_data *qoi = (qoi_data *)q;
+    int rc = 0;
+
+    /* check argument */
+    if (qoi == 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    if (qoi->writing)
+    {
+        if (qoi->rows != qoi->config.height)
+        {
+            bmp_p_error(0, __FUNCTION__, "Error %d of %d rows were written", qoi->rows, qoi->config.height);
+            rc = -1;
+        }
+
+        /* pending run and end marker */
+        if (qoi->run > 0)
+            qoi->buf[qoi->len++] = QOI_OP_RUN | (qoi->run - 1);
+        memcpy(qoi->buf + qoi->len, qoi_padding, sizeof(qoi_padding));
+        qoi->len += sizeof(qoi_padding);
+
+        if (qoi_p_flush(qoi) != 0)
+            rc = -1;
+    }
+
+    qoi_p_release(qoi);
+
+    return rc;
+}
+
+int bmp_qoi_load(bmp_handle h, const char *filename)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    bmp_qoi_handle q;
+    bmp_config config;
+    bmp_view view;
+    uint32_t y;
+    uint64_t start;
+    int rc;
+
+    /* check argument */
+    if ((bmp == 0) || (filename == 0))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    start = bmp_p_span_begin();
+
+    rc = qoi_p_open_reader(&q, filename, &config, bmp);
+    if (rc != 0)
+        return rc;
+
+    rc = bmp_set_config(h, &config);
+    if (rc == 0)
+        rc = bmp_lock(h, &view, BMP_LOCK_WRITE);
+    if (rc == 0)
+    {
+        for (y = 0; (y < config.height) && (rc == 0); y++)
+            rc = bmp_qoi_read_row(q, bmp_view_row(&view, y));
+        bmp_unlock(h, &view);
+    }
+
+    bmp_qoi_close(q);
+    if (rc == 0)
+        bmp_p_count_load(bmp);
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    return rc;
+}
+
+int bmp_qoi_save(bmp_handle h, const char *filename)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    bmp_qoi_handle q;
+    bmp_view view;
+    uint32_t y;
+    uint64_t start;
+    int rc;
+
+    /* check argument */
+    if ((bmp == 0) || (filename == 0))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    start = bmp_p_span_begin();
+
+    rc = bmp_lock(h, &view, BMP_LOCK_READ);
+    if (rc != 0)
+        return rc;
+
+    rc = bmp_qoi_open_writer(&q, filename, &bmp->config);
+    if (rc == 0)
+    {
+        ((qoi_data *)q)->bmp = bmp;
+        for (y = 0; (y < view.height) && (rc == 0); y++)
+            rc = bmp_qoi_write_row(q, bmp_view_row(&view, y));
+        if (bmp_qoi_close(q) != 0)
+            rc = -1;
+    }
+    bmp_unlock(h, &view);
+
+    if (rc == 0)
+        bmp_p_count_save(bmp);
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    return rc;
+}
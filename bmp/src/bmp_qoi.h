@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * QOI (Quite OK Image) codec for the bmp library.
+ * It provides functions to load/save a bmp_handle as a QOI file and
+ * a streaming interface that encodes/decodes one row at a time.
+ */
+
+#ifndef BMP_QOI_H
+#define BMP_QOI_H
+
+#include "bmp.h"
+
+typedef uint32_t* bmp_qoi_handle;
+
+/* Load/save the whole image.  Same as bmp_load/bmp_save but in QOI format. */
+int bmp_qoi_load(bmp_handle h, const char *filename);
+int bmp_qoi_save(bmp_handle h, const char *filename);
+
+/*
+ * Streaming interface.
+ * Rows are passed top to bottom in the same 24 bits/pixel B,G,R layout as
+ * bmp_view_row().  bmp_qoi_open_reader returns the image size in config.
+ * bmp_qoi_close of a writer finishes the stream.
+ */
+int bmp_qoi_open_reader(bmp_qoi_handle *q, const char *filename, bmp_config *config);
+int bmp_qoi_open_writer(bmp_qoi_handle *q, const char *filename, bmp_config *config);
+int bmp_qoi_read_row(bmp_qoi_handle q, uint8_t *row);
+int bmp_qoi_write_row(bmp_qoi_handle q, const uint8_t *row);
+int bmp_qoi_close(bmp_qoi_handle q);
+
+#endif /* BMP_QOI_H */
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * Private thread primitives for the bmp library (Win32 threads or pthreads).
+ * This header is not part of the public API.
+ */
+
+#ifndef BMP_THREAD_H
+#define BMP_THREAD_H
+
+#include "bmp.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+
+typedef CRITICAL_SECTION bmp_p_mutex;
+typedef CONDITION_VARIABLE bmp_p_cond;
+typedef HANDLE bmp_p_thread;
+typedef INIT_ONCE bmp_p_once;
+
+#define BMP_P_THREAD_PROC(name, arg) unsigned __stdcall name(void *arg)
+#define BMP_P_ONCE_INIT INIT_ONCE_STATIC_INIT
+#define BMP_P_TLS __declspec(thread)
+
+BMP_INLINE void bmp_p_mutex_init(bmp_p_mutex *m) { InitializeCriticalSection(m); }
+BMP_INLINE void bmp_p_mutex_destroy(bmp_p_mutex *m) { DeleteCriticalSection(m); }
+BMP_INLINE void bmp_p_mutex_lock(bmp_p_mutex *m) { EnterCriticalSection(m); }
+BMP_INLINE void bmp_p_mutex_unlock(bmp_p_mutex *m) { LeaveCriticalSection(m); }
+
+BMP_INLINE void bmp_p_cond_init(bmp_p_cond *c) { InitializeConditionVariable(c); }
+BMP_INLINE void bmp_p_cond_destroy(bmp_p_cond *c) { (void)c; }
+BMP_INLINE void bmp_p_cond_wait(bmp_p_cond *c, bmp_p_mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+BMP_INLINE void bmp_p_cond_signal(bmp_p_cond *c) { WakeConditionVariable(c); }
+BMP_INLINE void bmp_p_cond_broadcast(bmp_p_cond *c) { WakeAllConditionVariable(c); }
+
+BMP_INLINE int bmp_p_thread_create(bmp_p_thread *t, unsigned (__stdcall *proc)(void *), void *arg)
+{
+    *t = (HANDLE)_beginthreadex(NULL, 0, proc, arg, 0, NULL);
+    return (*t == 0) ? -1 : 0;
+}
+
+BMP_INLINE void bmp_p_thread_join(bmp_p_thread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+BMP_INLINE BOOL CALLBACK bmp_p_once_proc(PINIT_ONCE once, PVOID proc, PVOID *ctx)
+{
+    ((void (*)(void))proc)();
+    return TRUE;
+}
+
+BMP_INLINE void bmp_p_call_once(bmp_p_once *once, void (*proc)(void))
+{
+    InitOnceExecuteOnce(once, bmp_p_once_proc, (PVOID)proc, NULL);
+}
+
+BMP_INLINE uint32_t bmp_p_cpu_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+BMP_INLINE void bmp_p_sleep(uint32_t msec) { Sleep(msec); }
+
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t bmp_p_mutex;
+typedef pthread_cond_t bmp_p_cond;
+typedef pthread_t bmp_p_thread;
+typedef pthread_once_t bmp_p_once;
+
+#define BMP_P_THREAD_PROC(name, arg) void *name(void *arg)
+#define BMP_P_ONCE_INIT PTHREAD_ONCE_INIT
+#define BMP_P_TLS __thread
+
+BMP_INLINE void bmp_p_mutex_init(bmp_p_mutex *m) { pthread_mutex_init(m, NULL); }
+BMP_INLINE void bmp_p_mutex_destroy(bmp_p_mutex *m) { pthread_mutex_destroy(m); }
+BMP_INLINE void bmp_p_mutex_lock(bmp_p_mutex *m) { pthread_mutex_lock(m); }
+BMP_INLINE void bmp_p_mutex_unlock(bmp_p_mutex *m) { pthread_mutex_unlock(m); }
+
+BMP_INLINE void bmp_p_cond_init(bmp_p_cond *c) { pthread_cond_init(c, NULL); }
+BMP_INLINE void bmp_p_cond_destroy(bmp_p_cond *c) { pthread_cond_destroy(c); }
+BMP_INLINE void bmp_p_cond_wait(bmp_p_cond *c, bmp_p_mutex *m) { pthread_cond_wait(c, m); }
+BMP_INLINE void bmp_p_cond_signal(bmp_p_cond *c) { pthread_cond_signal(c); }
+BMP_INLINE void bmp_p_cond_broadcast(bmp_p_cond *c) { pthread_cond_broadcast(c); }
+
+BMP_INLINE int bmp_p_thread_create(bmp_p_thread *t, void *(*proc)(void *), void *arg)
+{
+    return (pthread_create(t, NULL, proc, arg) == 0) ? 0 : -1;
+}
+
+BMP_INLINE void bmp_p_thread_join(bmp_p_thread t)
+{
+    pthread_join(t, NULL);
+}
+
+BMP_INLINE void bmp_p_call_once(bmp_p_once *once, void (*proc)(void))
+{
+    pthread_once(once, proc);
+}
+
+BMP_INLINE uint32_t bmp_p_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (uint32_t)n : 1;
+}
+
+BMP_INLINE void bmp_p_sleep(uint32_t msec) { usleep(msec * 1000); }
+
+#endif
+
+#endif /* BMP_THREAD_H */
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * File watcher for the bmp library.
+ * It reloads a bmp file in the background whenever it is rewritten.
+ */
+
+#ifndef BMP_WATCH_H
+#define BMP_WATCH_H
+
+#include "bmp.h"
+
+typedef uint32_t* bmp_watch_handle;
+
+/* Called from the watcher thread after a new image was swapped in */
+typedef void (*bmp_watch_callback)(bmp_watch_handle w, void *ctx);
+
+/*
+ * bmp_watch_open loads filename and starts watching it (inotify on Linux,
+ * change notification on Windows, mtime polling elsewhere).
+ * A change is loaded into a second buffer and swapped in atomically, so
+ * readers never see a partly loaded image.
+ */
+int bmp_watch_open(bmp_watch_handle *w, const char *filename, bmp_watch_callback callback, void *ctx);
+int bmp_watch_close(bmp_watch_handle w);
+
+/*
+ * bmp_watch_acquire returns the current image, which stays valid and
+ * unchanged until bmp_watch_release.  generation counts the reloads and
+ * may be 0.  Do not modify or reconfigure the returned handle.
+ */
+int bmp_watch_acquire(bmp_watch_handle w, bmp_handle *h, uint32_t *generation);
+int bmp_watch_release(bmp_watch_handle w, bmp_handle h);
+
+#endif /* BMP_WATCH_H */
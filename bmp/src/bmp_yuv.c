@@ -0,0 +1,518 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * RGB to YUV 4:2:0 conversion and Y4M (YUV4MPEG2) output for the bmp library.
+ *
+ * A pair of lines is split into 16 bit R, G, B arrays, then Y of both
+ * lines and U, V of the 2x2 averages are computed 8 pixels at a time with
+ * SSE2 multiply-add.  Coefficients are fixed point with 14 fraction bits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+#include "bmp_p.h"
+#include "bmp_thread.h"
+#include "bmp_yuv.h"
+#ifdef BMP_P_SSE2
+#include <emmintrin.h>
+#endif
+
+#define YUV_SHIFT   14
+#define YUV_PAD     8           /* work arrays are padded for the 8 pixel loop */
+
+/* fixed point coefficients, each in R, G, B order */
+typedef struct {
+    int16_t y[3];
+    int16_t u[3];
+    int16_t v[3];
+    int32_t y_offset;
+    int32_t c_offset;
+} yuv_coef;
+
+/*
+ * y4m internal data
+ */
+typedef struct {
+    FILE *fp;
+    uint32_t fps_num;
+    uint32_t fps_den;
+    uint32_t flags;
+    uint32_t width;             /* 0 until the first frame */
+    uint32_t height;
+    uint8_t *frame;             /* Y, U and V planes */
+    size_t frame_size;
+} y4m_data;
+
+/* loader state of bmp_y4m_write_sequence */
+#define SEQUENCE_FREE       0
+#define SEQUENCE_LOADED     1
+#define SEQUENCE_FAILED     2
+#define SEQUENCE_END        3
+
+typedef struct {
+    const char *format;
+    uint32_t first;
+    uint32_t count;
+    bmp_handle slot[2];
+    int state[2];
+    volatile int stop;
+    bmp_p_mutex mutex;
+    bmp_p_cond cond;
+} sequence_data;
+
+/*
+ * private functions
+ */
+
+static int16_t yuv_p_fix(double c)
+{
+    return (int16_t)(c * (1 << YUV_SHIFT) + (c < 0 ? -0.5 : 0.5));
+}
+
+/* G takes the rounding error so that gray maps exactly */
+static void yuv_p_coef(yuv_coef *coef, uint32_t flags)
+{
+    double kr = (flags & BMP_YUV_BT709) ? 0.2126 : 0.299;
+    double kb = (flags & BMP_YUV_BT709) ? 0.0722 : 0.114;
+    double ys = (flags & BMP_YUV_FULL) ? 1.0 : 219.0 / 255.0;
+    double cs = (flags & BMP_YUV_FULL) ? 1.0 : 224.0 / 255.0;
+
+    coef->y[0] = yuv_p_fix(kr * ys);
+    coef->y[2] = yuv_p_fix(kb * ys);
+    coef->y[1] = yuv_p_fix(ys) - coef->y[0] - coef->y[2];
+
+    coef->u[0] = yuv_p_fix(-kr / (2 * (1 - kb)) * cs);
+    coef->u[2] = yuv_p_fix(0.5 * cs);
+    coef->u[1] = -coef->u[0] - coef->u[2];
+
+    coef->v[0] = yuv_p_fix(0.5 * cs);
+    coef->v[2] = yuv_p_fix(-kb / (2 * (1 - kr)) * cs);
+    coef->v[1] = -coef->v[0] - coef->v[2];
+
+    coef->y_offset = (flags & BMP_YUV_FULL) ? 0 : 16;
+    coef->c_offset = 128;
+}
+
+/* out[i] = clamp((c[0]*r[i] + c[1]*g[i] + c[2]*b[i]) >> shift + offset) */
+static void yuv_p_dot(const int16_t *r, const int16_t *g, const int16_t *b, uint32_t n,
+                      const int16_t *c, int32_t offset, int shift, uint8_t *out)
+{
+    int32_t round = (offset << shift) + (1 << (shift - 1));
+    uint32_t i = 0;
+    int32_t value;
+
+#ifdef BMP_P_SSE2
+    __m128i crg = _mm_set1_epi32((int32_t)((uint16_t)c[0] | ((uint32_t)(uint16_t)c[1] << 16)));
+    __m128i cb = _mm_set1_epi32((int32_t)(uint16_t)c[2]);
+    __m128i add = _mm_set1_epi32(round);
+    __m128i zero = _mm_setzero_si128();
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+        __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i lo, hi;
+
+        lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(vr, vg), crg),
+                           _mm_madd_epi16(_mm_unpacklo_epi16(vb, zero), cb));
+        hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(vr, vg), crg),
+                           _mm_madd_epi16(_mm_unpackhi_epi16(vb, zero), cb));
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, add), shift);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, add), shift);
+        lo = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(lo, lo));
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        value = (c[0] * r[i] + c[1] * g[i] + c[2] * b[i] + round) >> shift;
+        out[i] = (value < 0) ? 0 : (value > 255) ? 255 : (uint8_t)value;
+    }
+}
+
+/* split a B, G, R line into 16 bit arrays.  The last pixel is repeated for the pair. */
+static void yuv_p_split(const uint8_t *p, uint32_t width, int16_t *r, int16_t *g, int16_t *b)
+{
+    uint32_t x;
+
+    for (x = 0; x < width; x++, p += 3)
+    {
+        b[x] = p[0];
+        g[x] = p[1];
+        r[x] = p[2];
+    }
+    r[width] = r[width - 1];
+    g[width] = g[width - 1];
+    b[width] = b[width - 1];
+}
+
+/* sum of 2x2 pixels */
+static void yuv_p_sum(const int16_t *a0, const int16_t *a1, uint32_t n, int16_t *sum)
+{
+    uint32_t k;
+
+    for (k = 0; k < n; k++)
+        sum[k] = a0[2 * k] + a0[2 * k + 1] + a1[2 * k] + a1[2 * k + 1];
+}
+
+static int yuv_p_convert(bmp_data *bmp, const bmp_view *view, uint8_t *y, uint8_t *u, uint8_t *v, uint32_t flags)
+{
+    yuv_coef coef;
+    uint32_t width = view->width;
+    uint32_t cw = (width + 1) / 2;
+    size_t n = width + YUV_PAD;
+    int16_t *work, *r0, *g0, *b0, *r1, *g1, *b1, *sr, *sg, *sb;
+    uint32_t line;
+
+    work = (int16_t*)malloc(sizeof(int16_t) * n * 9);
+    if (work == 0)
+    {
+        bmp_p_error(bmp, "bmp_to_yuv420", "Can't allocate work lines");
+        return -1;
+    }
+    r0 = work;
+    g0 = r0 + n;
+    b0 = g0 + n;
+    r1 = b0 + n;
+    g1 = r1 + n;
+    b1 = g1 + n;
+    sr = b1 + n;
+    sg = sr + n;
+    sb = sg + n;
+
+    yuv_p_coef(&coef, flags);
+
+    for (line = 0; line < view->height; line += 2)
+    {
+        /* an odd last line is paired with itself */
+        uint32_t next = (line + 1 < view->height) ? line + 1 : line;
+
+        yuv_p_split(bmp_view_row(view, line), width, r0, g0, b0);
+        yuv_p_split(bmp_view_row(view, next), width, r1, g1, b1);
+
+        yuv_p_dot(r0, g0, b0, width, coef.y, coef.y_offset, YUV_SHIFT, y + (size_t)line * width);
+        if (next != line)
+            yuv_p_dot(r1, g1, b1, width, coef.y, coef.y_offset, YUV_SHIFT, y + (size_t)next * width);
+
+        /* the sums are 4 pixels, so 2 more bits are shifted out */
+        yuv_p_sum(r0, r1, cw, sr);
+        yuv_p_sum(g0, g1, cw, sg);
+        yuv_p_sum(b0, b1, cw, sb);
+        yuv_p_dot(sr, sg, sb, cw, coef.u, coef.c_offset, YUV_SHIFT + 2, u + (size_t)(line / 2) * cw);
+        yuv_p_dot(sr, sg, sb, cw, coef.v, coef.c_offset, YUV_SHIFT + 2, v + (size_t)(line / 2) * cw);
+    }
+
+    free(work);
+
+    return 0;
+}
+
+static int y4m_p_header(y4m_data *y4m)
+{
+    int len;
+
+    len = fprintf(y4m->fp, "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C420jpeg XCOLORRANGE=%s\n",
+                  y4m->width, y4m->height, y4m->fps_num, y4m->fps_den,
+                  (y4m->flags & BMP_YUV_FULL) ? "FULL" : "LIMITED");
+    if (len < 0)
+        return -1;
+    bmp_p_count_write(0, len);
+
+    return 0;
+}
+
+static BMP_P_THREAD_PROC(sequence_p_loader, arg)
+{
+    sequence_data *seq = (sequence_data *)arg;
+    char filename[1024];
+    uint32_t i, s;
+    FILE *fp;
+    int state;
+
+    for (i = 0; ; i++)
+    {
+        s = i & 1;
+
+        bmp_p_mutex_lock(&seq->mutex);
+        while ((seq->state[s] != SEQUENCE_FREE) && !seq->stop)
+            bmp_p_cond_wait(&seq->cond, &seq->mutex);
+        bmp_p_mutex_unlock(&seq->mutex);
+        if (seq->stop)
+            break;
+
+        state = SEQUENCE_LOADED;
+        snprintf(filename, sizeof(filename), seq->format, seq->first + i);
+        if ((seq->count != 0) && (i >= seq->count))
+        {
+            state = SEQUENCE_END;
+        }
+        else if (seq->count == 0)
+        {
+            /* the end of an open ended sequence is not an error */
+            fp = fopen(filename, "rb");
+            if (fp == NULL)
+                state = SEQUENCE_END;
+            else
+                fclose(fp);
+        }
+        if ((state == SEQUENCE_LOADED) && (bmp_load(seq->slot[s], filename) != 0))
+            state = SEQUENCE_FAILED;
+
+        bmp_p_mutex_lock(&seq->mutex);
+        seq->state[s] = state;
+        bmp_p_cond_broadcast(&seq->cond);
+        bmp_p_mutex_unlock(&seq->mutex);
+        if (state != SEQUENCE_LOADED)
+            break;
+    }
+
+    return 0;
+}
+
+/*
+ * Public functions
+ */
+
+int bmp_to_yuv420(bmp_handle h, uint8_t *y, uint8_t *u, uint8_t *v, uint32_t flags)
+{
+    bmp_data *bmp = (bmp_data *)h;
+    bmp_view view;
+    int rc;
+    uint64_t start;
+
+    /* check argument */
+    if (bmp == 0)
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((y == 0) || (u == 0) || (v == 0))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    if (bmp_lock(h, &view, BMP_LOCK_READ) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
+    rc = yuv_p_convert(bmp, &view, y, u, v, flags);
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    bmp_unlock(h, &view);
+
+    return rc;
+}
+
+int bmp_y4m_open(bmp_y4m_handle *y, const char *filename, uint32_t fps_num, uint32_t fps_den, uint32_t flags)
+{
+    y4m_data *y4m;
+
+    /* check argument */
+    if ((y == 0) || (filename == 0) || (fps_num == 0) || (fps_den == 0))
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    y4m = (y4m_data*)malloc(sizeof(y4m_data));
+    if (y4m == 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Can't allocate y4m_data");
+        return -1;
+    }
+    memset(y4m, 0x00, sizeof(y4m_data));
+    y4m->fps_num = fps_num;
+    y4m->fps_den = fps_den;
+    y4m->flags = flags;
+
+    y4m->fp = fopen(filename, "wb");
+    if (y4m->fp == NULL)
+    {
+        bmp_p_error(0, __FUNCTION__, "Cannot open %s", filename);
+        free(y4m);
+        return -1;
+    }
+
+    *y = (bmp_y4m_handle)y4m;
+
+    return 0;
+}
+
+int bmp_y4m_write(bmp_y4m_handle y, bmp_handle h)
+{
+    y4m_data *y4m = (y4m_data *)y;
+    bmp_data *bmp = (bmp_data *)h;
+    bmp_view view;
+    size_t luma, chroma;
+    int rc;
+    uint64_t start;
+
+    /* check argument */
+    if ((y4m == 0) || (bmp == 0))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    if (bmp_lock(h, &view, BMP_LOCK_READ) != 0)
+        return -1;
+
+    start = bmp_p_span_begin();
+
+    /* the first frame decides the stream size */
+    if (y4m->width == 0)
+    {
+        y4m->width = view.width;
+        y4m->height = view.height;
+        y4m->frame_size = (size_t)view.width * view.height +
+                          2 * (size_t)((view.width + 1) / 2) * ((view.height + 1) / 2);
+        y4m->frame = (uint8_t*)malloc(y4m->frame_size);
+        if ((y4m->frame == 0) || (y4m_p_header(y4m) != 0))
+        {
+            bmp_p_error(bmp, __FUNCTION__, "Can't start the stream");
+            /* a retry allocates the frame again */
+            free(y4m->frame);
+            y4m->frame = 0;
+            y4m->width = 0;
+            bmp_unlock(h, &view);
+            return -1;
+        }
+    }
+    if ((view.width != y4m->width) || (view.height != y4m->height))
+    {
+        bmp_p_error(bmp, __FUNCTION__, "Error frame size %dx%d != %dx%d",
+                    view.width, view.height, y4m->width, y4m->height);
+        bmp_unlock(h, &view);
+        return -1;
+    }
+
+    luma = (size_t)view.width * view.height;
+    chroma = (size_t)((view.width + 1) / 2) * ((view.height + 1) / 2);
+    rc = yuv_p_convert(bmp, &view, y4m->frame, y4m->frame + luma, y4m->frame + luma + chroma, y4m->flags);
+    bmp_unlock(h, &view);
+
+    if (rc == 0)
+    {
+        if ((fwrite("FRAME\n", 1, 6, y4m->fp) != 6) ||
+            (fwrite(y4m->frame, 1, y4m->frame_size, y4m->fp) != y4m->frame_size))
+        {
+            bmp_p_error(bmp, __FUNCTION__, "Write error");
+            rc = -1;
+        }
+        else
+        {
+            bmp_p_count_write(bmp, (uint32_t)(6 + y4m->frame_size));
+        }
+    }
+
+    bmp_p_span_end(bmp, __FUNCTION__, start);
+
+    return rc;
+}
+
+int bmp_y4m_write_sequence(bmp_y4m_handle y, const char *format, uint32_t first, uint32_t count)
+{
+    sequence_data seq;
+    bmp_p_thread loader;
+    uint32_t i, s;
+    int state, rc = 0;
+
+    /* check argument */
+    if ((y == 0) || (format == 0))
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    memset(&seq, 0x00, sizeof(sequence_data));
+    seq.format = format;
+    seq.first = first;
+    seq.count = count;
+    if ((bmp_open(&seq.slot[0], 0) != 0) || (bmp_open(&seq.slot[1], 0) != 0))
+    {
+        if (seq.slot[0])
+            bmp_close(seq.slot[0]);
+        return -1;
+    }
+    bmp_p_mutex_init(&seq.mutex);
+    bmp_p_cond_init(&seq.cond);
+
+    if (bmp_p_thread_create(&loader, sequence_p_loader, &seq) != 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Can't create loader thread");
+        rc = -1;
+    }
+    else
+    {
+        /* write frame i while the loader reads frame i + 1 into the other slot */
+        for (i = 0; ; i++)
+        {
+            s = i & 1;
+
+            bmp_p_mutex_lock(&seq.mutex);
+            while (seq.state[s] == SEQUENCE_FREE)
+                bmp_p_cond_wait(&seq.cond, &seq.mutex);
+            state = seq.state[s];
+            bmp_p_mutex_unlock(&seq.mutex);
+
+            if (state == SEQUENCE_END)
+                break;
+            if (state == SEQUENCE_FAILED)
+            {
+                rc = -1;
+                break;
+            }
+
+            rc = bmp_y4m_write(y, seq.slot[s]);
+
+            bmp_p_mutex_lock(&seq.mutex);
+            seq.state[s] = SEQUENCE_FREE;
+            bmp_p_cond_broadcast(&seq.cond);
+            bmp_p_mutex_unlock(&seq.mutex);
+            if (rc != 0)
+                break;
+        }
+
+        bmp_p_mutex_lock(&seq.mutex);
+        seq.stop = 1;
+        bmp_p_cond_broadcast(&seq.cond);
+        bmp_p_mutex_unlock(&seq.mutex);
+        bmp_p_thread_join(loader);
+    }
+
+    bmp_p_cond_destroy(&seq.cond);
+    bmp_p_mutex_destroy(&seq.mutex);
+    bmp_close(seq.slot[0]);
+    bmp_close(seq.slot[1]);
+
+    return rc;
+}
+
+int bmp_y4m_close(bmp_y4m_handle y)
+{
+    y4m_data *y4m = (y4m_data *)y;
+    int rc = 0;
+
+    /* check argument */
+    if (y4m == 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    if (fclose(y4m->fp) != 0)
+    {
+        bmp_p_error(0, __FUNCTION__, "Write error");
+        rc = -1;
+    }
+    if (y4m->frame)
+        free(y4m->frame);
+    free(y4m);
+
+    return rc;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2002-2012 Hiroaki Inaba
+ *
+ * RGB to YUV 4:2:0 conversion and Y4M (YUV4MPEG2) output for the bmp library.
+ */
+
+#ifndef BMP_YUV_H
+#define BMP_YUV_H
+
+#include "bmp.h"
+
+/* color matrix and range.  The default is BT.601 limited (16-235) range. */
+#define BMP_YUV_BT601   0x00
+#define BMP_YUV_BT709   0x01
+#define BMP_YUV_FULL    0x10        /* full (0-255) range */
+
+/*
+ * Convert the image of h to planar Y, U (Cb) and V (Cr).
+ * The Y plane is width x height, U and V are (width+1)/2 x (height+1)/2,
+ * all without padding.
+ */
+int bmp_to_yuv420(bmp_handle h, uint8_t *y, uint8_t *u, uint8_t *v, uint32_t flags);
+
+/*
+ * Y4M writer.
+ * The stream header is written with the size of the first frame; the
+ * following frames must have the same size.  fps is fps_num / fps_den.
+ */
+typedef uint32_t* bmp_y4m_handle;
+
+int bmp_y4m_open(bmp_y4m_handle *y, const char *filename, uint32_t fps_num, uint32_t fps_den, uint32_t flags);
+int bmp_y4m_write(bmp_y4m_handle y, bmp_handle h);
+int bmp_y4m_close(bmp_y4m_handle y);
+
+/*
+ * Append numbered bmp files to the stream.  format is a printf format that
+ * takes the frame number, e.g. "frame_%04u.bmp".  Frames first,
+ * first + 1, ... are written; count = 0 writes until a file is missing.
+ * The next file is loaded by a second thread while the current one is
+ * converted and written.
+ */
+int bmp_y4m_write_sequence(bmp_y4m_handle y, const char *format, uint32_t first, uint32_t count);
+
+#endif /* BMP_YUV_H */
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Test program for wav library.
+ * It converts a wav file to 16, 24 or 32 bit integer or 32 bit float
+ * samples.  Dither is added when bits are dropped.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "wav.h"
+#include "wav_convert.h"
+
+int main(int argc, char* argv[])
+{
+    wav_handle src, dst;
+    uint32_t bits, format, dither = 1;
+    int rc;
+
+    if (argc != 4) {
+        printf("usage: wav_bits 16|24|32|float input output\n");
+        return -1;
+    }
+
+    format = WAV_FORMAT_PCM;
+    if (strcmp(argv[1], "float") == 0) {
+        bits = 32;
+        format = WAV_FORMAT_FLOAT;
+    }
+    else if (sscanf(argv[1], "%u", &bits) != 1) {
+        printf("usage: wav_bits 16|24|32|float input output\n");
+        return -1;
+    }
+
+    if (wav_open(&src, argv[2]) != 0)
+        return 1;
+    wav_open(&dst, 0);
+
+    rc = wav_convert(dst, src, bits, format, &dither);
+    if (rc == 0)
+        rc = wav_save(dst, argv[3]);
+
+    wav_close(dst);
+    wav_close(src);
+
+    return (rc == 0) ? 0 : 1;
+}
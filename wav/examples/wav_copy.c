@@ -8,12 +8,14 @@
 #include <stdio.h>
 #include "wav.h"
 
+#define BLOCK_FRAMES 4096
+
 int main(void)
 {
     wav_handle h0, h1;
     wav_config config;
-    int n, ch;
-    uint16_t data;
+    uint32_t n, count;
+    uint8_t block[BLOCK_FRAMES * 8];
 
     /* Open and load wav file */
     wav_open(&h0, "..\\examples\\sample.wav");
@@ -26,12 +28,13 @@ int main(void)
     wav_open(&h1, 0);
     wav_set_config(h1, &config);
 
-    /* Copy each sample */
-    for (ch = 0; ch < config.channels; ch++) {
-        for (n = 0; n < config.size; n++) {
-            wav_get_data(h0, ch, n, &data);
-            wav_set_data(h1, ch, n, data);
-        }
+    /* Copy frames in blocks (up to 8 bytes per frame) */
+    count = sizeof(block) / (config.channels * (config.bits_per_sample / 8));
+    for (n = 0; n < config.size; n += count) {
+        if (count > config.size - n)
+            count = config.size - n;
+        wav_read_frames(h0, n, count, block);
+        wav_write_frames(h1, n, count, block);
     }
 
     /* Save to a wav file */
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Test program for wav library.
+ * It mixes a wav file down (or up) to the given number of channels with
+ * the default gains for their speakers, e.g. 5.1 to stereo.
+ */
+
+#include <stdio.h>
+#include "wav.h"
+#include "wav_remix.h"
+
+int main(int argc, char* argv[])
+{
+    wav_handle src, dst;
+    uint32_t channels;
+    int rc;
+
+    if ((argc != 4) || (sscanf(argv[1], "%u", &channels) != 1)) {
+        printf("usage: wav_downmix channels input output\n");
+        return -1;
+    }
+
+    if (wav_open(&src, argv[2]) != 0)
+        return 1;
+    wav_open(&dst, 0);
+
+    rc = wav_remix(dst, src, channels, 0, 0);
+    if (rc == 0)
+        rc = wav_save(dst, argv[3]);
+
+    wav_close(dst);
+    wav_close(src);
+
+    return (rc == 0) ? 0 : 1;
+}
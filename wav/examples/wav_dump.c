@@ -12,8 +12,8 @@ int main(int argc, char* argv[])
 {
     wav_handle h;
     wav_config config;
-    int n, ch;
-    uint16_t data;
+    const uint8_t *frame;
+    uint32_t n, ch, stride;
 
     if (argc != 2) {
         printf("usage: wav_dump filename\n");
@@ -27,10 +27,16 @@ int main(int argc, char* argv[])
     printf("bits_per_sample = %d\n", config.bits_per_sample);
     printf("size            = %d\n", config.size);
 
-    for (n = 0; n < config.size; n++) {
+    if (config.size == 0)
+        return 0;
+
+    frame = wav_frame_data(h, 0, &stride);
+    for (n = 0; n < config.size; n++, frame += stride) {
         for (ch = 0; ch < config.channels; ch++) {
-            wav_get_data(h, ch, n, &data);
-            printf("%d  ", data);
+            if (config.bits_per_sample == 8)
+                printf("%d  ", frame[ch]);
+            else
+                printf("%d  ", ((const uint16_t*)frame)[ch]);
         }
         putchar('\n');
     }
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Test program for the C++ wav layer.
+ * It open a 16 bits/sample wav file and save it at half volume.
+ */
+
+#include <iostream>
+#include "wav.hpp"
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    const char *filename = (argc == 2) ? argv[1] : "..\\examples\\sample.wav";
+
+    try {
+        wav::Audio<wav::pcm_s16> audio(filename);
+
+        wav::gain(audio, 0.5f);
+        audio.save("wav_gain.wav");
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Test program for wav library.
+ * It reads a wav file of any length block by block and prints the peak
+ * level of each channel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "wav.h"
+#include "wav_stream.h"
+
+#define BLOCK_FRAMES    4096
+#define MAX_CHANNELS    16
+
+int main(int argc, char* argv[])
+{
+    wav_reader_handle r;
+    wav_config config;
+    uint8_t *block;
+    uint32_t got, i, ch;
+    int peak[MAX_CHANNELS] = { 0 };
+    int v;
+
+    if (argc != 2) {
+        printf("usage: wav_peak filename\n");
+        return -1;
+    }
+
+    if (wav_reader_open(&r, argv[1], BLOCK_FRAMES) != 0)
+        return 1;
+    wav_reader_get_config(r, &config);
+    if (config.channels > MAX_CHANNELS) {
+        wav_reader_close(r);
+        return 1;
+    }
+
+    block = (uint8_t*)malloc(BLOCK_FRAMES * config.channels * (config.bits_per_sample / 8));
+    if (block == 0) {
+        wav_reader_close(r);
+        return 1;
+    }
+
+    while ((wav_reader_read(r, block, BLOCK_FRAMES, &got) == 0) && (got > 0)) {
+        for (i = 0; i < got * config.channels; i++) {
+            if (config.bits_per_sample == 8)
+                v = abs(block[i] - 128) * 256;
+            else
+                v = abs(((int16_t*)block)[i]);
+            ch = i % config.channels;
+            if (v > peak[ch])
+                peak[ch] = v;
+        }
+    }
+
+    for (ch = 0; ch < config.channels; ch++)
+        printf("channel %d peak = %d\n", ch, peak[ch]);
+
+    free(block);
+    wav_reader_close(r);
+
+    return 0;
+}
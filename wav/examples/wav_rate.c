@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Test program for wav library.
+ * It converts a wav file to another sample rate.  The sample format is
+ * kept.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "wav.h"
+#include "wav_resample.h"
+
+int main(int argc, char* argv[])
+{
+    wav_handle src, dst;
+    uint32_t hz, quality = WAV_RESAMPLE_MEDIUM;
+    int rc;
+
+    if (argc == 5) {
+        if (strcmp(argv[2], "fast") == 0)
+            quality = WAV_RESAMPLE_FAST;
+        else if (strcmp(argv[2], "best") == 0)
+            quality = WAV_RESAMPLE_BEST;
+        else if (strcmp(argv[2], "medium") != 0)
+            argc = 0;
+    }
+    if ((argc != 4 && argc != 5) || sscanf(argv[1], "%u", &hz) != 1) {
+        printf("usage: wav_rate hz [fast|medium|best] input output\n");
+        return -1;
+    }
+
+    if (wav_open(&src, argv[argc - 2]) != 0)
+        return 1;
+    wav_open(&dst, 0);
+
+    rc = wav_resample(dst, src, hz, quality);
+    if (rc == 0)
+        rc = wav_save(dst, argv[argc - 1]);
+
+    wav_close(dst);
+    wav_close(src);
+
+    return (rc == 0) ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Test program for wav library.
+ * It writes a 440Hz stereo tone of the given length block by block.
+ * The header is updated every second, so the file can be played while
+ * it is being written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "wav.h"
+#include "wav_stream.h"
+
+#define BLOCK_FRAMES    1024
+#define SAMPLEHZ        44100
+
+int main(int argc, char* argv[])
+{
+    wav_writer_handle w;
+    wav_config config;
+    int16_t block[BLOCK_FRAMES * 2];
+    uint32_t frames, n, i, t;
+
+    if (argc != 3) {
+        printf("usage: wav_tone seconds output\n");
+        return -1;
+    }
+
+    config.channels = 2;
+    config.samplehz = SAMPLEHZ;
+    config.bits_per_sample = 16;
+    config.size = 0;
+    if (wav_writer_open(&w, argv[2], &config, WAV_WRITER_THREAD) != 0)
+        return 1;
+    wav_writer_set_sync(w, SAMPLEHZ);
+
+    frames = (uint32_t)atoi(argv[1]) * SAMPLEHZ;
+    for (t = 0; t < frames; t += n) {
+        n = frames - t;
+        if (n > BLOCK_FRAMES)
+            n = BLOCK_FRAMES;
+        for (i = 0; i < n; i++) {
+            block[i * 2] = (int16_t)(16000 * sin(2 * 3.14159265358979 * 440 * (t + i) / SAMPLEHZ));
+            block[i * 2 + 1] = block[i * 2];
+        }
+        if (wav_writer_write(w, block, n) != 0)
+            break;
+    }
+
+    return (wav_writer_close(w) == 0) ? 0 : 1;
+}
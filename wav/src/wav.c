@@ -6,7 +6,20 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
 #include "wav.h"
+#include "wav_p.h"
+#include "wav_thread.h"
+#ifdef WAV_P_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 /*
  * WAVE related structure
@@ -24,19 +37,178 @@ typedef struct {
 } PCMWAVEFORMAT;
 #pragma pack()
 
+#define WAVE_FORMAT_EXTENSIBLE  0xfffe
+
+/* KSDATAFORMAT_SUBTYPE_PCM/IEEE_FLOAT after the format tag (4 bytes) */
+static const uint8_t wav_p_subformat[12] = { 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+
 /*
- * wav internal data
+ * chunk index data
  */
 typedef struct {
-    uint8_t *image;
-    uint32_t image_size;
-    wav_config config;
-} wav_data;
+    FILE *fp;
+    wav_chunk *chunk;
+    uint32_t count;
+    uint32_t capacity;
+} chunks_data;
+
+
+/*
+ * diagnostics
+ * The counters and the handlers are shared by all threads (pool, stream,
+ * cache and watcher threads), so they are only used under diag_mutex.
+ */
+static wav_p_mutex diag_mutex;
+static wav_p_once diag_once = WAV_P_ONCE_INIT;
+static wav_error_handler error_handler = wav_stderr_handler;
+static void *error_ctx = 0;
+static wav_span_handler span_handler = 0;
+static void *span_ctx = 0;
+static wav_stats global_stats;
 
 /*
  * private functions
  */
 
+static void wav_p_diag_init(void)
+{
+    wav_p_mutex_init(&diag_mutex);
+}
+
+static void wav_p_diag_lock(void)
+{
+    wav_p_call_once(&diag_once, wav_p_diag_init);
+    wav_p_mutex_lock(&diag_mutex);
+}
+
+static void wav_p_diag_unlock(void)
+{
+    wav_p_mutex_unlock(&diag_mutex);
+}
+
+/* report an error to the registered handler */
+void wav_p_error(wav_data *wav, const char *func, const char *format, ...)
+{
+    wav_error_handler handler;
+    void *ctx;
+    char msg[256];
+    va_list ap;
+
+    wav_p_diag_lock();
+    global_stats.errors++;
+    if (wav)
+        wav->stats.errors++;
+    handler = error_handler;
+    ctx = error_ctx;
+    wav_p_diag_unlock();
+
+    if (handler == 0)
+        return;
+
+    va_start(ap, format);
+    vsnprintf(msg, sizeof(msg), format, ap);
+    va_end(ap);
+
+    handler((wav_handle)wav, func, msg, ctx);
+}
+
+/* report an out of range sample access */
+static void wav_p_reject(wav_data *wav, const char *func, const char *name, int value, uint32_t limit)
+{
+    wav_p_diag_lock();
+    global_stats.rejected++;
+    wav->stats.rejected++;
+    wav_p_diag_unlock();
+    wav_p_error(wav, func, "Error %s=%d is out of range. It must be within [0, %d]", name, value, limit-1);
+}
+
+/* return monotonic time in nsec */
+static uint64_t wav_p_clock(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/* start a timing span.  The clock is only read when a handler is set. */
+uint64_t wav_p_span_begin(void)
+{
+    wav_span_handler handler;
+
+    wav_p_diag_lock();
+    handler = span_handler;
+    wav_p_diag_unlock();
+
+    return handler ? wav_p_clock() : 0;
+}
+
+void wav_p_span_end(wav_data *wav, const char *func, uint64_t start)
+{
+    wav_span_handler handler;
+    void *ctx;
+
+    wav_p_diag_lock();
+    handler = span_handler;
+    ctx = span_ctx;
+    wav_p_diag_unlock();
+
+    if (handler)
+        handler((wav_handle)wav, func, wav_p_clock() - start, ctx);
+}
+
+/* update the I/O counters.  wav may be 0 for I/O without a handle. */
+void wav_p_count_read(wav_data *wav, uint32_t bytes)
+{
+    wav_p_diag_lock();
+    global_stats.bytes_read += bytes;
+    if (wav)
+        wav->stats.bytes_read += bytes;
+    wav_p_diag_unlock();
+}
+
+void wav_p_count_write(wav_data *wav, uint32_t bytes)
+{
+    wav_p_diag_lock();
+    global_stats.bytes_written += bytes;
+    if (wav)
+        wav->stats.bytes_written += bytes;
+    wav_p_diag_unlock();
+}
+
+void wav_p_count_load(wav_data *wav)
+{
+    wav_p_diag_lock();
+    global_stats.loads++;
+    if (wav)
+        wav->stats.loads++;
+    wav_p_diag_unlock();
+}
+
+void wav_p_count_save(wav_data *wav)
+{
+    wav_p_diag_lock();
+    global_stats.saves++;
+    if (wav)
+        wav->stats.saves++;
+    wav_p_diag_unlock();
+}
+
+void wav_p_count_allocation(wav_data *wav)
+{
+    wav_p_diag_lock();
+    global_stats.allocations++;
+    if (wav)
+        wav->stats.allocations++;
+    wav_p_diag_unlock();
+}
+
 /* return image buffer size that needs in wav_data->image */
 static uint32_t wav_p_image_size(wav_config *config)
 {
@@ -46,421 +218,2174 @@ static uint32_t wav_p_image_size(wav_config *config)
     return size;
 }
 
+/* free the sample buffer, or drop the reference if it is not owned */
+static void wav_p_free_image(wav_data *wav)
+{
+    if (wav->shared)
+        wav->shared_release(wav->shared);
+    else if (wav->image && !wav->image_external)
+        free(wav->image);
+    wav->shared = 0;
+    wav->image_external = 0;
+}
+
+/*
+ * Copy a shared sample buffer before it is modified.  Views of a read lock
+ * still point at the shared buffer, so it can't be dropped while locked.
+ */
+static int wav_p_unshare(wav_data *wav, const char *func)
+{
+    uint8_t *image;
+
+    if (wav->locks)
+    {
+        wav_p_error(wav, func, "Error shared wav is locked for read");
+        return -1;
+    }
+
+    image = (uint8_t*)malloc(wav->image_size);
+    if (image == 0)
+    {
+        wav_p_error(wav, func, "Can't allocate wav buffer");
+        return -1;
+    }
+    memcpy(image, wav->image, wav->image_size);
+    wav_p_count_allocation(wav);
+
+    wav_p_free_image(wav);
+    wav->image = image;
+
+    return 0;
+}
+
 /* return image buffer size that needs in wav_data->image */
 static void wav_p_release_image(wav_data *wav)
 {
-    if (wav->image)
-        free(wav->image);
+    wav_p_free_image(wav);
 
     wav->image = 0;
     wav->image_size = 0;
     wav->config.channels = 0;
     wav->config.samplehz = 0;
     wav->config.bits_per_sample = 0;
+    wav->format = WAV_FORMAT_PCM;
+    wav->channel_mask = 0;
+
+    return;
+}
+
+/*
+ * interleave / deinterleave
+ * Planar channel ch starts at src (dst) + ch * plane_stride.  The SSE2
+ * kernels do whole blocks of frames and return how many they did; the
+ * rest goes through the generic loops.
+ */
+
+/* generic loops, one channel at a time */
+static void wav_p_interleave_any(uint8_t *dst, const uint8_t *src, size_t plane_stride,
+                                 uint32_t channels, uint32_t bytes, uint32_t count)
+{
+    size_t frame_size = (size_t)channels * bytes;
+    const uint8_t *s;
+    uint8_t *d;
+    uint32_t ch, i;
+
+    for (ch = 0; ch < channels; ch++)
+    {
+        s = src + ch * plane_stride;
+        d = dst + (size_t)ch * bytes;
+        if (bytes == 1)
+            for (i = 0; i < count; i++)
+                d[i * frame_size] = s[i];
+        else if (bytes == 2)
+            for (i = 0; i < count; i++)
+                *(uint16_t*)(d + i * frame_size) = ((const uint16_t*)s)[i];
+        else if (bytes == 4)
+            for (i = 0; i < count; i++)
+                *(uint32_t*)(d + i * frame_size) = ((const uint32_t*)s)[i];
+        else
+            for (i = 0; i < count; i++)
+                memcpy(d + i * frame_size, s + (size_t)i * bytes, bytes);
+    }
+}
+
+static void wav_p_deinterleave_any(uint8_t *dst, size_t plane_stride, const uint8_t *src,
+                                   uint32_t channels, uint32_t bytes, uint32_t count)
+{
+    size_t frame_size = (size_t)channels * bytes;
+    const uint8_t *s;
+    uint8_t *d;
+    uint32_t ch, i;
+
+    for (ch = 0; ch < channels; ch++)
+    {
+        s = src + (size_t)ch * bytes;
+        d = dst + ch * plane_stride;
+        if (bytes == 1)
+            for (i = 0; i < count; i++)
+                d[i] = s[i * frame_size];
+        else if (bytes == 2)
+            for (i = 0; i < count; i++)
+                ((uint16_t*)d)[i] = *(const uint16_t*)(s + i * frame_size);
+        else if (bytes == 4)
+            for (i = 0; i < count; i++)
+                ((uint32_t*)d)[i] = *(const uint32_t*)(s + i * frame_size);
+        else
+            for (i = 0; i < count; i++)
+                memcpy(d + (size_t)i * bytes, s + i * frame_size, bytes);
+    }
+}
+
+#ifdef WAV_P_SSE2
+#define WAV_P_LOAD(p)       _mm_loadu_si128((const __m128i*)(p))
+#define WAV_P_STORE(p, x)   _mm_storeu_si128((__m128i*)(p), (x))
+
+/* 8x8 16 bit transpose; it turns 8 frames of 8 channels into 8 planes and back */
+static void wav_p_transpose16(__m128i *r)
+{
+    __m128i t0, t1, t2, t3, t4, t5, t6, t7;
+    __m128i u0, u1, u2, u3, u4, u5, u6, u7;
+
+    t0 = _mm_unpacklo_epi16(r[0], r[1]);
+    t1 = _mm_unpackhi_epi16(r[0], r[1]);
+    t2 = _mm_unpacklo_epi16(r[2], r[3]);
+    t3 = _mm_unpackhi_epi16(r[2], r[3]);
+    t4 = _mm_unpacklo_epi16(r[4], r[5]);
+    t5 = _mm_unpackhi_epi16(r[4], r[5]);
+    t6 = _mm_unpacklo_epi16(r[6], r[7]);
+    t7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+    u0 = _mm_unpacklo_epi32(t0, t2);
+    u1 = _mm_unpackhi_epi32(t0, t2);
+    u2 = _mm_unpacklo_epi32(t1, t3);
+    u3 = _mm_unpackhi_epi32(t1, t3);
+    u4 = _mm_unpacklo_epi32(t4, t6);
+    u5 = _mm_unpackhi_epi32(t4, t6);
+    u6 = _mm_unpacklo_epi32(t5, t7);
+    u7 = _mm_unpackhi_epi32(t5, t7);
+
+    r[0] = _mm_unpacklo_epi64(u0, u4);
+    r[1] = _mm_unpackhi_epi64(u0, u4);
+    r[2] = _mm_unpacklo_epi64(u1, u5);
+    r[3] = _mm_unpackhi_epi64(u1, u5);
+    r[4] = _mm_unpacklo_epi64(u2, u6);
+    r[5] = _mm_unpackhi_epi64(u2, u6);
+    r[6] = _mm_unpacklo_epi64(u3, u7);
+    r[7] = _mm_unpackhi_epi64(u3, u7);
+}
+
+/* 4x4 32 bit transpose */
+static void wav_p_transpose32(__m128i *r)
+{
+    __m128i t0, t1, t2, t3;
+
+    t0 = _mm_unpacklo_epi32(r[0], r[1]);
+    t1 = _mm_unpacklo_epi32(r[2], r[3]);
+    t2 = _mm_unpackhi_epi32(r[0], r[1]);
+    t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+    r[0] = _mm_unpacklo_epi64(t0, t1);
+    r[1] = _mm_unpackhi_epi64(t0, t1);
+    r[2] = _mm_unpacklo_epi64(t2, t3);
+    r[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+/*
+ * 8 frames of 16 bit samples per pass.  Other than 2 and 4 channels the
+ * frames go through a transpose with 16 byte loads/stores per frame; they
+ * run into the next frames for fewer than 8 channels, so the last frames
+ * of the buffer are left to the generic loops.
+ */
+static uint32_t wav_p_interleave16(uint8_t *dst, const uint8_t *src, size_t plane_stride, uint32_t channels, uint32_t count)
+{
+    __m128i r[8], ab0, ab1, cd0, cd1;
+    uint32_t i, ch, frame_size = channels * 2;
+    uint32_t tail = ((channels == 2) || (channels == 4) || (channels == 8)) ? 0 : (16 + frame_size - 1) / frame_size;
+
+    for (ch = channels; ch < 8; ch++)
+        r[ch] = _mm_setzero_si128();
+
+    for (i = 0; i + 8 + tail <= count; i += 8, src += 16, dst += frame_size * 8)
+    {
+        for (ch = 0; ch < channels; ch++)
+            r[ch] = WAV_P_LOAD(src + ch * plane_stride);
+
+        if (channels == 2)
+        {
+            WAV_P_STORE(dst, _mm_unpacklo_epi16(r[0], r[1]));
+            WAV_P_STORE(dst + 16, _mm_unpackhi_epi16(r[0], r[1]));
+        }
+        else if (channels == 4)
+        {
+            ab0 = _mm_unpacklo_epi16(r[0], r[1]);
+            ab1 = _mm_unpackhi_epi16(r[0], r[1]);
+            cd0 = _mm_unpacklo_epi16(r[2], r[3]);
+            cd1 = _mm_unpackhi_epi16(r[2], r[3]);
+            WAV_P_STORE(dst, _mm_unpacklo_epi32(ab0, cd0));
+            WAV_P_STORE(dst + 16, _mm_unpackhi_epi32(ab0, cd0));
+            WAV_P_STORE(dst + 32, _mm_unpacklo_epi32(ab1, cd1));
+            WAV_P_STORE(dst + 48, _mm_unpackhi_epi32(ab1, cd1));
+        }
+        else
+        {
+            wav_p_transpose16(r);
+            for (ch = 0; ch < 8; ch++)
+                WAV_P_STORE(dst + ch * frame_size, r[ch]);
+        }
+    }
+
+    return i;
+}
+
+static uint32_t wav_p_deinterleave16(uint8_t *dst, size_t plane_stride, const uint8_t *src, uint32_t channels, uint32_t count)
+{
+    __m128i r[8], t0, t1, t2, t3, u0, u1, u2, u3;
+    uint32_t i, ch, frame_size = channels * 2;
+    uint32_t tail = ((channels == 2) || (channels == 4) || (channels == 8)) ? 0 : (16 + frame_size - 1) / frame_size;
+
+    for (i = 0; i + 8 + tail <= count; i += 8, src += frame_size * 8, dst += 16)
+    {
+        if (channels == 2)
+        {
+            /* a0 b0 a1 b1 .. -> a0 a4 b0 b4 .. -> a0 a2 a4 a6 b0 .. -> a0 a1 a2 .. */
+            r[0] = WAV_P_LOAD(src);
+            r[1] = WAV_P_LOAD(src + 16);
+            t0 = _mm_unpacklo_epi16(r[0], r[1]);
+            t1 = _mm_unpackhi_epi16(r[0], r[1]);
+            u0 = _mm_unpacklo_epi16(t0, t1);
+            u1 = _mm_unpackhi_epi16(t0, t1);
+            r[0] = _mm_unpacklo_epi16(u0, u1);
+            r[1] = _mm_unpackhi_epi16(u0, u1);
+        }
+        else if (channels == 4)
+        {
+            for (ch = 0; ch < 4; ch++)
+                r[ch] = WAV_P_LOAD(src + ch * 16);
+            t0 = _mm_unpacklo_epi16(r[0], r[1]);
+            t1 = _mm_unpackhi_epi16(r[0], r[1]);
+            t2 = _mm_unpacklo_epi16(r[2], r[3]);
+            t3 = _mm_unpackhi_epi16(r[2], r[3]);
+            u0 = _mm_unpacklo_epi16(t0, t1);
+            u1 = _mm_unpackhi_epi16(t0, t1);
+            u2 = _mm_unpacklo_epi16(t2, t3);
+            u3 = _mm_unpackhi_epi16(t2, t3);
+            r[0] = _mm_unpacklo_epi64(u0, u2);
+            r[1] = _mm_unpackhi_epi64(u0, u2);
+            r[2] = _mm_unpacklo_epi64(u1, u3);
+            r[3] = _mm_unpackhi_epi64(u1, u3);
+        }
+        else
+        {
+            for (ch = 0; ch < 8; ch++)
+                r[ch] = WAV_P_LOAD(src + ch * frame_size);
+            wav_p_transpose16(r);
+        }
+
+        for (ch = 0; ch < channels; ch++)
+            WAV_P_STORE(dst + ch * plane_stride, r[ch]);
+    }
+
+    return i;
+}
+
+/* 4 frames of 32 bit samples per pass; a frame is one or two 16 byte vectors */
+static uint32_t wav_p_interleave32(uint8_t *dst, const uint8_t *src, size_t plane_stride, uint32_t channels, uint32_t count)
+{
+    __m128i r[8];
+    uint32_t i, ch, frame_size = channels * 4;
+    uint32_t tail = ((channels == 2) || (channels == 4) || (channels == 8)) ? 0 : (16 + frame_size - 1) / frame_size;
+
+    for (ch = channels; ch < 8; ch++)
+        r[ch] = _mm_setzero_si128();
+
+    for (i = 0; i + 4 + tail <= count; i += 4, src += 16, dst += frame_size * 4)
+    {
+        for (ch = 0; ch < channels; ch++)
+            r[ch] = WAV_P_LOAD(src + ch * plane_stride);
+
+        if (channels == 2)
+        {
+            WAV_P_STORE(dst, _mm_unpacklo_epi32(r[0], r[1]));
+            WAV_P_STORE(dst + 16, _mm_unpackhi_epi32(r[0], r[1]));
+            continue;
+        }
+
+        /* channels 0-3 and 4-7 are the two halves of each frame */
+        wav_p_transpose32(r);
+        if (channels > 4)
+            wav_p_transpose32(r + 4);
+        for (ch = 0; ch < 4; ch++)
+        {
+            WAV_P_STORE(dst + ch * frame_size, r[ch]);
+            if (channels > 4)
+                WAV_P_STORE(dst + ch * frame_size + 16, r[ch + 4]);
+        }
+    }
+
+    return i;
+}
+
+static uint32_t wav_p_deinterleave32(uint8_t *dst, size_t plane_stride, const uint8_t *src, uint32_t channels, uint32_t count)
+{
+    __m128i r[8], t0, t1;
+    uint32_t i, ch, frame_size = channels * 4;
+    uint32_t tail = ((channels == 2) || (channels == 4) || (channels == 8)) ? 0 : (16 + frame_size - 1) / frame_size;
+
+    for (i = 0; i + 4 + tail <= count; i += 4, src += frame_size * 4, dst += 16)
+    {
+        if (channels == 2)
+        {
+            /* a0 b0 a1 b1, a2 b2 a3 b3 -> a0 a2 b0 b2, a1 a3 b1 b3 -> a0 a1 a2 a3, .. */
+            r[0] = WAV_P_LOAD(src);
+            r[1] = WAV_P_LOAD(src + 16);
+            t0 = _mm_unpacklo_epi32(r[0], r[1]);
+            t1 = _mm_unpackhi_epi32(r[0], r[1]);
+            r[0] = _mm_unpacklo_epi32(t0, t1);
+            r[1] = _mm_unpackhi_epi32(t0, t1);
+        }
+        else
+        {
+            for (ch = 0; ch < 4; ch++)
+            {
+                r[ch] = WAV_P_LOAD(src + ch * frame_size);
+                if (channels > 4)
+                    r[ch + 4] = WAV_P_LOAD(src + ch * frame_size + 16);
+            }
+            wav_p_transpose32(r);
+            if (channels > 4)
+                wav_p_transpose32(r + 4);
+        }
+
+        for (ch = 0; ch < channels; ch++)
+            WAV_P_STORE(dst + ch * plane_stride, r[ch]);
+    }
+
+    return i;
+}
+#endif
+
+static void wav_p_interleave(uint8_t *dst, const uint8_t *src, size_t plane_stride,
+                             uint32_t channels, uint32_t bytes, uint32_t count)
+{
+    uint32_t done = 0;
+
+#ifdef WAV_P_SSE2
+    if ((channels >= 2) && (channels <= 8))
+    {
+        if (bytes == 2)
+            done = wav_p_interleave16(dst, src, plane_stride, channels, count);
+        else if (bytes == 4)
+            done = wav_p_interleave32(dst, src, plane_stride, channels, count);
+    }
+#endif
+    if (done < count)
+        wav_p_interleave_any(dst + (size_t)done * channels * bytes, src + (size_t)done * bytes,
+                             plane_stride, channels, bytes, count - done);
+}
+
+static void wav_p_deinterleave(uint8_t *dst, size_t plane_stride, const uint8_t *src,
+                               uint32_t channels, uint32_t bytes, uint32_t count)
+{
+    uint32_t done = 0;
+
+#ifdef WAV_P_SSE2
+    if ((channels >= 2) && (channels <= 8))
+    {
+        if (bytes == 2)
+            done = wav_p_deinterleave16(dst, plane_stride, src, channels, count);
+        else if (bytes == 4)
+            done = wav_p_deinterleave32(dst, plane_stride, src, channels, count);
+    }
+#endif
+    if (done < count)
+        wav_p_deinterleave_any(dst + (size_t)done * bytes, plane_stride, src + (size_t)done * channels * bytes,
+                               channels, bytes, count - done);
+}
+
+/* bytes between the channel planes of a planar image */
+static size_t wav_p_plane_stride(const wav_data *wav)
+{
+    return (size_t)wav->config.size * (wav->config.bits_per_sample/8);
+}
+
+/* fill the file header written in front of the samples and return its size */
+uint32_t wav_p_make_header(const wav_config *config, uint32_t format, uint32_t channel_mask, uint32_t data_size, uint8_t *header)
+{
+    uint32_t chunkID, chunkSize, size;
+    uint16_t cbSize, validBits;
+    PCMWAVEFORMAT pwf;
+    int extensible;
+
+    extensible = (format != WAV_FORMAT_PCM) || channel_mask || (config->channels > 2) || (config->bits_per_sample > 16);
+    size = extensible ? WAV_P_HEADER_MAX : WAV_P_HEADER_SIZE;
+
+    /* 'RIFF' */
+    chunkID = CHUNK_ID('R', 'I', 'F', 'F');
+    memcpy(header + 0, &chunkID, 4);
+
+    /* chunkSize */
+    chunkSize = data_size + size - 8;
+    memcpy(header + 4, &chunkSize, 4);
+
+    /* 'WAVE' */
+    chunkID = CHUNK_ID('W', 'A', 'V', 'E');
+    memcpy(header + 8, &chunkID, 4);
+
+    /* 'fmt ' */
+    chunkID = CHUNK_ID('f', 'm', 't', ' ');
+    memcpy(header + 12, &chunkID, 4);
+
+    /* chunkSize */
+    chunkSize = size - 28;
+    memcpy(header + 16, &chunkSize, 4);
+
+    /* PCMWAVEFORMAT */
+    pwf.wFormatTag = extensible ? WAVE_FORMAT_EXTENSIBLE : 1;	// PCM
+    pwf.nChannels = config->channels;
+    pwf.nSamplesPerSec = config->samplehz;
+    pwf.nBlockAlign = config->channels * (config->bits_per_sample/8);
+    pwf.nAvgBytesPerSec = pwf.nSamplesPerSec * pwf.nBlockAlign;
+    pwf.wBitsPerSample = config->bits_per_sample;
+    memcpy(header + 20, &pwf, sizeof(PCMWAVEFORMAT));
+
+    /* Extended data */
+    cbSize = extensible ? 22 : 0;
+    memcpy(header + 36, &cbSize, 2);
+    if (extensible)
+    {
+        /* wValidBitsPerSample, dwChannelMask, SubFormat */
+        validBits = config->bits_per_sample;
+        memcpy(header + 38, &validBits, 2);
+        memcpy(header + 40, &channel_mask, 4);
+        memcpy(header + 44, &format, 4);
+        memcpy(header + 48, wav_p_subformat, 12);
+    }
+
+    /* 'data' */
+    chunkID = CHUNK_ID('d', 'a', 't', 'a');
+    memcpy(header + size - 8, &chunkID, 4);
+
+    /* chunkSize */
+    chunkSize = data_size;
+    memcpy(header + size - 4, &chunkSize, 4);
+
+    return size;
+}
+
+/* sample sizes that can be read and written */
+int wav_p_valid_format(uint32_t format, uint32_t bits_per_sample)
+{
+    if (format == WAV_FORMAT_PCM)
+        return (bits_per_sample == 8) || (bits_per_sample == 16) || (bits_per_sample == 24) || (bits_per_sample == 32);
+    if (format == WAV_FORMAT_FLOAT)
+        return (bits_per_sample == 32) || (bits_per_sample == 64);
+    return 0;
+}
+
+/* read the "fmt " chunk payload (size bytes, at least a PCMWAVEFORMAT) */
+static int wav_p_parse_fmt(wav_data *wav, const char *func, const uint8_t *fmt, uint32_t size, wav_p_header *header)
+{
+    PCMWAVEFORMAT pwf;
+    uint32_t format, mask = 0;
+
+    memcpy(&pwf, fmt, sizeof(PCMWAVEFORMAT));
+    format = pwf.wFormatTag;
+    if (format == WAVE_FORMAT_EXTENSIBLE)
+    {
+        if (size < 40)
+        {
+            wav_p_error(wav, func, "Error WAVE_FORMAT_EXTENSIBLE fmt is too short (%d)", size);
+            return -1;
+        }
+        memcpy(&mask, fmt + 20, 4);
+        memcpy(&format, fmt + 24, 4);
+        if (memcmp(fmt + 28, wav_p_subformat, 12) != 0)
+            format = 0;
+    }
+
+    if ((format != WAV_FORMAT_PCM) && (format != WAV_FORMAT_FLOAT))
+    {
+        wav_p_error(wav, func, "WAVEFORMAT.wFormatTag %d is not PCM or float", format);
+        return -1;
+    }
+    if ((pwf.nChannels == 0) || !wav_p_valid_format(format, pwf.wBitsPerSample))
+    {
+        wav_p_error(wav, func, "Error invalid fmt (format %d, channels %d, bits %d)", format, pwf.nChannels, pwf.wBitsPerSample);
+        return -1;
+    }
+
+    header->config.channels = pwf.nChannels;
+    header->config.samplehz = pwf.nSamplesPerSec;
+    header->config.bits_per_sample = pwf.wBitsPerSample;
+    header->format = format;
+    header->channel_mask = mask;
+
+    return 0;
+}
+
+/*
+ * Parse a wav file image in memory.  Chunks are walked, so "fmt " and
+ * "data" may come in any order with other chunks in between.
+ */
+int wav_p_parse_mem(wav_data *wav, const char *func, const uint8_t *buf, size_t size, wav_p_header *header)
+{
+    uint32_t data, chunkSize, fmt_size = 0;
+    const uint8_t *fmt = 0, *payload = 0;
+    size_t pos;
+
+    if ((buf == 0) || (size < 12))
+    {
+        wav_p_error(wav, func, "Error buffer is too short");
+        return -1;
+    }
+
+    /* 'RIFF' */
+    memcpy(&data, buf, 4);
+    if (data != CHUNK_ID('R', 'I', 'F', 'F')) {
+        wav_p_error(wav, func, "Can't find \"RIFF\"");
+        return -1;
+    }
+
+    /* 'WAVE' */
+    memcpy(&data, buf + 8, 4);
+    if (data != CHUNK_ID('W', 'A', 'V', 'E')) {
+        wav_p_error(wav, func, "Can't find \"WAVE\"");
+        return -1;
+    }
+
+    for (pos = 12; (pos + 8 <= size) && ((fmt == 0) || (payload == 0)); pos += 8 + chunkSize + (chunkSize & 1))
+    {
+        memcpy(&data, buf + pos, 4);
+        memcpy(&chunkSize, buf + pos + 4, 4);
+        if (chunkSize > size - pos - 8)
+            chunkSize = (uint32_t)(size - pos - 8);
+
+        if ((data == CHUNK_ID('f', 'm', 't', ' ')) && (fmt == 0) && (chunkSize >= sizeof(PCMWAVEFORMAT)))
+        {
+            fmt = buf + pos + 8;
+            fmt_size = chunkSize;
+        }
+        else if ((data == CHUNK_ID('d', 'a', 't', 'a')) && (payload == 0))
+        {
+            payload = buf + pos + 8;
+            header->data_offset = pos + 8;
+            header->data_size = chunkSize;
+        }
+    }
+
+    if (fmt == 0)
+    {
+        wav_p_error(wav, func, "Can't find \"fmt \"");
+        return -1;
+    }
+    if (wav_p_parse_fmt(wav, func, fmt, fmt_size, header) != 0)
+        return -1;
+    if (payload == 0)
+    {
+        wav_p_error(wav, func, "Can't find 'data'");
+        return -1;
+    }
+
+    header->config.size = header->data_size / (header->config.channels * (header->config.bits_per_sample/8));
+
+    return 0;
+}
+
+/*
+ * Use a sample buffer owned by someone else (wav_cache.c) as a read-only
+ * shared buffer.  release(shared) is called when the handle drops it;
+ * the first write makes a private copy.  The buffer holds interleaved
+ * samples, so the handle becomes interleaved.
+ */
+int wav_p_share(wav_data *wav, const wav_config *config, uint32_t format, uint32_t channel_mask,
+                uint8_t *image, void (*release)(void *), void *shared)
+{
+    uint32_t layout = wav->layout;
+
+    if (wav->locks)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error wav is locked");
+        return -1;
+    }
+
+    /* the shared samples are interleaved, planar gets a private copy */
+    wav_p_release_image(wav);
+    wav->config = *config;
+    wav->format = format;
+    wav->channel_mask = channel_mask;
+    wav->layout = WAV_LAYOUT_INTERLEAVED;
+    wav->image_size = wav_p_image_size(&wav->config);
+    wav->image = image;
+    wav->shared = shared;
+    wav->shared_release = release;
+
+    if (layout != WAV_LAYOUT_INTERLEAVED)
+        return wav_set_layout((wav_handle)wav, layout);
+
+    return 0;
+}
+
+/* seek to a file offset beyond 2GB */
+int wav_p_seek(FILE *fp, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static int wav_p_file_size(FILE *fp, uint64_t *size)
+{
+#ifdef _WIN32
+    __int64 end;
+
+    if (_fseeki64(fp, 0, SEEK_END) != 0)
+        return -1;
+    end = _ftelli64(fp);
+#else
+    off_t end;
+
+    if (fseeko(fp, 0, SEEK_END) != 0)
+        return -1;
+    end = ftello(fp);
+#endif
+    if (end < 0)
+        return -1;
+    *size = (uint64_t)end;
+
+    return 0;
+}
+
+/*
+ * Index all chunks after "WAVE".  Only the chunk headers are read and the
+ * payloads are skipped with seeks, so the cost does not depend on the
+ * size of LIST, bext or other metadata.  A chunk running past the end of
+ * the file (a cut off recording) is clipped and ends the walk.
+ */
+static int wav_p_walk_chunks(wav_data *wav, const char *func, chunks_data *chunks)
+{
+    uint8_t buf[12];
+    uint32_t data;
+    uint64_t pos, file_size;
+    wav_chunk *chunk;
+
+    if ((wav_p_file_size(chunks->fp, &file_size) != 0) || (wav_p_seek(chunks->fp, 0) != 0) ||
+        (fread(buf, 1, 12, chunks->fp) != 12))
+    {
+        wav_p_error(wav, func, "Can't find \"RIFF\"");
+        return -1;
+    }
+
+    /* 'RIFF' */
+    memcpy(&data, buf, 4);
+    if (data != CHUNK_ID('R', 'I', 'F', 'F')) {
+        wav_p_error(wav, func, "Can't find \"RIFF\"");
+        return -1;
+    }
+
+    /* 'WAVE' */
+    memcpy(&data, buf + 8, 4);
+    if (data != CHUNK_ID('W', 'A', 'V', 'E')) {
+        wav_p_error(wav, func, "Can't find \"WAVE\"");
+        return -1;
+    }
+
+    for (pos = 12; pos + 8 <= file_size; pos = chunk->offset + chunk->size + (chunk->size & 1))
+    {
+        if ((wav_p_seek(chunks->fp, pos) != 0) || (fread(buf, 1, 8, chunks->fp) != 8))
+            break;
+
+        if (chunks->count == chunks->capacity)
+        {
+            chunk = (wav_chunk*)realloc(chunks->chunk, sizeof(wav_chunk) * (chunks->capacity ? chunks->capacity * 2 : 16));
+            if (chunk == 0)
+            {
+                wav_p_error(wav, func, "Can't allocate chunk index");
+                return -1;
+            }
+            chunks->chunk = chunk;
+            chunks->capacity = chunks->capacity ? chunks->capacity * 2 : 16;
+        }
+
+        chunk = &chunks->chunk[chunks->count++];
+        memcpy(&chunk->id, buf, 4);
+        memcpy(&chunk->size, buf + 4, 4);
+        chunk->offset = pos + 8;
+        if (chunk->size > file_size - chunk->offset)
+        {
+            chunk->size = (uint32_t)(file_size - chunk->offset);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static const wav_chunk *wav_p_find_chunk(const chunks_data *chunks, uint32_t id)
+{
+    uint32_t i;
+
+    for (i = 0; i < chunks->count; i++)
+        if (chunks->chunk[i].id == id)
+            return &chunks->chunk[i];
+
+    return 0;
+}
+
+/*
+ * Find "fmt " and "data" anywhere in the file.  config.size is the
+ * number of whole frames in the data chunk.
+ */
+int wav_p_read_header(wav_data *wav, const char *func, FILE *fp, wav_p_header *header)
+{
+    chunks_data chunks;
+    const wav_chunk *fmt, *data;
+    uint8_t buf[40];
+    uint32_t size;
+    int rc;
+
+    memset(&chunks, 0x00, sizeof(chunks_data));
+    chunks.fp = fp;
+    rc = wav_p_walk_chunks(wav, func, &chunks);
+    if (rc != 0)
+        goto exit;
+
+    fmt = wav_p_find_chunk(&chunks, CHUNK_ID('f', 'm', 't', ' '));
+    size = fmt ? fmt->size : 0;
+    if (size > sizeof(buf))
+        size = sizeof(buf);
+    if ((size < sizeof(PCMWAVEFORMAT)) || (wav_p_seek(fp, fmt->offset) != 0) || (fread(buf, 1, size, fp) != size))
+    {
+        wav_p_error(wav, func, "Can't find \"fmt \"");
+        rc = -1;
+        goto exit;
+    }
+    rc = wav_p_parse_fmt(wav, func, buf, size, header);
+    if (rc != 0)
+        goto exit;
+
+    data = wav_p_find_chunk(&chunks, CHUNK_ID('d', 'a', 't', 'a'));
+    if (data == 0)
+    {
+        wav_p_error(wav, func, "Can't find 'data'");
+        rc = -1;
+        goto exit;
+    }
+
+    header->config.size = data->size / (header->config.channels * (header->config.bits_per_sample/8));
+    header->data_offset = data->offset;
+    header->data_size = data->size;
+
+ exit:
+    free(chunks.chunk);
+    return rc;
+}
+
+/*
+ * Read (write) the interleaved samples of a file through a block buffer
+ * for a planar image.  Return the number of bytes read (written).
+ */
+#define WAV_P_BLOCK_SIZE    65536
+
+static uint8_t *wav_p_alloc_block(wav_data *wav, const char *func, uint32_t *frames)
+{
+    uint32_t frame_size = wav->config.channels * (wav->config.bits_per_sample/8);
+    uint8_t *block;
+
+    *frames = WAV_P_BLOCK_SIZE / frame_size;
+    if (*frames == 0)
+        *frames = 1;
+    block = (uint8_t*)malloc((size_t)*frames * frame_size);
+    if (block == 0)
+        wav_p_error(wav, func, "Can't allocate block buffer");
+
+    return block;
+}
+
+static size_t wav_p_read_planar(wav_data *wav, FILE *fp)
+{
+    uint32_t bytes_per_sample = wav->config.bits_per_sample/8;
+    uint32_t frame_size = wav->config.channels * bytes_per_sample;
+    uint32_t n, count, frames;
+    uint8_t *block;
+    size_t len, total = 0;
+
+    if (wav->image_size == 0)
+        return 0;
+    block = wav_p_alloc_block(wav, "wav_load", &frames);
+    if (block == 0)
+        return 0;
+
+    for (n = 0; n < wav->config.size; n += count)
+    {
+        count = wav->config.size - n;
+        if (count > frames)
+            count = frames;
+        len = fread(block, 1, (size_t)count * frame_size, fp);
+        total += len;
+        wav_p_deinterleave(wav->image + (size_t)n * bytes_per_sample, wav_p_plane_stride(wav), block,
+                           wav->config.channels, bytes_per_sample, (uint32_t)(len / frame_size));
+        if (len < (size_t)count * frame_size)
+            break;
+    }
+
+    free(block);
+    return total;
+}
+
+static size_t wav_p_write_planar(wav_data *wav, FILE *fp)
+{
+    uint32_t bytes_per_sample = wav->config.bits_per_sample/8;
+    uint32_t frame_size = wav->config.channels * bytes_per_sample;
+    uint32_t n, count, frames;
+    uint8_t *block;
+    size_t len, total = 0;
+
+    if (wav->image_size == 0)
+        return 0;
+    block = wav_p_alloc_block(wav, "wav_save", &frames);
+    if (block == 0)
+        return 0;
+
+    for (n = 0; n < wav->config.size; n += count)
+    {
+        count = wav->config.size - n;
+        if (count > frames)
+            count = frames;
+        wav_p_interleave(block, wav->image + (size_t)n * bytes_per_sample, wav_p_plane_stride(wav),
+                         wav->config.channels, bytes_per_sample, count);
+        len = fwrite(block, 1, (size_t)count * frame_size, fp);
+        total += len;
+        if (len < (size_t)count * frame_size)
+            break;
+    }
+
+    free(block);
+    return total;
+}
+
+/*
+ * Public functions
+ */
+
+/* Create new wav_handle (pointer to wav_data) */
+int wav_open(wav_handle *h, const char *filename)
+{
+    wav_data *wav;
+    int rc = 0;
+
+    /* check argument */
+    if (h == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    wav = (wav_data*)malloc(sizeof(wav_data));
+    if (wav)
+    {
+        memset(wav, 0x00, sizeof(wav_data));
+        wav->format = WAV_FORMAT_PCM;
+        *h = (wav_handle)wav;
+
+        if (filename)
+            rc = wav_load(*h, filename);
+    }
+    else
+    {
+        wav_p_error(0, __FUNCTION__, "Can't allocate wav_data");
+        rc = -1;
+    }
+
+    return rc;
+}
+
+/* Release wav_data and image buffer */
+int wav_close(wav_handle h)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    /* release all resources */
+    wav_p_release_image(wav);
+    free(wav);
+
+    return 0;
+}
+
+/* Set new config and re-allocate image buffer */
+int wav_set_config(wav_handle h, wav_config *config)
+{
+    wav_data *wav = (wav_data *)h;
+    int rc = 0;
+    uint64_t start;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (config == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if (wav->locks)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error wav is locked");
+        return -1;
+    }
+
+    start = wav_p_span_begin();
+
+    /* free old wav buffer */
+    wav_p_release_image(wav);
+
+    /* copy config and allocate new buffer */
+    wav->config = *config;
+    wav->image_size = wav_p_image_size(config);
+    wav->image = (uint8_t*)malloc(wav->image_size);
+    if (wav->image == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Can't allocate wav buffer");
+        wav_p_release_image(wav);
+        rc = -1;
+    }
+    else
+    {
+        wav_p_count_allocation(wav);
+        memset(wav->image, 0x00, wav->image_size);
+    }
+
+    wav_p_span_end(wav, __FUNCTION__, start);
+
+    return rc;
+}
+
+int wav_get_config(wav_handle h, wav_config *config)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (config == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    /* return data */
+    *config = wav->config;
+
+    return 0;
+}
+
+/* check ch and n of a sample access */
+static int wav_p_check_sample(wav_data *wav, const char *func, int ch, int n)
+{
+    if ((n < 0) || (wav->config.size -1 < n))
+    {
+        wav_p_reject(wav, func, "n", n, wav->config.size);
+        return -1;
+    }
+    if ((ch < 0) || (wav->config.channels -1 < ch))
+    {
+        wav_p_reject(wav, func, "ch", ch, wav->config.channels);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+  ch=1, b=8:	0, 1, 2, 3, 4, 5, ...							:
+  ch=2, b=8:	0:0, 1:0, 0:1, 1:1, 0:2, 1:2, 0:3, 1:3, ...		:
+  ch=1, b=16: 0L, 0H, 1L, 1H, 2L, 2H, ...						:
+  ch=2, b=16: 0:0L, 0:0H, 1:0L, 1:0H, 0:1L, 0:1H, 1:1L, 1:1H,	: data[(m_channels*n+ch) * (m_samplebits/8)]
+  planar:     0:0, 0:1, 0:2, ..., 1:0, 1:1, ...					: data[(m_size*ch+n) * (m_samplebits/8)]
+*/
+static uint8_t *wav_p_sample(wav_data *wav, int ch, int n)
+{
+    if (wav->layout == WAV_LAYOUT_PLANAR)
+        return wav->image + ((size_t)wav->config.size*ch+n) * (wav->config.bits_per_sample/8);
+    return wav->image + ((size_t)wav->config.channels*n+ch) * (wav->config.bits_per_sample/8);
+}
+
+/* round a float sample to a bits wide integer and return it full scale */
+static int32_t wav_p_quantize(double data, uint32_t bits)
+{
+    double scale = (double)((uint32_t)1 << (bits - 1));
+    double v = data * scale;
+
+    if (v >= scale - 1)
+        v = scale - 1;
+    else if (v <= -scale)
+        v = -scale;
+    else
+        v = (v < 0) ? v - 0.5 : v + 0.5;
+
+    return (int32_t)((uint32_t)(int32_t)v << (32 - bits));
+}
+
+static int wav_p_read_i32(wav_data *wav, const uint8_t *p, int32_t *data)
+{
+    int16_t s16;
+    int32_t s32;
+    float f32;
+    double f64;
+
+    switch (wav->config.bits_per_sample/8)
+    {
+    case 1:
+        *data = (int32_t)(((uint32_t)p[0] ^ 0x80) << 24);
+        break;
+    case 2:
+        memcpy(&s16, p, 2);
+        *data = (int32_t)s16 * 65536;
+        break;
+    case 3:
+        *data = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24);
+        break;
+    case 4:
+        if (wav->format == WAV_FORMAT_FLOAT)
+        {
+            memcpy(&f32, p, 4);
+            *data = wav_p_quantize(f32, 32);
+        }
+        else
+        {
+            memcpy(&s32, p, 4);
+            *data = s32;
+        }
+        break;
+    case 8:
+        memcpy(&f64, p, 8);
+        *data = wav_p_quantize(f64, 32);
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+static int wav_p_write_i32(wav_data *wav, uint8_t *p, int32_t data)
+{
+    int16_t s16;
+    float f32;
+    double f64;
+
+    switch (wav->config.bits_per_sample/8)
+    {
+    case 1:
+        p[0] = (uint8_t)(((uint32_t)data >> 24) ^ 0x80);
+        break;
+    case 2:
+        s16 = (int16_t)((uint32_t)data >> 16);
+        memcpy(p, &s16, 2);
+        break;
+    case 3:
+        p[0] = (uint8_t)((uint32_t)data >> 8);
+        p[1] = (uint8_t)((uint32_t)data >> 16);
+        p[2] = (uint8_t)((uint32_t)data >> 24);
+        break;
+    case 4:
+        if (wav->format == WAV_FORMAT_FLOAT)
+        {
+            f32 = (float)(data / 2147483648.0);
+            memcpy(p, &f32, 4);
+        }
+        else
+            memcpy(p, &data, 4);
+        break;
+    case 8:
+        f64 = data / 2147483648.0;
+        memcpy(p, &f64, 8);
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+static int wav_p_read_f32(wav_data *wav, const uint8_t *p, float *data)
+{
+    double f64;
+    int32_t s32;
+
+    if ((wav->format == WAV_FORMAT_FLOAT) && (wav->config.bits_per_sample == 32))
+        memcpy(data, p, 4);
+    else if ((wav->format == WAV_FORMAT_FLOAT) && (wav->config.bits_per_sample == 64))
+    {
+        memcpy(&f64, p, 8);
+        *data = (float)f64;
+    }
+    else if (wav_p_read_i32(wav, p, &s32) == 0)
+        *data = (float)(s32 / 2147483648.0);
+    else
+        return -1;
+
+    return 0;
+}
+
+static int wav_p_write_f32(wav_data *wav, uint8_t *p, float data)
+{
+    double f64;
+    uint32_t bits = wav->config.bits_per_sample/8*8;
+
+    if ((wav->format == WAV_FORMAT_FLOAT) && (bits == 32))
+        memcpy(p, &data, 4);
+    else if ((wav->format == WAV_FORMAT_FLOAT) && (bits == 64))
+    {
+        f64 = data;
+        memcpy(p, &f64, 8);
+    }
+    else if ((bits >= 8) && (bits <= 32))
+        return wav_p_write_i32(wav, p, wav_p_quantize(data, bits));
+    else
+        return -1;
+
+    return 0;
+}
+
+/* Functions to access each sample */
+int wav_set_data(wav_handle h, int ch, int n, uint16_t data)
+{
+    wav_data *wav = (wav_data *)h;
+    int rc = 0;
+    int bytes_per_sample;
+    uint8_t *p;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (wav_p_check_sample(wav, __FUNCTION__, ch, n) != 0)
+        return -1;
+
+    if (wav->shared && (wav_p_unshare(wav, __FUNCTION__) != 0))
+        return -1;
+
+    bytes_per_sample = wav->config.bits_per_sample/8;
+    p = wav_p_sample(wav, ch, n);
+
+    if (bytes_per_sample == 1)
+        *p = (uint8_t)data;
+    else if (bytes_per_sample == 2)
+        memcpy(p, &data, 2);
+    else
+        rc = wav_p_write_i32(wav, p, (int32_t)((uint32_t)data << 16));
+
+    if (rc != 0)
+        wav_p_error(wav, __FUNCTION__, "Error invalid bytes_per_sample");
+
+    return rc;
+}
+
+int wav_get_data(wav_handle h, int ch, int n, uint16_t *data)
+{
+    wav_data *wav = (wav_data *)h;
+    int rc = 0;
+    int bytes_per_sample;
+    int32_t sample;
+    const uint8_t *p;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (data == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid parameter");
+        return -1;
+    }
+    if (wav_p_check_sample(wav, __FUNCTION__, ch, n) != 0)
+        return -1;
+
+    bytes_per_sample = wav->config.bits_per_sample/8;
+    p = wav_p_sample(wav, ch, n);
+
+    if (bytes_per_sample == 1)
+        *data = *p;
+    else if (bytes_per_sample == 2)
+        memcpy(data, p, 2);
+    else
+    {
+        rc = wav_p_read_i32(wav, p, &sample);
+        *data = (uint16_t)((uint32_t)sample >> 16);
+    }
+
+    if (rc != 0)
+        wav_p_error(wav, __FUNCTION__, "Error invalid bytes_per_sample");
+
+    return rc;
+}
+
+int wav_set_format(wav_handle h, uint32_t format, uint32_t channel_mask)
+{
+    wav_data *wav = (wav_data *)h;
+    uint32_t i, speakers = 0;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (!wav_p_valid_format(format, wav->config.bits_per_sample))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error format %d with %d bits per sample", format, wav->config.bits_per_sample);
+        return -1;
+    }
+    for (i = 0; i < 32; i++)
+        speakers += (channel_mask >> i) & 1;
+    if (speakers > wav->config.channels)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error channel_mask 0x%x has more than %d channels", channel_mask, wav->config.channels);
+        return -1;
+    }
+
+    wav->format = format;
+    wav->channel_mask = channel_mask;
+
+    return 0;
+}
+
+int wav_get_format(wav_handle h, uint32_t *format, uint32_t *channel_mask)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((format == 0) || (channel_mask == 0))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    *format = wav->format;
+    *channel_mask = wav->channel_mask;
+
+    return 0;
+}
+
+int wav_set_sample_i32(wav_handle h, int ch, int n, int32_t data)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (wav_p_check_sample(wav, __FUNCTION__, ch, n) != 0)
+        return -1;
+
+    if (wav->shared && (wav_p_unshare(wav, __FUNCTION__) != 0))
+        return -1;
+
+    if (wav_p_write_i32(wav, wav_p_sample(wav, ch, n), data) != 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error invalid bytes_per_sample");
+        return -1;
+    }
+
+    return 0;
+}
+
+int wav_get_sample_i32(wav_handle h, int ch, int n, int32_t *data)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (data == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid parameter");
+        return -1;
+    }
+    if (wav_p_check_sample(wav, __FUNCTION__, ch, n) != 0)
+        return -1;
+
+    if (wav_p_read_i32(wav, wav_p_sample(wav, ch, n), data) != 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error invalid bytes_per_sample");
+        return -1;
+    }
+
+    return 0;
+}
+
+int wav_set_sample_f32(wav_handle h, int ch, int n, float data)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (wav_p_check_sample(wav, __FUNCTION__, ch, n) != 0)
+        return -1;
+
+    if (wav->shared && (wav_p_unshare(wav, __FUNCTION__) != 0))
+        return -1;
+
+    if (wav_p_write_f32(wav, wav_p_sample(wav, ch, n), data) != 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error invalid bytes_per_sample");
+        return -1;
+    }
+
+    return 0;
+}
+
+int wav_get_sample_f32(wav_handle h, int ch, int n, float *data)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (data == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid parameter");
+        return -1;
+    }
+    if (wav_p_check_sample(wav, __FUNCTION__, ch, n) != 0)
+        return -1;
+
+    if (wav_p_read_f32(wav, wav_p_sample(wav, ch, n), data) != 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error invalid bytes_per_sample");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* check that frames [first, first + count) are in the buffer */
+static int wav_p_check_frames(wav_data *wav, const char *func, uint32_t first, uint32_t count)
+{
+    if (first > wav->config.size)
+    {
+        wav_p_reject(wav, func, "first", (int)first, wav->config.size + 1);
+        return -1;
+    }
+    if (count > wav->config.size - first)
+    {
+        wav_p_reject(wav, func, "count", (int)count, wav->config.size - first + 1);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Functions to move interleaved frames in bulk */
+int wav_read_frames(wav_handle h, uint32_t first, uint32_t count, void *buf)
+{
+    wav_data *wav = (wav_data *)h;
+    uint32_t frame_size, bytes_per_sample;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((buf == 0) && (count > 0))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid parameter");
+        return -1;
+    }
+    if (wav_p_check_frames(wav, __FUNCTION__, first, count) != 0)
+        return -1;
+
+    bytes_per_sample = wav->config.bits_per_sample/8;
+    frame_size = wav->config.channels * bytes_per_sample;
+    if (count == 0)
+        return 0;
+
+    if (wav->layout == WAV_LAYOUT_PLANAR)
+        wav_p_interleave((uint8_t*)buf, wav->image + (size_t)first * bytes_per_sample, wav_p_plane_stride(wav),
+                         wav->config.channels, bytes_per_sample, count);
+    else
+        memcpy(buf, wav->image + (size_t)first * frame_size, (size_t)count * frame_size);
+
+    return 0;
+}
+
+int wav_write_frames(wav_handle h, uint32_t first, uint32_t count, const void *buf)
+{
+    wav_data *wav = (wav_data *)h;
+    uint32_t frame_size, bytes_per_sample;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((buf == 0) && (count > 0))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid parameter");
+        return -1;
+    }
+    if (wav_p_check_frames(wav, __FUNCTION__, first, count) != 0)
+        return -1;
+    if (count == 0)
+        return 0;
+
+    if (wav->shared && (wav_p_unshare(wav, __FUNCTION__) != 0))
+        return -1;
+
+    bytes_per_sample = wav->config.bits_per_sample/8;
+    frame_size = wav->config.channels * bytes_per_sample;
+    if (wav->layout == WAV_LAYOUT_PLANAR)
+        wav_p_deinterleave(wav->image + (size_t)first * bytes_per_sample, wav_p_plane_stride(wav), (const uint8_t*)buf,
+                           wav->config.channels, bytes_per_sample, count);
+    else
+        memcpy(wav->image + (size_t)first * frame_size, buf, (size_t)count * frame_size);
+
+    return 0;
+}
+
+/* read-only pointer to frame n; use wav_lock to write in place */
+const uint8_t *wav_frame_data(wav_handle h, uint32_t n, uint32_t *stride)
+{
+    wav_data *wav = (wav_data *)h;
+    uint32_t frame_size;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return 0;
+    }
+    if (n >= wav->config.size)
+    {
+        wav_p_reject(wav, __FUNCTION__, "n", (int)n, wav->config.size);
+        return 0;
+    }
+    if (wav->layout == WAV_LAYOUT_PLANAR)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error wav is planar");
+        return 0;
+    }
+
+    frame_size = wav->config.channels * (wav->config.bits_per_sample/8);
+    if (stride)
+        *stride = frame_size;
+
+    return wav->image + (size_t)n * frame_size;
+}
+
+int wav_set_layout(wav_handle h, uint32_t layout)
+{
+    wav_data *wav = (wav_data *)h;
+    uint32_t bytes_per_sample;
+    uint8_t *image;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((layout != WAV_LAYOUT_INTERLEAVED) && (layout != WAV_LAYOUT_PLANAR))
+    {
+        wav_p_reject(wav, __FUNCTION__, "layout", (int)layout, WAV_LAYOUT_PLANAR + 1);
+        return -1;
+    }
+    if (wav->locks)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error wav is locked");
+        return -1;
+    }
+    if (layout == wav->layout)
+        return 0;
+
+    /* rearrange the samples into a new buffer; one channel is the same either way */
+    if ((wav->image_size > 0) && (wav->config.channels > 1))
+    {
+        image = (uint8_t*)malloc(wav->image_size);
+        if (image == 0)
+        {
+            wav_p_error(wav, __FUNCTION__, "Can't allocate wav buffer");
+            return -1;
+        }
+        wav_p_count_allocation(wav);
+
+        bytes_per_sample = wav->config.bits_per_sample/8;
+        if (layout == WAV_LAYOUT_PLANAR)
+            wav_p_deinterleave(image, wav_p_plane_stride(wav), wav->image,
+                               wav->config.channels, bytes_per_sample, wav->config.size);
+        else
+            wav_p_interleave(image, wav->image, wav_p_plane_stride(wav),
+                             wav->config.channels, bytes_per_sample, wav->config.size);
+
+        wav_p_free_image(wav);
+        wav->image = image;
+    }
+    wav->layout = layout;
+
+    return 0;
+}
+
+int wav_get_layout(wav_handle h, uint32_t *layout)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (layout == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    *layout = wav->layout;
+
+    return 0;
+}
+
+/* read-only pointer to the first sample of channel ch */
+const uint8_t *wav_channel_data(wav_handle h, int ch, uint32_t *stride)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return 0;
+    }
+    if (wav_p_check_sample(wav, __FUNCTION__, ch, 0) != 0)
+        return 0;
+
+    if (stride)
+    {
+        if (wav->layout == WAV_LAYOUT_PLANAR)
+            *stride = wav->config.bits_per_sample/8;
+        else
+            *stride = wav->config.channels * (wav->config.bits_per_sample/8);
+    }
+
+    return wav_p_sample(wav, ch, 0);
+}
+
+/* Functions to convert between interleaved and planar buffers */
+int wav_interleave(void *dst, const void *src, size_t plane_stride, uint32_t channels, uint32_t bytes_per_sample, uint32_t count)
+{
+    /* check argument */
+    if ((channels == 0) || (bytes_per_sample == 0) || (bytes_per_sample > 8) || (((dst == 0) || (src == 0)) && (count > 0)))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    wav_p_interleave((uint8_t*)dst, (const uint8_t*)src, plane_stride, channels, bytes_per_sample, count);
+
+    return 0;
+}
+
+int wav_deinterleave(void *dst, size_t plane_stride, const void *src, uint32_t channels, uint32_t bytes_per_sample, uint32_t count)
+{
+    /* check argument */
+    if ((channels == 0) || (bytes_per_sample == 0) || (bytes_per_sample > 8) || (((dst == 0) || (src == 0)) && (count > 0)))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    wav_p_deinterleave((uint8_t*)dst, plane_stride, (const uint8_t*)src, channels, bytes_per_sample, count);
+
+    return 0;
+}
+
+/*
+ * Lock the sample buffer and return a view of it.
+ * Locks nest; each wav_lock must be paired with wav_unlock.
+ */
+int wav_lock(wav_handle h, wav_view *view, uint32_t flags)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((view == 0) || ((flags & (WAV_LOCK_READ | WAV_LOCK_WRITE)) == 0))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if (wav->image == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error No sample data");
+        return -1;
+    }
+
+    /* a shared buffer is copied before the first write */
+    if (wav->shared && (flags & WAV_LOCK_WRITE) && (wav_p_unshare(wav, __FUNCTION__) != 0))
+        return -1;
+
+    view->base = wav->image;
+    view->bytes_per_sample = wav->config.bits_per_sample/8;
+    if (wav->layout == WAV_LAYOUT_PLANAR)
+    {
+        view->stride = view->bytes_per_sample;
+        view->channel_stride = (uint32_t)wav_p_plane_stride(wav);
+    }
+    else
+    {
+        view->stride = wav->config.channels * view->bytes_per_sample;
+        view->channel_stride = view->bytes_per_sample;
+    }
+    view->channels = wav->config.channels;
+    view->size = wav->config.size;
+    view->flags = flags;
+    wav->locks++;
+
+    return 0;
+}
+
+int wav_unlock(wav_handle h, wav_view *view)
+{
+    wav_data *wav = (wav_data *)h;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((view == 0) || (wav->locks == 0))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    view->base = 0;
+    wav->locks--;
+
+    return 0;
+}
+
+int wav_copy(wav_handle dst, wav_handle src)
+{
+    wav_data *wav_dst = (wav_data *)dst;
+    wav_data *wav_src = (wav_data *)src;
+    int rc = 0;
+
+    /* check argument */
+    if (wav_dst == 0)
+    {
+        wav_p_error(wav_dst, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (wav_src == 0)
+    {
+        wav_p_error(wav_dst, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    /* dst keeps its own layout */
+    rc = wav_set_config(dst, &wav_src->config);
+    if (rc == 0)
+    {
+        if (wav_dst->layout == wav_src->layout)
+            memcpy(wav_dst->image, wav_src->image, wav_dst->image_size);
+        else if (wav_dst->layout == WAV_LAYOUT_PLANAR)
+            wav_p_deinterleave(wav_dst->image, wav_p_plane_stride(wav_dst), wav_src->image,
+                               wav_src->config.channels, wav_src->config.bits_per_sample/8, wav_src->config.size);
+        else
+            wav_p_interleave(wav_dst->image, wav_src->image, wav_p_plane_stride(wav_src),
+                             wav_src->config.channels, wav_src->config.bits_per_sample/8, wav_src->config.size);
+        wav_dst->format = wav_src->format;
+        wav_dst->channel_mask = wav_src->channel_mask;
+    }
 
-    return;
+    return rc;
 }
 
-/*
- * Public functions
- */
-
-/* Create new wav_handle (pointer to wav_data) */
-int wav_open(wav_handle *h, const char *filename)
+int wav_load(wav_handle h, const char *filename)
 {
-    wav_data *wav;
+    wav_data *wav = (wav_data *)h;
     int rc = 0;
+    wav_p_header header;
+    FILE *fp;
+    size_t len;
+    uint64_t start;
 
     /* check argument */
-    if (h == 0)
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (filename == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
 
-    wav = (wav_data*)malloc(sizeof(wav_data));
-    if (wav)
+    fp = fopen(filename, "rb");
+    if (fp == NULL)
     {
-        memset(wav, 0x00, sizeof(wav_data));
-        *h = (wav_handle)wav;
+        wav_p_error(wav, __FUNCTION__, "Cannot open %s", filename);
+        return -1;
+    }
+    start = wav_p_span_begin();
 
-        if (filename)
-            rc = wav_load(*h, filename);
+    /* "fmt " and "data" may be anywhere among LIST, bext, JUNK, ... */
+    rc = wav_p_read_header(wav, __FUNCTION__, fp, &header);
+    if (rc != 0)
+        goto exit;
+
+    rc = wav_set_config(h, &header.config);
+    if (rc != 0)
+        goto exit;
+    wav->format = header.format;
+    wav->channel_mask = header.channel_mask;
+
+    if (header.data_size != wav->image_size)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error chunkSize (%d) != wav->image_size (%d)", header.data_size, wav->image_size);
     }
-    else
+
+    /* Load new wav data */
+    len = 0;
+    if (wav_p_seek(fp, header.data_offset) == 0)
     {
-        rc = -1;
+        if (wav->layout == WAV_LAYOUT_PLANAR)
+            len = wav_p_read_planar(wav, fp);
+        else
+            len = fread(wav->image, 1, wav->image_size, fp);
     }
+    wav_p_count_read(wav, (uint32_t)len);
+    wav_p_count_load(wav);
 
+ exit:
+    fclose(fp);
+    wav_p_span_end(wav, __FUNCTION__, start);
     return rc;
 }
 
-/* Release wav_data and image buffer */
-int wav_close(wav_handle h)
+int wav_save(wav_handle h, const char *filename)
 {
     wav_data *wav = (wav_data *)h;
+    int rc = 0;
+    FILE *fp;
+    int len;
+    uint8_t header[WAV_P_HEADER_MAX];
+    uint32_t header_size;
+    uint64_t start;
 
     /* check argument */
     if (wav == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (filename == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
 
-    /* release all resources */
-    wav_p_release_image(wav);
-    free(wav);
+    fp = fopen(filename, "wb+");
+    if (fp == NULL)
+    {
+        wav_p_error(wav, __FUNCTION__, "Cannot open %s", filename);
+        return -1;
+    }
+    start = wav_p_span_begin();
+
+    /* header */
+    header_size = wav_p_make_header(&wav->config, wav->format, wav->channel_mask, wav->image_size, header);
+    len = fwrite(header, 1, header_size, fp);
+
+    /* audio samples */
+    if (wav->layout == WAV_LAYOUT_PLANAR)
+        len = (int)wav_p_write_planar(wav, fp);
+    else
+        len = fwrite(wav->image, 1, wav->image_size, fp);
+    if (len != wav->image_size) {
+        wav_p_error(wav, __FUNCTION__, "Write error %d bytes were written", len);
+    }
+    wav_p_count_write(wav, ftell(fp));
+    wav_p_count_save(wav);
+
+    fclose(fp);
+    wav_p_span_end(wav, __FUNCTION__, start);
 
     return 0;
 }
 
-/* Set new config and re-allocate image buffer */
-int wav_set_config(wav_handle h, wav_config *config)
+/* Load a wav file image from memory.  The samples are copied. */
+int wav_load_mem(wav_handle h, const void *buf, size_t size)
 {
     wav_data *wav = (wav_data *)h;
-    int rc = 0;
+    wav_p_header header;
+    int rc;
 
     /* check argument */
     if (wav == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
-        return -1;
-    }
-    if (config == 0)
-    {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid argument\n");
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
 
-    /* free old wav buffer */
-    wav_p_release_image(wav);
-
-    /* copy config and allocate new buffer */
-    wav->config = *config;
-    wav->image_size = wav_p_image_size(config);
-    wav->image = (uint8_t*)malloc(wav->image_size);
-    if (wav->image == 0)
+    rc = wav_p_parse_mem(wav, __FUNCTION__, (const uint8_t*)buf, size, &header);
+    if (rc == 0)
+        rc = wav_set_config(h, &header.config);
+    if (rc == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Can't allocate wav buffer\n");
-        memset(wav, 0x00, sizeof(wav_data));
-        rc = -1;
+        if (wav->layout == WAV_LAYOUT_PLANAR)
+            wav_p_deinterleave(wav->image, wav_p_plane_stride(wav), (const uint8_t*)buf + header.data_offset,
+                               header.config.channels, header.config.bits_per_sample/8, header.config.size);
+        else
+            memcpy(wav->image, (const uint8_t*)buf + header.data_offset, wav->image_size);
+        wav->format = header.format;
+        wav->channel_mask = header.channel_mask;
+        wav_p_count_read(wav, (uint32_t)(header.data_offset + wav->image_size));
+        wav_p_count_load(wav);
     }
-    memset(wav->image, 0x00, wav->image_size);
 
     return rc;
 }
 
-int wav_get_config(wav_handle h, wav_config *config)
+/*
+ * Use the samples of a wav file image in memory without copying.
+ * The handle reads and writes buf directly until it is reconfigured,
+ * reloaded or closed, so buf must stay valid until then.
+ * The samples are copied instead when they are not aligned to the sample size.
+ */
+int wav_attach_mem(wav_handle h, void *buf, size_t size)
 {
     wav_data *wav = (wav_data *)h;
+    wav_p_header header;
+    uint32_t bytes_per_sample;
+    int rc;
 
     /* check argument */
     if (wav == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
-    if (config == 0)
+    if (wav->locks)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid argument\n");
+        wav_p_error(wav, __FUNCTION__, "Error wav is locked");
         return -1;
     }
 
-    /* return data */
-    *config = wav->config;
+    rc = wav_p_parse_mem(wav, __FUNCTION__, (const uint8_t*)buf, size, &header);
+    if (rc != 0)
+        return rc;
+
+    /* 24 bit samples are accessed bytewise; a planar handle needs its own copy */
+    bytes_per_sample = header.config.bits_per_sample/8;
+    if ((bytes_per_sample != 3) && ((uintptr_t)buf + header.data_offset) % bytes_per_sample != 0)
+        return wav_load_mem(h, buf, size);
+    if (wav->layout == WAV_LAYOUT_PLANAR)
+        return wav_load_mem(h, buf, size);
+
+    wav_p_release_image(wav);
+    wav->config = header.config;
+    wav->format = header.format;
+    wav->channel_mask = header.channel_mask;
+    wav->image_size = wav_p_image_size(&header.config);
+    wav->image = (uint8_t*)buf + header.data_offset;
+    wav->image_external = 1;
+    wav_p_count_read(wav, (uint32_t)header.data_offset);
+    wav_p_count_load(wav);
 
     return 0;
 }
 
-/* Functions to access each sample */
-int wav_set_data(wav_handle h, int ch, int n, uint16_t data)
+/*
+ * Write a wav file image to buf.  size returns the number of bytes needed.
+ * Pass buf = 0 to get the size only.
+ */
+int wav_save_mem(wav_handle h, void *buf, size_t capacity, size_t *size)
 {
     wav_data *wav = (wav_data *)h;
-    int rc = 0;
-    int bytes_per_sample;
-    uint16_t sample;
+    uint8_t *p = (uint8_t*)buf;
+    uint8_t header[WAV_P_HEADER_MAX];
+    uint32_t header_size;
 
     /* check argument */
     if (wav == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
         return -1;
     }
-    if ((n < 0) || (wav->config.size -1 < n))
+    if (size == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error n=%d is out of range. It must be within [0, %d]\n", n, wav->config.size-1);
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
         return -1;
     }
-    if ((ch < 0) || (wav->config.channels -1 < ch))
+
+    header_size = wav_p_make_header(&wav->config, wav->format, wav->channel_mask, wav->image_size, header);
+    *size = header_size + wav->image_size;
+    if (buf == 0)
+        return 0;
+    if (capacity < *size)
     {
-        fprintf(stderr, __FUNCTION__ ": Error ch=%d is out of range. It must be within [0, %d]\n", ch, wav->config.channels-1);
+        wav_p_error(wav, __FUNCTION__, "Error buffer is too short (%d < %d)", (uint32_t)capacity, (uint32_t)*size);
         return -1;
     }
 
-    bytes_per_sample = wav->config.bits_per_sample/8;
-
-    if (bytes_per_sample == 1)
-        *(wav->image + (wav->config.channels*n+ch) * bytes_per_sample) = data;
-    else if (bytes_per_sample == 2)
-        *((uint16_t*)(wav->image + (wav->config.channels*n+ch) * bytes_per_sample)) = data;
+    memcpy(p, header, header_size);
+    if (wav->layout == WAV_LAYOUT_PLANAR)
+        wav_p_interleave(p + header_size, wav->image, wav_p_plane_stride(wav),
+                         wav->config.channels, wav->config.bits_per_sample/8, wav->config.size);
     else
-    {
-        rc = -1;
-        fprintf(stderr, __FUNCTION__ ": Error invalid bytes_per_sample\n");
-    }
+        memcpy(p + header_size, wav->image, wav->image_size);
+    wav_p_count_write(wav, (uint32_t)*size);
+    wav_p_count_save(wav);
 
-    return rc;
+    return 0;
 }
 
-int wav_get_data(wav_handle h, int ch, int n, uint16_t *data)
+/*
+ * RIFF chunk index
+ */
+
+int wav_chunks_open(wav_chunks_handle *c, const char *filename)
 {
-    wav_data *wav = (wav_data *)h;
-    int rc = 0;
-    int bytes_per_sample;
-    uint16_t sample;
+    chunks_data *chunks;
 
     /* check argument */
-    if (wav == 0)
+    if ((c == 0) || (filename == 0))
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
         return -1;
     }
-    if (data == 0)
+
+    chunks = (chunks_data*)malloc(sizeof(chunks_data));
+    if (chunks == 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid parameter\n");
+        wav_p_error(0, __FUNCTION__, "Can't allocate chunks_data");
         return -1;
     }
-    if ((n < 0) || (wav->config.size -1 < n))
+    memset(chunks, 0x00, sizeof(chunks_data));
+
+    chunks->fp = fopen(filename, "rb");
+    if (chunks->fp == NULL)
     {
-        fprintf(stderr, __FUNCTION__ ": Error n=%d is out of range. It must be within [0, %d]\n", n, wav->config.size-1);
+        wav_p_error(0, __FUNCTION__, "Cannot open %s", filename);
+        free(chunks);
         return -1;
     }
-    if ((ch < 0) || (wav->config.channels -1 < ch))
+    if (wav_p_walk_chunks(0, __FUNCTION__, chunks) != 0)
     {
-        fprintf(stderr, __FUNCTION__ ": Error ch=%d is out of range. It must be within [0, %d]\n", ch, wav->config.channels-1);
+        wav_chunks_close((wav_chunks_handle)chunks);
         return -1;
     }
 
-    /*
-      ch=1, b=8:	0, 1, 2, 3, 4, 5, ...							:
-      ch=2, b=8:	0:0, 1:0, 0:1, 1:1, 0:2, 1:2, 0:3, 1:3, ...		:
-      ch=1, b=16: 0L, 0H, 1L, 1H, 2L, 2H, ...						:
-      ch=2, b=16: 0:0L, 0:0H, 1:0L, 1:0H, 0:1L, 0:1H, 1:1L, 1:1H,	: data[(m_channels*n+ch) * (m_samplebits/8)]
-    */
+    *c = (wav_chunks_handle)chunks;
 
-    bytes_per_sample = wav->config.bits_per_sample/8;
+    return 0;
+}
 
-    if (bytes_per_sample == 1)
-        sample = *(wav->image + (wav->config.channels*n+ch) * bytes_per_sample);
-    else if (bytes_per_sample == 2)
-        sample = *((uint16_t*)(wav->image + (wav->config.channels*n+ch) * bytes_per_sample));
-    else
+int wav_chunks_close(wav_chunks_handle c)
+{
+    chunks_data *chunks = (chunks_data *)c;
+
+    /* check argument */
+    if (chunks == 0)
     {
-        rc = -1;
-        fprintf(stderr, __FUNCTION__ ": Error invalid bytes_per_sample\n");
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
     }
 
-    *data = sample;
+    fclose(chunks->fp);
+    free(chunks->chunk);
+    free(chunks);
 
-    return rc;
+    return 0;
 }
 
-int wav_copy(wav_handle dst, wav_handle src)
+int wav_chunks_count(wav_chunks_handle c, uint32_t *count)
 {
-    wav_data *wav_dst = (wav_data *)dst;
-    wav_data *wav_src = (wav_data *)src;
-    int rc = 0;
+    chunks_data *chunks = (chunks_data *)c;
 
     /* check argument */
-    if (wav_dst == 0)
-    {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
-        return -1;
-    }
-    if (wav_src == 0)
+    if ((chunks == 0) || (count == 0))
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
         return -1;
     }
 
-    rc = wav_set_config(dst, &wav_src->config);
-    if (rc == 0)
-        memcpy(wav_dst->image, wav_src->image, wav_dst->image_size);
+    *count = chunks->count;
 
-    return rc;
+    return 0;
 }
 
-int wav_load(wav_handle h, const char *filename)
+int wav_chunks_get(wav_chunks_handle c, uint32_t index, wav_chunk *chunk)
 {
-    wav_data *wav = (wav_data *)h;
-    int rc = 0;
-    wav_config new_config;
-    FILE *fp;
-    int i, len;
-    uint32_t data, chunkSize;
-    PCMWAVEFORMAT pwf;
+    chunks_data *chunks = (chunks_data *)c;
 
     /* check argument */
-    if (wav == 0)
-    {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
-        return -1;
-    }
-    if (filename == 0)
+    if ((chunks == 0) || (chunk == 0))
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
         return -1;
     }
-
-    fp = fopen(filename, "rb");
-    if (fp == NULL)
+    if (index >= chunks->count)
     {
-        printf("Cannot open %s\n", filename);
+        wav_p_error(0, __FUNCTION__, "Error index %d >= %d chunks", index, chunks->count);
         return -1;
     }
-    /* 'RIFF' */
-    len = fread(&data, 4, 1, fp);
-    if (data != CHUNK_ID('R', 'I', 'F', 'F')) {
-        fprintf(stderr, __FUNCTION__ ": Can't find \"RIFF\"\n");
-        rc = -1;
-        goto exit;
-    }
-
-    /* chunkSize */
-    len = fread(&data, 4, 1, fp);
-
-    /* 'WAVE' */
-    len = fread(&data, 4, 1, fp);
-    if (data != CHUNK_ID('W', 'A', 'V', 'E')) {
-        fprintf(stderr, __FUNCTION__ ": Can't find \"WAVE\"\n");
-        rc = -1;
-        goto exit;
-    }
 
-    /* 'fmt ' */
-    len = fread(&data, 4, 1, fp);
-    if (data != CHUNK_ID('f', 'm', 't', ' ')) {
-        fprintf(stderr, __FUNCTION__ ": Can't find \"fmt \"\n");
-        rc = -1;
-        goto exit;
-    }
-
-    /* chunkSize */
-    len = fread(&chunkSize, 4, 1, fp);
-
-    // PCMWAVEFORMAT
-    len = fread(&pwf, sizeof(PCMWAVEFORMAT), 1, fp);
-    if (pwf.wFormatTag != 1) {
-        fprintf(stderr, __FUNCTION__ ": WAVEFORMAT.wFormatTag != 1(PCM)\n");
-        rc = -1;
-        goto exit;
-    }
-
-    /* Read and throw Extend Data (should be able to replace with seek) */
-    for (i = 0; i < chunkSize - 16; i++)
-        len = fread((char*)&data, 1, 1, fp);
-
-    /* 'data' */
-    len = fread(&data, 4, 1, fp);
-    if (data != CHUNK_ID('d', 'a', 't', 'a')) {
-        fprintf(stderr, __FUNCTION__ ": Can't find 'data'\n");
-        rc = -1;
-        goto exit;
-    }
+    *chunk = chunks->chunk[index];
 
-    /* chunkSize */
-    len = fread(&chunkSize, 4, 1, fp);
+    return 0;
+}
 
-    new_config.channels = pwf.nChannels;
-    new_config.samplehz = pwf.nSamplesPerSec;
-    new_config.bits_per_sample = pwf.wBitsPerSample;
-    new_config.size = (uint32_t)chunkSize / (new_config.channels * (new_config.bits_per_sample/8));
-    wav_set_config(h, &new_config);
+/* A missing chunk is not reported as an error */
+int wav_chunks_find(wav_chunks_handle c, uint32_t id, wav_chunk *chunk)
+{
+    chunks_data *chunks = (chunks_data *)c;
+    const wav_chunk *found;
 
-    if (chunkSize != wav->image_size)
+    /* check argument */
+    if ((chunks == 0) || (chunk == 0))
     {
-        fprintf(stderr, __FUNCTION__ ": Error chunkSize (%d) != wav->image_size (%d)\n", chunkSize, wav->image_size);
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
     }
 
-    /* Load new wav data */
-    len = fread(wav->image, 1, wav->image_size, fp);
+    found = wav_p_find_chunk(chunks, id);
+    if (found == 0)
+        return -1;
+    *chunk = *found;
 
- exit:
-    fclose(fp);
-    return rc;
+    return 0;
 }
 
-int wav_save(wav_handle h, const char *filename)
+int wav_chunks_read(wav_chunks_handle c, const wav_chunk *chunk, uint32_t offset, void *buf, uint32_t size)
 {
-    wav_data *wav = (wav_data *)h;
-    int rc = 0;
-    FILE *fp;
-    int len;
-    uint32_t chunkID, chunkSize;
-    PCMWAVEFORMAT pwf;
+    chunks_data *chunks = (chunks_data *)c;
 
     /* check argument */
-    if (wav == 0)
+    if ((chunks == 0) || (chunk == 0) || ((buf == 0) && (size > 0)))
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
         return -1;
     }
-    if (filename == 0)
+    if ((offset > chunk->size) || (size > chunk->size - offset))
     {
-        fprintf(stderr, __FUNCTION__ ": Error Invalid handle\n");
+        wav_p_error(0, __FUNCTION__, "Error %d bytes at %d exceed chunk size %d", size, offset, chunk->size);
         return -1;
     }
 
-    fp = fopen(filename, "wb+");
+    if ((wav_p_seek(chunks->fp, chunk->offset + offset) != 0) || (fread(buf, 1, size, chunks->fp) != size))
+    {
+        wav_p_error(0, __FUNCTION__, "Read error at %d", (uint32_t)(chunk->offset + offset));
+        return -1;
+    }
+    wav_p_count_read(0, size);
 
-    /* 'RIFF' */
-    chunkID = CHUNK_ID('R', 'I', 'F', 'F');
-    len = fwrite(&chunkID, 4, 1, fp);
+    return 0;
+}
 
-    /* chunkSize */
-    chunkSize = wav->image_size + 38;
-    len = fwrite(&chunkSize, 4, 1, fp);
+/*
+ * Diagnostics
+ */
 
-    /* 'WAVE' */
-    chunkID = CHUNK_ID('W', 'A', 'V', 'E');
-    len = fwrite(&chunkID, 4, 1, fp);
+/* Default error handler */
+void wav_stderr_handler(wav_handle h, const char *func, const char *msg, void *ctx)
+{
+    (void)h;
+    (void)ctx;
+    fprintf(stderr, "%s: %s\n", func, msg);
+}
 
-    /* 'fmt ' */
-    chunkID = CHUNK_ID('f', 'm', 't', ' ');
-    len = fwrite(&chunkID, 4, 1, fp);
+void wav_set_error_handler(wav_error_handler handler, void *ctx)
+{
+    wav_p_diag_lock();
+    error_handler = handler;
+    error_ctx = ctx;
+    wav_p_diag_unlock();
+}
 
-    /* chunkSize */
-    chunkSize = 18;
-    len = fwrite(&chunkSize, 4, 1, fp);
+void wav_set_span_handler(wav_span_handler handler, void *ctx)
+{
+    wav_p_diag_lock();
+    span_handler = handler;
+    span_ctx = ctx;
+    wav_p_diag_unlock();
+}
 
-    /* PCMWAVEFORMAT */
-    pwf.wFormatTag = 1;			// PCM
-    pwf.nChannels = wav->config.channels;
-    pwf.nSamplesPerSec = wav->config.samplehz;
-    pwf.nBlockAlign = wav->config.channels * (wav->config.bits_per_sample/8);
-    pwf.nAvgBytesPerSec = pwf.nSamplesPerSec * pwf.nBlockAlign;
-    pwf.wBitsPerSample = wav->config.bits_per_sample;
-    len = fwrite(&pwf, sizeof(PCMWAVEFORMAT), 1, fp);
+int wav_get_stats(wav_handle h, wav_stats *stats)
+{
+    wav_data *wav = (wav_data *)h;
 
-    /* Extended data */
-    chunkSize = 0;
-    len = fwrite(&chunkSize, 2, 1, fp);
+    /* check argument */
+    if (stats == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
 
-    /* 'data' */
-    chunkID = CHUNK_ID('d', 'a', 't', 'a');
-    len = fwrite(&chunkID, 4, 1, fp);
+    /* h == 0 returns the process wide counters */
+    wav_p_diag_lock();
+    *stats = wav ? wav->stats : global_stats;
+    wav_p_diag_unlock();
 
-    /* chunkSize */
-    chunkSize = wav->image_size;
-    len = fwrite(&chunkSize, 4, 1, fp);
+    return 0;
+}
 
-    /* audio samples */
-    len = fwrite(wav->image, 1, wav->image_size, fp);
-    if (len != wav->image_size) {
-        fprintf(stderr, __FUNCTION__ ": Write error %d bytes were written\n", len);
-    }
+int wav_reset_stats(wav_handle h)
+{
+    wav_data *wav = (wav_data *)h;
 
-    fclose(fp);
+    wav_p_diag_lock();
+    if (wav)
+        memset(&wav->stats, 0x00, sizeof(wav_stats));
+    else
+        memset(&global_stats, 0x00, sizeof(wav_stats));
+    wav_p_diag_unlock();
 
     return 0;
 }
@@ -8,6 +8,7 @@
 #ifndef WAV_H
 #define WAV_H
 
+#include <stddef.h>
 #include <stdint.h>
 typedef uint32_t* wav_handle;
 
@@ -30,13 +31,240 @@ typedef struct {
 int wav_set_config(wav_handle h, wav_config *config);
 int wav_get_config(wav_handle h, wav_config *config);
 
-/* Functions to access each audio sample */
+/*
+ * Functions to access each audio sample.
+ * 8 and 16 bit samples are passed as stored; wider samples are passed as
+ * their upper 16 bits (signed).
+ */
 int wav_set_data(wav_handle h, int ch, int n, uint16_t data);
 int wav_get_data(wav_handle h, int ch, int n, uint16_t *data);
 
+/*
+ * Sample formats.
+ * wav_set_config selects integer PCM: 8 bit unsigned, 16/24/32 bit signed.
+ * wav_set_format switches 32/64 bit samples to IEEE float and sets the
+ * speaker of each channel (WAVE_FORMAT_EXTENSIBLE dwChannelMask, 0 if not
+ * known).  Files with more than 2 channels or 16 bits, float samples or a
+ * channel mask are saved with a WAVE_FORMAT_EXTENSIBLE header.
+ */
+#define WAV_FORMAT_PCM      1
+#define WAV_FORMAT_FLOAT    3
+
+#define WAV_SPEAKER_FRONT_LEFT      0x001
+#define WAV_SPEAKER_FRONT_RIGHT     0x002
+#define WAV_SPEAKER_FRONT_CENTER    0x004
+#define WAV_SPEAKER_LOW_FREQUENCY   0x008
+#define WAV_SPEAKER_BACK_LEFT       0x010
+#define WAV_SPEAKER_BACK_RIGHT      0x020
+#define WAV_SPEAKER_BACK_CENTER     0x100
+#define WAV_SPEAKER_SIDE_LEFT       0x200
+#define WAV_SPEAKER_SIDE_RIGHT      0x400
+
+int wav_set_format(wav_handle h, uint32_t format, uint32_t channel_mask);
+int wav_get_format(wav_handle h, uint32_t *format, uint32_t *channel_mask);
+
+/*
+ * Typed sample access for every format.
+ * i32 is full scale signed 32 bit (8 bit 0x80 is 0, 16 bit samples are
+ * shifted up by 16, ...); f32 is -1.0 to 1.0.  Out of range floats are
+ * clipped when they are stored as integers.
+ */
+int wav_set_sample_i32(wav_handle h, int ch, int n, int32_t data);
+int wav_get_sample_i32(wav_handle h, int ch, int n, int32_t *data);
+int wav_set_sample_f32(wav_handle h, int ch, int n, float data);
+int wav_get_sample_f32(wav_handle h, int ch, int n, float *data);
+
+/*
+ * Functions to move frames [first, first + count) in bulk.
+ * buf holds the interleaved samples as they are stored in the file,
+ * count * channels * bits_per_sample / 8 bytes.
+ */
+int wav_read_frames(wav_handle h, uint32_t first, uint32_t count, void *buf);
+int wav_write_frames(wav_handle h, uint32_t first, uint32_t count, const void *buf);
+
+/*
+ * Return a read-only pointer to frame n; the next frame is stride bytes
+ * further.  It is valid until the handle is written, reconfigured,
+ * reloaded or closed.  Returns 0 on error.
+ */
+const uint8_t *wav_frame_data(wav_handle h, uint32_t n, uint32_t *stride);
+
+/*
+ * Sample layout.
+ * Samples are interleaved by default.  A planar handle keeps each channel
+ * contiguous: channel ch starts at ch * size * bytes_per_sample, so per
+ * channel processing reads sequential memory.  wav_set_layout rearranges
+ * the samples already loaded and the layout is kept by wav_set_config and
+ * wav_load.  Files and the frame functions above stay interleaved;
+ * wav_frame_data fails on a planar handle.
+ * wav_channel_data returns a read-only pointer to the first sample of ch;
+ * the next sample is stride bytes further.
+ */
+#define WAV_LAYOUT_INTERLEAVED  0
+#define WAV_LAYOUT_PLANAR       1
+
+int wav_set_layout(wav_handle h, uint32_t layout);
+int wav_get_layout(wav_handle h, uint32_t *layout);
+const uint8_t *wav_channel_data(wav_handle h, int ch, uint32_t *stride);
+
+/*
+ * Convert count frames between interleaved and planar buffers.  Channel ch
+ * of the planar buffer starts at ch * plane_stride bytes, which must keep
+ * the samples aligned.  16 and 32 bit samples of 2 to 8 channels use SSE2.
+ */
+int wav_interleave(void *dst, const void *src, size_t plane_stride, uint32_t channels, uint32_t bytes_per_sample, uint32_t count);
+int wav_deinterleave(void *dst, size_t plane_stride, const void *src, uint32_t channels, uint32_t bytes_per_sample, uint32_t count);
+
 int wav_copy(wav_handle dst, wav_handle src);
 
 int wav_load(wav_handle h, const char *filename);
 int wav_save(wav_handle h, const char *filename);
 
+/*
+ * Functions to load/save a wav file image in memory.
+ * wav_attach_mem uses the samples in buf without copying; buf must stay
+ * valid until the handle is reconfigured, reloaded or closed.
+ * wav_save_mem returns the bytes needed in size; pass buf = 0 to query it.
+ */
+int wav_load_mem(wav_handle h, const void *buf, size_t size);
+int wav_attach_mem(wav_handle h, void *buf, size_t size);
+int wav_save_mem(wav_handle h, void *buf, size_t capacity, size_t *size);
+
+/*
+ * RIFF chunk index.
+ * wav_chunks_open reads the chunk headers of a file and skips the payloads
+ * with seeks, so it is quick whatever the size of the metadata (LIST,
+ * bext, cue, ...).  offset is the file offset of the payload.
+ * wav_chunks_find returns the first chunk with id and -1 if there is none;
+ * wav_chunks_read reads size bytes at offset in the payload.
+ */
+#define WAV_CHUNK_ID(a0, a1, a2, a3)	((uint32_t)(a3) << 24 | (uint32_t)(a2) << 16 | (uint32_t)(a1) << 8 | (uint32_t)(a0))
+
+typedef uint32_t* wav_chunks_handle;
+
+typedef struct {
+    uint32_t id;
+    uint32_t size;
+    uint64_t offset;
+} wav_chunk;
+
+int wav_chunks_open(wav_chunks_handle *c, const char *filename);
+int wav_chunks_close(wav_chunks_handle c);
+int wav_chunks_count(wav_chunks_handle c, uint32_t *count);
+int wav_chunks_get(wav_chunks_handle c, uint32_t index, wav_chunk *chunk);
+int wav_chunks_find(wav_chunks_handle c, uint32_t id, wav_chunk *chunk);
+int wav_chunks_read(wav_chunks_handle c, const wav_chunk *chunk, uint32_t offset, void *buf, uint32_t size);
+
+/*
+ * Locked view for fast sample access.
+ * Sample (ch, n) is at base + n * stride + ch * channel_stride.  For
+ * interleaved samples stride is the frame size and channel_stride is
+ * bytes_per_sample; for planar samples it is the other way round.
+ * The inline accessors below are unchecked unless WAV_DEBUG is defined.
+ * The handle must not be reconfigured or reloaded while it is locked.
+ */
+#define WAV_LOCK_READ   0x01
+#define WAV_LOCK_WRITE  0x02
+
+typedef struct {
+    uint8_t *base;
+    uint32_t stride;
+    uint32_t channel_stride;
+    uint32_t channels;
+    uint32_t bytes_per_sample;
+    uint32_t size;
+    uint32_t flags;
+} wav_view;
+
+int wav_lock(wav_handle h, wav_view *view, uint32_t flags);
+int wav_unlock(wav_handle h, wav_view *view);
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define WAV_INLINE static __inline
+#else
+#define WAV_INLINE static inline
+#endif
+
+#ifdef WAV_DEBUG
+#include <assert.h>
+#define WAV_VIEW_CHECK(view, ch, n) \
+    assert((view)->base && (uint32_t)(ch) < (view)->channels && (uint32_t)(n) < (view)->size)
+#else
+#define WAV_VIEW_CHECK(view, ch, n) ((void)0)
+#endif
+
+/* sample 0 of frame n; the frame is contiguous only if interleaved */
+WAV_INLINE uint8_t *wav_view_frame(const wav_view *view, int n)
+{
+    WAV_VIEW_CHECK(view, 0, n);
+    return view->base + (size_t)n * view->stride;
+}
+
+/* first sample of channel ch */
+WAV_INLINE uint8_t *wav_view_channel(const wav_view *view, int ch)
+{
+    WAV_VIEW_CHECK(view, ch, 0);
+    return view->base + (size_t)ch * view->channel_stride;
+}
+
+/* 8 bits/sample */
+WAV_INLINE uint8_t wav_view_get8(const wav_view *view, int ch, int n)
+{
+    WAV_VIEW_CHECK(view, ch, n);
+    return view->base[(size_t)n * view->stride + (size_t)ch * view->channel_stride];
+}
+
+WAV_INLINE void wav_view_set8(const wav_view *view, int ch, int n, uint8_t data)
+{
+    WAV_VIEW_CHECK(view, ch, n);
+    view->base[(size_t)n * view->stride + (size_t)ch * view->channel_stride] = data;
+}
+
+/* 16 bits/sample */
+WAV_INLINE uint16_t wav_view_get16(const wav_view *view, int ch, int n)
+{
+    WAV_VIEW_CHECK(view, ch, n);
+    return *(uint16_t*)(view->base + (size_t)n * view->stride + (size_t)ch * view->channel_stride);
+}
+
+WAV_INLINE void wav_view_set16(const wav_view *view, int ch, int n, uint16_t data)
+{
+    WAV_VIEW_CHECK(view, ch, n);
+    *(uint16_t*)(view->base + (size_t)n * view->stride + (size_t)ch * view->channel_stride) = data;
+}
+
+/*
+ * Diagnostics.
+ * Errors are passed to the error handler instead of being printed inline.
+ * wav_stderr_handler is the default.  Pass 0 to disable the output.
+ * The span handler, if set, receives the elapsed time in nsec of
+ * wav_load, wav_save and wav_set_config.
+ * Handlers are called on the thread that hit the error, which may be a
+ * library thread; the counters can be read from any thread.
+ */
+typedef void (*wav_error_handler)(wav_handle h, const char *func, const char *msg, void *ctx);
+typedef void (*wav_span_handler)(wav_handle h, const char *func, uint64_t nsec, void *ctx);
+
+void wav_stderr_handler(wav_handle h, const char *func, const char *msg, void *ctx);
+void wav_set_error_handler(wav_error_handler handler, void *ctx);
+void wav_set_span_handler(wav_span_handler handler, void *ctx);
+
+/*
+ * Counters are kept per handle and for the whole process.
+ * Pass h = 0 to get/reset the process wide counters.
+ * The mem functions count the bytes they copy; attaching counts the header only.
+ */
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint32_t loads;
+    uint32_t saves;
+    uint32_t allocations;
+    uint32_t rejected;          /* out of range sample accesses */
+    uint32_t errors;
+} wav_stats;
+
+int wav_get_stats(wav_handle h, wav_stats *stats);
+int wav_reset_stats(wav_handle h);
+
 #endif	/* WAV_H */
@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * This is a C++17 header layer on top of the wav library.
+ * Audio<SampleFormat> owns a wav_handle and keeps it locked, so samples are
+ * accessed through plain pointers and the format is fixed at compile time.
+ */
+
+#ifndef WAV_HPP
+#define WAV_HPP
+
+extern "C" {
+#include "wav.h"
+}
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace wav {
+
+/*
+ * Sample formats.  8 bit PCM is unsigned, 16 and 32 bit PCM are signed.
+ * 24 bit PCM has no sample type; use wav_get_sample_i32/f32 for it.
+ */
+using pcm_u8 = uint8_t;
+using pcm_s16 = int16_t;
+using pcm_s32 = int32_t;
+using pcm_f32 = float;
+
+template <class S> struct sample_traits;
+
+template <> struct sample_traits<pcm_u8> {
+    static constexpr uint32_t bits_per_sample = 8;
+    static constexpr uint32_t format = WAV_FORMAT_PCM;
+
+    static constexpr float to_float(pcm_u8 s)
+    {
+        return (float(s) - 128.0f) * (1.0f / 128.0f);
+    }
+    static constexpr pcm_u8 from_float(float f)
+    {
+        return f >= 127.0f / 128.0f ? pcm_u8(255)
+             : f <= -1.0f ? pcm_u8(0)
+             : pcm_u8(int(f * 128.0f + 128.5f));
+    }
+};
+
+template <> struct sample_traits<pcm_s16> {
+    static constexpr uint32_t bits_per_sample = 16;
+    static constexpr uint32_t format = WAV_FORMAT_PCM;
+
+    static constexpr float to_float(pcm_s16 s)
+    {
+        return float(s) * (1.0f / 32768.0f);
+    }
+    static constexpr pcm_s16 from_float(float f)
+    {
+        return f >= 32767.0f / 32768.0f ? pcm_s16(32767)
+             : f <= -1.0f ? pcm_s16(-32768)
+             : pcm_s16(f * 32768.0f + (f < 0 ? -0.5f : 0.5f));
+    }
+};
+
+template <> struct sample_traits<pcm_s32> {
+    static constexpr uint32_t bits_per_sample = 32;
+    static constexpr uint32_t format = WAV_FORMAT_PCM;
+
+    static constexpr float to_float(pcm_s32 s)
+    {
+        return float(s) * (1.0f / 2147483648.0f);
+    }
+    static constexpr pcm_s32 from_float(float f)
+    {
+        return f >= 1.0f ? pcm_s32(2147483647)
+             : f <= -1.0f ? pcm_s32(-2147483647 - 1)
+             : pcm_s32(double(f) * 2147483648.0 + (f < 0 ? -0.5 : 0.5));
+    }
+};
+
+template <> struct sample_traits<pcm_f32> {
+    static constexpr uint32_t bits_per_sample = 32;
+    static constexpr uint32_t format = WAV_FORMAT_FLOAT;
+
+    static constexpr float to_float(pcm_f32 s) { return s; }
+    static constexpr pcm_f32 from_float(float f) { return f; }
+};
+
+/*
+ * One frame: one sample of each channel.
+ */
+template <class S> class Frame {
+public:
+    Frame(S *first, uint32_t channels) : first_(first), channels_(channels) { }
+
+    S *begin() const { return first_; }
+    S *end() const { return first_ + channels_; }
+    uint32_t size() const { return channels_; }
+    S &operator[](uint32_t ch) const { return first_[ch]; }
+
+private:
+    S *first_;
+    uint32_t channels_;
+};
+
+/*
+ * Iterator over frames.
+ */
+template <class S> class FrameIterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Frame<S>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Frame<S>;
+
+    FrameIterator(S *frame, uint32_t channels) : frame_(frame), channels_(channels) { }
+
+    Frame<S> operator*() const { return Frame<S>(frame_, channels_); }
+    Frame<S> operator[](difference_type n) const { return *(*this + n); }
+    FrameIterator &operator++() { frame_ += channels_; return *this; }
+    FrameIterator operator++(int) { FrameIterator t = *this; frame_ += channels_; return t; }
+    FrameIterator &operator--() { frame_ -= channels_; return *this; }
+    FrameIterator operator--(int) { FrameIterator t = *this; frame_ -= channels_; return t; }
+    FrameIterator &operator+=(difference_type n) { frame_ += n * channels_; return *this; }
+    FrameIterator &operator-=(difference_type n) { frame_ -= n * channels_; return *this; }
+    FrameIterator operator+(difference_type n) const { FrameIterator t = *this; return t += n; }
+    FrameIterator operator-(difference_type n) const { FrameIterator t = *this; return t -= n; }
+    difference_type operator-(const FrameIterator &o) const { return (frame_ - o.frame_) / channels_; }
+    bool operator==(const FrameIterator &o) const { return frame_ == o.frame_; }
+    bool operator!=(const FrameIterator &o) const { return frame_ != o.frame_; }
+    bool operator<(const FrameIterator &o) const { return frame_ < o.frame_; }
+    bool operator>(const FrameIterator &o) const { return o < *this; }
+    bool operator<=(const FrameIterator &o) const { return !(o < *this); }
+    bool operator>=(const FrameIterator &o) const { return !(*this < o); }
+    friend FrameIterator operator+(difference_type n, const FrameIterator &it) { return it + n; }
+
+private:
+    S *frame_;
+    uint32_t channels_;
+};
+
+template <class S> class Frames {
+public:
+    Frames(FrameIterator<S> first, FrameIterator<S> last) : first_(first), last_(last) { }
+    FrameIterator<S> begin() const { return first_; }
+    FrameIterator<S> end() const { return last_; }
+
+private:
+    FrameIterator<S> first_, last_;
+};
+
+/*
+ * Move-only owner of a locked wav_handle.
+ * Errors of the underlying C functions are thrown as std::runtime_error.
+ */
+template <class S> class Audio {
+public:
+    using sample_type = S;
+    using traits = sample_traits<S>;
+
+    Audio(uint32_t channels, uint32_t samplehz, uint32_t size) : h_(0), view_()
+    {
+        wav_config config;
+        config.channels = channels;
+        config.samplehz = samplehz;
+        config.bits_per_sample = traits::bits_per_sample;
+        config.size = size;
+        open(0);
+        try {
+            check(wav_set_config(h_, &config), "wav_set_config");
+            check(wav_set_format(h_, traits::format, 0), "wav_set_format");
+            lock();
+        }
+        catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    explicit Audio(const std::string &filename) : h_(0), view_()
+    {
+        open(filename.c_str());
+        try {
+            lock();
+        }
+        catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    Audio(Audio &&other) noexcept : h_(other.h_), view_(other.view_)
+    {
+        other.h_ = 0;
+    }
+
+    Audio &operator=(Audio &&other) noexcept
+    {
+        if (this != &other) {
+            release();
+            h_ = other.h_;
+            view_ = other.view_;
+            other.h_ = 0;
+        }
+        return *this;
+    }
+
+    Audio(const Audio &) = delete;
+    Audio &operator=(const Audio &) = delete;
+
+    ~Audio() { release(); }
+
+    void load(const std::string &filename)
+    {
+        if (view_.base) {
+            wav_unlock(h_, &view_);
+            view_ = wav_view();
+        }
+        check(wav_load(h_, filename.c_str()), "wav_load");
+        lock();
+    }
+
+    void save(const std::string &filename) const
+    {
+        check(wav_save(h_, filename.c_str()), "wav_save");
+    }
+
+    uint32_t channels() const { return view_.channels; }
+    uint32_t size() const { return view_.size; }
+    wav_handle handle() const { return h_; }
+
+    Frame<S> frame(uint32_t n) const
+    {
+        return Frame<S>(reinterpret_cast<S*>(wav_view_frame(&view_, n)), view_.channels);
+    }
+
+    S &operator()(uint32_t ch, uint32_t n) const { return frame(n)[ch]; }
+
+    Frames<S> frames() const
+    {
+        FrameIterator<S> first(data(), view_.channels);
+        return Frames<S>(first, first + view_.size);
+    }
+
+    /* All interleaved samples as one contiguous array */
+    S *data() const { return reinterpret_cast<S*>(view_.base); }
+    S *begin() const { return data(); }
+    S *end() const { return data() + size_t(view_.size) * view_.channels; }
+
+private:
+    static void check(int rc, const char *func)
+    {
+        if (rc != 0)
+            throw std::runtime_error(std::string(func) + " failed");
+    }
+
+    void open(const char *filename)
+    {
+        wav_handle h = 0;
+        int rc = wav_open(&h, filename);
+        if (rc != 0 && h)
+            wav_close(h);
+        check(rc, "wav_open");
+        h_ = h;
+    }
+
+    void lock()
+    {
+        wav_config config;
+        uint32_t format, channel_mask, layout;
+        wav_get_config(h_, &config);
+        wav_get_format(h_, &format, &channel_mask);
+        wav_get_layout(h_, &layout);
+        if (config.bits_per_sample != traits::bits_per_sample || format != traits::format)
+            throw std::runtime_error("wav sample format mismatch");
+        if (layout != WAV_LAYOUT_INTERLEAVED)
+            throw std::runtime_error("wav is planar");
+        check(wav_lock(h_, &view_, WAV_LOCK_READ | WAV_LOCK_WRITE), "wav_lock");
+    }
+
+    void release()
+    {
+        if (h_) {
+            if (view_.base)
+                wav_unlock(h_, &view_);
+            wav_close(h_);
+            h_ = 0;
+        }
+    }
+
+    wav_handle h_;
+    wav_view view_;
+};
+
+/*
+ * Kernels.  The sample format is a template parameter, so the buffer is a
+ * contiguous array of S and the per-sample function is inlined into the
+ * loop.
+ */
+
+/* Apply f(S) -> S to every sample of dst, reading from src of the same shape */
+template <class S, class F>
+void transform(const Audio<S> &src, Audio<S> &dst, F f)
+{
+    if (src.channels() != dst.channels() || src.size() != dst.size())
+        throw std::invalid_argument("audio size mismatch");
+
+    std::transform(src.begin(), src.end(), dst.begin(), f);
+}
+
+/* Apply f(S) -> S to every sample in place */
+template <class S, class F>
+void transform(Audio<S> &audio, F f)
+{
+    std::transform(audio.begin(), audio.end(), audio.begin(), f);
+}
+
+/* Multiply every sample by gain with clipping */
+template <class S>
+void gain(Audio<S> &audio, float gain)
+{
+    transform(audio, [gain](S s) {
+        return sample_traits<S>::from_float(sample_traits<S>::to_float(s) * gain);
+    });
+}
+
+} /* namespace wav */
+
+#endif /* WAV_HPP */
@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Process-wide cache of loaded wav files.
+ *
+ * Every entry owns one sample buffer and is reference counted: the cache
+ * holds one reference while the entry is in the LRU list and every handle
+ * sharing the samples holds one more.  An evicted entry is freed when the
+ * last handle lets go of it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "wav.h"
+#include "wav_p.h"
+#include "wav_thread.h"
+#include "wav_cache.h"
+
+/*
+ * cache internal data
+ */
+typedef struct cache_entry {
+    struct cache_entry *prev;   /* more recently used */
+    struct cache_entry *next;   /* less recently used */
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime;
+    int64_t size;
+    char *filename;             /* used as the key when there is no inode */
+    wav_config config;
+    uint32_t format;
+    uint32_t channel_mask;
+    uint8_t *image;
+    uint32_t bytes;
+    uint32_t refs;
+} cache_entry;
+
+typedef struct {
+    wav_p_mutex mutex;
+    cache_entry *head;
+    cache_entry *tail;
+    wav_cache_stats stats;
+} cache_data;
+
+static cache_data cache;
+static wav_p_once cache_once = WAV_P_ONCE_INIT;
+
+/*
+ * private functions
+ */
+
+static void cache_p_init(void)
+{
+    wav_p_mutex_init(&cache.mutex);
+    cache.stats.budget = WAV_CACHE_DEFAULT_BUDGET;
+}
+
+static void cache_p_free(cache_entry *entry)
+{
+    free(entry->image);
+    free(entry->filename);
+    free(entry);
+}
+
+static void cache_p_unlink(cache_entry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache.head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache.tail = entry->prev;
+    entry->prev = 0;
+    entry->next = 0;
+}
+
+static void cache_p_push_front(cache_entry *entry)
+{
+    entry->prev = 0;
+    entry->next = cache.head;
+    if (cache.head)
+        cache.head->prev = entry;
+    else
+        cache.tail = entry;
+    cache.head = entry;
+}
+
+/* called with cache.mutex held */
+static void cache_p_drop(cache_entry *entry)
+{
+    cache_p_unlink(entry);
+    cache.stats.bytes -= entry->bytes;
+    cache.stats.entries--;
+    if (--entry->refs == 0)
+        cache_p_free(entry);
+}
+
+/* called with cache.mutex held */
+static void cache_p_trim(void)
+{
+    while (cache.tail && (cache.stats.bytes > cache.stats.budget))
+    {
+        cache_p_drop(cache.tail);
+        cache.stats.evictions++;
+    }
+}
+
+/* called with cache.mutex held */
+static cache_entry *cache_p_find(const struct stat *st, const char *filename)
+{
+    cache_entry *entry;
+
+    for (entry = cache.head; entry; entry = entry->next)
+    {
+        if ((entry->dev != (uint64_t)st->st_dev) || (entry->ino != (uint64_t)st->st_ino) ||
+            (entry->mtime != (int64_t)st->st_mtime) || (entry->size != (int64_t)st->st_size))
+            continue;
+        if ((st->st_ino == 0) && (strcmp(entry->filename, filename) != 0))
+            continue;
+        return entry;
+    }
+
+    return 0;
+}
+
+/* release function given to wav_p_share */
+static void cache_p_release(void *shared)
+{
+    cache_entry *entry = (cache_entry *)shared;
+
+    wav_p_mutex_lock(&cache.mutex);
+    if (--entry->refs == 0)
+        cache_p_free(entry);
+    wav_p_mutex_unlock(&cache.mutex);
+}
+
+/* load filename into a new entry, 0 on error */
+static cache_entry *cache_p_load(const struct stat *st, const char *filename)
+{
+    cache_entry *entry;
+    wav_handle h = 0;
+    wav_data *wav;
+
+    if (wav_open(&h, filename) != 0)
+    {
+        /* wav_open leaves the handle open when the file can't be loaded */
+        if (h)
+            wav_close(h);
+        return 0;
+    }
+    wav = (wav_data *)h;
+
+    entry = (cache_entry*)malloc(sizeof(cache_entry));
+    if (entry)
+    {
+        memset(entry, 0x00, sizeof(cache_entry));
+        entry->filename = (char*)malloc(strlen(filename) + 1);
+    }
+    if ((entry == 0) || (entry->filename == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Can't allocate cache entry");
+        if (entry)
+            free(entry);
+        wav_close(h);
+        return 0;
+    }
+    strcpy(entry->filename, filename);
+    entry->dev = (uint64_t)st->st_dev;
+    entry->ino = (uint64_t)st->st_ino;
+    entry->mtime = (int64_t)st->st_mtime;
+    entry->size = (int64_t)st->st_size;
+
+    /* take the samples over from the handle */
+    entry->config = wav->config;
+    entry->format = wav->format;
+    entry->channel_mask = wav->channel_mask;
+    entry->image = wav->image;
+    entry->bytes = wav->image_size;
+    wav->image = 0;
+    wav_close(h);
+
+    return entry;
+}
+
+/*
+ * Public functions
+ */
+
+int wav_cache_open(wav_handle *h, const char *filename)
+{
+    cache_entry *entry, *found;
+    struct stat st;
+    uint64_t start;
+
+    /* check argument */
+    if ((h == 0) || (filename == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    if (stat(filename, &st) != 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Can't open %s", filename);
+        return -1;
+    }
+
+    wav_p_call_once(&cache_once, cache_p_init);
+    start = wav_p_span_begin();
+
+    wav_p_mutex_lock(&cache.mutex);
+    entry = cache_p_find(&st, filename);
+    if (entry)
+    {
+        cache.stats.hits++;
+        cache_p_unlink(entry);
+        cache_p_push_front(entry);
+        entry->refs++;
+    }
+    else
+        cache.stats.misses++;
+    wav_p_mutex_unlock(&cache.mutex);
+
+    if (entry == 0)
+    {
+        entry = cache_p_load(&st, filename);
+        if (entry == 0)
+            return -1;
+        entry->refs = 1;
+
+        /* do not cache a file that changed while it was loaded */
+        if ((stat(filename, &st) == 0) && (entry->mtime == (int64_t)st.st_mtime) && (entry->size == (int64_t)st.st_size))
+        {
+            wav_p_mutex_lock(&cache.mutex);
+            found = cache_p_find(&st, filename);
+            if (found)
+            {
+                /* another thread loaded it meanwhile */
+                found->refs++;
+                cache_p_free(entry);
+                entry = found;
+            }
+            else if (entry->bytes <= cache.stats.budget)
+            {
+                entry->refs++;
+                cache_p_push_front(entry);
+                cache.stats.bytes += entry->bytes;
+                cache.stats.entries++;
+                cache_p_trim();
+            }
+            wav_p_mutex_unlock(&cache.mutex);
+        }
+    }
+
+    if (wav_open(h, 0) != 0)
+    {
+        cache_p_release(entry);
+        return -1;
+    }
+    if (wav_p_share((wav_data *)*h, &entry->config, entry->format, entry->channel_mask, entry->image, cache_p_release, entry) != 0)
+    {
+        wav_close(*h);
+        *h = 0;
+        return -1;
+    }
+
+    wav_p_span_end((wav_data *)*h, __FUNCTION__, start);
+
+    return 0;
+}
+
+int wav_cache_set_budget(uint64_t budget)
+{
+    wav_p_call_once(&cache_once, cache_p_init);
+
+    wav_p_mutex_lock(&cache.mutex);
+    cache.stats.budget = budget;
+    cache_p_trim();
+    wav_p_mutex_unlock(&cache.mutex);
+
+    return 0;
+}
+
+int wav_cache_get_stats(wav_cache_stats *stats)
+{
+    /* check argument */
+    if (stats == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    wav_p_call_once(&cache_once, cache_p_init);
+
+    wav_p_mutex_lock(&cache.mutex);
+    *stats = cache.stats;
+    wav_p_mutex_unlock(&cache.mutex);
+
+    return 0;
+}
+
+int wav_cache_clear(void)
+{
+    wav_p_call_once(&cache_once, cache_p_init);
+
+    wav_p_mutex_lock(&cache.mutex);
+    while (cache.head)
+        cache_p_drop(cache.head);
+    wav_p_mutex_unlock(&cache.mutex);
+
+    return 0;
+}
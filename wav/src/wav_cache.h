@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Process-wide cache of loaded wav files.
+ * Opening the same unchanged file again shares the samples already in
+ * memory instead of reading and decoding the file.
+ */
+
+#ifndef WAV_CACHE_H
+#define WAV_CACHE_H
+
+#include "wav.h"
+
+#define WAV_CACHE_DEFAULT_BUDGET    (256 * 1024 * 1024)
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bytes;             /* sample bytes held by the cache */
+    uint64_t entries;
+    uint64_t budget;
+} wav_cache_stats;
+
+/*
+ * wav_cache_open creates a new handle like wav_open(h, filename).
+ * A file is identified by device, inode, modification time and size, so
+ * a rewritten file is loaded again.  The handle shares the cached samples
+ * read-only; the first wav_set_data or write lock makes a private copy.
+ */
+int wav_cache_open(wav_handle *h, const char *filename);
+
+/*
+ * Least recently used files are dropped while the cache holds more than
+ * budget bytes.  Handles keep their samples until they are closed.
+ * Files larger than the budget are not cached.
+ */
+int wav_cache_set_budget(uint64_t budget);
+int wav_cache_get_stats(wav_cache_stats *stats);
+int wav_cache_clear(void);
+
+#endif /* WAV_CACHE_H */
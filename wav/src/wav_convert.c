@@ -0,0 +1,618 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Sample format conversion for the wav library.
+ *
+ * Samples go through a block of full scale int32 (16 and 24 bit samples
+ * shifted up) or float.  The kernels between these and int16/int32/float
+ * have scalar, SSE2 and AVX2 versions; the AVX2 ones are compiled for
+ * that instruction set only and picked when the CPU supports it.  Packed
+ * 24 bit samples are unpacked and packed byte by byte.
+ * Dither is the difference of two uniform numbers from one xorshift
+ * generator, made in a block before the kernels so that every kernel
+ * adds the same noise.  Float sources add it to x * scale; integer
+ * sources add it to the full scale int32 and round in 64 bits, so the
+ * bits below the result take part in the rounding.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "wav.h"
+#include "wav_p.h"
+#include "wav_thread.h"
+#include "wav_parallel.h"
+#include "wav_convert.h"
+#ifdef WAV_P_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef WAV_P_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#define CONVERT_BLOCK       1024    /* samples per pass through the kernels */
+#define CONVERT_TASK        65536   /* samples per task of wav_convert, with their own dither seed */
+
+/*
+ * kernel table
+ */
+typedef struct {
+    void (*s16_to_i32)(const int16_t *src, int32_t *dst, size_t n);
+    void (*i32_to_s16)(const int32_t *src, int16_t *dst, size_t n);
+    void (*i32_to_f32)(const int32_t *src, float *dst, size_t n);
+    /* quantize to bits and return full scale; noise in 1/16777216 LSB or 0 */
+    void (*f32_to_i32)(const float *src, int32_t *dst, size_t n, uint32_t bits, const int32_t *noise);
+} convert_kernels;
+
+typedef struct {
+    const uint8_t *src;
+    uint8_t *dst;
+    uint32_t src_type;
+    uint32_t dst_type;
+    size_t count;               /* samples */
+    uint32_t seed;
+    int dither;
+} convert_job;
+
+static const convert_kernels *kernels;
+static wav_p_once kernels_once = WAV_P_ONCE_INIT;
+
+/*
+ * private functions
+ */
+
+static uint32_t convert_p_size(uint32_t type)
+{
+    static const uint32_t size[] = { 2, 3, 4, 4 };
+    return size[type];
+}
+
+static uint32_t convert_p_bits(uint32_t type)
+{
+    static const uint32_t bits[] = { 16, 24, 32, 32 };
+    return bits[type];
+}
+
+/* a nonzero xorshift state for block i */
+static uint32_t convert_p_seed(uint32_t state, uint32_t i)
+{
+    state = (state + i) * 0x9e3779b9;
+    state ^= state >> 16;
+    return state ? state : 0x2545f491;
+}
+
+static uint32_t convert_p_random(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+/* TPDF noise of +-(1 << (32 - shift)), the random state is carried in *dither */
+static void convert_p_noise(int32_t *noise, size_t n, uint32_t shift, uint32_t *dither)
+{
+    uint32_t state = convert_p_seed(*dither, 0);
+    int32_t a;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        a = (int32_t)(convert_p_random(&state) >> shift);
+        noise[i] = a - (int32_t)(convert_p_random(&state) >> shift);
+    }
+    *dither = state;
+}
+
+/*
+ * scalar kernels
+ */
+
+static void convert_p_s16_to_i32(const int16_t *src, int32_t *dst, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = (int32_t)((uint32_t)(uint16_t)src[i] << 16);
+}
+
+static void convert_p_i32_to_s16(const int32_t *src, int16_t *dst, size_t n)
+{
+    size_t i;
+    int32_t x;
+
+    for (i = 0; i < n; i++)
+    {
+        x = ((src[i] >> 15) + 1) >> 1;
+        dst[i] = (int16_t)((x > 32767) ? 32767 : x);
+    }
+}
+
+static void convert_p_i32_to_f32(const int32_t *src, float *dst, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = (float)src[i] * (1.0f / 2147483648.0f);
+}
+
+static void convert_p_f32_to_i32(const float *src, int32_t *dst, size_t n, uint32_t bits, const int32_t *noise)
+{
+    float scale = (float)((uint32_t)1 << (bits - 1));
+    int32_t max = (int32_t)(((uint32_t)1 << (bits - 1)) - 1);
+    double d;
+    float y;
+    int32_t r;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        y = src[i] * scale;
+        if (noise)
+            y += (float)noise[i] * (1.0f / 16777216.0f);
+
+        if (!(y > -scale))
+            r = -max - 1;
+        else if (y >= scale)
+            r = max;
+        else
+        {
+            /* to nearest, ties to even as cvtps in the SIMD kernels */
+            d = floor((double)y);
+            r = (int32_t)d;
+            if (((double)y - d > 0.5) || (((double)y - d == 0.5) && (r & 1)))
+                r++;
+            if (r > max)
+                r = max;
+        }
+        dst[i] = (int32_t)((uint32_t)r << (32 - bits));
+    }
+}
+
+static const convert_kernels convert_scalar = {
+    convert_p_s16_to_i32,
+    convert_p_i32_to_s16,
+    convert_p_i32_to_f32,
+    convert_p_f32_to_i32,
+};
+
+#ifdef WAV_P_SSE2
+/*
+ * SSE2 kernels
+ */
+
+static void convert_p_s16_to_i32_sse2(const int16_t *src, int32_t *dst, size_t n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i x;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        x = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(zero, x));
+        _mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(zero, x));
+    }
+    convert_p_s16_to_i32(src + i, dst + i, n - i);
+}
+
+static void convert_p_i32_to_s16_sse2(const int32_t *src, int16_t *dst, size_t n)
+{
+    __m128i one = _mm_set1_epi32(1);
+    __m128i a, b;
+    size_t i;
+
+    /* round by halves so that nothing overflows; packs clips */
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        a = _mm_loadu_si128((const __m128i *)(src + i));
+        b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+        a = _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(a, 15), one), 1);
+        b = _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(b, 15), one), 1);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+    }
+    convert_p_i32_to_s16(src + i, dst + i, n - i);
+}
+
+static void convert_p_i32_to_f32_sse2(const int32_t *src, float *dst, size_t n)
+{
+    __m128 k = _mm_set1_ps(1.0f / 2147483648.0f);
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src + i))), k));
+    convert_p_i32_to_f32(src + i, dst + i, n - i);
+}
+
+static void convert_p_f32_to_i32_sse2(const float *src, int32_t *dst, size_t n, uint32_t bits, const int32_t *noise)
+{
+    __m128 scale = _mm_set1_ps((float)((uint32_t)1 << (bits - 1)));
+    __m128 low = _mm_set1_ps(-(float)((uint32_t)1 << (bits - 1)));
+    __m128 k = _mm_set1_ps(1.0f / 16777216.0f);
+    __m128i max = _mm_set1_epi32((int32_t)(((uint32_t)1 << (bits - 1)) - 1));
+    __m128i shift = _mm_cvtsi32_si128(32 - bits);
+    __m128i r, over;
+    __m128 y;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        y = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        if (noise)
+            y = _mm_add_ps(y, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(noise + i))), k));
+
+        /* cvtps gives 0x80000000 for too large values; catch them and rounding up to max + 1 */
+        r = _mm_cvtps_epi32(_mm_max_ps(y, low));
+        over = _mm_or_si128(_mm_castps_si128(_mm_cmpge_ps(y, scale)), _mm_cmpgt_epi32(r, max));
+        r = _mm_or_si128(_mm_and_si128(over, max), _mm_andnot_si128(over, r));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_sll_epi32(r, shift));
+    }
+    convert_p_f32_to_i32(src + i, dst + i, n - i, bits, noise ? noise + i : 0);
+}
+
+static const convert_kernels convert_sse2 = {
+    convert_p_s16_to_i32_sse2,
+    convert_p_i32_to_s16_sse2,
+    convert_p_i32_to_f32_sse2,
+    convert_p_f32_to_i32_sse2,
+};
+#endif
+
+#ifdef WAV_P_AVX2
+/*
+ * AVX2 kernels
+ */
+
+static WAV_P_AVX2_FN void convert_p_s16_to_i32_avx2(const int16_t *src, int32_t *dst, size_t n)
+{
+    __m256i x;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_slli_epi32(x, 16));
+    }
+    convert_p_s16_to_i32(src + i, dst + i, n - i);
+}
+
+static WAV_P_AVX2_FN void convert_p_i32_to_s16_avx2(const int32_t *src, int16_t *dst, size_t n)
+{
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i a, b;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        a = _mm256_loadu_si256((const __m256i *)(src + i));
+        b = _mm256_loadu_si256((const __m256i *)(src + i + 8));
+        a = _mm256_srai_epi32(_mm256_add_epi32(_mm256_srai_epi32(a, 15), one), 1);
+        b = _mm256_srai_epi32(_mm256_add_epi32(_mm256_srai_epi32(b, 15), one), 1);
+        /* packs works within 128 bit lanes */
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+    }
+    convert_p_i32_to_s16(src + i, dst + i, n - i);
+}
+
+static WAV_P_AVX2_FN void convert_p_i32_to_f32_avx2(const int32_t *src, float *dst, size_t n)
+{
+    __m256 k = _mm256_set1_ps(1.0f / 2147483648.0f);
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(src + i))), k));
+    convert_p_i32_to_f32(src + i, dst + i, n - i);
+}
+
+static WAV_P_AVX2_FN void convert_p_f32_to_i32_avx2(const float *src, int32_t *dst, size_t n, uint32_t bits, const int32_t *noise)
+{
+    __m256 scale = _mm256_set1_ps((float)((uint32_t)1 << (bits - 1)));
+    __m256 low = _mm256_set1_ps(-(float)((uint32_t)1 << (bits - 1)));
+    __m256 k = _mm256_set1_ps(1.0f / 16777216.0f);
+    __m256i max = _mm256_set1_epi32((int32_t)(((uint32_t)1 << (bits - 1)) - 1));
+    __m128i shift = _mm_cvtsi32_si128(32 - bits);
+    __m256i r, over;
+    __m256 y;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        y = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+        if (noise)
+            y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(noise + i))), k));
+
+        r = _mm256_cvtps_epi32(_mm256_max_ps(y, low));
+        over = _mm256_or_si256(_mm256_castps_si256(_mm256_cmp_ps(y, scale, _CMP_GE_OQ)), _mm256_cmpgt_epi32(r, max));
+        r = _mm256_blendv_epi8(r, max, over);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_sll_epi32(r, shift));
+    }
+    convert_p_f32_to_i32(src + i, dst + i, n - i, bits, noise ? noise + i : 0);
+}
+
+static const convert_kernels convert_avx2 = {
+    convert_p_s16_to_i32_avx2,
+    convert_p_i32_to_s16_avx2,
+    convert_p_i32_to_f32_avx2,
+    convert_p_f32_to_i32_avx2,
+};
+
+/* also used by wav_resample.c */
+int wav_p_has_avx2(void)
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 0;
+    /* the OS must save the ymm registers */
+    __cpuid(info, 1);
+    if (((info[2] & (1 << 27)) == 0) || ((_xgetbv(0) & 6) != 6))
+        return 0;
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 5) & 1;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static void convert_p_init(void)
+{
+    kernels = &convert_scalar;
+#ifdef WAV_P_SSE2
+    kernels = &convert_sse2;
+#endif
+#ifdef WAV_P_AVX2
+    if (wav_p_has_avx2())
+        kernels = &convert_avx2;
+#endif
+}
+
+/* full scale int32 from packed 24 bit */
+static void convert_p_s24_to_i32(const uint8_t *src, int32_t *dst, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++, src += 3)
+        dst[i] = (int32_t)((uint32_t)src[0] << 8 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 24);
+}
+
+/* packed 24 bit from full scale int32, rounded and clipped */
+static void convert_p_i32_to_s24(const int32_t *src, uint8_t *dst, size_t n)
+{
+    size_t i;
+    int32_t x;
+
+    for (i = 0; i < n; i++, dst += 3)
+    {
+        x = ((src[i] >> 7) + 1) >> 1;
+        if (x > 0x7fffff)
+            x = 0x7fffff;
+        dst[0] = (uint8_t)x;
+        dst[1] = (uint8_t)(x >> 8);
+        dst[2] = (uint8_t)(x >> 16);
+    }
+}
+
+/* full scale int32 with noise added, rounded to bits and clipped */
+static void convert_p_dither_i32(const int32_t *src, int32_t *dst, size_t n, uint32_t bits, const int32_t *noise)
+{
+    uint32_t shift = 32 - bits;
+    int64_t half = (int64_t)1 << (shift - 1);
+    int64_t max = ((int64_t)1 << (bits - 1)) - 1;
+    int64_t y;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        y = ((int64_t)src[i] + noise[i] + half) >> shift;
+        if (y > max)
+            y = max;
+        else if (y < -max - 1)
+            y = -max - 1;
+        dst[i] = (int32_t)((uint32_t)y << shift);
+    }
+}
+
+/* convert up to CONVERT_BLOCK samples */
+static void convert_p_block(uint8_t *dst, uint32_t dst_type, const uint8_t *src, uint32_t src_type, size_t n, uint32_t *dither)
+{
+    int32_t ibuf[CONVERT_BLOCK];
+    int32_t noise[CONVERT_BLOCK];
+    float fbuf[CONVERT_BLOCK];
+    const int32_t *i32 = ibuf;
+    const float *f32 = fbuf;
+
+    /* dither only when bits are dropped */
+    if ((dst_type == WAV_CONVERT_F32) || (convert_p_bits(dst_type) >= convert_p_bits(src_type) && (src_type != WAV_CONVERT_F32)))
+        dither = 0;
+
+    /* to full scale int32, or float */
+    if (src_type == WAV_CONVERT_F32)
+        f32 = (const float *)src;
+    else
+    {
+        if (src_type == WAV_CONVERT_S16)
+            kernels->s16_to_i32((const int16_t *)src, ibuf, n);
+        else if (src_type == WAV_CONVERT_S24)
+            convert_p_s24_to_i32(src, ibuf, n);
+        else
+            i32 = (const int32_t *)src;
+
+        if (dst_type == WAV_CONVERT_F32)
+            kernels->i32_to_f32(i32, fbuf, n);
+        else
+            f32 = 0;
+    }
+
+    if (dst_type == WAV_CONVERT_F32)
+    {
+        memcpy(dst, f32, n * sizeof(float));
+        return;
+    }
+    if (f32)
+    {
+        /* noise in 1/16777216 LSB */
+        if (dither)
+            convert_p_noise(noise, n, 8, dither);
+        kernels->f32_to_i32(f32, ibuf, n, convert_p_bits(dst_type), dither ? noise : 0);
+        i32 = ibuf;
+    }
+    else if (dither)
+    {
+        /* noise in full scale int32, 1 LSB is 1 << (32 - bits) */
+        convert_p_noise(noise, n, convert_p_bits(dst_type), dither);
+        convert_p_dither_i32(i32, ibuf, n, convert_p_bits(dst_type), noise);
+        i32 = ibuf;
+    }
+
+    if (dst_type == WAV_CONVERT_S16)
+        kernels->i32_to_s16(i32, (int16_t *)dst, n);
+    else if (dst_type == WAV_CONVERT_S24)
+        convert_p_i32_to_s24(i32, dst, n);
+    else
+        memcpy(dst, i32, n * sizeof(int32_t));
+}
+
+static void convert_p_run(uint8_t *dst, uint32_t dst_type, const uint8_t *src, uint32_t src_type, size_t count, uint32_t *dither)
+{
+    size_t n;
+
+    wav_p_call_once(&kernels_once, convert_p_init);
+
+    if (src_type == dst_type)
+    {
+        memcpy(dst, src, count * convert_p_size(src_type));
+        return;
+    }
+
+    for (; count > 0; count -= n)
+    {
+        n = (count > CONVERT_BLOCK) ? CONVERT_BLOCK : count;
+        convert_p_block(dst, dst_type, src, src_type, n, dither);
+        dst += n * convert_p_size(dst_type);
+        src += n * convert_p_size(src_type);
+    }
+}
+
+/* WAV_CONVERT_* of a sample format, -1 if there is none */
+static int convert_p_type(uint32_t bits_per_sample, uint32_t format)
+{
+    if ((format == WAV_FORMAT_PCM) && (bits_per_sample == 16))
+        return WAV_CONVERT_S16;
+    if ((format == WAV_FORMAT_PCM) && (bits_per_sample == 24))
+        return WAV_CONVERT_S24;
+    if ((format == WAV_FORMAT_PCM) && (bits_per_sample == 32))
+        return WAV_CONVERT_S32;
+    if ((format == WAV_FORMAT_FLOAT) && (bits_per_sample == 32))
+        return WAV_CONVERT_F32;
+    return -1;
+}
+
+/* convert CONVERT_TASK samples; the dither seed depends on the task only, not on the CPUs */
+static void convert_p_task(uint32_t index, void *ctx)
+{
+    convert_job *job = (convert_job *)ctx;
+    size_t first = (size_t)index * CONVERT_TASK;
+    size_t count = job->count - first;
+    uint32_t state;
+
+    if (count > CONVERT_TASK)
+        count = CONVERT_TASK;
+    state = convert_p_seed(job->seed, index);
+    convert_p_run(job->dst + first * convert_p_size(job->dst_type), job->dst_type,
+                  job->src + first * convert_p_size(job->src_type), job->src_type,
+                  count, job->dither ? &state : 0);
+}
+
+/*
+ * Public functions
+ */
+
+int wav_convert_samples(void *dst, uint32_t dst_type, const void *src, uint32_t src_type, size_t count, uint32_t *dither)
+{
+    /* check argument */
+    if ((dst_type > WAV_CONVERT_F32) || (src_type > WAV_CONVERT_F32) || (((dst == 0) || (src == 0)) && (count > 0)))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    convert_p_run((uint8_t *)dst, dst_type, (const uint8_t *)src, src_type, count, dither);
+
+    return 0;
+}
+
+int wav_convert(wav_handle dst, wav_handle src, uint32_t bits_per_sample, uint32_t format, uint32_t *dither)
+{
+    wav_data *wav = (wav_data *)dst;
+    wav_config config;
+    convert_job job;
+    wav_view src_view, dst_view;
+    uint32_t src_format, channel_mask, layout;
+    int src_type, dst_type;
+
+    /* check argument */
+    if ((wav == 0) || (src == 0) || (dst == src))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((wav_get_config(src, &config) != 0) || (wav_get_format(src, &src_format, &channel_mask) != 0) ||
+        (wav_get_layout(src, &layout) != 0))
+        return -1;
+
+    src_type = convert_p_type(config.bits_per_sample, src_format);
+    dst_type = convert_p_type(bits_per_sample, format);
+    if ((src_type < 0) || (dst_type < 0))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error can't convert %d bits (format %d) to %d bits (format %d)",
+                    config.bits_per_sample, src_format, bits_per_sample, format);
+        return -1;
+    }
+
+    job.src_type = (uint32_t)src_type;
+    job.dst_type = (uint32_t)dst_type;
+    job.dither = (dither != 0);
+    job.seed = dither ? *dither : 0;
+
+    config.bits_per_sample = bits_per_sample;
+    if ((wav_set_config(dst, &config) != 0) || (wav_set_format(dst, format, channel_mask) != 0))
+        return -1;
+
+    /* the new buffer is all zero, so it can take any layout */
+    wav->layout = layout;
+    if (config.size == 0)
+        return 0;
+
+    /* the planes follow each other, so the samples are one run in either layout */
+    if (wav_lock(src, &src_view, WAV_LOCK_READ) != 0)
+        return -1;
+    if (wav_lock(dst, &dst_view, WAV_LOCK_WRITE) != 0)
+    {
+        wav_unlock(src, &src_view);
+        return -1;
+    }
+    job.src = src_view.base;
+    job.dst = dst_view.base;
+    job.count = (size_t)config.size * config.channels;
+    wav_parallel_tasks((uint32_t)((job.count + CONVERT_TASK - 1) / CONVERT_TASK), convert_p_task, &job);
+    wav_unlock(dst, &dst_view);
+    wav_unlock(src, &src_view);
+
+    /* the next call gets other noise */
+    if (dither)
+        *dither = convert_p_seed(*dither, 1);
+
+    return 0;
+}
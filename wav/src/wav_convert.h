@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Sample format conversion for the wav library.
+ * Converts between 16, 24 (packed) and 32 bit integer and 32 bit float
+ * samples with SSE2/AVX2 when the CPU has them.
+ */
+
+#ifndef WAV_CONVERT_H
+#define WAV_CONVERT_H
+
+#include <stddef.h>
+#include "wav.h"
+
+#define WAV_CONVERT_S16     0       /* int16_t */
+#define WAV_CONVERT_S24     1       /* 3 bytes, little endian */
+#define WAV_CONVERT_S32     2       /* int32_t */
+#define WAV_CONVERT_F32     3       /* float, -1.0 to 1.0 */
+
+/*
+ * Convert count samples from src to dst; the buffers must not overlap.
+ * Integers are scaled by their full scale (1 << (bits - 1)), rounded to
+ * the nearest value and clipped.  If dither is not 0, TPDF dither of
+ * +-1 LSB is added when the result has fewer bits than the source, and
+ * *dither is the random state carried from block to block (any value to
+ * start with).  Works on any block size, so it can be used on streams.
+ */
+int wav_convert_samples(void *dst, uint32_t dst_type, const void *src, uint32_t src_type, size_t count, uint32_t *dither);
+
+/*
+ * Make dst a copy of src with bits_per_sample/format samples
+ * (16/24/32 bit WAV_FORMAT_PCM or 32 bit WAV_FORMAT_FLOAT) and the
+ * layout of src.  Blocks of samples are converted on all CPUs; each
+ * block has its own dither seed, so the result does not depend on the
+ * number of CPUs.
+ */
+int wav_convert(wav_handle dst, wav_handle src, uint32_t bits_per_sample, uint32_t format, uint32_t *dither);
+
+#endif /* WAV_CONVERT_H */
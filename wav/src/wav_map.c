@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Memory-mapped wav files.
+ *
+ * The whole file is mapped read-only and shared.  The handle gets the
+ * data chunk as a shared buffer (wav_p_share) and the mapping is removed
+ * when the handle drops it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wav.h"
+#include "wav_p.h"
+#include "wav_map.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ * map internal data
+ */
+typedef struct {
+    void *base;
+    size_t length;
+} map_data;
+
+/*
+ * private functions
+ */
+
+static void map_p_release(void *shared)
+{
+    map_data *map = (map_data *)shared;
+
+#ifdef _WIN32
+    UnmapViewOfFile(map->base);
+#else
+    munmap(map->base, map->length);
+#endif
+    free(map);
+}
+
+/* map the whole file read-only */
+static int map_p_map(map_data *map, const char *filename, uint32_t flags)
+{
+#ifdef _WIN32
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                       (flags & WAV_MAP_SEQUENTIAL) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return -1;
+    if (!GetFileSizeEx(file, &size) || (size.QuadPart == 0) || ((uint64_t)size.QuadPart > (SIZE_MAX >> 1)))
+    {
+        CloseHandle(file);
+        return -1;
+    }
+
+    /* the view keeps the mapping and the file open */
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+        return -1;
+    map->base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (map->base == NULL)
+        return -1;
+    map->length = (size_t)size.QuadPart;
+#else
+    struct stat st;
+    int fd, mflags = MAP_SHARED;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0) || ((uint64_t)st.st_size > (SIZE_MAX >> 1)))
+    {
+        close(fd);
+        return -1;
+    }
+#ifdef MAP_POPULATE
+    if (flags & WAV_MAP_POPULATE)
+        mflags |= MAP_POPULATE;
+#endif
+    map->length = (size_t)st.st_size;
+    map->base = mmap(NULL, map->length, PROT_READ, mflags, fd, 0);
+    close(fd);
+    if (map->base == MAP_FAILED)
+        return -1;
+
+    if (flags & WAV_MAP_SEQUENTIAL)
+        madvise(map->base, map->length, MADV_SEQUENTIAL);
+    if (flags & WAV_MAP_WILLNEED)
+        madvise(map->base, map->length, MADV_WILLNEED);
+#endif
+
+    return 0;
+}
+
+/* touch every page where the system has no MAP_POPULATE */
+static void map_p_populate(const uint8_t *p, size_t size)
+{
+#if defined(_WIN32) || !defined(MAP_POPULATE)
+    volatile uint8_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < size; i += 4096)
+        sum += p[i];
+    (void)sum;
+#else
+    (void)p;
+    (void)size;
+#endif
+}
+
+/*
+ * Public functions
+ */
+
+int wav_map_open(wav_handle *h, const char *filename, uint32_t flags)
+{
+    map_data *map;
+    wav_p_header header;
+    const uint8_t *payload;
+    uint32_t bytes_per_sample;
+    uint64_t start;
+
+    /* check argument */
+    if ((h == 0) || (filename == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    map = (map_data*)malloc(sizeof(map_data));
+    if (map == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Can't allocate map_data");
+        return -1;
+    }
+
+    start = wav_p_span_begin();
+    if (map_p_map(map, filename, flags) != 0)
+    {
+        /* empty files, pipes and the like */
+        free(map);
+        *h = 0;
+        if (wav_open(h, filename) != 0)
+        {
+            if (*h)
+                wav_close(*h);
+            *h = 0;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (wav_open(h, 0) != 0)
+    {
+        map_p_release(map);
+        return -1;
+    }
+    if (wav_p_parse_mem((wav_data *)*h, __FUNCTION__, (const uint8_t *)map->base, map->length, &header) != 0)
+    {
+        map_p_release(map);
+        wav_close(*h);
+        *h = 0;
+        return -1;
+    }
+
+    /* 24 bit samples are accessed bytewise */
+    payload = (const uint8_t *)map->base + header.data_offset;
+    bytes_per_sample = header.config.bits_per_sample/8;
+    if ((bytes_per_sample != 3) && ((uintptr_t)payload % bytes_per_sample != 0))
+    {
+        map_p_release(map);
+        if (wav_load(*h, filename) != 0)
+        {
+            wav_close(*h);
+            *h = 0;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (flags & WAV_MAP_POPULATE)
+        map_p_populate(payload, (size_t)header.config.size * header.config.channels * bytes_per_sample);
+
+    if (wav_p_share((wav_data *)*h, &header.config, header.format, header.channel_mask, (uint8_t *)payload, map_p_release, map) != 0)
+    {
+        map_p_release(map);
+        wav_close(*h);
+        *h = 0;
+        return -1;
+    }
+    wav_p_count_load((wav_data *)*h);
+    wav_p_span_end((wav_data *)*h, __FUNCTION__, start);
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Memory-mapped wav files.
+ * The samples are used in place in a read-only mapping of the file, so
+ * opening is quick and processes opening the same file share the pages.
+ */
+
+#ifndef WAV_MAP_H
+#define WAV_MAP_H
+
+#include "wav.h"
+
+#define WAV_MAP_POPULATE    0x01    /* read all pages in now (MAP_POPULATE) */
+#define WAV_MAP_SEQUENTIAL  0x02    /* samples are read in order, read ahead aggressively */
+#define WAV_MAP_WILLNEED    0x04    /* start reading the samples in the background */
+
+/*
+ * wav_map_open creates a new handle like wav_open(h, filename) whose
+ * samples point into the mapped data chunk.  The mapping is read-only:
+ * the first wav_set_data or write lock makes a private copy.  The file
+ * must not be truncated while it is mapped.  The file is loaded normally
+ * when it can not be mapped or the samples are not aligned.  On error
+ * no handle is left open and *h is 0.
+ */
+int wav_map_open(wav_handle *h, const char *filename, uint32_t flags);
+
+#endif /* WAV_MAP_H */
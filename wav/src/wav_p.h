@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Private definitions shared by the wav library sources.
+ * This header is not part of the public API.
+ */
+
+#ifndef WAV_P_H
+#define WAV_P_H
+
+#include <stdio.h>
+#include "wav.h"
+
+/* SSE2 is always available on x64 */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WAV_P_SSE2
+#endif
+
+/* AVX2 functions are compiled for that instruction set only and picked at runtime */
+#if defined(WAV_P_SSE2) && (defined(_MSC_VER) || defined(__GNUC__))
+#define WAV_P_AVX2
+#ifdef _MSC_VER
+#define WAV_P_AVX2_FN
+#else
+#define WAV_P_AVX2_FN       __attribute__((target("avx2")))
+#endif
+#endif
+
+/*
+ * wav internal data
+ */
+typedef struct {
+    uint8_t *image;
+    uint32_t image_size;
+    int image_external;         /* image is not owned (wav_attach_mem) */
+    void *shared;               /* owner of a shared read-only buffer (wav_cache.c) */
+    void (*shared_release)(void *shared);
+    wav_config config;
+    uint32_t format;            /* WAV_FORMAT_PCM or WAV_FORMAT_FLOAT */
+    uint32_t channel_mask;      /* WAV_SPEAKER_* bits, 0 if not known */
+    uint32_t layout;            /* WAV_LAYOUT_INTERLEAVED or WAV_LAYOUT_PLANAR */
+    uint32_t locks;
+    wav_stats stats;
+} wav_data;
+
+#define WAV_P_HEADER_SIZE   46      /* RIFF, fmt (18 bytes) and data chunk headers */
+#define WAV_P_HEADER_MAX    68      /* the same with WAVE_FORMAT_EXTENSIBLE fmt (40 bytes) */
+
+/* what the header of a file says about its samples */
+typedef struct {
+    wav_config config;
+    uint32_t format;
+    uint32_t channel_mask;
+    uint64_t data_offset;       /* from the start of the file */
+    uint32_t data_size;
+} wav_p_header;
+
+/*
+ * Fill the file header written in front of data_size bytes of samples and
+ * return its size, WAV_P_HEADER_SIZE or WAV_P_HEADER_MAX (wav.c).
+ * The data chunk size is in the last 4 bytes.
+ */
+uint32_t wav_p_make_header(const wav_config *config, uint32_t format, uint32_t channel_mask, uint32_t data_size, uint8_t *header);
+
+/* format and bits_per_sample can be read and written (wav.c) */
+int wav_p_valid_format(uint32_t format, uint32_t bits_per_sample);
+
+/* find "fmt " and "data" in a wav file image (wav.c) */
+int wav_p_parse_mem(wav_data *wav, const char *func, const uint8_t *buf, size_t size, wav_p_header *header);
+
+/* file access (wav.c) */
+int wav_p_seek(FILE *fp, uint64_t offset);
+int wav_p_read_header(wav_data *wav, const char *func, FILE *fp, wav_p_header *header);
+
+/*
+ * diagnostics (wav.c)
+ */
+void wav_p_error(wav_data *wav, const char *func, const char *format, ...);
+uint64_t wav_p_span_begin(void);
+void wav_p_span_end(wav_data *wav, const char *func, uint64_t start);
+void wav_p_count_read(wav_data *wav, uint32_t bytes);
+void wav_p_count_write(wav_data *wav, uint32_t bytes);
+void wav_p_count_load(wav_data *wav);
+void wav_p_count_save(wav_data *wav);
+void wav_p_count_allocation(wav_data *wav);
+
+#ifdef WAV_P_AVX2
+/* the CPU and the OS support AVX2 (wav_convert.c) */
+int wav_p_has_avx2(void);
+#endif
+
+/*
+ * shared read-only sample buffer (wav.c); the handle keeps its layout, a
+ * layout other than WAV_LAYOUT_INTERLEAVED gets a private copy
+ */
+int wav_p_share(wav_data *wav, const wav_config *config, uint32_t format, uint32_t channel_mask,
+                uint8_t *image, void (*release)(void *), void *shared);
+
+#endif /* WAV_P_H */
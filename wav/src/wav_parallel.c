@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Parallel processing of wav frames on a thread pool owned by the library.
+ *
+ * A job is split into chunks and every worker (the calling thread is one
+ * of them) gets a contiguous range of chunks in its own queue.  A worker
+ * takes chunks from the front of its queue and, when it is empty, steals
+ * from the back of the other queues, so a slow block does not hold up the
+ * whole job.  The threads stay alive between jobs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wav.h"
+#include "wav_p.h"
+#include "wav_thread.h"
+#include "wav_parallel.h"
+
+#define PARALLEL_MAX_THREADS    64
+#define PARALLEL_CHUNKS         4       /* chunks per thread */
+#define PARALLEL_MIN_FRAMES     4096
+
+typedef void (*parallel_task)(void *arg, uint32_t chunk);
+
+typedef struct {
+    wav_p_mutex mutex;
+    uint32_t begin;
+    uint32_t end;
+} parallel_queue;
+
+/*
+ * pool data
+ */
+typedef struct {
+    wav_p_mutex mutex;          /* one job at a time, start/stop */
+    wav_p_mutex state;          /* protects the fields below */
+    wav_p_cond wake;
+    wav_p_cond done;
+    int running;
+    int stop;
+    uint32_t threads;           /* workers including the calling thread */
+    uint32_t generation;        /* incremented for each job */
+    uint32_t active;            /* pool threads still working on the job */
+    parallel_task task;
+    void *arg;
+    wav_p_thread thread[PARALLEL_MAX_THREADS];
+    parallel_queue queue[PARALLEL_MAX_THREADS];
+} parallel_pool;
+
+static parallel_pool pool;
+static wav_p_once pool_once = WAV_P_ONCE_INIT;
+static WAV_P_TLS int in_pool;
+
+typedef struct {
+    wav_view view;
+    uint32_t frames;            /* frames per chunk */
+    wav_frames_fn fn;
+    void *ctx;
+} frames_job;
+
+typedef struct {
+    wav_task_fn fn;
+    void *ctx;
+} tasks_job;
+
+/*
+ * private functions
+ */
+
+static void parallel_p_init(void)
+{
+    wav_p_mutex_init(&pool.mutex);
+}
+
+/* run chunks from our queue, then steal from the others until all are empty */
+static void parallel_p_work(uint32_t index)
+{
+    parallel_queue *q;
+    uint32_t i, chunk;
+    int found;
+
+    for (;;)
+    {
+        q = &pool.queue[index];
+        wav_p_mutex_lock(&q->mutex);
+        found = (q->begin < q->end);
+        if (found)
+            chunk = q->begin++;
+        wav_p_mutex_unlock(&q->mutex);
+
+        for (i = 1; (i < pool.threads) && !found; i++)
+        {
+            q = &pool.queue[(index + i) % pool.threads];
+            wav_p_mutex_lock(&q->mutex);
+            found = (q->begin < q->end);
+            if (found)
+                chunk = --q->end;
+            wav_p_mutex_unlock(&q->mutex);
+        }
+
+        if (!found)
+            return;
+        pool.task(pool.arg, chunk);
+    }
+}
+
+static WAV_P_THREAD_PROC(parallel_p_worker, arg)
+{
+    uint32_t index = (uint32_t)(uintptr_t)arg;
+    uint32_t seen = 0;
+
+    in_pool = 1;
+
+    for (;;)
+    {
+        wav_p_mutex_lock(&pool.state);
+        while ((pool.generation == seen) && !pool.stop)
+            wav_p_cond_wait(&pool.wake, &pool.state);
+        seen = pool.generation;
+        wav_p_mutex_unlock(&pool.state);
+        if (pool.stop)
+            break;
+
+        parallel_p_work(index);
+
+        wav_p_mutex_lock(&pool.state);
+        if (--pool.active == 0)
+            wav_p_cond_signal(&pool.done);
+        wav_p_mutex_unlock(&pool.state);
+    }
+
+    return 0;
+}
+
+/* called with pool.mutex held */
+static void parallel_p_start(void)
+{
+    uint32_t i, n;
+
+    n = wav_p_cpu_count();
+    if (n > PARALLEL_MAX_THREADS)
+        n = PARALLEL_MAX_THREADS;
+
+    wav_p_mutex_init(&pool.state);
+    wav_p_cond_init(&pool.wake);
+    wav_p_cond_init(&pool.done);
+    pool.stop = 0;
+    pool.generation = 0;
+    pool.threads = n;
+
+    for (i = 1; i < n; i++)
+    {
+        if (wav_p_thread_create(&pool.thread[i], parallel_p_worker, (void *)(uintptr_t)i) != 0)
+        {
+            wav_p_error(0, __FUNCTION__, "Can't create worker thread (%d of %d)", i, n);
+            break;
+        }
+    }
+    pool.threads = i;
+    for (i = 0; i < pool.threads; i++)
+        wav_p_mutex_init(&pool.queue[i].mutex);
+    pool.running = 1;
+}
+
+/* run task for chunks [0, chunks) on the pool and wait for them */
+static void parallel_p_run(uint32_t chunks, parallel_task task, void *arg)
+{
+    uint32_t i, n;
+
+    if (!in_pool && (chunks > 1))
+    {
+        wav_p_call_once(&pool_once, parallel_p_init);
+        wav_p_mutex_lock(&pool.mutex);
+        if (!pool.running)
+            parallel_p_start();
+        n = pool.threads;
+
+        if (n > 1)
+        {
+            for (i = 0; i < n; i++)
+            {
+                pool.queue[i].begin = (uint32_t)((uint64_t)chunks * i / n);
+                pool.queue[i].end = (uint32_t)((uint64_t)chunks * (i + 1) / n);
+            }
+
+            wav_p_mutex_lock(&pool.state);
+            pool.task = task;
+            pool.arg = arg;
+            pool.active = n - 1;
+            pool.generation++;
+            wav_p_cond_broadcast(&pool.wake);
+            wav_p_mutex_unlock(&pool.state);
+
+            in_pool = 1;
+            parallel_p_work(0);
+            in_pool = 0;
+
+            wav_p_mutex_lock(&pool.state);
+            while (pool.active > 0)
+                wav_p_cond_wait(&pool.done, &pool.state);
+            wav_p_mutex_unlock(&pool.state);
+
+            wav_p_mutex_unlock(&pool.mutex);
+            return;
+        }
+        wav_p_mutex_unlock(&pool.mutex);
+    }
+
+    /* nested call or nothing to share */
+    for (i = 0; i < chunks; i++)
+        task(arg, i);
+}
+
+static void parallel_p_frames(void *arg, uint32_t chunk)
+{
+    frames_job *job = (frames_job *)arg;
+    uint32_t n = chunk * job->frames;
+    uint32_t count = job->view.size - n;
+
+    if (count > job->frames)
+        count = job->frames;
+    job->fn(wav_view_frame(&job->view, n), job->view.stride, job->view.channels, n, count, job->ctx);
+}
+
+static void parallel_p_tasks(void *arg, uint32_t chunk)
+{
+    tasks_job *job = (tasks_job *)arg;
+
+    job->fn(chunk, job->ctx);
+}
+
+/*
+ * Public functions
+ */
+
+int wav_parallel_frames(wav_handle h, wav_frames_fn fn, void *ctx)
+{
+    wav_data *wav = (wav_data *)h;
+    frames_job job;
+    uint32_t chunks;
+    uint64_t start;
+
+    /* check argument */
+    if (wav == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (fn == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if (wav->layout == WAV_LAYOUT_PLANAR)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error wav is planar");
+        return -1;
+    }
+
+    if (wav_lock(h, &job.view, WAV_LOCK_READ | WAV_LOCK_WRITE) != 0)
+        return -1;
+
+    start = wav_p_span_begin();
+
+    /* blocks of at least PARALLEL_MIN_FRAMES so that short jobs are not split up */
+    chunks = wav_p_cpu_count() * PARALLEL_CHUNKS;
+    job.frames = (job.view.size + chunks - 1) / chunks;
+    if (job.frames < PARALLEL_MIN_FRAMES)
+        job.frames = PARALLEL_MIN_FRAMES;
+    job.fn = fn;
+    job.ctx = ctx;
+
+    parallel_p_run((job.view.size + job.frames - 1) / job.frames, parallel_p_frames, &job);
+
+    wav_p_span_end(wav, __FUNCTION__, start);
+    wav_unlock(h, &job.view);
+
+    return 0;
+}
+
+int wav_parallel_tasks(uint32_t count, wav_task_fn fn, void *ctx)
+{
+    tasks_job job;
+
+    /* check argument */
+    if (fn == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    job.fn = fn;
+    job.ctx = ctx;
+    parallel_p_run(count, parallel_p_tasks, &job);
+
+    return 0;
+}
+
+void wav_parallel_shutdown(void)
+{
+    uint32_t i;
+
+    wav_p_call_once(&pool_once, parallel_p_init);
+    wav_p_mutex_lock(&pool.mutex);
+
+    if (pool.running)
+    {
+        wav_p_mutex_lock(&pool.state);
+        pool.stop = 1;
+        wav_p_cond_broadcast(&pool.wake);
+        wav_p_mutex_unlock(&pool.state);
+
+        for (i = 1; i < pool.threads; i++)
+            wav_p_thread_join(pool.thread[i]);
+        for (i = 0; i < pool.threads; i++)
+            wav_p_mutex_destroy(&pool.queue[i].mutex);
+        wav_p_cond_destroy(&pool.done);
+        wav_p_cond_destroy(&pool.wake);
+        wav_p_mutex_destroy(&pool.state);
+        pool.running = 0;
+    }
+
+    wav_p_mutex_unlock(&pool.mutex);
+}
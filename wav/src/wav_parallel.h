@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Parallel processing of wav frames on a thread pool owned by the library.
+ */
+
+#ifndef WAV_PARALLEL_H
+#define WAV_PARALLEL_H
+
+#include "wav.h"
+
+/*
+ * fn processes count frames starting at frame n.  frame points to frame n
+ * and frame n + i starts at frame + i * stride.  Each frame holds channels
+ * interleaved samples as in wav_view_frame().
+ */
+typedef void (*wav_frames_fn)(uint8_t *frame, uint32_t stride, uint32_t channels, uint32_t n, uint32_t count, void *ctx);
+
+/*
+ * Call fn for blocks of frames covering the whole data and return when
+ * all are done.  The blocks run at the same time on the pool, so fn must
+ * only write the frames it is given.  The handle is locked for read/write
+ * during the call and must be interleaved.  A call from inside fn runs on
+ * the calling thread.
+ */
+int wav_parallel_frames(wav_handle h, wav_frames_fn fn, void *ctx);
+
+/*
+ * Call fn for index 0 to count - 1 on the pool and return when all are
+ * done, for jobs that are not split by frames (e.g. one per channel).
+ */
+typedef void (*wav_task_fn)(uint32_t index, void *ctx);
+
+int wav_parallel_tasks(uint32_t count, wav_task_fn fn, void *ctx);
+
+/*
+ * The pool is started on first use with one thread per CPU.
+ * wav_parallel_shutdown stops it, e.g. before unloading the library.
+ */
+void wav_parallel_shutdown(void);
+
+#endif /* WAV_PARALLEL_H */
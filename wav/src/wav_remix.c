@@ -0,0 +1,410 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Channel remixing for the wav library.
+ *
+ * Every output sample is a dot product of an input frame with a row of
+ * the matrix.  Stereo to mono does 4 frames per pass: two products with
+ * (g0, g1, g0, g1) are shuffled into the left and the right halves and
+ * added.  5.1 to stereo does 2 frames per pass: each input channel of
+ * both frames is shuffled into (a, a, b, b) and multiplied by the gains
+ * of that channel for (L, R, L, R).  The handle version converts blocks
+ * of frames to float and back with wav_convert_samples.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wav.h"
+#include "wav_p.h"
+#include "wav_parallel.h"
+#include "wav_convert.h"
+#include "wav_remix.h"
+#ifdef WAV_P_SSE2
+#include <emmintrin.h>
+#endif
+
+#define REMIX_BLOCK         4096        /* samples per pass of wav_remix */
+#define REMIX_K             0.70710678f /* -3 dB */
+
+/* bits of the WAV_SPEAKER_* masks */
+#define REMIX_FL            0
+#define REMIX_FR            1
+#define REMIX_FC            2
+#define REMIX_BL            4
+#define REMIX_BR            5
+#define REMIX_BC            8
+#define REMIX_SL            9
+#define REMIX_SR            10
+
+typedef struct {
+    const float *matrix;
+    const uint8_t *src;         /* channel 0 of frame 0 */
+    uint32_t src_stride;        /* bytes to the next frame */
+    size_t plane_stride;        /* bytes to the next channel, 0 if interleaved */
+    uint32_t in_channels;
+    uint32_t type;              /* WAV_CONVERT_* of src and dst */
+    uint32_t bytes;             /* per sample */
+} remix_job;
+
+/* speakers of 0 to 8 channels without a channel mask */
+static const uint32_t remix_default_mask[] = {
+    0,
+    WAV_SPEAKER_FRONT_CENTER,
+    0x003,                      /* stereo */
+    0x007,                      /* 3.0 */
+    0x033,                      /* quad */
+    0x037,                      /* 5.0 */
+    0x03f,                      /* 5.1 */
+    0x70f,                      /* 6.1 */
+    0x63f,                      /* 7.1 */
+};
+
+/*
+ * private functions
+ */
+
+static void remix_p_generic(float *dst, uint32_t out_channels, const float *src, uint32_t in_channels,
+                            const float *matrix, size_t count)
+{
+    const float *m;
+    float s;
+    size_t n;
+    uint32_t o, i;
+
+    for (n = 0; n < count; n++)
+    {
+        m = matrix;
+        for (o = 0; o < out_channels; o++)
+        {
+            s = 0.0f;
+            for (i = 0; i < in_channels; i++)
+                s += m[i] * src[i];
+            dst[o] = s;
+            m += in_channels;
+        }
+        dst += out_channels;
+        src += in_channels;
+    }
+}
+
+#ifdef WAV_P_SSE2
+static void remix_p_2to1_sse2(float *dst, const float *src, const float *matrix, size_t count)
+{
+    __m128 g = _mm_setr_ps(matrix[0], matrix[1], matrix[0], matrix[1]);
+    __m128 a, b;
+    size_t n;
+
+    for (n = 0; n + 4 <= count; n += 4)
+    {
+        a = _mm_mul_ps(_mm_loadu_ps(src + 2 * n), g);
+        b = _mm_mul_ps(_mm_loadu_ps(src + 2 * n + 4), g);
+        _mm_storeu_ps(dst + n, _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+                                          _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+    remix_p_generic(dst + n, 1, src + 2 * n, 2, matrix, count - n);
+}
+
+static void remix_p_6to2_sse2(float *dst, const float *src, const float *matrix, size_t count)
+{
+    __m128 c[6];
+    __m128 v0, v1, v2, s;
+    size_t n;
+    uint32_t i;
+
+    for (i = 0; i < 6; i++)
+        c[i] = _mm_setr_ps(matrix[i], matrix[6 + i], matrix[i], matrix[6 + i]);
+
+    /* v0 = a0 a1 a2 a3, v1 = a4 a5 b0 b1, v2 = b2 b3 b4 b5 */
+    for (n = 0; n + 2 <= count; n += 2)
+    {
+        v0 = _mm_loadu_ps(src + 6 * n);
+        v1 = _mm_loadu_ps(src + 6 * n + 4);
+        v2 = _mm_loadu_ps(src + 6 * n + 8);
+        s = _mm_mul_ps(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 2, 0, 0)), c[0]);
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 3, 1, 1)), c[1]));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_shuffle_ps(v0, v2, _MM_SHUFFLE(0, 0, 2, 2)), c[2]));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_shuffle_ps(v0, v2, _MM_SHUFFLE(1, 1, 3, 3)), c[3]));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_shuffle_ps(v1, v2, _MM_SHUFFLE(2, 2, 0, 0)), c[4]));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_shuffle_ps(v1, v2, _MM_SHUFFLE(3, 3, 1, 1)), c[5]));
+        _mm_storeu_ps(dst + 2 * n, s);
+    }
+    remix_p_generic(dst + 2 * n, 2, src + 6 * n, 6, matrix, count - n);
+}
+#endif
+
+static void remix_p_run(float *dst, uint32_t out_channels, const float *src, uint32_t in_channels,
+                        const float *matrix, size_t count)
+{
+#ifdef WAV_P_SSE2
+    if ((in_channels == 2) && (out_channels == 1))
+    {
+        remix_p_2to1_sse2(dst, src, matrix, count);
+        return;
+    }
+    if ((in_channels == 6) && (out_channels == 2))
+    {
+        remix_p_6to2_sse2(dst, src, matrix, count);
+        return;
+    }
+#endif
+    remix_p_generic(dst, out_channels, src, in_channels, matrix, count);
+}
+
+/* channel of each speaker bit, -1 if there is none; returns the channels with a speaker */
+static uint32_t remix_p_speakers(int *channel, uint32_t mask, uint32_t channels)
+{
+    uint32_t bit, n = 0;
+
+    if ((mask == 0) && (channels < sizeof(remix_default_mask) / sizeof(remix_default_mask[0])))
+        mask = remix_default_mask[channels];
+
+    for (bit = 0; bit < 32; bit++)
+    {
+        channel[bit] = -1;
+        if ((mask >> bit) & 1)
+        {
+            if (n < channels)
+                channel[bit] = (int)n;
+            n++;
+        }
+    }
+
+    return (n < channels) ? n : channels;
+}
+
+/* add gain from input channel i on speaker bit to the output speakers */
+static void remix_p_route(float *matrix, uint32_t in_channels, const int *out, uint32_t i, uint32_t bit, float gain)
+{
+    if (out[bit] >= 0)
+    {
+        matrix[out[bit] * in_channels + i] += gain;
+        return;
+    }
+
+    switch (bit)
+    {
+    case REMIX_FL:
+    case REMIX_FR:
+        if (out[REMIX_FC] >= 0)
+            matrix[out[REMIX_FC] * in_channels + i] += gain * REMIX_K;
+        break;
+    case REMIX_FC:
+        if (out[REMIX_FL] >= 0)
+            matrix[out[REMIX_FL] * in_channels + i] += gain * REMIX_K;
+        if (out[REMIX_FR] >= 0)
+            matrix[out[REMIX_FR] * in_channels + i] += gain * REMIX_K;
+        break;
+    case REMIX_BL:
+        if (out[REMIX_SL] >= 0)
+            remix_p_route(matrix, in_channels, out, i, REMIX_SL, gain);
+        else
+            remix_p_route(matrix, in_channels, out, i, REMIX_FL, gain * REMIX_K);
+        break;
+    case REMIX_BR:
+        if (out[REMIX_SR] >= 0)
+            remix_p_route(matrix, in_channels, out, i, REMIX_SR, gain);
+        else
+            remix_p_route(matrix, in_channels, out, i, REMIX_FR, gain * REMIX_K);
+        break;
+    case REMIX_SL:
+        if (out[REMIX_BL] >= 0)
+            remix_p_route(matrix, in_channels, out, i, REMIX_BL, gain);
+        else
+            remix_p_route(matrix, in_channels, out, i, REMIX_FL, gain * REMIX_K);
+        break;
+    case REMIX_SR:
+        if (out[REMIX_BR] >= 0)
+            remix_p_route(matrix, in_channels, out, i, REMIX_BR, gain);
+        else
+            remix_p_route(matrix, in_channels, out, i, REMIX_FR, gain * REMIX_K);
+        break;
+    case REMIX_BC:
+        remix_p_route(matrix, in_channels, out, i, REMIX_BL, gain * REMIX_K);
+        remix_p_route(matrix, in_channels, out, i, REMIX_BR, gain * REMIX_K);
+        break;
+    default:
+        /* LFE and the others are dropped */
+        break;
+    }
+}
+
+/* WAV_CONVERT_* of a sample format, -1 if there is none */
+static int remix_p_type(uint32_t bits_per_sample, uint32_t format)
+{
+    if ((format == WAV_FORMAT_PCM) && (bits_per_sample == 16))
+        return WAV_CONVERT_S16;
+    if ((format == WAV_FORMAT_PCM) && (bits_per_sample == 24))
+        return WAV_CONVERT_S24;
+    if ((format == WAV_FORMAT_PCM) && (bits_per_sample == 32))
+        return WAV_CONVERT_S32;
+    if ((format == WAV_FORMAT_FLOAT) && (bits_per_sample == 32))
+        return WAV_CONVERT_F32;
+    return -1;
+}
+
+static void remix_p_frames(uint8_t *frame, uint32_t stride, uint32_t channels, uint32_t n, uint32_t count, void *ctx)
+{
+    remix_job *job = (remix_job *)ctx;
+    float in[REMIX_BLOCK], out[REMIX_BLOCK];
+    uint8_t packed[REMIX_BLOCK * 4];
+    const uint8_t *src;
+    const float *x;
+    float *y;
+    uint32_t step, k;
+
+    step = REMIX_BLOCK / ((job->in_channels > channels) ? job->in_channels : channels);
+    for (; count > 0; count -= k)
+    {
+        k = (count < step) ? count : step;
+
+        /* interleaved input */
+        if (job->plane_stride)
+        {
+            wav_interleave(packed, job->src + (size_t)n * job->bytes, job->plane_stride, job->in_channels, job->bytes, k);
+            src = packed;
+        }
+        else
+            src = job->src + (size_t)n * job->src_stride;
+
+        /* float samples are used in place */
+        if ((job->type == WAV_CONVERT_F32) && (((size_t)src & 3) == 0))
+            x = (const float *)src;
+        else
+        {
+            wav_convert_samples(in, WAV_CONVERT_F32, src, job->type, (size_t)k * job->in_channels, 0);
+            x = in;
+        }
+        y = ((job->type == WAV_CONVERT_F32) && (((size_t)frame & 3) == 0)) ? (float *)frame : out;
+
+        remix_p_run(y, channels, x, job->in_channels, job->matrix, k);
+        if (y == out)
+            wav_convert_samples(frame, job->type, out, WAV_CONVERT_F32, (size_t)k * channels, 0);
+
+        frame += (size_t)k * stride;
+        n += k;
+    }
+}
+
+/*
+ * Public functions
+ */
+
+int wav_remix_matrix(float *matrix, uint32_t out_channels, uint32_t out_mask, uint32_t in_channels, uint32_t in_mask)
+{
+    int in[32], out[32];
+    uint32_t in_speakers, out_speakers, bit, i;
+
+    /* check argument */
+    if ((matrix == 0) || (out_channels == 0) || (in_channels == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    memset(matrix, 0x00, sizeof(float) * out_channels * in_channels);
+    in_speakers = remix_p_speakers(in, in_mask, in_channels);
+    out_speakers = remix_p_speakers(out, out_mask, out_channels);
+
+    for (bit = 0; bit < 32; bit++)
+        if (in[bit] >= 0)
+            remix_p_route(matrix, in_channels, out, (uint32_t)in[bit], bit, 1.0f);
+
+    /* channels without a speaker */
+    for (i = in_speakers; i < in_channels; i++)
+        if ((i >= out_speakers) && (i < out_channels))
+            matrix[i * in_channels + i] = 1.0f;
+
+    return 0;
+}
+
+int wav_remix_samples(float *dst, uint32_t out_channels, const float *src, uint32_t in_channels,
+                      const float *matrix, size_t count)
+{
+    /* check argument */
+    if ((out_channels == 0) || (in_channels == 0) || (matrix == 0) || (((dst == 0) || (src == 0)) && (count > 0)))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    remix_p_run(dst, out_channels, src, in_channels, matrix, count);
+
+    return 0;
+}
+
+int wav_remix(wav_handle dst, wav_handle src, uint32_t channels, uint32_t channel_mask, const float *matrix)
+{
+    wav_data *wav = (wav_data *)dst;
+    wav_config config;
+    remix_job job;
+    float *gains = 0;
+    uint32_t format, src_mask, layout, dst_layout, stride;
+    int type, rc = -1;
+
+    /* check argument */
+    if ((wav == 0) || (src == 0) || (dst == src))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((wav_get_config(src, &config) != 0) || (wav_get_format(src, &format, &src_mask) != 0) ||
+        (wav_get_layout(src, &layout) != 0) || (wav_get_layout(dst, &dst_layout) != 0))
+        return -1;
+    if ((channels == 0) || (channels > WAV_REMIX_MAX_CHANNELS) || (config.channels > WAV_REMIX_MAX_CHANNELS))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error can't remix %d channels to %d channels", config.channels, channels);
+        return -1;
+    }
+    type = remix_p_type(config.bits_per_sample, format);
+    if (type < 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error can't remix %d bits (format %d)", config.bits_per_sample, format);
+        return -1;
+    }
+
+    if (matrix == 0)
+    {
+        gains = (float*)malloc(sizeof(float) * channels * config.channels);
+        if (gains == 0)
+        {
+            wav_p_error(wav, __FUNCTION__, "Can't allocate matrix");
+            return -1;
+        }
+        wav_remix_matrix(gains, channels, channel_mask, config.channels, src_mask);
+        matrix = gains;
+    }
+
+    job.matrix = matrix;
+    job.in_channels = config.channels;
+    job.type = (uint32_t)type;
+    job.bytes = config.bits_per_sample / 8;
+    job.src = 0;
+    job.src_stride = 0;
+    job.plane_stride = 0;
+    if (config.size > 0)
+    {
+        job.src = wav_channel_data(src, 0, &stride);
+        if (job.src == 0)
+            goto exit;
+        if (layout == WAV_LAYOUT_PLANAR)
+            job.plane_stride = (size_t)config.size * job.bytes;
+        else
+            job.src_stride = stride;
+    }
+
+    config.channels = channels;
+    if ((wav_set_config(dst, &config) != 0) || (wav_set_format(dst, format, channel_mask) != 0))
+        goto exit;
+
+    /* the new buffer is all zero, so it can be filled interleaved */
+    wav->layout = WAV_LAYOUT_INTERLEAVED;
+    if ((config.size > 0) && (wav_parallel_frames(dst, remix_p_frames, &job) != 0))
+        goto exit;
+    if (wav_set_layout(dst, dst_layout) == 0)
+        rc = 0;
+
+ exit:
+    free(gains);
+    return rc;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Channel remixing for the wav library.
+ * Maps M input channels to N output channels through a matrix of gains
+ * (downmix, upmix, channel extraction); stereo to mono and 5.1 to stereo
+ * use SSE2.
+ */
+
+#ifndef WAV_REMIX_H
+#define WAV_REMIX_H
+
+#include <stddef.h>
+#include "wav.h"
+
+#define WAV_REMIX_MAX_CHANNELS  64      /* channels of wav_remix */
+
+/*
+ * matrix has out_channels rows of in_channels gains: output channel o of
+ * a frame is the sum of matrix[o * in_channels + i] * input channel i.
+ */
+
+/*
+ * Fill matrix with the usual gains from the speakers of in_mask to the
+ * speakers of out_mask (WAV_SPEAKER_*, 0 for the default speakers of the
+ * channel count, e.g. 5.1 for 6 channels).  A speaker in both gets 1.
+ * Otherwise center goes to left and right, left and right to center,
+ * side and back to each other or to the front at -3 dB (0.7071); the LFE
+ * and other speakers are dropped.  Channels beyond the speakers of the
+ * masks are copied to the same channel.  5.1 to stereo gives
+ * L = FL + 0.7071 * (FC + BL).  The gains are not scaled down, so loud
+ * mixes may clip when they are stored as integers.
+ */
+int wav_remix_matrix(float *matrix, uint32_t out_channels, uint32_t out_mask, uint32_t in_channels, uint32_t in_mask);
+
+/*
+ * Remix count interleaved float frames from src to dst; the buffers must
+ * not overlap.  Works on any block size, so it can be used on streams.
+ */
+int wav_remix_samples(float *dst, uint32_t out_channels, const float *src, uint32_t in_channels,
+                      const float *matrix, size_t count);
+
+/*
+ * Make dst a copy of src with channels channels and channel_mask, mixed
+ * by matrix (0 for wav_remix_matrix of the masks).  dst keeps its layout
+ * and gets the sample rate and format of src (16/24/32 bit PCM or 32 bit
+ * float).  Blocks of frames are mixed on all CPUs.
+ */
+int wav_remix(wav_handle dst, wav_handle src, uint32_t channels, uint32_t channel_mask, const float *matrix);
+
+#endif /* WAV_REMIX_H */
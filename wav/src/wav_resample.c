@@ -0,0 +1,625 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Sample rate conversion for the wav library.
+ *
+ * out_hz / in_hz is reduced to up / down.  Output frame k is at input time
+ * k * down / up: the integer part is the input sample and the remainder
+ * (k * down) % up picks one of up phases of a Kaiser windowed sinc
+ * low-pass, so common ratios such as 44.1 -> 48 kHz (160 / 147) run from
+ * a table of exact phases.  If up is too large for a table, the filter is
+ * tabulated at RESAMPLE_PHASES points and two phases are interpolated.
+ * Every output sample is a dot product of contiguous float samples of one
+ * channel with a row of the table; it has scalar, SSE2 and AVX2 versions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "wav.h"
+#include "wav_p.h"
+#include "wav_thread.h"
+#include "wav_parallel.h"
+#include "wav_convert.h"
+#include "wav_resample.h"
+#ifdef WAV_P_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef WAV_P_AVX2
+#include <immintrin.h>
+#endif
+
+#define RESAMPLE_PI             3.14159265358979323846
+#define RESAMPLE_MAX_PHASES     1024    /* largest up with a table of exact phases */
+#define RESAMPLE_PHASES         512     /* points of an interpolated table */
+#define RESAMPLE_MAX_HALF       2048    /* taps on each side */
+#define RESAMPLE_BLOCK          1024    /* frames per pass of wav_resampler_process */
+#define RESAMPLE_TASK_FRAMES    16384   /* output frames per task of wav_resample */
+
+/*
+ * filter data
+ */
+typedef struct {
+    uint32_t up;
+    uint32_t down;
+    uint32_t step;              /* down / up */
+    uint32_t step_rem;          /* down % up */
+    uint32_t half;              /* taps on each side, a multiple of 4 */
+    uint32_t taps;              /* 2 * half */
+    uint32_t phases;            /* rows of coef */
+    int exact;                  /* row is (k * down) % up, else interpolated */
+    float *coef;                /* phases rows of taps */
+} resample_filter;
+
+/*
+ * resampler internal data
+ */
+typedef struct {
+    resample_filter filter;
+    uint32_t channels;
+    uint32_t capacity;          /* samples per plane */
+    float *plane;               /* input history, channels planes of capacity */
+    float *block;               /* output, channels planes of RESAMPLE_BLOCK */
+    uint32_t fill;              /* samples in each plane */
+    uint32_t pos;               /* plane index of the input sample of the next output */
+    uint32_t rem;               /* and its phase */
+    uint64_t in_total;
+    uint64_t out_total;
+} resampler_data;
+
+typedef struct {
+    const resample_filter *filter;
+    const float *src;           /* one plane per channel with half zeros on each side */
+    size_t src_stride;
+    float *dst;                 /* one plane per channel */
+    size_t dst_stride;
+    uint32_t size;              /* output frames */
+    uint32_t blocks;            /* tasks per channel */
+} resample_job;
+
+typedef float (*resample_dot_fn)(const float *x, const float *c, uint32_t taps);
+
+static resample_dot_fn resample_dot;
+static wav_p_once dot_once = WAV_P_ONCE_INIT;
+
+/* taps on each side, Kaiser beta and -6 dB point (of the lower Nyquist frequency) */
+static const struct {
+    uint32_t half;
+    double beta;
+    double cutoff;
+} resample_quality[] = {
+    {  8, 5.65, 0.76 },         /* WAV_RESAMPLE_FAST */
+    { 16, 7.86, 0.84 },         /* WAV_RESAMPLE_MEDIUM */
+    { 32, 8.96, 0.91 },         /* WAV_RESAMPLE_BEST */
+};
+
+/*
+ * private functions
+ */
+
+/* taps is a multiple of 8 */
+static float resample_p_dot(const float *x, const float *c, uint32_t taps)
+{
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    uint32_t j;
+
+    for (j = 0; j < taps; j += 4)
+    {
+        s0 += x[j] * c[j];
+        s1 += x[j + 1] * c[j + 1];
+        s2 += x[j + 2] * c[j + 2];
+        s3 += x[j + 3] * c[j + 3];
+    }
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef WAV_P_SSE2
+static float resample_p_dot_sse2(const float *x, const float *c, uint32_t taps)
+{
+    __m128 a0 = _mm_setzero_ps();
+    __m128 a1 = _mm_setzero_ps();
+    uint32_t j;
+
+    for (j = 0; j < taps; j += 8)
+    {
+        a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(x + j), _mm_loadu_ps(c + j)));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(x + j + 4), _mm_loadu_ps(c + j + 4)));
+    }
+    a0 = _mm_add_ps(a0, a1);
+    a0 = _mm_add_ps(a0, _mm_movehl_ps(a0, a0));
+    a0 = _mm_add_ss(a0, _mm_shuffle_ps(a0, a0, 1));
+
+    return _mm_cvtss_f32(a0);
+}
+#endif
+
+#ifdef WAV_P_AVX2
+static WAV_P_AVX2_FN float resample_p_dot_avx2(const float *x, const float *c, uint32_t taps)
+{
+    __m256 a0 = _mm256_setzero_ps();
+    __m256 a1 = _mm256_setzero_ps();
+    __m128 s;
+    uint32_t j;
+
+    for (j = 0; j + 16 <= taps; j += 16)
+    {
+        a0 = _mm256_add_ps(a0, _mm256_mul_ps(_mm256_loadu_ps(x + j), _mm256_loadu_ps(c + j)));
+        a1 = _mm256_add_ps(a1, _mm256_mul_ps(_mm256_loadu_ps(x + j + 8), _mm256_loadu_ps(c + j + 8)));
+    }
+    if (j < taps)
+        a0 = _mm256_add_ps(a0, _mm256_mul_ps(_mm256_loadu_ps(x + j), _mm256_loadu_ps(c + j)));
+    a0 = _mm256_add_ps(a0, a1);
+    s = _mm_add_ps(_mm256_castps256_ps128(a0), _mm256_extractf128_ps(a0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+
+    return _mm_cvtss_f32(s);
+}
+#endif
+
+static void resample_p_init(void)
+{
+    resample_dot = resample_p_dot;
+#ifdef WAV_P_SSE2
+    resample_dot = resample_p_dot_sse2;
+#endif
+#ifdef WAV_P_AVX2
+    if (wav_p_has_avx2())
+        resample_dot = resample_p_dot_avx2;
+#endif
+}
+
+static uint32_t resample_p_gcd(uint32_t a, uint32_t b)
+{
+    uint32_t t;
+
+    while (b != 0)
+    {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* modified Bessel function of the first kind, order 0 */
+static double resample_p_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    uint32_t k;
+
+    for (k = 1; k < 100; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+
+    return sum;
+}
+
+/*
+ * Tap j of row p is the input sample j - (half - 1) after the output time
+ * and the row is for output times p / up (p / RESAMPLE_PHASES) after an
+ * input sample.  Rows are normalized to a gain of 1.
+ */
+static int resample_p_filter(resample_filter *f, uint32_t in_hz, uint32_t out_hz, uint32_t quality)
+{
+    double ratio, fc, beta, i0beta, frac, d, x, c, sum;
+    uint32_t g, p, j, half;
+    float *row;
+
+    g = resample_p_gcd(in_hz, out_hz);
+    f->up = out_hz / g;
+    f->down = in_hz / g;
+    f->step = f->down / f->up;
+    f->step_rem = f->down % f->up;
+
+    /* a lower cutoff and a longer filter when the rate goes down; the same rate passes through */
+    ratio = (f->up < f->down) ? (double)f->up / f->down : 1.0;
+    fc = (f->up == f->down) ? 1.0 : resample_quality[quality].cutoff * ratio;
+    beta = resample_quality[quality].beta;
+    half = (uint32_t)ceil(resample_quality[quality].half / ratio);
+    if (half > RESAMPLE_MAX_HALF)
+        half = RESAMPLE_MAX_HALF;
+    f->half = (half + 3) & ~3u;
+    f->taps = 2 * f->half;
+
+    f->exact = (f->up <= RESAMPLE_MAX_PHASES);
+    f->phases = f->exact ? f->up : RESAMPLE_PHASES + 1;
+    f->coef = (float*)malloc((size_t)f->phases * f->taps * sizeof(float));
+    if (f->coef == 0)
+        return -1;
+
+    i0beta = resample_p_i0(beta);
+    for (p = 0; p < f->phases; p++)
+    {
+        frac = f->exact ? (double)p / f->up : (double)p / RESAMPLE_PHASES;
+        row = f->coef + (size_t)p * f->taps;
+        sum = 0.0;
+        for (j = 0; j < f->taps; j++)
+        {
+            d = (double)j - (f->half - 1) - frac;
+            x = d / f->half;
+            c = (d == 0.0) ? fc : sin(RESAMPLE_PI * fc * d) / (RESAMPLE_PI * d);
+            c *= (x * x < 1.0) ? resample_p_i0(beta * sqrt(1.0 - x * x)) / i0beta : 0.0;
+            row[j] = (float)c;
+            sum += c;
+        }
+        for (j = 0; j < f->taps; j++)
+            row[j] = (float)(row[j] / sum);
+    }
+
+    return 0;
+}
+
+/* move to the next output frame */
+static void resample_p_advance(const resample_filter *f, size_t *pos, uint32_t *rem)
+{
+    uint64_t r = (uint64_t)*rem + f->step_rem;
+
+    *pos += f->step;
+    if (r >= f->up)
+    {
+        r -= f->up;
+        (*pos)++;
+    }
+    *rem = (uint32_t)r;
+}
+
+/*
+ * count output samples of one channel from the output at input sample pos
+ * with phase rem; x[pos - half + 1] to x[pos + half] of each must be there
+ */
+static void resample_p_run(const resample_filter *f, const float *x, size_t pos, uint32_t rem, float *out, uint32_t count)
+{
+    const float *p;
+    double phase;
+    uint32_t i, row;
+    float y0, y1;
+
+    for (i = 0; i < count; i++)
+    {
+        p = x + pos + 1 - f->half;
+        if (f->exact)
+            out[i] = resample_dot(p, f->coef + (size_t)rem * f->taps, f->taps);
+        else
+        {
+            phase = (double)rem * RESAMPLE_PHASES / f->up;
+            row = (uint32_t)phase;
+            y0 = resample_dot(p, f->coef + (size_t)row * f->taps, f->taps);
+            y1 = resample_dot(p, f->coef + (size_t)(row + 1) * f->taps, f->taps);
+            out[i] = y0 + (float)(phase - row) * (y1 - y0);
+        }
+        resample_p_advance(f, &pos, &rem);
+    }
+}
+
+/* output frames of the stream that can be computed now, up to max */
+static uint32_t resample_p_ready(const resampler_data *rs, uint32_t max)
+{
+    const resample_filter *f = &rs->filter;
+    size_t pos = rs->pos;
+    uint32_t rem = rs->rem;
+    uint32_t n;
+
+    if (rs->fill < f->half + 1)
+        return 0;
+    for (n = 0; (n < max) && (pos + f->half < rs->fill); n++)
+        resample_p_advance(f, &pos, &rem);
+
+    return n;
+}
+
+static void resample_p_task(uint32_t index, void *ctx)
+{
+    resample_job *job = (resample_job *)ctx;
+    const resample_filter *f = job->filter;
+    uint32_t ch = index / job->blocks;
+    uint32_t k = (index % job->blocks) * RESAMPLE_TASK_FRAMES;
+    uint32_t count = job->size - k;
+    uint64_t t = (uint64_t)k * f->down;
+
+    if (count > RESAMPLE_TASK_FRAMES)
+        count = RESAMPLE_TASK_FRAMES;
+
+    /* input sample 0 is at half in the padded planes */
+    resample_p_run(f, job->src + ch * job->src_stride, (size_t)(t / f->up) + f->half, (uint32_t)(t % f->up),
+                   job->dst + ch * job->dst_stride + k, count);
+}
+
+/*
+ * Public functions
+ */
+
+int wav_resampler_open(wav_resampler_handle *r, uint32_t channels, uint32_t in_hz, uint32_t out_hz, uint32_t quality)
+{
+    resampler_data *rs;
+
+    /* check argument */
+    if (r == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((channels == 0) || (in_hz == 0) || (out_hz == 0) || (quality > WAV_RESAMPLE_BEST))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    wav_p_call_once(&dot_once, resample_p_init);
+
+    rs = (resampler_data*)malloc(sizeof(resampler_data));
+    if (rs == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Can't allocate resampler_data");
+        return -1;
+    }
+    memset(rs, 0x00, sizeof(resampler_data));
+
+    if (resample_p_filter(&rs->filter, in_hz, out_hz, quality) == 0)
+    {
+        rs->channels = channels;
+        rs->capacity = rs->filter.taps + RESAMPLE_BLOCK;
+        rs->plane = (float*)malloc((size_t)channels * rs->capacity * sizeof(float));
+        rs->block = (float*)malloc((size_t)channels * RESAMPLE_BLOCK * sizeof(float));
+    }
+    if ((rs->plane == 0) || (rs->block == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Can't allocate resampler buffers");
+        wav_resampler_close((wav_resampler_handle)rs);
+        return -1;
+    }
+
+    *r = (wav_resampler_handle)rs;
+
+    return wav_resampler_reset(*r);
+}
+
+int wav_resampler_close(wav_resampler_handle r)
+{
+    resampler_data *rs = (resampler_data *)r;
+
+    /* check argument */
+    if (rs == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    free(rs->filter.coef);
+    free(rs->plane);
+    free(rs->block);
+    free(rs);
+
+    return 0;
+}
+
+/* forget the stream; the filter starts on half - 1 zeros before the first frame */
+int wav_resampler_reset(wav_resampler_handle r)
+{
+    resampler_data *rs = (resampler_data *)r;
+
+    /* check argument */
+    if (rs == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    memset(rs->plane, 0x00, (size_t)rs->channels * rs->capacity * sizeof(float));
+    rs->fill = rs->filter.half - 1;
+    rs->pos = rs->filter.half - 1;
+    rs->rem = 0;
+    rs->in_total = 0;
+    rs->out_total = 0;
+
+    return 0;
+}
+
+int wav_resampler_process(wav_resampler_handle r, const float *in, uint32_t in_count, uint32_t *in_used,
+                          float *out, uint32_t out_count, uint32_t *out_done)
+{
+    resampler_data *rs = (resampler_data *)r;
+    resample_filter *f;
+    uint64_t total = 0;
+    uint32_t used = 0, done = 0, ch, n, drop;
+    size_t pos;
+
+    /* check argument */
+    if (rs == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((in_used == 0) || (out_done == 0) || ((out == 0) && (out_count > 0)))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    f = &rs->filter;
+    for (;;)
+    {
+        /* frames whose filter lies in the planes; after the end, no more than the input gives */
+        n = out_count - done;
+        if (n > RESAMPLE_BLOCK)
+            n = RESAMPLE_BLOCK;
+        if (in == 0)
+        {
+            total = (rs->in_total * f->up + f->down - 1) / f->down;
+            if (n > total - rs->out_total)
+                n = (uint32_t)(total - rs->out_total);
+        }
+        n = resample_p_ready(rs, n);
+        if (n > 0)
+        {
+            for (ch = 0; ch < rs->channels; ch++)
+                resample_p_run(f, rs->plane + (size_t)ch * rs->capacity, rs->pos, rs->rem,
+                               rs->block + (size_t)ch * RESAMPLE_BLOCK, n);
+            wav_interleave(out + (size_t)done * rs->channels, rs->block, RESAMPLE_BLOCK * sizeof(float),
+                           rs->channels, sizeof(float), n);
+
+            pos = rs->pos;
+            for (ch = 0; ch < n; ch++)
+                resample_p_advance(f, &pos, &rs->rem);
+            rs->pos = (uint32_t)pos;
+            done += n;
+            rs->out_total += n;
+            continue;
+        }
+        if ((done == out_count) || ((in == 0) && (rs->out_total >= total)))
+            break;
+
+        /* drop the samples before the filter of the next frame */
+        drop = rs->pos + 1 - f->half;
+        if (drop > rs->fill)
+            drop = rs->fill;
+        if (drop > 0)
+        {
+            for (ch = 0; ch < rs->channels; ch++)
+                memmove(rs->plane + (size_t)ch * rs->capacity, rs->plane + (size_t)ch * rs->capacity + drop,
+                        (rs->fill - drop) * sizeof(float));
+            rs->fill -= drop;
+            rs->pos -= drop;
+        }
+
+        /* more input, or zeros after the end */
+        n = rs->capacity - rs->fill;
+        if (in)
+        {
+            if (n > in_count - used)
+                n = in_count - used;
+            if (n == 0)
+                break;
+            wav_deinterleave(rs->plane + rs->fill, rs->capacity * sizeof(float), in + (size_t)used * rs->channels,
+                             rs->channels, sizeof(float), n);
+            used += n;
+            rs->in_total += n;
+        }
+        else
+        {
+            for (ch = 0; ch < rs->channels; ch++)
+                memset(rs->plane + (size_t)ch * rs->capacity + rs->fill, 0x00, n * sizeof(float));
+        }
+        rs->fill += n;
+    }
+
+    *in_used = used;
+    *out_done = done;
+
+    return 0;
+}
+
+int wav_resample(wav_handle dst, wav_handle src, uint32_t samplehz, uint32_t quality)
+{
+    wav_data *wav = (wav_data *)dst;
+    wav_config config;
+    wav_handle tmp = 0;
+    wav_view view;
+    resample_filter filter;
+    resample_job job;
+    uint32_t format, channel_mask, layout, dst_layout, ch;
+    const float *samples;
+    float *padded = 0;
+    uint64_t size;
+    int rc = -1;
+
+    /* check argument */
+    if ((wav == 0) || (src == 0) || (dst == src))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if ((samplehz == 0) || (quality > WAV_RESAMPLE_BEST))
+    {
+        wav_p_error(wav, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if ((wav_get_config(src, &config) != 0) || (wav_get_format(src, &format, &channel_mask) != 0) ||
+        (wav_get_layout(dst, &dst_layout) != 0))
+        return -1;
+    if (config.samplehz == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error source has no sample rate");
+        return -1;
+    }
+
+    wav_p_call_once(&dot_once, resample_p_init);
+    memset(&filter, 0x00, sizeof(filter));
+    if (resample_p_filter(&filter, config.samplehz, samplehz, quality) != 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Can't allocate filter");
+        return -1;
+    }
+    size = ((uint64_t)config.size * filter.up + filter.down - 1) / filter.down;
+    if (size > 0xffffffff)
+    {
+        wav_p_error(wav, __FUNCTION__, "Error too many frames at %d Hz", samplehz);
+        goto exit;
+    }
+
+    /* float samples of src in planes with half zeros on each side */
+    if ((wav_open(&tmp, 0) != 0) || (wav_convert(tmp, src, 32, WAV_FORMAT_FLOAT, 0) != 0))
+        goto exit;
+    job.src_stride = (size_t)config.size + 2 * filter.half;
+    padded = (float*)calloc(config.channels * job.src_stride, sizeof(float));
+    if (padded == 0)
+    {
+        wav_p_error(wav, __FUNCTION__, "Can't allocate %d frames", (uint32_t)job.src_stride);
+        goto exit;
+    }
+    if (config.size > 0)
+    {
+        wav_get_layout(tmp, &layout);
+        samples = (const float*)wav_channel_data(tmp, 0, 0);
+        if (layout == WAV_LAYOUT_PLANAR)
+            for (ch = 0; ch < config.channels; ch++)
+                memcpy(padded + ch * job.src_stride + filter.half, samples + (size_t)ch * config.size, config.size * sizeof(float));
+        else
+            wav_deinterleave(padded + filter.half, job.src_stride * sizeof(float), samples,
+                             config.channels, sizeof(float), config.size);
+    }
+
+    wav_close(tmp);
+    tmp = 0;
+
+    /* planar float result */
+    config.samplehz = samplehz;
+    config.bits_per_sample = 32;
+    config.size = (uint32_t)size;
+    if ((wav_open(&tmp, 0) != 0) || (wav_set_layout(tmp, WAV_LAYOUT_PLANAR) != 0) || (wav_set_config(tmp, &config) != 0))
+        goto exit;
+    if (config.size > 0)
+    {
+        if (wav_lock(tmp, &view, WAV_LOCK_WRITE) != 0)
+            goto exit;
+        job.filter = &filter;
+        job.src = padded;
+        job.dst = (float*)view.base;
+        job.dst_stride = config.size;
+        job.size = config.size;
+        job.blocks = (config.size + RESAMPLE_TASK_FRAMES - 1) / RESAMPLE_TASK_FRAMES;
+        wav_parallel_tasks(config.channels * job.blocks, resample_p_task, &job);
+        wav_unlock(tmp, &view);
+    }
+
+    /* back to the sample format of src */
+    wav_get_config(src, &config);
+    if ((wav_set_format(tmp, WAV_FORMAT_FLOAT, channel_mask) == 0) &&
+        (wav_convert(dst, tmp, config.bits_per_sample, format, 0) == 0) &&
+        (wav_set_layout(dst, dst_layout) == 0))
+        rc = 0;
+
+ exit:
+    if (tmp)
+        wav_close(tmp);
+    free(padded);
+    free(filter.coef);
+    return rc;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Sample rate conversion for the wav library.
+ * Windowed-sinc polyphase filters; the FIR loops use SSE2/AVX2 when the
+ * CPU has them.
+ */
+
+#ifndef WAV_RESAMPLE_H
+#define WAV_RESAMPLE_H
+
+#include "wav.h"
+
+/*
+ * Quality.  Longer filters keep more of the band (up to about 76, 84 and
+ * 91 % of the lower Nyquist frequency), alias less (about 70, 90 and
+ * 115 dB down) and cost proportionally more.
+ */
+#define WAV_RESAMPLE_FAST       0       /* 16 taps */
+#define WAV_RESAMPLE_MEDIUM     1       /* 32 taps */
+#define WAV_RESAMPLE_BEST       2       /* 64 taps */
+
+/*
+ * Streaming converter for interleaved float frames.
+ * wav_resampler_process takes up to in_count frames from in and writes up
+ * to out_count frames to out; in_used and out_done return how many.  Call
+ * it again with the rest of the input when the output is full.  At the
+ * end of the stream call it with in = 0 until out_done is 0 to get the
+ * last frames, and reset it before another stream.  in_hz * n frames in
+ * give out_hz * n frames out; the first output frame is at the time of
+ * the first input frame.
+ */
+typedef uint32_t* wav_resampler_handle;
+
+int wav_resampler_open(wav_resampler_handle *r, uint32_t channels, uint32_t in_hz, uint32_t out_hz, uint32_t quality);
+int wav_resampler_close(wav_resampler_handle r);
+int wav_resampler_reset(wav_resampler_handle r);
+int wav_resampler_process(wav_resampler_handle r, const float *in, uint32_t in_count, uint32_t *in_used,
+                          float *out, uint32_t out_count, uint32_t *out_done);
+
+/*
+ * Make dst a copy of src at samplehz with the same channels and sample
+ * format (16/24/32 bit PCM or 32 bit float).  dst keeps its layout.
+ * Each channel is converted in blocks on all CPUs.
+ */
+int wav_resample(wav_handle dst, wav_handle src, uint32_t samplehz, uint32_t quality);
+
+#endif /* WAV_RESAMPLE_H */
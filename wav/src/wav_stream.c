@@ -0,0 +1,785 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Streaming access to wav files of any length with constant memory.
+ *
+ * The reader keeps a ring of blocks.  The read-ahead thread fills the
+ * free blocks in file order and the caller empties them from the head.
+ * A seek bumps the generation: the ring is emptied and a block that was
+ * being read for the old position is dropped when it arrives.
+ *
+ * The writer works the other way round: the caller fills a block and
+ * queues it, the writer thread writes the queued blocks.  The header is
+ * rewritten only when no block is being written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wav.h"
+#include "wav_p.h"
+#include "wav_thread.h"
+#include "wav_stream.h"
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+/*
+ * reader internal data
+ */
+typedef struct {
+    uint8_t *data;
+    uint32_t first;             /* frame index of data[0] */
+    uint32_t frames;
+} stream_block;
+
+typedef struct {
+    FILE *fp;
+    wav_config config;
+    uint32_t format;
+    uint32_t channel_mask;
+    uint32_t frame_size;
+    uint64_t data_offset;       /* file offset of the first frame */
+    uint32_t block_frames;
+    stream_block block[WAV_STREAM_BLOCKS];
+    uint32_t head;              /* next block to read from */
+    uint32_t count;             /* filled blocks */
+    uint32_t offset;            /* frames already taken from the head block */
+    uint32_t pos;               /* current frame */
+    uint32_t next;              /* next frame to read from the file */
+    uint32_t end;               /* frames available (less if the file is short) */
+    uint32_t file_frame;        /* frame at the file position */
+    uint32_t generation;
+    int stop;
+    int threaded;
+    wav_p_mutex mutex;
+    wav_p_cond cond;
+    wav_p_thread thread;
+} reader_data;
+
+/*
+ * writer internal data
+ */
+typedef struct {
+    FILE *fp;
+    wav_config config;
+    uint32_t format;
+    uint32_t channel_mask;
+    uint32_t header_size;       /* bytes in front of the samples */
+    uint32_t frame_size;
+    uint32_t block_frames;
+    stream_block block[WAV_STREAM_BLOCKS];
+    uint32_t head;              /* next block to write */
+    uint32_t count;             /* queued blocks */
+    uint32_t fill;              /* frames in the block after the queued ones */
+    uint32_t max_frames;        /* the data chunk size is 32 bits */
+    uint64_t frames;            /* frames given to wav_writer_write */
+    uint64_t written;           /* frames in the file */
+    uint64_t synced;            /* written when the header was updated */
+    uint32_t sync_frames;
+    int error;
+    int stop;
+    int threaded;
+    wav_p_mutex mutex;
+    wav_p_cond cond;
+    wav_p_thread thread;
+} writer_data;
+
+/*
+ * private functions
+ */
+
+/* find "fmt " and "data" and leave the file at the first frame */
+static int stream_p_header(reader_data *reader, const char *func)
+{
+    wav_p_header header;
+
+    if (wav_p_read_header(0, func, reader->fp, &header) != 0)
+        return -1;
+    reader->config = header.config;
+    reader->format = header.format;
+    reader->channel_mask = header.channel_mask;
+    reader->data_offset = header.data_offset;
+    reader->frame_size = reader->config.channels * (reader->config.bits_per_sample/8);
+
+    return wav_p_seek(reader->fp, reader->data_offset);
+}
+
+/*
+ * Read the next block into the tail of the ring.  Called with the mutex
+ * held and at least one free block; the mutex is released while reading.
+ */
+static void stream_p_fill(reader_data *reader)
+{
+    stream_block *block = &reader->block[(reader->head + reader->count) % WAV_STREAM_BLOCKS];
+    uint32_t generation = reader->generation;
+    uint32_t first = reader->next;
+    uint32_t frames = reader->end - first;
+    size_t got;
+
+    if (frames > reader->block_frames)
+        frames = reader->block_frames;
+    wav_p_mutex_unlock(&reader->mutex);
+
+    got = 0;
+    if ((reader->file_frame == first) ||
+        (wav_p_seek(reader->fp, reader->data_offset + (uint64_t)first * reader->frame_size) == 0))
+        got = fread(block->data, reader->frame_size, frames, reader->fp);
+    reader->file_frame = first + (uint32_t)got;
+    wav_p_count_read(0, (uint32_t)(got * reader->frame_size));
+
+    wav_p_mutex_lock(&reader->mutex);
+    if (generation == reader->generation)
+    {
+        if (got < frames)
+        {
+            wav_p_error(0, __FUNCTION__, "Error data ends at frame %d of %d", first + (uint32_t)got, reader->config.size);
+            reader->end = first + (uint32_t)got;
+        }
+        if (got > 0)
+        {
+            block->first = first;
+            block->frames = (uint32_t)got;
+            reader->count++;
+            reader->next = first + (uint32_t)got;
+        }
+    }
+    wav_p_cond_broadcast(&reader->cond);
+}
+
+static WAV_P_THREAD_PROC(stream_p_reader, arg)
+{
+    reader_data *reader = (reader_data *)arg;
+
+    wav_p_mutex_lock(&reader->mutex);
+    for (;;)
+    {
+        while (!reader->stop && ((reader->count == WAV_STREAM_BLOCKS) || (reader->next >= reader->end)))
+            wav_p_cond_wait(&reader->cond, &reader->mutex);
+        if (reader->stop)
+            break;
+        stream_p_fill(reader);
+    }
+    wav_p_mutex_unlock(&reader->mutex);
+
+    return 0;
+}
+
+static void stream_p_release(reader_data *reader)
+{
+    uint32_t i;
+
+    for (i = 0; i < WAV_STREAM_BLOCKS; i++)
+        if (reader->block[i].data)
+            free(reader->block[i].data);
+    if (reader->fp)
+        fclose(reader->fp);
+    free(reader);
+}
+
+/*
+ * Write the header with zero sizes.  A header shorter than the one
+ * already in the file is padded with a "JUNK" chunk before "data".
+ */
+static int stream_p_begin(writer_data *writer)
+{
+    uint8_t header[WAV_P_HEADER_MAX + 8];
+    uint32_t size, pad;
+
+    size = wav_p_make_header(&writer->config, writer->format, writer->channel_mask, 0, header);
+    if (size + 8 <= writer->header_size)
+    {
+        pad = writer->header_size - size - 8;
+        memmove(header + size - 8 + 8 + pad, header + size - 8, 8);
+        memcpy(header + size - 8, "JUNK", 4);
+        memcpy(header + size - 4, &pad, 4);
+        memset(header + size, 0x00, pad);
+        size = writer->header_size;
+    }
+    writer->header_size = size;
+
+    if ((wav_p_seek(writer->fp, 0) != 0) || (fwrite(header, 1, size, writer->fp) != size) || (fflush(writer->fp) != 0))
+        return -1;
+    wav_p_count_write(0, size);
+
+    return 0;
+}
+
+/* write the current sizes into the header and flush the file */
+static void stream_p_patch(writer_data *writer)
+{
+    uint32_t size = (uint32_t)(writer->written * writer->frame_size);
+    uint32_t riff_size = size + writer->header_size - 8;
+
+    if ((wav_p_seek(writer->fp, 4) != 0) || (fwrite(&riff_size, 1, 4, writer->fp) != 4) ||
+        (wav_p_seek(writer->fp, writer->header_size - 4) != 0) || (fwrite(&size, 1, 4, writer->fp) != 4) ||
+        (wav_p_seek(writer->fp, writer->header_size + (uint64_t)size) != 0) || (fflush(writer->fp) != 0))
+        writer->error = 1;
+    writer->synced = writer->written;
+}
+
+/*
+ * RIFF chunks have an even size: a data chunk of odd size is followed by a
+ * pad byte, which is counted in the RIFF size but not in the data size.
+ */
+static void stream_p_pad(writer_data *writer)
+{
+    uint32_t riff_size = (uint32_t)(writer->written * writer->frame_size) + writer->header_size - 8 + 1;
+
+    if ((fputc(0, writer->fp) == EOF) || (wav_p_seek(writer->fp, 4) != 0) ||
+        (fwrite(&riff_size, 1, 4, writer->fp) != 4) || (fflush(writer->fp) != 0))
+        writer->error = 1;
+    else
+        wav_p_count_write(0, 1);
+}
+
+/* append frames to the file */
+static void stream_p_put(writer_data *writer, const void *buf, uint32_t frames, uint32_t sync_frames)
+{
+    size_t len;
+
+    len = fwrite(buf, writer->frame_size, frames, writer->fp);
+    wav_p_count_write(0, (uint32_t)(len * writer->frame_size));
+    if (len != frames)
+    {
+        wav_p_error(0, __FUNCTION__, "Write error at frame %d", (uint32_t)writer->written);
+        writer->error = 1;
+    }
+    writer->written += len;
+
+    if (sync_frames && (writer->written - writer->synced >= sync_frames))
+        stream_p_patch(writer);
+}
+
+static WAV_P_THREAD_PROC(stream_p_writer, arg)
+{
+    writer_data *writer = (writer_data *)arg;
+    stream_block *block;
+    uint32_t sync_frames;
+
+    wav_p_mutex_lock(&writer->mutex);
+    for (;;)
+    {
+        while (!writer->stop && (writer->count == 0))
+            wav_p_cond_wait(&writer->cond, &writer->mutex);
+        if (writer->count == 0)
+            break;
+
+        /* the caller does not touch queued blocks */
+        block = &writer->block[writer->head];
+        sync_frames = writer->sync_frames;
+        wav_p_mutex_unlock(&writer->mutex);
+        stream_p_put(writer, block->data, block->frames, sync_frames);
+        wav_p_mutex_lock(&writer->mutex);
+
+        writer->head = (writer->head + 1) % WAV_STREAM_BLOCKS;
+        writer->count--;
+        wav_p_cond_broadcast(&writer->cond);
+    }
+    wav_p_mutex_unlock(&writer->mutex);
+
+    return 0;
+}
+
+/* queue the partly filled block and wait until everything is written */
+static void stream_p_drain(writer_data *writer)
+{
+    if (!writer->threaded)
+        return;
+
+    wav_p_mutex_lock(&writer->mutex);
+    if (writer->fill > 0)
+    {
+        writer->block[(writer->head + writer->count) % WAV_STREAM_BLOCKS].frames = writer->fill;
+        writer->count++;
+        writer->fill = 0;
+        wav_p_cond_broadcast(&writer->cond);
+    }
+    while (writer->count > 0)
+        wav_p_cond_wait(&writer->cond, &writer->mutex);
+    wav_p_mutex_unlock(&writer->mutex);
+}
+
+static void stream_p_release_writer(writer_data *writer)
+{
+    uint32_t i;
+
+    for (i = 0; i < WAV_STREAM_BLOCKS; i++)
+        if (writer->block[i].data)
+            free(writer->block[i].data);
+    if (writer->fp)
+        fclose(writer->fp);
+    free(writer);
+}
+
+/*
+ * Public functions
+ */
+
+int wav_reader_open(wav_reader_handle *r, const char *filename, uint32_t block_frames)
+{
+    reader_data *reader;
+    uint32_t i;
+    uint64_t start;
+
+    /* check argument */
+    if ((r == 0) || (filename == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    reader = (reader_data*)malloc(sizeof(reader_data));
+    if (reader == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Can't allocate reader_data");
+        return -1;
+    }
+    memset(reader, 0x00, sizeof(reader_data));
+
+    reader->fp = fopen(filename, "rb");
+    if (reader->fp == NULL)
+    {
+        wav_p_error(0, __FUNCTION__, "Cannot open %s", filename);
+        stream_p_release(reader);
+        return -1;
+    }
+    start = wav_p_span_begin();
+
+    if (stream_p_header(reader, __FUNCTION__) != 0)
+    {
+        stream_p_release(reader);
+        return -1;
+    }
+#ifdef __linux__
+    posix_fadvise(fileno(reader->fp), (off_t)reader->data_offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    reader->block_frames = (block_frames > 0) ? block_frames : WAV_STREAM_BLOCK_FRAMES;
+    for (i = 0; i < WAV_STREAM_BLOCKS; i++)
+    {
+        reader->block[i].data = (uint8_t*)malloc((size_t)reader->block_frames * reader->frame_size);
+        if (reader->block[i].data == 0)
+        {
+            wav_p_error(0, __FUNCTION__, "Can't allocate %d frames", reader->block_frames);
+            stream_p_release(reader);
+            return -1;
+        }
+    }
+    reader->end = reader->config.size;
+
+    wav_p_mutex_init(&reader->mutex);
+    wav_p_cond_init(&reader->cond);
+
+    /* without the thread the blocks are read by wav_reader_read */
+    reader->threaded = (wav_p_thread_create(&reader->thread, stream_p_reader, reader) == 0);
+
+    *r = (wav_reader_handle)reader;
+    wav_p_span_end(0, __FUNCTION__, start);
+
+    return 0;
+}
+
+int wav_reader_close(wav_reader_handle r)
+{
+    reader_data *reader = (reader_data *)r;
+
+    /* check argument */
+    if (reader == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    if (reader->threaded)
+    {
+        wav_p_mutex_lock(&reader->mutex);
+        reader->stop = 1;
+        wav_p_cond_broadcast(&reader->cond);
+        wav_p_mutex_unlock(&reader->mutex);
+        wav_p_thread_join(reader->thread);
+    }
+    wav_p_cond_destroy(&reader->cond);
+    wav_p_mutex_destroy(&reader->mutex);
+    stream_p_release(reader);
+
+    return 0;
+}
+
+int wav_reader_get_config(wav_reader_handle r, wav_config *config)
+{
+    reader_data *reader = (reader_data *)r;
+
+    /* check argument */
+    if ((reader == 0) || (config == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    *config = reader->config;
+
+    return 0;
+}
+
+int wav_reader_get_format(wav_reader_handle r, uint32_t *format, uint32_t *channel_mask)
+{
+    reader_data *reader = (reader_data *)r;
+
+    /* check argument */
+    if ((reader == 0) || (format == 0) || (channel_mask == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    *format = reader->format;
+    *channel_mask = reader->channel_mask;
+
+    return 0;
+}
+
+int wav_reader_read(wav_reader_handle r, void *buf, uint32_t count, uint32_t *got)
+{
+    reader_data *reader = (reader_data *)r;
+    stream_block *block;
+    uint32_t copied = 0;
+    uint32_t n;
+
+    /* check argument */
+    if ((reader == 0) || (got == 0) || ((buf == 0) && (count > 0)))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    wav_p_mutex_lock(&reader->mutex);
+    while (copied < count)
+    {
+        if (reader->count == 0)
+        {
+            if (reader->pos >= reader->end)
+                break;
+            if (reader->threaded)
+                wav_p_cond_wait(&reader->cond, &reader->mutex);
+            else
+                stream_p_fill(reader);
+            continue;
+        }
+
+        /* the head block is not touched by the reader thread */
+        block = &reader->block[reader->head];
+        n = block->frames - reader->offset;
+        if (n > count - copied)
+            n = count - copied;
+        wav_p_mutex_unlock(&reader->mutex);
+
+        memcpy((uint8_t *)buf + (size_t)copied * reader->frame_size,
+               block->data + (size_t)reader->offset * reader->frame_size, (size_t)n * reader->frame_size);
+        copied += n;
+
+        wav_p_mutex_lock(&reader->mutex);
+        reader->offset += n;
+        reader->pos += n;
+        if (reader->offset == block->frames)
+        {
+            reader->head = (reader->head + 1) % WAV_STREAM_BLOCKS;
+            reader->count--;
+            reader->offset = 0;
+            wav_p_cond_broadcast(&reader->cond);
+        }
+    }
+    wav_p_mutex_unlock(&reader->mutex);
+
+    *got = copied;
+
+    return 0;
+}
+
+int wav_reader_seek(wav_reader_handle r, uint32_t n)
+{
+    reader_data *reader = (reader_data *)r;
+
+    /* check argument */
+    if (reader == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    if (n > reader->config.size)
+    {
+        wav_p_error(0, __FUNCTION__, "Error n=%d is out of range. It must be within [0, %d]", n, reader->config.size);
+        return -1;
+    }
+
+    wav_p_mutex_lock(&reader->mutex);
+    reader->generation++;
+    reader->head = 0;
+    reader->count = 0;
+    reader->offset = 0;
+    reader->pos = n;
+    reader->next = n;
+    wav_p_cond_broadcast(&reader->cond);
+    wav_p_mutex_unlock(&reader->mutex);
+
+    return 0;
+}
+
+int wav_reader_tell(wav_reader_handle r, uint32_t *n)
+{
+    reader_data *reader = (reader_data *)r;
+
+    /* check argument */
+    if ((reader == 0) || (n == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    wav_p_mutex_lock(&reader->mutex);
+    *n = reader->pos;
+    wav_p_mutex_unlock(&reader->mutex);
+
+    return 0;
+}
+
+int wav_writer_open(wav_writer_handle *w, const char *filename, const wav_config *config, uint32_t flags)
+{
+    writer_data *writer;
+    uint32_t i;
+
+    /* check argument */
+    if ((w == 0) || (filename == 0) || (config == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if ((config->channels == 0) ||
+        (!wav_p_valid_format(WAV_FORMAT_PCM, config->bits_per_sample) &&
+         !wav_p_valid_format(WAV_FORMAT_FLOAT, config->bits_per_sample)))
+    {
+        wav_p_error(0, __FUNCTION__, "Error invalid config (channels %d, bits %d)", config->channels, config->bits_per_sample);
+        return -1;
+    }
+
+    writer = (writer_data*)malloc(sizeof(writer_data));
+    if (writer == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Can't allocate writer_data");
+        return -1;
+    }
+    memset(writer, 0x00, sizeof(writer_data));
+    writer->config = *config;
+    writer->config.size = 0;
+    /* 64 bit samples can only be float */
+    writer->format = wav_p_valid_format(WAV_FORMAT_PCM, config->bits_per_sample) ? WAV_FORMAT_PCM : WAV_FORMAT_FLOAT;
+    writer->frame_size = config->channels * (config->bits_per_sample/8);
+    writer->max_frames = (0xffffffff - WAV_P_HEADER_MAX) / writer->frame_size;
+    writer->block_frames = WAV_STREAM_BLOCK_FRAMES;
+
+    writer->fp = fopen(filename, "wb");
+    if (writer->fp == NULL)
+    {
+        wav_p_error(0, __FUNCTION__, "Cannot open %s", filename);
+        stream_p_release_writer(writer);
+        return -1;
+    }
+
+    /* sizes are 0 until the first update */
+    if (stream_p_begin(writer) != 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Write error %s", filename);
+        stream_p_release_writer(writer);
+        return -1;
+    }
+
+    if (flags & WAV_WRITER_THREAD)
+    {
+        for (i = 0; i < WAV_STREAM_BLOCKS; i++)
+        {
+            writer->block[i].data = (uint8_t*)malloc((size_t)writer->block_frames * writer->frame_size);
+            if (writer->block[i].data == 0)
+            {
+                wav_p_error(0, __FUNCTION__, "Can't allocate %d frames", writer->block_frames);
+                stream_p_release_writer(writer);
+                return -1;
+            }
+        }
+    }
+
+    wav_p_mutex_init(&writer->mutex);
+    wav_p_cond_init(&writer->cond);
+
+    /* without the thread wav_writer_write writes the file itself */
+    if (flags & WAV_WRITER_THREAD)
+        writer->threaded = (wav_p_thread_create(&writer->thread, stream_p_writer, writer) == 0);
+
+    *w = (wav_writer_handle)writer;
+
+    return 0;
+}
+
+int wav_writer_close(wav_writer_handle w)
+{
+    writer_data *writer = (writer_data *)w;
+    int rc;
+
+    /* check argument */
+    if (writer == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    stream_p_drain(writer);
+    if (writer->threaded)
+    {
+        wav_p_mutex_lock(&writer->mutex);
+        writer->stop = 1;
+        wav_p_cond_broadcast(&writer->cond);
+        wav_p_mutex_unlock(&writer->mutex);
+        wav_p_thread_join(writer->thread);
+    }
+    stream_p_patch(writer);
+    if (!writer->error && ((writer->written * writer->frame_size) & 1))
+        stream_p_pad(writer);
+    rc = writer->error ? -1 : 0;
+    if (rc == 0)
+        wav_p_count_save(0);
+
+    wav_p_cond_destroy(&writer->cond);
+    wav_p_mutex_destroy(&writer->mutex);
+    stream_p_release_writer(writer);
+
+    return rc;
+}
+
+int wav_writer_write(wav_writer_handle w, const void *buf, uint32_t count)
+{
+    writer_data *writer = (writer_data *)w;
+    const uint8_t *p = (const uint8_t *)buf;
+    stream_block *block;
+    uint32_t n;
+
+    /* check argument */
+    if ((writer == 0) || ((buf == 0) && (count > 0)))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+    if (count > writer->max_frames - writer->frames)
+    {
+        wav_p_error(0, __FUNCTION__, "Error data chunk would exceed 4GB (%d frames)", writer->max_frames);
+        return -1;
+    }
+    if (writer->error)
+        return -1;
+
+    writer->frames += count;
+    if (!writer->threaded)
+    {
+        if (count > 0)
+            stream_p_put(writer, buf, count, writer->sync_frames);
+        return writer->error ? -1 : 0;
+    }
+
+    while (count > 0)
+    {
+        /* wait for a free block */
+        wav_p_mutex_lock(&writer->mutex);
+        while (writer->count == WAV_STREAM_BLOCKS)
+            wav_p_cond_wait(&writer->cond, &writer->mutex);
+        block = &writer->block[(writer->head + writer->count) % WAV_STREAM_BLOCKS];
+        wav_p_mutex_unlock(&writer->mutex);
+
+        n = writer->block_frames - writer->fill;
+        if (n > count)
+            n = count;
+        memcpy(block->data + (size_t)writer->fill * writer->frame_size, p, (size_t)n * writer->frame_size);
+        writer->fill += n;
+        p += (size_t)n * writer->frame_size;
+        count -= n;
+
+        if (writer->fill == writer->block_frames)
+        {
+            wav_p_mutex_lock(&writer->mutex);
+            block->frames = writer->fill;
+            writer->count++;
+            writer->fill = 0;
+            wav_p_cond_broadcast(&writer->cond);
+            wav_p_mutex_unlock(&writer->mutex);
+        }
+    }
+
+    return writer->error ? -1 : 0;
+}
+
+int wav_writer_flush(wav_writer_handle w)
+{
+    writer_data *writer = (writer_data *)w;
+
+    /* check argument */
+    if (writer == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    stream_p_drain(writer);
+    stream_p_patch(writer);
+
+    return writer->error ? -1 : 0;
+}
+
+int wav_writer_set_sync(wav_writer_handle w, uint32_t sync_frames)
+{
+    writer_data *writer = (writer_data *)w;
+
+    /* check argument */
+    if (writer == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    wav_p_mutex_lock(&writer->mutex);
+    writer->sync_frames = sync_frames;
+    wav_p_mutex_unlock(&writer->mutex);
+
+    return 0;
+}
+
+int wav_writer_set_format(wav_writer_handle w, uint32_t format, uint32_t channel_mask)
+{
+    writer_data *writer = (writer_data *)w;
+    uint32_t bits;
+
+    /* check argument */
+    if (writer == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+    bits = writer->config.bits_per_sample;
+    if (!wav_p_valid_format(format, bits))
+    {
+        wav_p_error(0, __FUNCTION__, "Error format %d with %d bits per sample", format, bits);
+        return -1;
+    }
+    if (writer->frames > 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error frames are already written");
+        return -1;
+    }
+
+    writer->format = format;
+    writer->channel_mask = channel_mask;
+    if (stream_p_begin(writer) != 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Write error");
+        writer->error = 1;
+        return -1;
+    }
+
+    return 0;
+}
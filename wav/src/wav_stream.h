@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Streaming access to wav files of any length with constant memory.
+ */
+
+#ifndef WAV_STREAM_H
+#define WAV_STREAM_H
+
+#include "wav.h"
+
+#define WAV_STREAM_BLOCK_FRAMES     4096    /* default frames per block */
+#define WAV_STREAM_BLOCKS           4       /* blocks in the ring buffer */
+
+/*
+ * Reader.
+ * A read-ahead thread fills a ring of blocks from the data chunk while
+ * the caller consumes them, so only WAV_STREAM_BLOCKS blocks are in
+ * memory.  block_frames = 0 uses WAV_STREAM_BLOCK_FRAMES.
+ * config->size is the number of frames in the file.
+ */
+typedef uint32_t* wav_reader_handle;
+
+int wav_reader_open(wav_reader_handle *r, const char *filename, uint32_t block_frames);
+int wav_reader_close(wav_reader_handle r);
+int wav_reader_get_config(wav_reader_handle r, wav_config *config);
+int wav_reader_get_format(wav_reader_handle r, uint32_t *format, uint32_t *channel_mask);
+
+/*
+ * Copy up to count interleaved frames from the current position into buf
+ * and advance.  got is set to the frames copied; 0 at the end of data.
+ */
+int wav_reader_read(wav_reader_handle r, void *buf, uint32_t count, uint32_t *got);
+
+/* move to frame n (0 - size); the read-ahead restarts there */
+int wav_reader_seek(wav_reader_handle r, uint32_t n);
+int wav_reader_tell(wav_reader_handle r, uint32_t *n);
+
+/*
+ * Writer.
+ * The header is written at once and frames are appended as they come.
+ * The RIFF and data sizes in the header are fixed on wav_writer_flush and
+ * wav_writer_close, and every sync_frames frames if set, so the file
+ * stays playable if the program stops.
+ * With WAV_WRITER_THREAD the frames are copied into the ring of blocks
+ * and written by a background thread; wav_writer_write waits only when
+ * the ring is full.
+ * config takes 8/16/24/32 bit PCM or 64 bit float samples (PCM unless
+ * bits_per_sample is 64); wav_writer_set_format works like wav_set_format
+ * before the first frame.  A data chunk of odd size gets a pad byte on
+ * wav_writer_close.
+ */
+typedef uint32_t* wav_writer_handle;
+
+#define WAV_WRITER_THREAD   0x01
+
+int wav_writer_open(wav_writer_handle *w, const char *filename, const wav_config *config, uint32_t flags);
+int wav_writer_close(wav_writer_handle w);
+int wav_writer_write(wav_writer_handle w, const void *buf, uint32_t count);
+int wav_writer_flush(wav_writer_handle w);
+int wav_writer_set_sync(wav_writer_handle w, uint32_t sync_frames);
+int wav_writer_set_format(wav_writer_handle w, uint32_t format, uint32_t channel_mask);
+
+#endif /* WAV_STREAM_H */
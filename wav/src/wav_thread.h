@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * Private thread primitives for the wav library (Win32 threads or pthreads).
+ * This header is not part of the public API.
+ */
+
+#ifndef WAV_THREAD_H
+#define WAV_THREAD_H
+
+#include "wav.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+
+typedef CRITICAL_SECTION wav_p_mutex;
+typedef CONDITION_VARIABLE wav_p_cond;
+typedef HANDLE wav_p_thread;
+typedef INIT_ONCE wav_p_once;
+
+#define WAV_P_THREAD_PROC(name, arg) unsigned __stdcall name(void *arg)
+#define WAV_P_ONCE_INIT INIT_ONCE_STATIC_INIT
+#define WAV_P_TLS __declspec(thread)
+
+WAV_INLINE void wav_p_mutex_init(wav_p_mutex *m) { InitializeCriticalSection(m); }
+WAV_INLINE void wav_p_mutex_destroy(wav_p_mutex *m) { DeleteCriticalSection(m); }
+WAV_INLINE void wav_p_mutex_lock(wav_p_mutex *m) { EnterCriticalSection(m); }
+WAV_INLINE void wav_p_mutex_unlock(wav_p_mutex *m) { LeaveCriticalSection(m); }
+
+WAV_INLINE void wav_p_cond_init(wav_p_cond *c) { InitializeConditionVariable(c); }
+WAV_INLINE void wav_p_cond_destroy(wav_p_cond *c) { (void)c; }
+WAV_INLINE void wav_p_cond_wait(wav_p_cond *c, wav_p_mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+WAV_INLINE void wav_p_cond_signal(wav_p_cond *c) { WakeConditionVariable(c); }
+WAV_INLINE void wav_p_cond_broadcast(wav_p_cond *c) { WakeAllConditionVariable(c); }
+
+WAV_INLINE int wav_p_thread_create(wav_p_thread *t, unsigned (__stdcall *proc)(void *), void *arg)
+{
+    *t = (HANDLE)_beginthreadex(NULL, 0, proc, arg, 0, NULL);
+    return (*t == 0) ? -1 : 0;
+}
+
+WAV_INLINE void wav_p_thread_join(wav_p_thread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+WAV_INLINE BOOL CALLBACK wav_p_once_proc(PINIT_ONCE once, PVOID proc, PVOID *ctx)
+{
+    ((void (*)(void))proc)();
+    return TRUE;
+}
+
+WAV_INLINE void wav_p_call_once(wav_p_once *once, void (*proc)(void))
+{
+    InitOnceExecuteOnce(once, wav_p_once_proc, (PVOID)proc, NULL);
+}
+
+WAV_INLINE uint32_t wav_p_cpu_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+WAV_INLINE void wav_p_sleep(uint32_t msec) { Sleep(msec); }
+
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t wav_p_mutex;
+typedef pthread_cond_t wav_p_cond;
+typedef pthread_t wav_p_thread;
+typedef pthread_once_t wav_p_once;
+
+#define WAV_P_THREAD_PROC(name, arg) void *name(void *arg)
+#define WAV_P_ONCE_INIT PTHREAD_ONCE_INIT
+#define WAV_P_TLS __thread
+
+WAV_INLINE void wav_p_mutex_init(wav_p_mutex *m) { pthread_mutex_init(m, NULL); }
+WAV_INLINE void wav_p_mutex_destroy(wav_p_mutex *m) { pthread_mutex_destroy(m); }
+WAV_INLINE void wav_p_mutex_lock(wav_p_mutex *m) { pthread_mutex_lock(m); }
+WAV_INLINE void wav_p_mutex_unlock(wav_p_mutex *m) { pthread_mutex_unlock(m); }
+
+WAV_INLINE void wav_p_cond_init(wav_p_cond *c) { pthread_cond_init(c, NULL); }
+WAV_INLINE void wav_p_cond_destroy(wav_p_cond *c) { pthread_cond_destroy(c); }
+WAV_INLINE void wav_p_cond_wait(wav_p_cond *c, wav_p_mutex *m) { pthread_cond_wait(c, m); }
+WAV_INLINE void wav_p_cond_signal(wav_p_cond *c) { pthread_cond_signal(c); }
+WAV_INLINE void wav_p_cond_broadcast(wav_p_cond *c) { pthread_cond_broadcast(c); }
+
+WAV_INLINE int wav_p_thread_create(wav_p_thread *t, void *(*proc)(void *), void *arg)
+{
+    return (pthread_create(t, NULL, proc, arg) == 0) ? 0 : -1;
+}
+
+WAV_INLINE void wav_p_thread_join(wav_p_thread t)
+{
+    pthread_join(t, NULL);
+}
+
+WAV_INLINE void wav_p_call_once(wav_p_once *once, void (*proc)(void))
+{
+    pthread_once(once, proc);
+}
+
+WAV_INLINE uint32_t wav_p_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (uint32_t)n : 1;
+}
+
+WAV_INLINE void wav_p_sleep(uint32_t msec) { usleep(msec * 1000); }
+
+#endif
+
+#endif /* WAV_THREAD_H */
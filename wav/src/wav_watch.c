@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * File watcher for the wav library.
+ * It reloads a wav file in the background whenever it is rewritten.
+ *
+ * Two wav handles are used as front and back buffer.  Readers pin the
+ * front buffer with wav_watch_acquire.  The watcher thread loads into the
+ * back buffer once nobody holds it any more, then makes it the front.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "wav.h"
+#include "wav_p.h"
+#include "wav_thread.h"
+#include "wav_watch.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#define WATCH_POLL_MSEC     250     /* mtime polling interval */
+#define WATCH_SETTLE_MSEC   100     /* wait for the writer on Windows */
+
+/*
+ * watch internal data
+ */
+typedef struct {
+    char *filename;
+    char *dir;
+    const char *name;           /* file name part of filename */
+    wav_handle buf[2];
+    uint32_t refs[2];
+    uint32_t front;
+    uint32_t generation;
+    volatile int stop;
+    wav_watch_callback callback;
+    void *ctx;
+    wav_p_mutex mutex;
+    wav_p_cond cond;
+    wav_p_thread thread;
+    time_t mtime;
+    off_t size;
+#if defined(__linux__)
+    int fd;
+    int pipe[2];
+#elif defined(_WIN32)
+    HANDLE change;
+    HANDLE stop_event;
+#endif
+} watch_data;
+
+/*
+ * private functions
+ */
+
+/* return 1 if mtime or size of the file changed since the last call */
+static int watch_p_changed(watch_data *watch)
+{
+    struct stat st;
+
+    if (stat(watch->filename, &st) != 0)
+        return 0;
+    if ((st.st_mtime == watch->mtime) && (st.st_size == watch->size))
+        return 0;
+
+    watch->mtime = st.st_mtime;
+    watch->size = st.st_size;
+
+    return 1;
+}
+
+/* load into the back buffer and swap it in */
+static void watch_p_reload(watch_data *watch)
+{
+    uint32_t back;
+
+    /* wait for readers that still hold the previous data */
+    wav_p_mutex_lock(&watch->mutex);
+    back = 1 - watch->front;
+    while ((watch->refs[back] > 0) && !watch->stop)
+        wav_p_cond_wait(&watch->cond, &watch->mutex);
+    wav_p_mutex_unlock(&watch->mutex);
+
+    if (watch->stop)
+        return;
+
+    /* keep the current data if the new file is broken */
+    if (wav_load(watch->buf[back], watch->filename) != 0)
+        return;
+
+    wav_p_mutex_lock(&watch->mutex);
+    watch->front = back;
+    watch->generation++;
+    wav_p_mutex_unlock(&watch->mutex);
+
+    if (watch->callback)
+        watch->callback((wav_watch_handle)watch, watch->ctx);
+}
+
+#if defined(__linux__)
+
+static int watch_p_start(watch_data *watch)
+{
+    watch->fd = inotify_init();
+    if (watch->fd < 0)
+        return -1;
+    if (inotify_add_watch(watch->fd, watch->dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        close(watch->fd);
+        return -1;
+    }
+    if (pipe(watch->pipe) != 0)
+    {
+        close(watch->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void watch_p_stop(watch_data *watch)
+{
+    char c = 0;
+
+    if (write(watch->pipe[1], &c, 1) != 1)
+        wav_p_error(0, __FUNCTION__, "Can't wake up watcher");
+}
+
+static void watch_p_cleanup(watch_data *watch)
+{
+    close(watch->fd);
+    close(watch->pipe[0]);
+    close(watch->pipe[1]);
+}
+
+/* the directory is watched, so renames over the file are seen too */
+static WAV_P_THREAD_PROC(watch_p_thread, arg)
+{
+    watch_data *watch = (watch_data *)arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event;
+    struct pollfd fds[2];
+    ssize_t len;
+    char *p;
+    int changed;
+
+    fds[0].fd = watch->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = watch->pipe[0];
+    fds[1].events = POLLIN;
+
+    while (!watch->stop)
+    {
+        if (poll(fds, 2, -1) <= 0)
+            continue;
+        if (fds[1].revents)
+            break;
+
+        len = read(watch->fd, buf, sizeof(buf));
+        changed = 0;
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len)
+        {
+            event = (struct inotify_event *)p;
+            if (event->len && (strcmp(event->name, watch->name) == 0))
+                changed = 1;
+        }
+
+        if (changed)
+            watch_p_reload(watch);
+    }
+
+    return 0;
+}
+
+#elif defined(_WIN32)
+
+static int watch_p_start(watch_data *watch)
+{
+    watch->change = FindFirstChangeNotificationA(watch->dir, FALSE,
+        FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    if (watch->change == INVALID_HANDLE_VALUE)
+        return -1;
+    watch->stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (watch->stop_event == NULL)
+    {
+        FindCloseChangeNotification(watch->change);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void watch_p_stop(watch_data *watch)
+{
+    SetEvent(watch->stop_event);
+}
+
+static void watch_p_cleanup(watch_data *watch)
+{
+    FindCloseChangeNotification(watch->change);
+    CloseHandle(watch->stop_event);
+}
+
+/* the notification is for the whole directory, so mtime tells if it was our file */
+static WAV_P_THREAD_PROC(watch_p_thread, arg)
+{
+    watch_data *watch = (watch_data *)arg;
+    HANDLE handles[2];
+
+    handles[0] = watch->stop_event;
+    handles[1] = watch->change;
+
+    while (!watch->stop)
+    {
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+            break;
+
+        /* the notification comes while the writer is still writing */
+        Sleep(WATCH_SETTLE_MSEC);
+        if (watch_p_changed(watch))
+            watch_p_reload(watch);
+
+        FindNextChangeNotification(watch->change);
+    }
+
+    return 0;
+}
+
+#else
+
+static int watch_p_start(watch_data *watch)
+{
+    return 0;
+}
+
+static void watch_p_stop(watch_data *watch)
+{
+}
+
+static void watch_p_cleanup(watch_data *watch)
+{
+}
+
+static WAV_P_THREAD_PROC(watch_p_thread, arg)
+{
+    watch_data *watch = (watch_data *)arg;
+
+    while (!watch->stop)
+    {
+        wav_p_sleep(WATCH_POLL_MSEC);
+        if (!watch->stop && watch_p_changed(watch))
+            watch_p_reload(watch);
+    }
+
+    return 0;
+}
+
+#endif
+
+static void watch_p_release(watch_data *watch)
+{
+    if (watch->buf[0])
+        wav_close(watch->buf[0]);
+    if (watch->buf[1])
+        wav_close(watch->buf[1]);
+    if (watch->filename)
+        free(watch->filename);
+    if (watch->dir)
+        free(watch->dir);
+    free(watch);
+}
+
+/*
+ * Public functions
+ */
+
+int wav_watch_open(wav_watch_handle *w, const char *filename, wav_watch_callback callback, void *ctx)
+{
+    watch_data *watch;
+    char *p;
+    size_t len;
+
+    /* check argument */
+    if ((w == 0) || (filename == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    watch = (watch_data*)malloc(sizeof(watch_data));
+    if (watch == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Can't allocate watch_data");
+        return -1;
+    }
+    memset(watch, 0x00, sizeof(watch_data));
+    watch->callback = callback;
+    watch->ctx = ctx;
+
+    /* split filename into directory and name */
+    len = strlen(filename);
+    watch->filename = (char*)malloc(len + 1);
+    watch->dir = (char*)malloc(len + 2);
+    if ((watch->filename == 0) || (watch->dir == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Can't allocate watch_data");
+        watch_p_release(watch);
+        return -1;
+    }
+    strcpy(watch->filename, filename);
+    strcpy(watch->dir, filename);
+    p = watch->dir + len;
+    while ((p > watch->dir) && (p[-1] != '/') && (p[-1] != '\\'))
+        p--;
+    watch->name = watch->filename + (p - watch->dir);
+    if (p == watch->dir)
+        strcpy(watch->dir, ".");
+    else
+        p[-1] = '\0';
+
+    /* initial data */
+    watch_p_changed(watch);
+    if ((wav_open(&watch->buf[0], filename) != 0) || (wav_open(&watch->buf[1], 0) != 0))
+    {
+        watch_p_release(watch);
+        return -1;
+    }
+
+    if (watch_p_start(watch) != 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Can't watch %s", watch->dir);
+        watch_p_release(watch);
+        return -1;
+    }
+
+    wav_p_mutex_init(&watch->mutex);
+    wav_p_cond_init(&watch->cond);
+    if (wav_p_thread_create(&watch->thread, watch_p_thread, watch) != 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Can't create watcher thread");
+        watch_p_cleanup(watch);
+        wav_p_cond_destroy(&watch->cond);
+        wav_p_mutex_destroy(&watch->mutex);
+        watch_p_release(watch);
+        return -1;
+    }
+
+    *w = (wav_watch_handle)watch;
+
+    return 0;
+}
+
+int wav_watch_close(wav_watch_handle w)
+{
+    watch_data *watch = (watch_data *)w;
+
+    /* check argument */
+    if (watch == 0)
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid handle");
+        return -1;
+    }
+
+    wav_p_mutex_lock(&watch->mutex);
+    watch->stop = 1;
+    wav_p_cond_broadcast(&watch->cond);
+    wav_p_mutex_unlock(&watch->mutex);
+    watch_p_stop(watch);
+    wav_p_thread_join(watch->thread);
+
+    watch_p_cleanup(watch);
+    wav_p_cond_destroy(&watch->cond);
+    wav_p_mutex_destroy(&watch->mutex);
+    watch_p_release(watch);
+
+    return 0;
+}
+
+int wav_watch_acquire(wav_watch_handle w, wav_handle *h, uint32_t *generation)
+{
+    watch_data *watch = (watch_data *)w;
+
+    /* check argument */
+    if ((watch == 0) || (h == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    wav_p_mutex_lock(&watch->mutex);
+    watch->refs[watch->front]++;
+    *h = watch->buf[watch->front];
+    if (generation)
+        *generation = watch->generation;
+    wav_p_mutex_unlock(&watch->mutex);
+
+    return 0;
+}
+
+int wav_watch_release(wav_watch_handle w, wav_handle h)
+{
+    watch_data *watch = (watch_data *)w;
+    uint32_t i;
+
+    /* check argument */
+    if ((watch == 0) || (h == 0))
+    {
+        wav_p_error(0, __FUNCTION__, "Error Invalid argument");
+        return -1;
+    }
+
+    i = (h == watch->buf[0]) ? 0 : 1;
+
+    wav_p_mutex_lock(&watch->mutex);
+    if ((h != watch->buf[i]) || (watch->refs[i] == 0))
+    {
+        wav_p_mutex_unlock(&watch->mutex);
+        wav_p_error(0, __FUNCTION__, "Error handle was not acquired");
+        return -1;
+    }
+    if (--watch->refs[i] == 0)
+        wav_p_cond_broadcast(&watch->cond);
+    wav_p_mutex_unlock(&watch->mutex);
+
+    return 0;
+}
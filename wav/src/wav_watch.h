@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2003-2012 Hiroaki Inaba
+ *
+ * File watcher for the wav library.
+ * It reloads a wav file in the background whenever it is rewritten.
+ */
+
+#ifndef WAV_WATCH_H
+#define WAV_WATCH_H
+
+#include "wav.h"
+
+typedef uint32_t* wav_watch_handle;
+
+/* Called from the watcher thread after new data was swapped in */
+typedef void (*wav_watch_callback)(wav_watch_handle w, void *ctx);
+
+/*
+ * wav_watch_open loads filename and starts watching it (inotify on Linux,
+ * change notification on Windows, mtime polling elsewhere).
+ * A change is loaded into a second buffer and swapped in atomically, so
+ * readers never see a partly loaded sample data.
+ */
+int wav_watch_open(wav_watch_handle *w, const char *filename, wav_watch_callback callback, void *ctx);
+int wav_watch_close(wav_watch_handle w);
+
+/*
+ * wav_watch_acquire returns the current sample data, which stays valid and
+ * unchanged until wav_watch_release.  generation counts the reloads and
+ * may be 0.  Do not modify or reconfigure the returned handle.
+ */
+int wav_watch_acquire(wav_watch_handle w, wav_handle *h, uint32_t *generation);
+int wav_watch_release(wav_watch_handle w, wav_handle h);
+
+#endif /* WAV_WATCH_H */